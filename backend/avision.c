@@ -133,6 +133,10 @@
 
 #include <math.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #define BACKEND_NAME avision
 #define BACKEND_BUILD 297 /* avision backend BUILD version */
 
@@ -1280,6 +1284,9 @@ static SANE_Bool force_a3 = SANE_FALSE;
 /* trust ADF-presence flag, even if ADF model is nonzero */
 static SANE_Bool skip_adf = SANE_FALSE;
 
+/* keep the duplex rear data in memory up to this size, in MB */
+static int rear_memory_limit = 256;
+
 /* hardware resolutions to interpolate from */
 static const int  hw_res_list_c5[] =
   {
@@ -6692,6 +6699,148 @@ init_options (Avision_Scanner* s)
   return SANE_STATUS_GOOD;
 }
 
+/* The rear data of duplex scans is stored by one run of the reader and
+   read back by the next one. The reader may be a forked process, so the
+   memory is a shared mapping made by sane_start, with the number of bytes
+   stored in front of the data. Scans too large for the memory limit use
+   the temporary file. */
+
+#define REAR_HEADER 16
+
+typedef struct
+{
+  FILE* fp;
+  uint8_t* data;
+  size_t* len;
+  size_t size;
+  size_t pos;
+} Avision_Rear;
+
+static void
+rear_buffer_free (Avision_Scanner* s)
+{
+#if defined (HAVE_MMAP) && defined (MAP_ANONYMOUS)
+  if (s->duplex_rear_buf)
+    munmap (s->duplex_rear_buf, s->duplex_rear_size);
+#endif
+  s->duplex_rear_buf = 0;
+  s->duplex_rear_size = 0;
+}
+
+static void
+rear_buffer_prepare (Avision_Scanner* s)
+{
+#if defined (HAVE_MMAP) && defined (MAP_ANONYMOUS)
+  size_t lines = s->avdimen.hw_lines + 2 * s->avdimen.line_difference +
+    s->avdimen.rear_offset;
+  size_t size;
+
+  /* the flipped rear page is positioned by the front page lines */
+  if (lines < (size_t) s->params.lines)
+    lines = s->params.lines;
+  size = REAR_HEADER + (lines + 1) * s->avdimen.hw_bytes_per_line;
+
+  if (size > (size_t) rear_memory_limit * 1024 * 1024) {
+    DBG (3, "rear_buffer_prepare: %lu bytes over limit, using %s\n",
+	 (u_long) size, s->duplex_rear_fname);
+    rear_buffer_free (s);
+    return;
+  }
+
+  if (s->duplex_rear_buf && s->duplex_rear_size < size)
+    rear_buffer_free (s);
+  if (!s->duplex_rear_buf) {
+    void* buf = mmap (0, size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+      DBG (1, "rear_buffer_prepare: mmap failed, using %s\n",
+	   s->duplex_rear_fname);
+      return;
+    }
+    s->duplex_rear_buf = buf;
+    s->duplex_rear_size = size;
+  }
+  DBG (3, "rear_buffer_prepare: %lu bytes in memory\n",
+       (u_long) s->duplex_rear_size);
+#else
+  (void) s;
+#endif
+}
+
+static SANE_Status
+rear_open (Avision_Scanner* s, Avision_Rear* rear, SANE_Bool write)
+{
+  memset (rear, 0, sizeof (*rear));
+  if (s->duplex_rear_buf) {
+    rear->len = (size_t*) s->duplex_rear_buf;
+    rear->data = s->duplex_rear_buf + REAR_HEADER;
+    rear->size = s->duplex_rear_size - REAR_HEADER;
+    if (write)
+      *rear->len = 0;
+    return SANE_STATUS_GOOD;
+  }
+
+  rear->fp = fopen (s->duplex_rear_fname, write ? "w" : "r");
+  if (! rear->fp)
+    return write ? SANE_STATUS_NO_MEM : SANE_STATUS_IO_ERROR;
+  return SANE_STATUS_GOOD;
+}
+
+static void
+rear_close (Avision_Rear* rear)
+{
+  if (rear->fp)
+    fclose (rear->fp);
+  rear->fp = 0;
+  rear->data = 0;
+}
+
+static int
+rear_seek (Avision_Rear* rear, long offset)
+{
+  if (rear->fp)
+    return fseek (rear->fp, offset, SEEK_SET);
+  if (offset < 0)
+    return -1;
+  rear->pos = offset;
+  return 0;
+}
+
+static size_t
+rear_write (Avision_Rear* rear, const uint8_t* data, size_t size)
+{
+  if (rear->fp)
+    return fwrite (data, 1, size, rear->fp);
+
+  if (rear->pos + size > rear->size) {
+    DBG (1, "rear_write: rear buffer full\n");
+    return 0;
+  }
+  /* like a file, skipped over data reads as zero */
+  if (rear->pos > *rear->len)
+    memset (rear->data + *rear->len, 0, rear->pos - *rear->len);
+  memcpy (rear->data + rear->pos, data, size);
+  rear->pos += size;
+  if (rear->pos > *rear->len)
+    *rear->len = rear->pos;
+  return size;
+}
+
+static size_t
+rear_read (Avision_Rear* rear, uint8_t* data, size_t size)
+{
+  if (rear->fp)
+    return fread (data, 1, size, rear->fp);
+
+  if (rear->pos >= *rear->len)
+    return 0;
+  if (size > *rear->len - rear->pos)
+    size = *rear->len - rear->pos;
+  memcpy (data, rear->data + rear->pos, size);
+  rear->pos += size;
+  return size;
+}
+
 /* This function is executed as a child process. The reason this is
    executed as a subprocess is because some (most?) generic SCSI
    interfaces block a SCSI request until it has completed. With a
@@ -6718,7 +6867,7 @@ reader_process (void *data)
   struct SIGACTION act;
 
   FILE* fp;
-  FILE* rear_fp = 0; /* used to store the deinterlaced rear data */
+  Avision_Rear rear; /* used to store the deinterlaced rear data */
   FILE* raw_fp = 0; /* used to write the RAW image data for debugging */
 
   /* the complex params */
@@ -6757,6 +6906,8 @@ reader_process (void *data)
 
   DBG (3, "reader_process:\n");
 
+  memset (&rear, 0, sizeof (rear));
+
   if (sanei_thread_is_forked())
     close (s->read_fds);
 
@@ -6833,21 +6984,14 @@ reader_process (void *data)
   if (deinterlace != NONE ||
      (dev->hw->feature_type & AV_ADF_FLIPPING_DUPLEX && s->source_mode == AV_ADF_DUPLEX && !(s->page % 2)))
     {
-      if (!s->duplex_rear_valid) { /* create new file for writing */
-	DBG (3, "reader_process: opening duplex rear file for writing.\n");
-	rear_fp = fopen (s->duplex_rear_fname, "w");
-	if (! rear_fp) {
-	  fclose (fp);
-	  return SANE_STATUS_NO_MEM;
-	}
-      }
-      else { /* open saved rear data */
-	DBG (3, "reader_process: opening duplex rear file for reading.\n");
-	rear_fp = fopen (s->duplex_rear_fname, "r");
-	if (! rear_fp) {
-	  fclose (fp);
-	  return SANE_STATUS_IO_ERROR;
-	}
+      if (!s->duplex_rear_valid) /* create new file for writing */
+	DBG (3, "reader_process: opening duplex rear data for writing.\n");
+      else /* open saved rear data */
+	DBG (3, "reader_process: opening duplex rear data for reading.\n");
+      status = rear_open (s, &rear, !s->duplex_rear_valid);
+      if (status != SANE_STATUS_GOOD) {
+	fclose (fp);
+	return status;
       }
     }
 
@@ -7013,7 +7157,7 @@ reader_process (void *data)
 	       (u_long) processed_bytes, (u_long) total_size);
 	  DBG (5, "reader_process: virtual this_read: %lu\n", (u_long) this_read);
 
-	  got = fread (stripe_data + stripe_fill, 1, this_read, rear_fp);
+	  got = rear_read (&rear, stripe_data + stripe_fill, this_read);
 	  stripe_fill += got;
 	  processed_bytes += got;
 	  if (got != this_read)
@@ -7038,6 +7182,7 @@ reader_process (void *data)
 	  unsigned int absline = (processed_bytes - stripe_fill) / s->avdimen.hw_bytes_per_line;
 	  unsigned int abslines = absline + useful_bytes / s->avdimen.hw_bytes_per_line;
 	  uint8_t* ptr = stripe_data;
+	  uint8_t* dst = stripe_data; /* where the kept LINE data goes */
 	  for ( ; absline < abslines; ++absline)
 	    {
 	      DBG (9, "reader_process: deinterlacing line %d\n", absline);
@@ -7046,19 +7191,29 @@ reader_process (void *data)
 		   (deinterlace == HALF   && absline >= total_size / s->avdimen.hw_bytes_per_line / 2) ||
 		   (deinterlace == LINE   && absline & 0x1) ) /* last bit equals % 2 */
 		{
-		  DBG (9, "reader_process: saving rear line %d to temporary file.\n", absline);
-		  fwrite (ptr, s->avdimen.hw_bytes_per_line, 1, rear_fp);
-		  if (deinterlace == LINE)
-		    memmove (ptr, ptr+s->avdimen.hw_bytes_per_line,
-			     stripe_data + stripe_fill - ptr - s->avdimen.hw_bytes_per_line);
-		  else
-		    ptr += s->avdimen.hw_bytes_per_line;
+		  DBG (9, "reader_process: saving rear line %d to rear buffer.\n", absline);
+		  if (rear_write (&rear, ptr, s->avdimen.hw_bytes_per_line) !=
+		      (size_t) s->avdimen.hw_bytes_per_line) {
+		    DBG (1, "reader_process: cannot store rear line %u\n", absline);
+		    exit_status = SANE_STATUS_NO_MEM;
+		    break;
+		  }
+		  if (deinterlace != LINE)
+		    dst += s->avdimen.hw_bytes_per_line;
 		  useful_bytes -= s->avdimen.hw_bytes_per_line;
 		  stripe_fill -= s->avdimen.hw_bytes_per_line;
 		}
-	      else
-		ptr += s->avdimen.hw_bytes_per_line;
+	      else {
+		/* front line, for LINE moved down over the rear lines */
+		if (dst != ptr)
+		  memmove (dst, ptr, s->avdimen.hw_bytes_per_line);
+		dst += s->avdimen.hw_bytes_per_line;
+	      }
+	      ptr += s->avdimen.hw_bytes_per_line;
  	    }
+	  /* and the lines kept for the color line difference behind them */
+	  if (dst != ptr)
+	    memmove (dst, ptr, stripe_data + stripe_fill - dst);
 	  DBG (9, "reader_process: after deinterlacing: useful_bytes: %d, stripe_fill: %d\n",
 	       useful_bytes, stripe_fill);
 	}
@@ -7068,8 +7223,22 @@ reader_process (void *data)
 	unsigned int abslines = absline + useful_bytes / s->avdimen.hw_bytes_per_line;
 	uint8_t* ptr = stripe_data;
 	for ( ; absline < abslines; ++absline) {
-          fseek (rear_fp, ((0 - s->params.lines) - absline - 2) * s->avdimen.hw_bytes_per_line, SEEK_SET);
-          fwrite (ptr, s->avdimen.hw_bytes_per_line, 1, rear_fp);
+	  /* params.lines holds minus the front page lines here */
+	  long row = (long) -s->params.lines - 2 - (long) absline;
+
+	  /* lines past the top of the flipped page are not part of it */
+	  if (row >= 0) {
+	    if (rear_seek (&rear, row * s->avdimen.hw_bytes_per_line) != 0 ||
+		rear_write (&rear, ptr, s->avdimen.hw_bytes_per_line) !=
+		(size_t) s->avdimen.hw_bytes_per_line) {
+	      DBG (1, "reader_process: cannot store flipped rear line %u\n",
+		   absline);
+	      exit_status = SANE_STATUS_NO_MEM;
+	      break;
+	    }
+	  }
+	  else
+	    DBG (9, "reader_process: rear line %u outside the page\n", absline);
           useful_bytes -= s->avdimen.hw_bytes_per_line;
           stripe_fill -= s->avdimen.hw_bytes_per_line;
           ptr += s->avdimen.hw_bytes_per_line;
@@ -7519,8 +7688,7 @@ reader_process (void *data)
   } else {
     fclose (fp);
   }
-  if (rear_fp)
-    fclose (rear_fp);
+  rear_close (&rear);
 
   if (ip_data) free (ip_data);
   if (ip_history)
@@ -7642,6 +7810,18 @@ sane_reload_devices (void)
 		     linenumber);
 		skip_adf = SANE_TRUE;
 	      }
+	      else if (strcmp (word, "rear-memory-limit") == 0) {
+		free (word);
+		word = NULL;
+		cp = sanei_config_get_string (cp, &word);
+		if (word && atoi (word) >= 0)
+		  rear_memory_limit = atoi (word);
+		else
+		  DBG (1, "sane_reload_devices: config file line %d: rear-memory-limit needs a number of MB, not negative\n",
+		       linenumber);
+		DBG (3, "sane_reload_devices: config file line %d: rear-memory-limit %d MB\n",
+		     linenumber, rear_memory_limit);
+	      }
 	      else if (strcmp (word, "static-red-calib") == 0) {
 		DBG (3, "sane_reload_devices: config file line %d: static red calibration\n",
 		     linenumber);
@@ -8020,6 +8200,7 @@ sane_close (SANE_Handle handle)
     unlink (s->duplex_rear_fname);
     *(s->duplex_rear_fname) = 0;
   }
+  rear_buffer_free (s);
 
   free (handle);
 }
@@ -8541,6 +8722,12 @@ sane_start (SANE_Handle handle)
 
  start_scan_end:
 
+  /* the reader stores the rear data for the next page */
+  if (!s->duplex_rear_valid &&
+      (s->avdimen.interlaced_duplex ||
+       (dev->hw->feature_type & AV_ADF_FLIPPING_DUPLEX && s->source_mode == AV_ADF_DUPLEX)))
+    rear_buffer_prepare (s);
+
   s->scanning = SANE_TRUE;
   s->page += 1; /* processing next page */
 
@@ -449,9 +449,12 @@ typedef struct Avision_Scanner
   SANE_Parameters params;       /* scan window */
   Avision_Dimensions avdimen;   /* scan window - detailed internals */
 
-  /* Internal data for duplex scans */
+  /* Internal data for duplex scans, the rear data is kept in memory
+     shared with the reader, or in the file if it is too large */
   char duplex_rear_fname [PATH_MAX];
   SANE_Bool duplex_rear_valid;
+  uint8_t* duplex_rear_buf;
+  size_t duplex_rear_size;
 
   color_mode c_mode;
   source_mode source_mode;
@@ -368,11 +368,15 @@
 
 #include "../include/sane/config.h"
 
+#include <stdlib.h> /*getenv*/
 #include <string.h> /*memcpy...*/
 #include <ctype.h> /*isspace*/
 #include <math.h> /*tan*/
 #include <unistd.h> /*usleep*/
 #include <sys/time.h> /*gettimeofday*/
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "../include/sane/sanei_backend.h"
 #include "../include/sane/sanei_scsi.h"
@@ -380,6 +384,7 @@
 #include "../include/sane/saneopts.h"
 #include "../include/sane/sanei_config.h"
 #include "../include/sane/sanei_magic.h"
+#include "../include/sane/sanei_perf.h"
 
 #include "canon_dr-cmd.h"
 #include "canon_dr.h"
@@ -437,6 +442,8 @@ static int global_extra_status;
 static int global_extra_status_default = 0;
 static int global_duplex_offset;
 static int global_duplex_offset_default = 0;
+static int global_read_ahead;
+static int global_read_ahead_default = 0;
 static char global_vendor_name[9];
 static char global_model_name[17];
 static char global_version_name[5];
@@ -664,6 +671,26 @@ sane_get_devices (const SANE_Device *** device_list, SANE_Bool local_only)
                   global_duplex_offset = buf;
               }
 
+              /* READ AHEAD: megabytes, 0 to not read ahead */
+              else if (!strncmp (lp, "read-ahead", 10) && isspace (lp[10])) {
+
+                  int buf;
+                  lp += 10;
+                  lp = sanei_config_skip_whitespace (lp);
+                  buf = atoi (lp);
+
+                  if (buf < 0) {
+                    DBG (5, "sane_get_devices: config option \"read-ahead\" "
+                      "(%d) is < 0, ignoring!\n", buf);
+                    continue;
+                  }
+
+                  DBG (15, "sane_get_devices: setting \"read-ahead\" to %d\n",
+                    buf);
+
+                  global_read_ahead = buf;
+              }
+
               /* VENDOR: we ingest up to 8 bytes */
               else if (!strncmp (lp, "vendor-name", 11) && isspace (lp[11])) {
 
@@ -830,6 +857,7 @@ attach_one (const char *device_name, int connType)
   s->padded_read = global_padded_read;
   s->extra_status = global_extra_status;
   s->duplex_offset = global_duplex_offset;
+  s->read_ahead = global_read_ahead;
 
   /* copy the device name */
   strcpy (s->device_name, device_name);
@@ -3628,6 +3656,12 @@ read_sensors(struct scanner *s,SANE_Int option)
     return ret;
   }
 
+  /* the read-ahead thread is using the scanner, keep the old values */
+  if(s->ahead){
+    DBG (15, "read_sensors: reading ahead, not running\n");
+    return ret;
+  }
+
   /* only run this if frontend has already read the last time we got it */
   /* or if we don't care for such bookkeeping (private use) */
   if (!option || !s->sensors_read[option-OPT_ADF_LOADED]) {
@@ -3683,6 +3717,12 @@ read_panel(struct scanner *s,SANE_Int option)
     return ret;
   }
 
+  /* the read-ahead thread is using the scanner, keep the old values */
+  if(s->ahead){
+    DBG (15, "read_panel: reading ahead, not running\n");
+    return ret;
+  }
+
   /* only run this if frontend has already read the last time we got it */
   /* or if we don't care for such bookkeeping (private use) */
   if (!option || !s->panel_read[option-OPT_START]) {
@@ -4051,9 +4091,15 @@ sane_start (SANE_Handle handle)
     return SANE_STATUS_INVAL;
   }
 
+  /* back side processing must be done before we change anything */
+  post_wait(s);
+
   /* batch start? inititalize struct and scanner */
   if(!s->started){
 
+    /* sheets read ahead in the last batch are gone */
+    read_ahead_stop(s);
+
     /* load side marker */
     if(s->u.source == SOURCE_ADF_BACK || s->u.source == SOURCE_CARD_BACK){
       s->side = SIDE_BACK;
@@ -4208,7 +4254,16 @@ sane_start (SANE_Handle handle)
     /* otherwise buffered back page will be lost */
     /* ingest paper with adf (no-op for fb) */
     /* dont call object pos or scan on back side of duplex scan */
-    if(s->side == SIDE_FRONT || s->s.source == SOURCE_ADF_BACK || s->s.source == SOURCE_CARD_BACK){
+    /* the sheet may have been read already, by the read-ahead thread */
+    if((s->side == SIDE_FRONT || s->s.source == SOURCE_ADF_BACK)
+      && read_ahead_get(s, &ret)
+    ){
+      if (ret != SANE_STATUS_GOOD) {
+        DBG (5, "sane_start: ERROR: cannot read ahead\n");
+        goto errors;
+      }
+    }
+    else if(s->side == SIDE_FRONT || s->s.source == SOURCE_ADF_BACK || s->s.source == SOURCE_CARD_BACK){
 
       /* clean scan params for new scan */
       ret = clean_params(s);
@@ -4268,40 +4323,90 @@ sane_start (SANE_Handle handle)
    * so we block and buffer. yuck */
   if(must_fully_buffer(s)){
 
-    /* get image */
-    while(!s->s.eof[s->side] && !ret){
+    int blank = 0;
+    int cropped = 0;
+
+    /* back side of duplex page was processed with the front side */
+    if(s->side == SIDE_BACK && s->post_done){
+      s->post_done = 0;
+      s->s_params = s->post_params;
+      cropped = s->post_cropped;
+      blank = s->post_blank;
+      DBG (5, "sane_start: OK: back side already processed\n");
+    }
+    else{
+
+      /* get image */
+      while(!s->s.eof[s->side] && !ret){
+        SANE_Int len = 0;
+        ret = sane_read((SANE_Handle)s, NULL, 0, &len);
+      }
+
+      /* check for errors */
+      if (ret != SANE_STATUS_GOOD) {
+        DBG (5, "sane_start: ERROR: cannot buffer image\n");
+        goto errors;
+      }
+
+      DBG (5, "sane_start: OK: done buffering\n");
+
+      /* finished buffering, adjust image as required */
+      sane_get_parameters((SANE_Handle) s, &s->s_params);
+      if(s->swdeskew){
+        find_deskew(s,s->side,&s->s_params,0);
+      }
+
+      /* duplex reads both sides together, so the back side is
+       * ready too. process it while the user reads this side */
+      if(s->side == SIDE_FRONT
+        && (s->s.source == SOURCE_ADF_DUPLEX
+          || s->s.source == SOURCE_CARD_DUPLEX)
+      ){
+        post_start(s);
+      }
+
+      blank = buffer_process(s,s->side,&s->s_params,&cropped);
+    }
+
+    /* need to update user with new size */
+    if(cropped){
+      buffer_apply(s,s->side,&s->s_params);
+    }
+
+    /* Skipping means throwing out this image.
+     * Pretend the user read the whole thing
+     * and call sane_start again.
+     * This assumes we are running in batch mode. */
+    if(blank){
+      s->u.eof[s->side] = 1;
+      return sane_start(handle);
+    }
+  }
+
+  /* deskew and blank page detection only need to look at the
+   * start of the image, the rest is processed as it arrives */
+  else if(must_stream_buffer(s)){
+
+    while(!s->s.eof[s->side] && !ret && !stream_ready(s,s->side)){
       SANE_Int len = 0;
       ret = sane_read((SANE_Handle)s, NULL, 0, &len);
     }
 
     /* check for errors */
     if (ret != SANE_STATUS_GOOD) {
-      DBG (5, "sane_start: ERROR: cannot buffer image\n");
+      DBG (5, "sane_start: ERROR: cannot buffer image start\n");
       goto errors;
     }
 
-    DBG (5, "sane_start: OK: done buffering\n");
-
-    /* finished buffering, adjust image as required */
-    if(s->swdeskew){
-      buffer_deskew(s,s->side);
-    }
-    if(s->swcrop){
-      buffer_crop(s,s->side);
-    }
-    if(s->swdespeck){
-      buffer_despeck(s,s->side);
-    }
-    if(s->swskip){
-      /* Skipping means throwing out this image.
-       * Pretend the user read the whole thing
-       * and call sane_start again.
-       * This assumes we are running in batch mode. */
-      if(buffer_isblank(s,s->side)){
-        s->u.eof[s->side] = 1;
-        return sane_start(handle);
-      }
+    /* once the whole image is read, this decides if it is blank */
+    if(!stream_ready(s,s->side)){
+      DBG (5, "sane_start: blank page, skipping\n");
+      stream_reset(s,s->side);
+      s->u.eof[s->side] = 1;
+      return sane_start(handle);
     }
+
+    DBG (5, "sane_start: OK: done buffering image start\n");
   }
 
   ret = check_for_cancel(s);
@@ -4312,6 +4417,7 @@ sane_start (SANE_Handle handle)
 
   errors:
     DBG (10, "sane_start: error %d\n", ret);
+    read_ahead_stop(s);
     s->started = 0;
     s->cancelled = 0;
     s->reading = 0;
@@ -4328,6 +4434,12 @@ clean_params (struct scanner *s)
 
   DBG (10, "clean_params: start\n");
 
+  stream_reset(s,SIDE_FRONT);
+  stream_reset(s,SIDE_BACK);
+
+  /* a sheet loaded here is read directly */
+  s->ahead_sheet = 0;
+
   s->u.eof[0]=0;
   s->u.eof[1]=0;
   s->u.bytes_sent[0]=0;
@@ -4388,9 +4500,18 @@ image_buffers (struct scanner *s, int setup)
 
   DBG (10, "image_buffers: start\n");
 
+  /* nothing may still be working on the old buffers */
+  post_wait(s);
+  s->post_done = 0;
+
+  /* rebuilt by the first stupid line of the scan */
+  free_line_plan(s);
+
   for(side=0;side<2;side++){
 
     /* free current buffer */
+    stream_reset(s,side);
+
     if (s->buffers[side]) {
       DBG (15, "image_buffers: free buffer %d.\n",side);
       free(s->buffers[side]);
@@ -4640,171 +4761,668 @@ start_scan (struct scanner *s, int type)
 }
 
 /*
- * Called by SANE to read data.
- *
- * From the SANE spec:
- * This function is used to read image data from the device
- * represented by handle h.  Argument buf is a pointer to a memory
- * area that is at least maxlen bytes long.  The number of bytes
- * returned is stored in *len. A backend must set this to zero when
- * the call fails (i.e., when a status other than SANE_STATUS_GOOD is
- * returned).
- *
- * When the call succeeds, the number of bytes returned can be
- * anywhere in the range from 0 to maxlen bytes.
+ * Read-ahead: during an adf batch, a thread can feed and read the
+ * following sheets while the frontend is busy with the current one.
+ * The read-ahead config option gives the memory to use for this in
+ * megabytes, at least one sheet is read ahead if it is not 0. Each sheet
+ * is read into its own full size buffers, by a private copy of the
+ * scanner struct. A sheet is handed to sane_start as soon as it is
+ * loaded, sane_read then takes the data as the thread publishes it.
+ * While the thread runs, it is the only one talking to the scanner.
+ * The thread stops when it finds no more paper without reporting it,
+ * the sane_start which finds no sheet left looks for paper itself, so
+ * more paper can still be loaded while the frontend is busy.
  */
-SANE_Status
-sane_read (SANE_Handle handle, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len)
+#ifdef USE_PTHREAD
+
+struct ahead_sheet
 {
-  struct scanner *s = (struct scanner *) handle;
-  SANE_Status ret=SANE_STATUS_GOOD;
+  SANE_Status ret;
+  int ready;                    /* buffers allocated */
+  int done;                     /* read to the end, or failed */
+  int blocks;                   /* counts the updates below */
 
-  DBG (10, "sane_read: start\n");
+  struct img_params u;
+  struct img_params i;
+  struct img_params s;
+  int prev_page;
 
-  *len=0;
+  unsigned char * buffers[2];
+};
 
-  /* maybe cancelled? */
-  if(!s->started){
-    DBG (5, "sane_read: not started, call sane_start\n");
-    return SANE_STATUS_CANCELLED;
-  }
+struct read_ahead
+{
+  pthread_t thread;
+  pthread_mutex_t mu;
+  pthread_cond_t cond;
+  int running;
 
-  /* sane_start required between sides */
-  if(s->u.bytes_sent[s->side] == s->i.bytes_tot[s->side]){
-    s->u.eof[s->side] = 1;
-    DBG (15, "sane_read: returning eof\n");
-    return SANE_STATUS_EOF;
-  }
+  struct scanner reader;
 
-  s->reading = 1;
+  int sheets;                   /* number of sheet slots */
+  struct ahead_sheet * sheet;
+  int head;                     /* oldest sheet loaded */
+  int count;                    /* sheets loaded, not yet finished by sane_read */
+  int taken;                    /* oldest sheet is given to sane_start */
+  int seen;                     /* its updates already copied */
 
-  /* double width pnm interlacing */
-  if((s->s.source == SOURCE_ADF_DUPLEX || s->s.source == SOURCE_CARD_DUPLEX)
-    && s->s.format <= SANE_FRAME_RGB
-    && s->duplex_interlace != DUPLEX_INTERLACE_NONE
-  ){
+  int stop;
+  int done;
+};
 
-    /* buffer both sides */
-    if(!s->s.eof[SIDE_FRONT] || !s->s.eof[SIDE_BACK]){
-      ret = read_from_scanner_duplex(s, 0);
-      if(ret){
-        DBG(5,"sane_read: front returning %d\n",ret);
-        goto errors;
-      }
-      /*read last block, update counter*/
-      if(s->s.eof[SIDE_FRONT] && s->s.eof[SIDE_BACK]){
-        s->prev_page++;
-        DBG(15,"sane_read: duplex counter %d\n",s->prev_page);
+static void
+ahead_free(struct scanner *r)
+{
+  free(r->buffers[SIDE_FRONT]);
+  free(r->buffers[SIDE_BACK]);
+  r->buffers[SIDE_FRONT] = NULL;
+  r->buffers[SIDE_BACK] = NULL;
+}
+
+/* makes the progress of the reader on a sheet visible to sane_read */
+static void
+ahead_publish(struct read_ahead *a, struct ahead_sheet *sh,
+  SANE_Status ret, int done)
+{
+  struct scanner *r = &a->reader;
+
+  pthread_mutex_lock(&a->mu);
+  sh->ret = ret;
+  sh->ready = 1;
+  sh->done = done;
+  sh->blocks++;
+  sh->u = r->u;
+  sh->i = r->i;
+  sh->s = r->s;
+  sh->prev_page = r->prev_page;
+  sh->buffers[SIDE_FRONT] = r->buffers[SIDE_FRONT];
+  sh->buffers[SIDE_BACK] = r->buffers[SIDE_BACK];
+  pthread_cond_broadcast(&a->cond);
+  pthread_mutex_unlock(&a->mu);
+}
+
+/* reads the sheet the reader just started, both sides, to the end */
+static SANE_Status
+ahead_read(struct read_ahead *a, struct ahead_sheet *sh)
+{
+  struct scanner *r = &a->reader;
+  SANE_Status ret = SANE_STATUS_GOOD;
+  int side, stop;
+
+  for(side=0;side<2;side++){
+    if(r->i.bytes_tot[side]){
+      r->buffers[side] = calloc(1,r->i.bytes_tot[side]);
+      if(!r->buffers[side]){
+        DBG (5, "ahead_read: Error, no buffer %d.\n",side);
+        return SANE_STATUS_NO_MEM;
       }
     }
   }
 
-  /* simplex or non-alternating duplex */
-  else{
-    if(!s->s.eof[s->side]){
-      ret = read_from_scanner(s, s->side, 0);
-      if(ret){
-        DBG(5,"sane_read: side %d returning %d\n",s->side,ret);
-        goto errors;
-      }
-      /*read last block, update counter*/
-      if(s->s.eof[s->side]){
-        s->prev_page++;
-        DBG(15,"sane_read: side %d counter %d\n",s->side,s->prev_page);
-      }
+  r->side = SIDE_FRONT;
+  if(r->s.source == SOURCE_ADF_BACK){
+    r->side = SIDE_BACK;
+  }
+
+  /* sane_start can go on */
+  ahead_publish(a, sh, SANE_STATUS_GOOD, 0);
+
+  for(;;){
+
+    pthread_mutex_lock(&a->mu);
+    stop = a->stop;
+    pthread_mutex_unlock(&a->mu);
+    if(stop){
+      return SANE_STATUS_CANCELLED;
+    }
+
+    ret = read_block(r);
+    if(ret){
+      return ret;
+    }
+
+    if(r->s.eof[r->side] && r->side == SIDE_FRONT
+      && r->s.source == SOURCE_ADF_DUPLEX
+    ){
+      r->side = SIDE_BACK;
+    }
+
+    /* the last block is published with the end of the sheet */
+    if(r->s.eof[r->side]){
+      return SANE_STATUS_GOOD;
     }
+
+    ahead_publish(a, sh, SANE_STATUS_GOOD, 0);
   }
+}
 
-  /* copy a block from buffer to frontend */
-  ret = read_from_buffer(s,buf,max_len,len,s->side);
-  if(ret)
-    goto errors;
+/* looks for the next sheet the way sane_start does, and starts it */
+static SANE_Status
+ahead_load(struct scanner *r)
+{
+  SANE_Status ret;
 
-  ret = check_for_cancel(s);
-  s->reading = 0;
+  clean_params(r);
+  r->jpeg_stage=JPEG_STAGE_NONE;
+  r->jpeg_ff_offset=0;
 
-  DBG (10, "sane_read: finish %d\n", ret);
-  return ret;
+  /* small, buffering scanners check for more pages by reading counter */
+  if(!r->always_op && r->buffermode){
+    ret = read_panel (r, OPT_COUNTER);
+    if(ret){
+      return ret;
+    }
+    if(r->prev_page == r->panel_counter){
+      DBG (15, "ahead_load: same counter (%d) no paper?\n",r->prev_page);
+      return SANE_STATUS_NO_DOCS;
+    }
+    return SANE_STATUS_GOOD;
+  }
 
-  errors:
-    DBG (10, "sane_read: error %d\n", ret);
-    s->reading = 0;
-    s->cancelled = 0;
-    s->started = 0;
+  ret = object_position (r, SANE_TRUE);
+  if(ret){
     return ret;
+  }
+  if(!r->buffermode){
+    ret = start_scan (r,0);
+  }
+  return ret;
 }
 
-static SANE_Status
-read_from_scanner(struct scanner *s, int side, int exact)
+static void *
+read_ahead_thread(void *arg)
 {
-  SANE_Status ret=SANE_STATUS_GOOD;
+  struct read_ahead *a = arg;
+  struct scanner *r = &a->reader;
+  struct ahead_sheet *sh;
+  SANE_Status ret;
 
-  unsigned char cmd[READ_len];
-  size_t cmdLen = READ_len;
+  DBG (10, "read_ahead_thread: start\n");
 
-  unsigned char * in;
-  size_t inLen = 0;
+  for(;;){
 
-  size_t bytes = s->buffer_size;
-  size_t remain = s->s.bytes_tot[side] - s->s.bytes_sent[side];
+    pthread_mutex_lock(&a->mu);
+    while(a->count == a->sheets && !a->stop){
+      pthread_cond_wait(&a->cond, &a->mu);
+    }
+    sh = &a->sheet[(a->head + a->count) % a->sheets];
+    if(a->stop){
+      pthread_mutex_unlock(&a->mu);
+      break;
+    }
+    pthread_mutex_unlock(&a->mu);
 
-  DBG (10, "read_from_scanner: start\n");
+    /* out of paper, sane_start tries again when it gets here */
+    ret = ahead_load(r);
+    if(ret){
+      DBG (15, "read_ahead_thread: cannot load page %d\n", ret);
+      break;
+    }
 
-  /* all requests must end on line boundary */
-  bytes -= (bytes % s->s.Bpl);
+    /* the slot is not in use until it is counted */
+    memset(sh, 0, sizeof(*sh));
+    pthread_mutex_lock(&a->mu);
+    a->count++;
+    pthread_mutex_unlock(&a->mu);
 
-  /* some larger scanners require even bytes per block */
-  if(bytes % 2){
-    bytes -= s->s.Bpl;
-  }
+    ret = ahead_read(a, sh);
 
-  /* usually (image) we want to read too much data, and get RS */
-  /* sometimes (calib) we want to do an exact read */
-  if(exact && bytes > remain){
-    bytes = remain;
+    /* the buffers now belong to the slot */
+    ahead_publish(a, sh, ret, 1);
+    r->buffers[SIDE_FRONT] = NULL;
+    r->buffers[SIDE_BACK] = NULL;
+
+    /* failed, sane_start takes over again */
+    if(ret){
+      break;
+    }
   }
 
-  DBG(15, "read_from_scanner: si:%d to:%d rx:%d re:%lu bu:%d pa:%lu ex:%d\n",
-      side, s->s.bytes_tot[side], s->s.bytes_sent[side],
-      (unsigned long)remain, s->buffer_size, (unsigned long)bytes, exact);
+  pthread_mutex_lock(&a->mu);
+  a->done = 1;
+  pthread_cond_broadcast(&a->cond);
+  pthread_mutex_unlock(&a->mu);
 
-  inLen = bytes;
-  in = malloc(inLen);
-  if(!in){
-    DBG(5, "read_from_scanner: not enough mem for buffer: %d\n",(int)inLen);
-    return SANE_STATUS_NO_MEM;
-  }
+  DBG (10, "read_ahead_thread: finish\n");
+  return NULL;
+}
 
-  memset(cmd,0,cmdLen);
-  set_SCSI_opcode(cmd, READ_code);
-  set_R_datatype_code (cmd, SR_datatype_image);
+static void
+read_ahead_stop(struct scanner *s)
+{
+  struct read_ahead *a = s->ahead;
+  int i;
 
-  set_R_xfer_length (cmd, inLen);
+  if(!a){
+    return;
+  }
 
-  ret = do_cmd (
-    s, 1, 0,
-    cmd, cmdLen,
-    NULL, 0,
-    in, &inLen
-  );
+  pthread_mutex_lock(&a->mu);
+  a->stop = 1;
+  pthread_cond_broadcast(&a->cond);
+  pthread_mutex_unlock(&a->mu);
+  pthread_join(a->thread, NULL);
+  a->running = 0;
+
+  DBG (15, "read_ahead_stop: %d sheets dropped\n", a->count - a->taken);
+
+  /* the buffers of a sheet given to sane_start are in s */
+  for(i=a->taken;i<a->count;i++){
+    struct ahead_sheet *sh = &a->sheet[(a->head + i) % a->sheets];
+    free(sh->buffers[SIDE_FRONT]);
+    free(sh->buffers[SIDE_BACK]);
+  }
+  ahead_free(&a->reader);
+  free_line_plan(&a->reader);
+  pthread_cond_destroy(&a->cond);
+  pthread_mutex_destroy(&a->mu);
+  free(a->sheet);
+  free(a);
+  s->ahead = NULL;
+  s->ahead_sheet = 0;
+}
 
-  if (ret == SANE_STATUS_GOOD) {
-    DBG(15, "read_from_scanner: got GOOD, returning GOOD %lu\n", (unsigned long)inLen);
+static void
+read_ahead_start(struct scanner *s)
+{
+  struct read_ahead *a;
+  unsigned long size = (unsigned long)s->i.Bpl * s->i.height;
+  unsigned long limit = (unsigned long)s->read_ahead * 1024 * 1024;
+
+  if(s->s.source != SOURCE_ADF_FRONT
+    && s->s.source != SOURCE_ADF_BACK && s->s.source != SOURCE_ADF_DUPLEX
+  ){
+    return;
   }
-  else if (ret == SANE_STATUS_EOF) {
-    DBG(15, "read_from_scanner: got EOF, finishing %lu\n", (unsigned long)inLen);
+  if(s->s.source == SOURCE_ADF_DUPLEX){
+    size *= 2;
   }
-  else if (ret == SANE_STATUS_DEVICE_BUSY) {
-    DBG(5, "read_from_scanner: got BUSY, returning GOOD\n");
-    inLen = 0;
-    ret = SANE_STATUS_GOOD;
+  if(!limit || !size){
+    return;
   }
-  else {
-    DBG(5, "read_from_scanner: error reading data block status = %d\n",ret);
-    inLen = 0;
+
+  a = calloc(1, sizeof(*a));
+  if(!a){
+    DBG (5, "read_ahead_start: not enough memory, not reading ahead\n");
+    return;
+  }
+  a->sheets = limit / size ? limit / size : 1;
+  a->sheet = calloc(a->sheets, sizeof(*a->sheet));
+  if(!a->sheet){
+    DBG (5, "read_ahead_start: not enough memory, not reading ahead\n");
+    free(a);
+    return;
   }
 
-  /* this is jpeg data, we need to fix the missing image size */
+  /* the thread works on its own copy of the scanner struct */
+  a->reader = *s;
+  a->reader.ahead = NULL;
+  a->reader.buffers[SIDE_FRONT] = NULL;
+  a->reader.buffers[SIDE_BACK] = NULL;
+  a->reader.stream_rot[SIDE_FRONT] = NULL;
+  a->reader.stream_rot[SIDE_BACK] = NULL;
+  memset(&a->reader.plan, 0, sizeof(a->reader.plan));
+  a->reader.post_running = 0;
+  a->reader.post_done = 0;
+
+  pthread_mutex_init(&a->mu, NULL);
+  pthread_cond_init(&a->cond, NULL);
+  s->ahead = a;
+  a->running = 1;
+  if(pthread_create(&a->thread, NULL, read_ahead_thread, a)){
+    DBG (5, "read_ahead_start: cannot start thread, not reading ahead\n");
+    pthread_cond_destroy(&a->cond);
+    pthread_mutex_destroy(&a->mu);
+    free(a->sheet);
+    free(a);
+    s->ahead = NULL;
+    return;
+  }
+
+  DBG (15, "read_ahead_start: up to %d sheets\n", a->sheets);
+}
+
+/* copies what the thread has read of the sheet since the last call,
+ * with the mutex held. the sides sane_read has seen to the end are
+ * left alone, they may have been cropped or deskewed already. releases
+ * the slot once the sheet is done */
+static SANE_Status
+ahead_take(struct scanner *s, struct read_ahead *a)
+{
+  struct ahead_sheet *sh = &a->sheet[a->head];
+  int side;
+
+  for(side=0;side<2;side++){
+    if(s->s.eof[side]){
+      continue;
+    }
+    s->s.bytes_tot[side] = sh->s.bytes_tot[side];
+    s->s.bytes_sent[side] = sh->s.bytes_sent[side];
+    s->s.eof[side] = sh->s.eof[side];
+    s->i.bytes_tot[side] = sh->i.bytes_tot[side];
+    s->i.bytes_sent[side] = sh->i.bytes_sent[side];
+    s->i.eof[side] = sh->i.eof[side];
+    s->u.bytes_tot[side] = sh->u.bytes_tot[side];
+  }
+  s->prev_page = sh->prev_page;
+  a->seen = sh->blocks;
+
+  if(sh->done){
+    a->head = (a->head + 1) % a->sheets;
+    a->count--;
+    a->taken = 0;
+    pthread_cond_broadcast(&a->cond);
+  }
+  return sh->ret;
+}
+
+/* Take the next sheet from the read-ahead thread, starting the thread
+ * if there is none. Returns as soon as the sheet is loaded, sane_read
+ * gets the data with read_ahead_sync. Returns 0 if the thread has
+ * finished and all of its sheets have been taken, the sheet must then
+ * be loaded and read directly. */
+static int
+read_ahead_get(struct scanner *s, SANE_Status * ret)
+{
+  struct read_ahead *a;
+  struct ahead_sheet *sh;
+  int side;
+
+  if(!s->ahead){
+    read_ahead_start(s);
+  }
+  a = s->ahead;
+  if(!a){
+    return 0;
+  }
+
+  pthread_mutex_lock(&a->mu);
+
+  /* the frontend skipped the rest of the sheet before */
+  if(a->taken){
+    while(!a->sheet[a->head].done){
+      pthread_cond_wait(&a->cond, &a->mu);
+    }
+    ahead_take(s, a);
+  }
+
+  while(!(a->count && a->sheet[a->head].ready) && !a->done){
+    pthread_cond_wait(&a->cond, &a->mu);
+  }
+  if(!a->count){
+    pthread_mutex_unlock(&a->mu);
+    read_ahead_stop(s);
+    return 0;
+  }
+  sh = &a->sheet[a->head];
+
+  /* the sheet before is done, drop it */
+  s->post_done = 0;
+  for(side=0;side<2;side++){
+    stream_reset(s,side);
+    free(s->buffers[side]);
+    s->buffers[side] = sh->buffers[side];
+  }
+  s->u = sh->u;
+  s->i = sh->i;
+  s->s = sh->s;
+  s->ahead_sheet = 1;
+  a->taken = 1;
+  *ret = ahead_take(s, a);
+
+  pthread_mutex_unlock(&a->mu);
+  return 1;
+}
+
+/* waits for the thread to read more of the sheet given to sane_start */
+static SANE_Status
+read_ahead_sync(struct scanner *s)
+{
+  struct read_ahead *a = s->ahead;
+  struct ahead_sheet *sh;
+  SANE_Status ret;
+
+  if(!a){
+    return SANE_STATUS_GOOD;
+  }
+
+  pthread_mutex_lock(&a->mu);
+  if(!a->taken){
+    pthread_mutex_unlock(&a->mu);
+    return SANE_STATUS_GOOD;
+  }
+  sh = &a->sheet[a->head];
+  while(!sh->done && sh->blocks == a->seen && !s->s.eof[s->side]){
+    pthread_cond_wait(&a->cond, &a->mu);
+  }
+  ret = ahead_take(s, a);
+  pthread_mutex_unlock(&a->mu);
+
+  return ret;
+}
+
+#else
+
+static void
+read_ahead_stop(struct scanner *s)
+{
+  (void) s;
+}
+
+static void
+read_ahead_start(struct scanner *s)
+{
+  (void) s;
+}
+
+static int
+read_ahead_get(struct scanner *s, SANE_Status * ret)
+{
+  (void) s;
+  (void) ret;
+  return 0;
+}
+
+static SANE_Status
+read_ahead_sync(struct scanner *s)
+{
+  (void) s;
+  return SANE_STATUS_GOOD;
+}
+
+#endif
+
+/*
+ * Called by SANE to read data.
+ *
+ * From the SANE spec:
+ * This function is used to read image data from the device
+ * represented by handle h.  Argument buf is a pointer to a memory
+ * area that is at least maxlen bytes long.  The number of bytes
+ * returned is stored in *len. A backend must set this to zero when
+ * the call fails (i.e., when a status other than SANE_STATUS_GOOD is
+ * returned).
+ *
+ * When the call succeeds, the number of bytes returned can be
+ * anywhere in the range from 0 to maxlen bytes.
+ */
+SANE_Status
+sane_read (SANE_Handle handle, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len)
+{
+  struct scanner *s = (struct scanner *) handle;
+  SANE_Status ret=SANE_STATUS_GOOD;
+
+  DBG (10, "sane_read: start\n");
+
+  *len=0;
+
+  /* maybe cancelled? */
+  if(!s->started){
+    DBG (5, "sane_read: not started, call sane_start\n");
+    return SANE_STATUS_CANCELLED;
+  }
+
+  /* sane_start required between sides */
+  if(s->u.bytes_sent[s->side] == s->i.bytes_tot[s->side]){
+    s->u.eof[s->side] = 1;
+    stream_reset(s,s->side);
+    DBG (15, "sane_read: returning eof\n");
+    return SANE_STATUS_EOF;
+  }
+
+  s->reading = 1;
+
+  /* a sheet from the read-ahead thread arrives in its buffers */
+  if(s->ahead_sheet){
+    ret = read_ahead_sync(s);
+  }
+  else{
+    ret = read_block(s);
+  }
+  if(ret)
+    goto errors;
+
+  /* deskew the lines which arrived */
+  stream_rotate(s,SIDE_FRONT);
+  stream_rotate(s,SIDE_BACK);
+
+  /* copy a block from buffer to frontend */
+  ret = read_from_buffer(s,buf,max_len,len,s->side);
+  if(ret)
+    goto errors;
+
+  ret = check_for_cancel(s);
+  s->reading = 0;
+
+  DBG (10, "sane_read: finish %d\n", ret);
+  return ret;
+
+  errors:
+    DBG (10, "sane_read: error %d\n", ret);
+    s->reading = 0;
+    s->cancelled = 0;
+    s->started = 0;
+    return ret;
+}
+
+/* reads the next block of the current side from the scanner into the
+ * image buffers, unless that side has already been read to the end */
+static SANE_Status
+read_block(struct scanner *s)
+{
+  SANE_Status ret=SANE_STATUS_GOOD;
+
+  /* double width pnm interlacing */
+  if((s->s.source == SOURCE_ADF_DUPLEX || s->s.source == SOURCE_CARD_DUPLEX)
+    && s->s.format <= SANE_FRAME_RGB
+    && s->duplex_interlace != DUPLEX_INTERLACE_NONE
+  ){
+
+    /* buffer both sides */
+    if(!s->s.eof[SIDE_FRONT] || !s->s.eof[SIDE_BACK]){
+      ret = read_from_scanner_duplex(s, 0);
+      if(ret){
+        DBG(5,"read_block: front returning %d\n",ret);
+        return ret;
+      }
+      /*read last block, update counter*/
+      if(s->s.eof[SIDE_FRONT] && s->s.eof[SIDE_BACK]){
+        s->prev_page++;
+        DBG(15,"read_block: duplex counter %d\n",s->prev_page);
+      }
+    }
+  }
+
+  /* simplex or non-alternating duplex */
+  else{
+    if(!s->s.eof[s->side]){
+      ret = read_from_scanner(s, s->side, 0);
+      if(ret){
+        DBG(5,"read_block: side %d returning %d\n",s->side,ret);
+        return ret;
+      }
+      /*read last block, update counter*/
+      if(s->s.eof[s->side]){
+        s->prev_page++;
+        DBG(15,"read_block: side %d counter %d\n",s->side,s->prev_page);
+      }
+    }
+  }
+
+  return ret;
+}
+
+static SANE_Status
+read_from_scanner(struct scanner *s, int side, int exact)
+{
+  SANE_Status ret=SANE_STATUS_GOOD;
+
+  unsigned char cmd[READ_len];
+  size_t cmdLen = READ_len;
+
+  unsigned char * in;
+  size_t inLen = 0;
+
+  size_t bytes = s->buffer_size;
+  size_t remain = s->s.bytes_tot[side] - s->s.bytes_sent[side];
+
+  DBG (10, "read_from_scanner: start\n");
+
+  /* all requests must end on line boundary */
+  bytes -= (bytes % s->s.Bpl);
+
+  /* some larger scanners require even bytes per block */
+  if(bytes % 2){
+    bytes -= s->s.Bpl;
+  }
+
+  /* usually (image) we want to read too much data, and get RS */
+  /* sometimes (calib) we want to do an exact read */
+  if(exact && bytes > remain){
+    bytes = remain;
+  }
+
+  DBG(15, "read_from_scanner: si:%d to:%d rx:%d re:%lu bu:%d pa:%lu ex:%d\n",
+      side, s->s.bytes_tot[side], s->s.bytes_sent[side],
+      (unsigned long)remain, s->buffer_size, (unsigned long)bytes, exact);
+
+  inLen = bytes;
+  in = malloc(inLen);
+  if(!in){
+    DBG(5, "read_from_scanner: not enough mem for buffer: %d\n",(int)inLen);
+    return SANE_STATUS_NO_MEM;
+  }
+
+  memset(cmd,0,cmdLen);
+  set_SCSI_opcode(cmd, READ_code);
+  set_R_datatype_code (cmd, SR_datatype_image);
+
+  set_R_xfer_length (cmd, inLen);
+
+  ret = do_cmd (
+    s, 1, 0,
+    cmd, cmdLen,
+    NULL, 0,
+    in, &inLen
+  );
+
+  if (ret == SANE_STATUS_GOOD) {
+    DBG(15, "read_from_scanner: got GOOD, returning GOOD %lu\n", (unsigned long)inLen);
+  }
+  else if (ret == SANE_STATUS_EOF) {
+    DBG(15, "read_from_scanner: got EOF, finishing %lu\n", (unsigned long)inLen);
+  }
+  else if (ret == SANE_STATUS_DEVICE_BUSY) {
+    DBG(5, "read_from_scanner: got BUSY, returning GOOD\n");
+    inLen = 0;
+    ret = SANE_STATUS_GOOD;
+  }
+  else {
+    DBG(5, "read_from_scanner: error reading data block status = %d\n",ret);
+    inLen = 0;
+  }
+
+  /* this is jpeg data, we need to fix the missing image size */
   if(s->s.format == SANE_FRAME_JPEG){
 
     /* look for the SOF header near the beginning */
@@ -5363,11 +5981,12 @@ static SANE_Status
 copy_line(struct scanner *s, unsigned char * buff, int side)
 {
   SANE_Status ret=SANE_STATUS_GOOD;
+  struct line_plan *p = &s->plan;
   int spwidth = s->s.width;
   int sbwidth = s->s.Bpl;
   int ibwidth = s->i.Bpl;
-  unsigned char * line;
-  int offset = 0;
+  unsigned char * out;
+  unsigned char * v;
   int i, j;
 
   DBG (20, "copy_line: start\n");
@@ -5387,139 +6006,282 @@ copy_line(struct scanner *s, unsigned char * buff, int side)
 
   /* the 'corner' case: stupid scan */
 
-  /*setup 24 bit color single line buffer*/
-  line = malloc(spwidth*3);
-  if(!line) return SANE_STATUS_NO_MEM;
+  /* the plan is built on the first line, and again if the params change */
+  if(!line_plan_valid(s)){
+    ret = build_line_plan(s);
+    if(ret){
+      DBG (5, "copy_line: ERROR: cannot build plan\n");
+      return ret;
+    }
+  }
 
-  /*load single line color buffer*/
-  switch (s->s.mode) {
+  out = s->buffers[side] + s->i.bytes_sent[side];
+  s->i.bytes_sent[side] += ibwidth;
 
-    case MODE_COLOR:
-      if(must_downsample(s) && s->dropout_color[side]){
-        switch(s->dropout_color[side]){
-          case COLOR_RED:
-            for(i=0;i<spwidth;i++)
-              line[i*3] = line[i*3+1] = line[i*3+2] = buff[i*3];
-            break;
-          case COLOR_GREEN:
-            for(i=0;i<spwidth;i++)
-              line[i*3] = line[i*3+1] = line[i*3+2] = buff[i*3+1];
-            break;
-          case COLOR_BLUE:
-            for(i=0;i<spwidth;i++)
-              line[i*3] = line[i*3+1] = line[i*3+2] = buff[i*3+2];
-            break;
-          case COLOR_EN_RED:
-            for(i=0;i<spwidth;i++){
-              line[i*3] = (buff[i*3+1] + buff[i*3+2])/2;
-              line[i*3+1] = buff[i*3+1];
-              line[i*3+2] = buff[i*3+2];
-            }
-            break;
-          case COLOR_EN_GREEN:
-            for(i=0;i<spwidth;i++){
-              line[i*3] = buff[i*3];
-              line[i*3+1] = (buff[i*3] + buff[i*3+2])/2;
-              line[i*3+2] = buff[i*3+2];
-            }
-            break;
-          case COLOR_EN_BLUE:
-            for(i=0;i<spwidth;i++){
-              line[i*3] = buff[i*3];
-              line[i*3+1] = buff[i*3+1];
-              line[i*3+2] = (buff[i*3] + buff[i*3+1])/2;
-            }
-            break;
-        }
-      }
-      else{
-        memcpy(line, buff, sbwidth);
+  /* color, only when the scan is color too */
+  if(s->i.mode == MODE_COLOR){
+    if(p->linear){
+      memcpy(out, buff + p->index[0]*3, ibwidth);
+    }
+    else{
+      for(i=0;i<p->count;i++){
+        unsigned char * src = buff + p->index[i]*3;
+        out[i*3] = src[0];
+        out[i*3+1] = src[1];
+        out[i*3+2] = src[2];
       }
+    }
+    DBG (20, "copy_line: finish stupid\n");
+    return ret;
+  }
+
+  /* load one gray level or lineart bit per scanned pixel */
+  v = p->line;
+  switch (p->load[side]) {
+
+    case PLAN_LOAD_NONE:
+      v = buff;
       break;
 
-    case MODE_GRAYSCALE:
-      for(i=0;i<spwidth;i++){
-        line[i*3] = line[i*3+1] = line[i*3+2] = buff[i];
-      }
+    case PLAN_LOAD_GRAY:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[buff[i]*3];
+      break;
+
+    case PLAN_LOAD_BITS:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[((buff[i/8] >> (7-i%8)) & 1) ? 0 : 3*255];
+      break;
+
+    case PLAN_LOAD_SUM + COLOR_RED:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[buff[i*3]*3];
+      break;
+
+    case PLAN_LOAD_SUM + COLOR_GREEN:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[buff[i*3+1]*3];
+      break;
+
+    case PLAN_LOAD_SUM + COLOR_BLUE:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[buff[i*3+2]*3];
+      break;
+
+    case PLAN_LOAD_SUM + COLOR_EN_RED:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[(buff[i*3+1] + buff[i*3+2])/2
+          + buff[i*3+1] + buff[i*3+2]];
+      break;
+
+    case PLAN_LOAD_SUM + COLOR_EN_GREEN:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[buff[i*3] + (buff[i*3] + buff[i*3+2])/2
+          + buff[i*3+2]];
+      break;
+
+    case PLAN_LOAD_SUM + COLOR_EN_BLUE:
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[buff[i*3] + buff[i*3+1]
+          + (buff[i*3] + buff[i*3+1])/2];
       break;
 
     default:
-      for(i=0;i<sbwidth;i++){
-        unsigned char curr = buff[i];
-
-        line[i*24+0] = line[i*24+1] = line[i*24+2] = ((curr >> 7) & 1) ?0:255;
-        line[i*24+3] = line[i*24+4] = line[i*24+5] = ((curr >> 6) & 1) ?0:255;
-        line[i*24+6] = line[i*24+7] = line[i*24+8] = ((curr >> 5) & 1) ?0:255;
-        line[i*24+9] = line[i*24+10] = line[i*24+11] = ((curr >> 4) & 1) ?0:255;
-        line[i*24+12] = line[i*24+13] = line[i*24+14] =((curr >> 3) & 1) ?0:255;
-        line[i*24+15] = line[i*24+16] = line[i*24+17] =((curr >> 2) & 1) ?0:255;
-        line[i*24+18] = line[i*24+19] = line[i*24+20] =((curr >> 1) & 1) ?0:255;
-        line[i*24+21] = line[i*24+22] = line[i*24+23] =((curr >> 0) & 1) ?0:255;
-      }
+      for(i=0;i<spwidth;i++)
+        v[i] = p->lut[buff[i*3] + buff[i*3+1] + buff[i*3+2]];
       break;
   }
 
-  /* scan is higher res than user wanted, scale it */
-  /*FIXME: interpolate instead */
-  if(s->i.dpi_x != s->s.dpi_x){
-    for(i=0;i<spwidth;i++){
-      int source = i * s->s.dpi_x/s->i.dpi_x * 3;
+  /* store line in buffer */
+  if(s->i.mode == MODE_GRAYSCALE){
+    if(p->linear){
+      memcpy(out, v + p->index[0], ibwidth);
+    }
+    else{
+      for(i=0;i<ibwidth;i++)
+        out[i] = v[p->index[i]];
+    }
+  }
+  else{
+    int * index = p->index;
 
-      if(source+2 >= spwidth*3)
-        break;
+    for(i=0;i<ibwidth;i++,index+=8){
+      unsigned char curr = 0;
+
+      for(j=0;j<8;j++)
+        curr = (curr << 1) | v[index[j]];
 
-      line[i*3] = line[source];
-      line[i*3+1] = line[source+1];
-      line[i*3+2] = line[source+2];
+      out[i] = curr;
     }
   }
 
-  /* scan is wider than user wanted, skip some pixels on left side */
+  DBG (20, "copy_line: finish stupid\n");
+
+  return ret;
+}
+
+/* true if the line plan was built for the current scan params */
+static int
+line_plan_valid(struct scanner *s)
+{
+  struct line_plan *p = &s->plan;
+  int dropout = must_downsample(s);
+
+  return p->index
+    && p->s_mode == s->s.mode
+    && p->s_width == s->s.width
+    && p->s_dpi_x == s->s.dpi_x
+    && p->i_mode == s->i.mode
+    && p->i_width == s->i.width
+    && p->i_Bpl == s->i.Bpl
+    && p->i_dpi_x == s->i.dpi_x
+    && p->offset == line_plan_offset(s)
+    && p->threshold == s->threshold
+    && p->dropout[0] == (dropout ? s->dropout_color[0] : 0)
+    && p->dropout[1] == (dropout ? s->dropout_color[1] : 0);
+}
+
+/* scan is wider than user wanted, skip some pixels on left side */
+static int
+line_plan_offset(struct scanner *s)
+{
   if(s->i.width != s->s.width){
-    offset = ((s->valid_x-s->i.page_x) / 2 + s->i.tl_x) * s->i.dpi_x/1200;
+    return ((s->valid_x-s->i.page_x) / 2 + s->i.tl_x) * s->i.dpi_x/1200;
   }
+  return 0;
+}
 
-  /* change mode, store line in buffer */
-  switch (s->i.mode) {
+/*
+ * decides how copy_line() converts the lines of a 'stupid' scan. Instead
+ * of expanding each line to 24 bit color, scaling and then converting it,
+ * the source pixel of each output pixel is looked up once here, and the
+ * gray level or lineart bit of each possible channel sum goes in a lut.
+ */
+static SANE_Status
+build_line_plan(struct scanner *s)
+{
+  struct line_plan *p = &s->plan;
+  int spwidth = s->s.width;
+  int dropout = must_downsample(s);
+  int * pos;
+  int i, side, stop;
+
+  DBG (10, "build_line_plan: start\n");
 
+  free_line_plan(s);
+
+  if(s->i.mode == MODE_COLOR && s->s.mode != MODE_COLOR){
+    DBG (5, "build_line_plan: ERROR: cannot make color from mode %d\n",
+      s->s.mode);
+    return SANE_STATUS_INVAL;
+  }
+
+  p->s_mode = s->s.mode;
+  p->s_width = s->s.width;
+  p->s_dpi_x = s->s.dpi_x;
+  p->i_mode = s->i.mode;
+  p->i_width = s->i.width;
+  p->i_Bpl = s->i.Bpl;
+  p->i_dpi_x = s->i.dpi_x;
+  p->offset = line_plan_offset(s);
+  p->threshold = s->threshold;
+
+  switch (s->i.mode) {
     case MODE_COLOR:
-      memcpy(s->buffers[side]+s->i.bytes_sent[side], line+(offset*3), ibwidth);
-      s->i.bytes_sent[side] += ibwidth;
+      p->count = s->i.Bpl/3;
       break;
-
     case MODE_GRAYSCALE:
-      for(i=0;i<ibwidth;i++){
-        int source = (offset+i)*3;
-        s->buffers[side][s->i.bytes_sent[side]++]
-          = ((int)line[source] + line[source+1] + line[source+2])/3;
-      }
+      p->count = s->i.Bpl;
       break;
-
     default:
-      /*loop over output bytes*/
-      for(i=0;i<ibwidth;i++){
+      p->count = s->i.Bpl*8;
+      break;
+  }
 
-        unsigned char curr = 0;
-        int thresh = s->threshold*3;
+  p->index = calloc(p->count+1, sizeof(int));
+  p->line = malloc(spwidth+1);
+  pos = malloc((spwidth+1) * sizeof(int));
+  if(!p->index || !p->line || !pos){
+    DBG (5, "build_line_plan: ERROR: no mem\n");
+    free(pos);
+    free_line_plan(s);
+    return SANE_STATUS_NO_MEM;
+  }
 
-        /*loop over output bits*/
-        for(j=0;j<8;j++){
-          int source = offset*3 + i*24 + j*3;
-          if( (line[source] + line[source+1] + line[source+2]) < thresh ){
-            curr |= 1 << (7-j);
-          }
-        }
+  /* scan is higher res than user wanted, the scaling used to be done in
+   * place on the line, stopping at the first pixel taken from past its
+   * end, so do the same with pixel positions */
+  /*FIXME: interpolate instead */
+  for(i=0;i<spwidth;i++){
+    pos[i] = i;
+  }
+  if(s->i.dpi_x != s->s.dpi_x){
+    for(i=0;i<spwidth;i++){
+      int source = i * s->s.dpi_x/s->i.dpi_x;
 
-        s->buffers[side][s->i.bytes_sent[side]++] = curr;
-      }
-      break;
+      if(source >= spwidth)
+        break;
+
+      pos[i] = pos[source];
+    }
   }
 
-  free(line);
+  p->linear = 1;
+  stop = spwidth ? spwidth-1 : 0;
+  for(i=0;i<p->count;i++){
+    int source = p->offset + i;
 
-  DBG (20, "copy_line: finish stupid\n");
+    if(source > stop)
+      source = stop;
+    if(source < 0)
+      source = 0;
 
-  return ret;
+    p->index[i] = pos[source];
+    if(p->index[i] != p->index[0] + i)
+      p->linear = 0;
+  }
+  free(pos);
+
+  /* the gray level or lineart bit of a pixel from the sum of its channels */
+  for(i=0;i<=3*255;i++){
+    if(s->i.mode == MODE_GRAYSCALE)
+      p->lut[i] = i/3;
+    else
+      p->lut[i] = (i < s->threshold*3);
+  }
+
+  for(side=0;side<2;side++){
+    p->dropout[side] = dropout ? s->dropout_color[side] : 0;
+
+    if(s->s.mode == MODE_COLOR){
+      p->load[side] = PLAN_LOAD_SUM + p->dropout[side];
+    }
+    else if(s->s.mode == MODE_GRAYSCALE){
+      p->load[side] = PLAN_LOAD_GRAY;
+      if(s->i.mode == MODE_GRAYSCALE)
+        p->load[side] = PLAN_LOAD_NONE;
+    }
+    else{
+      p->load[side] = PLAN_LOAD_BITS;
+    }
+  }
+
+  DBG (10, "build_line_plan: finish\n");
+
+  return SANE_STATUS_GOOD;
+}
+
+static void
+free_line_plan(struct scanner *s)
+{
+  if(s->plan.index){
+    free(s->plan.index);
+    s->plan.index = NULL;
+  }
+  if(s->plan.line){
+    free(s->plan.line);
+    s->plan.line = NULL;
+  }
 }
 
 static SANE_Status
@@ -5532,6 +6294,11 @@ read_from_buffer(struct scanner *s, SANE_Byte * buf, SANE_Int max_len,
 
   DBG (10, "read_from_buffer: start\n");
 
+  /* lines which still have to be deskewed are held back */
+  if(s->stream_rot[side]
+    && s->stream_lines[side] * s->i.Bpl - s->u.bytes_sent[side] < remain)
+    remain = s->stream_lines[side] * s->i.Bpl - s->u.bytes_sent[side];
+
   /* figure out the max amount to transfer */
   if(bytes > remain)
     bytes = remain;
@@ -6462,6 +7229,8 @@ sane_cancel (SANE_Handle handle)
   if(!s->reading)
     check_for_cancel(s);
 
+  sanei_perf_dump (STRINGIFY(BACKEND_NAME));
+
   DBG (10, "sane_cancel: finish\n");
 }
 
@@ -6481,6 +7250,9 @@ check_for_cancel(struct scanner *s)
 
     DBG (15, "check_for_cancel: cancelling\n");
 
+    /* the thread may be in the middle of a command */
+    read_ahead_stop(s);
+
     /* cancel scan */
     memset(cmd,0,cmdLen);
     set_SCSI_opcode(cmd, CANCEL_code);
@@ -6529,6 +7301,7 @@ sane_close (SANE_Handle handle)
   struct scanner * s = (struct scanner *) handle;
 
   DBG (10, "sane_close: start\n");
+  read_ahead_stop(s);
   disconnect_fd(s);
   image_buffers(s,0);
   offset_buffers(s,0);
@@ -6605,6 +7378,7 @@ default_globals(void)
   global_padded_read = global_padded_read_default;
   global_extra_status = global_extra_status_default;
   global_duplex_offset = global_duplex_offset_default;
+  global_read_ahead = global_read_ahead_default;
   global_vendor_name[0] = 0;
   global_model_name[0] = 0;
   global_version_name[0] = 0;
@@ -6632,6 +7406,14 @@ sense_handler (int fd, unsigned char * sensed_data, void *arg)
   /* kill compiler warning */
   fd = fd;
 
+#ifdef USE_PTHREAD
+  /* the scsi layer calls us with the open handle, even when
+   * the read-ahead thread sent the command */
+  if(s->ahead && s->ahead->running){
+    s = &s->ahead->reader;
+  }
+#endif
+
   /* copy the rs return data into the scanner struct
      so that the caller can use it if he wants
   memcpy(&s->rs_buffer,sensed_data,RS_return_size);
@@ -7527,11 +8309,11 @@ sane_get_select_fd (SANE_Handle h, SANE_Int *fdp)
  * @@ Section 8 - Image processing functions
  */
 
-/* Look in image for likely upper and left paper edges, then rotate
- * image so that upper left corner of paper is upper left of image.
+/* Rotate image so that upper left corner of paper is upper left of
+ * image, using the skew found by find_deskew().
  * FIXME: should we do this before we binarize instead of after? */
 static SANE_Status
-buffer_deskew(struct scanner *s, int side)
+buffer_deskew(struct scanner *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
 
@@ -7539,28 +8321,14 @@ buffer_deskew(struct scanner *s, int side)
 
   DBG (10, "buffer_deskew: start\n");
 
-  ret = sane_get_parameters((SANE_Handle) s, &s->s_params);
-
-  /*only find skew on first image from a page, or if first image had error */
-  if(s->side == SIDE_FRONT || s->u.source == SOURCE_ADF_BACK || s->deskew_stat){
-
-    s->deskew_stat = sanei_magic_findSkew(
-      &s->s_params,s->buffers[side],s->u.dpi_x,s->u.dpi_y,
-      &s->deskew_vals[0],&s->deskew_vals[1],&s->deskew_slope);
-
-    if(s->deskew_stat){
-      DBG (5, "buffer_deskew: bad findSkew, bailing\n");
-      goto cleanup;
-    }
-  }
-  /* backside images can use a 'flipped' version of frontside data */
-  else{
-    s->deskew_slope *= -1;
-    s->deskew_vals[0] = s->s_params.pixels_per_line - s->deskew_vals[0];
+  if(s->deskew_stat[side]){
+    DBG (5, "buffer_deskew: bad findSkew, bailing\n");
+    goto cleanup;
   }
 
-  ret = sanei_magic_rotate(&s->s_params,s->buffers[side],
-    s->deskew_vals[0],s->deskew_vals[1],s->deskew_slope,bg_color);
+  ret = sanei_magic_rotate(params,s->buffers[side],
+    s->deskew_vals[side][0],s->deskew_vals[side][1],s->deskew_slope[side],
+    bg_color);
 
   if(ret){
     DBG(5,"buffer_deskew: rotate error: %d",ret);
@@ -7573,57 +8341,86 @@ buffer_deskew(struct scanner *s, int side)
   return ret;
 }
 
+/* Load deskew_vals and deskew_slope for the image in buffers[side].
+ * params may describe just the first part of the image, partial is set
+ * then, and the bottom edge of the page is not looked for. */
+static SANE_Status
+find_deskew(struct scanner *s, int side, SANE_Parameters * params, int partial)
+{
+  /*only find skew on first image from a page, or if first image had error */
+  if(side == SIDE_FRONT || s->u.source == SOURCE_ADF_BACK
+    || s->deskew_stat[SIDE_FRONT]){
+
+    if(partial){
+      s->deskew_stat[side] = sanei_magic_findSkewTop(
+        params,s->buffers[side],s->u.dpi_x,s->u.dpi_y,
+        &s->deskew_vals[side][0],&s->deskew_vals[side][1],
+        &s->deskew_slope[side]);
+    }
+    else{
+      s->deskew_stat[side] = sanei_magic_findSkew(
+        params,s->buffers[side],s->u.dpi_x,s->u.dpi_y,
+        &s->deskew_vals[side][0],&s->deskew_vals[side][1],
+        &s->deskew_slope[side]);
+    }
+
+    if(s->deskew_stat[side]){
+      DBG (5, "find_deskew: bad findSkew\n");
+      return s->deskew_stat[side];
+    }
+  }
+  /* backside images can use a 'flipped' version of frontside data */
+  else{
+    s->deskew_stat[side] = SANE_STATUS_GOOD;
+    s->deskew_slope[side] = -s->deskew_slope[SIDE_FRONT];
+    s->deskew_vals[side][0]
+      = params->pixels_per_line - s->deskew_vals[SIDE_FRONT][0];
+    s->deskew_vals[side][1] = s->deskew_vals[SIDE_FRONT][1];
+  }
+
+  return SANE_STATUS_GOOD;
+}
+
 /* Look in image for likely left/right/bottom paper edges, then crop
- * image to match. Does not attempt to rotate the image.
+ * image to match. Does not attempt to rotate the image. The new size
+ * is left in params, see buffer_apply(). Returns an error if the image
+ * was not cropped.
  * FIXME: should we do this before we binarize instead of after? */
 static SANE_Status
-buffer_crop(struct scanner *s, int side)
+buffer_crop(struct scanner *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
+  int crop_vals[4];
 
   DBG (10, "buffer_crop: start\n");
 
-  ret = sane_get_parameters((SANE_Handle) s, &s->s_params);
-
   ret = sanei_magic_findEdges(
-    &s->s_params,s->buffers[side],s->u.dpi_x,s->u.dpi_y,
-    &s->crop_vals[0],&s->crop_vals[1],&s->crop_vals[2],&s->crop_vals[3]);
+    params,s->buffers[side],s->u.dpi_x,s->u.dpi_y,
+    &crop_vals[0],&crop_vals[1],&crop_vals[2],&crop_vals[3]);
 
   if(ret){
     DBG (5, "buffer_crop: bad edges, bailing\n");
-    ret = SANE_STATUS_GOOD;
     goto cleanup;
   }
 
   DBG (15, "buffer_crop: t:%d b:%d l:%d r:%d\n",
-    s->crop_vals[0],s->crop_vals[1],s->crop_vals[2],s->crop_vals[3]);
+    crop_vals[0],crop_vals[1],crop_vals[2],crop_vals[3]);
 
   /* if we will later binarize this image, make sure the width
    * is a multiple of 8 pixels, by adjusting the right side */
   if ( must_downsample(s) && s->u.mode < MODE_GRAYSCALE ){
-    s->crop_vals[3] -= (s->crop_vals[3]-s->crop_vals[2]) % 8;
+    crop_vals[3] -= (crop_vals[3]-crop_vals[2]) % 8;
   }
 
   /* now crop the image */
-  ret = sanei_magic_crop(&s->s_params,s->buffers[side],
-      s->crop_vals[0],s->crop_vals[1],s->crop_vals[2],s->crop_vals[3]);
+  ret = sanei_magic_crop(params,s->buffers[side],
+      crop_vals[0],crop_vals[1],crop_vals[2],crop_vals[3]);
 
   if(ret){
     DBG (5, "buffer_crop: bad crop, bailing\n");
-    ret = SANE_STATUS_GOOD;
     goto cleanup;
   }
 
-  /* need to update user with new size */
-  s->i.width = s->s_params.pixels_per_line;
-  s->i.height = s->s_params.lines;
-  s->i.Bpl = s->s_params.bytes_per_line;
-
-  /* update image size counter to new, smaller size */
-  s->i.bytes_tot[side] = s->s_params.lines * s->s_params.bytes_per_line;
-  s->i.bytes_sent[side] = s->i.bytes_tot[side];
-  s->u.bytes_sent[side] = 0;
-
   cleanup:
   DBG (10, "buffer_crop: finish\n");
   return ret;
@@ -7633,15 +8430,13 @@ buffer_crop(struct scanner *s, int side)
  * Replace the spots with the average color of the surrounding pixels.
  * FIXME: should we do this before we binarize instead of after? */
 static SANE_Status
-buffer_despeck(struct scanner *s, int side)
+buffer_despeck(struct scanner *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
 
   DBG (10, "buffer_despeck: start\n");
 
-  ret = sane_get_parameters((SANE_Handle) s, &s->s_params);
-
-  ret = sanei_magic_despeck(&s->s_params,s->buffers[side],s->swdespeck);
+  ret = sanei_magic_despeck(params,s->buffers[side],s->swdespeck);
   if(ret){
     DBG (5, "buffer_despeck: bad despeck, bailing\n");
     ret = SANE_STATUS_GOOD;
@@ -7655,16 +8450,14 @@ buffer_despeck(struct scanner *s, int side)
 
 /* Look if image has too few dark pixels.*/
 static int
-buffer_isblank(struct scanner *s, int side)
+buffer_isblank(struct scanner *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
   int status = 0;
 
   DBG (10, "buffer_isblank: start\n");
 
-  ret = sane_get_parameters((SANE_Handle) s, &s->s_params);
-
-  ret = sanei_magic_isBlank2(&s->s_params, s->buffers[side],
+  ret = sanei_magic_isBlank2(params, s->buffers[side],
     s->u.dpi_x, s->u.dpi_y, s->swskip);
 
   if(ret == SANE_STATUS_NO_DOCS){
@@ -7679,6 +8472,211 @@ buffer_isblank(struct scanner *s, int side)
   return status;
 }
 
+/* Adjust a fully buffered image as required, once find_deskew() has
+ * run. Only changes buffers[side] and params, so it can run in a
+ * thread for one side while the other is sent. Sets cropped if the
+ * size changed, returns 1 if the image is blank and should be skipped. */
+static int
+buffer_process(struct scanner *s, int side, SANE_Parameters * params,
+  int * cropped)
+{
+  *cropped = 0;
+
+  if(s->swdeskew){
+    buffer_deskew(s,side,params);
+  }
+  if(s->swcrop && !buffer_crop(s,side,params)){
+    *cropped = 1;
+  }
+  if(s->swdespeck){
+    buffer_despeck(s,side,params);
+  }
+  if(s->swskip){
+    return buffer_isblank(s,side,params);
+  }
+  return 0;
+}
+
+/* tell the user about the new size of a cropped image */
+static void
+buffer_apply(struct scanner *s, int side, SANE_Parameters * params)
+{
+
+  s->i.width = params->pixels_per_line;
+  s->i.height = params->lines;
+  s->i.Bpl = params->bytes_per_line;
+
+  /* update image size counter to new, smaller size */
+  s->i.bytes_tot[side] = params->lines * params->bytes_per_line;
+  s->i.bytes_sent[side] = s->i.bytes_tot[side];
+  s->u.bytes_sent[side] = 0;
+}
+
+#ifdef USE_PTHREAD
+static void *
+post_thread(void *arg)
+{
+  struct scanner *s = arg;
+
+  DBG (10, "post_thread: start\n");
+
+  if(s->swdeskew){
+    find_deskew(s,SIDE_BACK,&s->post_params,0);
+  }
+  s->post_blank = buffer_process(s,SIDE_BACK,&s->post_params,
+    &s->post_cropped);
+
+  DBG (10, "post_thread: finish\n");
+  return NULL;
+}
+#endif
+
+/* Called when the front side of a fully buffered duplex page has been
+ * read, which in duplex mode means the back side has been read too.
+ * Starts processing the back side, so that it is done by the time the
+ * user has read the front side. Without threads, or if the thread
+ * cannot be started, the back side is processed when it is started. */
+static SANE_Status
+post_start(struct scanner *s)
+{
+#ifdef USE_PTHREAD
+  DBG (10, "post_start: start\n");
+
+  if(s->post_done || !s->s.eof[SIDE_BACK]){
+    return SANE_STATUS_GOOD;
+  }
+
+  /* both sides have the same size until they are cropped */
+  s->post_params = s->s_params;
+
+  if(pthread_create(&s->post_thread, NULL, post_thread, s)){
+    DBG (5, "post_start: cannot start thread, processing later\n");
+    return SANE_STATUS_GOOD;
+  }
+  s->post_running = 1;
+  s->post_done = 1;
+
+  DBG (10, "post_start: finish\n");
+#else
+  (void) s;
+#endif
+  return SANE_STATUS_GOOD;
+}
+
+/* Wait for the back side processing started by post_start(), the
+ * results stay in post_params and post_blank until the back side is
+ * started. Must be called before anything else touches the scanner
+ * struct or the image buffers. */
+static void
+post_wait(struct scanner *s)
+{
+  if(!s->post_running){
+    return;
+  }
+
+  DBG (10, "post_wait: waiting\n");
+#ifdef USE_PTHREAD
+  pthread_join(s->post_thread, NULL);
+#endif
+  s->post_running = 0;
+}
+
+/* Called while the start of the image is being read. Finds the skew
+ * once the first inch has arrived, and checks for a block that is not
+ * blank as lines get deskewed. Returns 1 once sending can start, or 0
+ * if the whole image has been read and it is blank. */
+static int
+stream_ready(struct scanner *s, int side)
+{
+  SANE_Parameters params;
+  int lines = s->i.bytes_sent[side] / s->i.Bpl;
+
+  sane_get_parameters((SANE_Handle) s, &s->s_params);
+  params = s->s_params;
+
+  if(s->s.eof[side]){
+    lines = s->i.height;
+  }
+
+  if(s->swdeskew && !s->stream_skew[side]){
+
+    if(lines < s->u.dpi_y && !s->s.eof[side]){
+      return 0;
+    }
+
+    s->stream_skew[side] = 1;
+
+    params.lines = lines;
+    if(find_deskew(s,side,&params,lines < s->i.height)){
+      DBG (5, "stream_ready: bad findSkew, not rotating\n");
+    }
+    else if(sanei_magic_rotateStart(&s->s_params,s->buffers[side],
+      s->deskew_vals[side][0],s->deskew_vals[side][1],s->deskew_slope[side],
+      calc_bg_color(s),SANE_FALSE,&s->stream_rot[side])
+    ){
+      DBG (5, "stream_ready: cannot rotate\n");
+    }
+
+    stream_rotate(s,side);
+  }
+
+  if(s->swskip && !s->stream_ink[side]){
+
+    if(s->stream_rot[side]){
+      lines = s->stream_lines[side];
+    }
+
+    /* only look again once another row of 1/2 inch blocks is ready */
+    if(lines < s->stream_checked[side] + s->u.dpi_y/2
+      && lines < s->i.height){
+      return 0;
+    }
+    s->stream_checked[side] = lines;
+
+    params.lines = lines;
+    if(sanei_magic_isBlank2(&params, s->buffers[side],
+      s->u.dpi_x, s->u.dpi_y, s->swskip) != SANE_STATUS_NO_DOCS
+    ){
+      s->stream_ink[side] = 1;
+    }
+    else{
+      if(lines >= s->i.height)
+        DBG (5, "stream_ready: blank!\n");
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* deskew as many lines as have arrived */
+static void
+stream_rotate(struct scanner *s, int side)
+{
+  int lines = s->i.bytes_sent[side] / s->i.Bpl;
+
+  if(!s->stream_rot[side]){
+    return;
+  }
+
+  if(s->s.eof[side]){
+    lines = s->i.height;
+  }
+
+  s->stream_lines[side] = sanei_magic_rotateLines(s->stream_rot[side], lines);
+}
+
+static void
+stream_reset(struct scanner *s, int side)
+{
+  sanei_magic_rotateFinish(s->stream_rot[side]);
+  s->stream_rot[side] = NULL;
+  s->stream_lines[side] = 0;
+  s->stream_skew[side] = 0;
+  s->stream_ink[side] = 0;
+  s->stream_checked[side] = 0;
+}
+
 /* certain options require the entire image to
  * be collected from the scanner before we can
  * tell the user the size of the image. */
@@ -7687,8 +8685,25 @@ must_fully_buffer(struct scanner *s)
 {
 
   if(
-    (s->swdeskew || s->swdespeck || s->swcrop)
+    (s->swdespeck || s->swcrop)
+    && s->s.format != SANE_FRAME_JPEG
+  ){
+    return 1;
+  }
+
+  return 0;
+}
+
+/* deskew and blank page detection only need to see the start
+ * of the image before we can send any of it to the user. */
+static int
+must_stream_buffer(struct scanner *s)
+{
+
+  if(
+    (s->swdeskew || s->swskip)
     && s->s.format != SANE_FRAME_JPEG
+    && !must_fully_buffer(s)
   ){
     return 1;
   }
@@ -105,6 +105,37 @@ struct img_params
 
 };
 
+/* decided once per scan by build_line_plan(), used by copy_line() when the
+ * scanner can't deliver the user's mode, resolution or width */
+struct line_plan
+{
+  /* the params the plan was built for */
+  int s_mode;
+  int s_width;
+  int s_dpi_x;
+  int i_mode;
+  int i_width;
+  int i_Bpl;
+  int i_dpi_x;
+  int offset;
+  int threshold;
+  int dropout[2];
+
+  /* how each side's line is loaded, PLAN_LOAD_* */
+  int load[2];
+
+  /* line pixel of each output pixel */
+  int * index;
+  int count;
+  int linear;
+
+  /* sum of the three channels of a pixel to gray level or lineart bit */
+  unsigned char lut[3*255+1];
+
+  /* one value per scanned pixel */
+  unsigned char * line;
+};
+
 struct scanner
 {
   /* --------------------------------------------------------------------- */
@@ -116,6 +147,7 @@ struct scanner
   /* --------------------------------------------------------------------- */
   /* immutable values which are set during reading of config file.         */
   int buffer_size;
+  int read_ahead;               /* megabytes for sheets read ahead */
   int connection;               /* hardware interface type */
 
   /* --------------------------------------------------------------------- */
@@ -302,11 +334,17 @@ struct scanner
 
   /* --------------------------------------------------------------------- */
   /* values used by the software enhancment code (deskew, crop, etc)       */
-  SANE_Status deskew_stat;
-  int deskew_vals[2];
-  double deskew_slope;
-
-  int crop_vals[4];
+  /* per side, the back side can reuse the front side values */
+  SANE_Status deskew_stat[2];
+  int deskew_vals[2][2];
+  double deskew_slope[2];
+
+  /* deskew and blank detection done while the image is read */
+  SANEI_Magic_Rotator * stream_rot[2];
+  int stream_lines[2];
+  int stream_skew[2];
+  int stream_ink[2];
+  int stream_checked[2];
 
   /* this is defined in sane spec as a struct containing:
         SANE_Frame format;
@@ -318,6 +356,21 @@ struct scanner
   */
   SANE_Parameters s_params;
 
+  /* the back side of a fully buffered duplex page is processed in a
+   * thread while the front side is sent to the user */
+  int post_running;
+  int post_done;
+  int post_blank;
+  int post_cropped;
+  SANE_Parameters post_params;
+#ifdef USE_PTHREAD
+  pthread_t post_thread;
+#endif
+
+  /* following sheets of an adf batch read by a thread, see read_ahead_start */
+  struct read_ahead * ahead;
+  int ahead_sheet;              /* the current sheet comes from the thread */
+
   /* --------------------------------------------------------------------- */
   /* values which are set by calibration functions                         */
   int c_res;
@@ -345,6 +398,9 @@ struct scanner
 
   unsigned char * buffers[2];
 
+  /* how copy_line() converts the lines of a 'stupid' scan */
+  struct line_plan plan;
+
   /* --------------------------------------------------------------------- */
   /* values used by the command and data sending functions (scsi/usb)      */
   int fd;                      /* The scanner device file descriptor.      */
@@ -431,6 +487,13 @@ enum {
  COLOR_EN_BLUE
 };
 
+/* how copy_line() loads a line, the PLAN_LOAD_SUM ones are
+ * PLAN_LOAD_SUM + dropout color */
+#define PLAN_LOAD_NONE 0
+#define PLAN_LOAD_GRAY 1
+#define PLAN_LOAD_BITS 2
+#define PLAN_LOAD_SUM 3
+
 /* these are same as scsi data to make code easier */
 #define COLOR_WHITE 1
 #define COLOR_BLACK 2
@@ -578,22 +641,43 @@ static SANE_Status start_scan (struct scanner *s, int type);
 
 static SANE_Status check_for_cancel(struct scanner *s);
 
+static SANE_Status read_block(struct scanner *s);
 static SANE_Status read_from_scanner(struct scanner *s, int side, int exact);
 static SANE_Status read_from_scanner_duplex(struct scanner *s, int exact);
 
 static SANE_Status copy_simplex(struct scanner *s, unsigned char * buf, int len, int side);
 static SANE_Status copy_duplex(struct scanner *s, unsigned char * buf, int len);
 static SANE_Status copy_line(struct scanner *s, unsigned char * buf, int side);
+static int line_plan_valid(struct scanner *s);
+static int line_plan_offset(struct scanner *s);
+static SANE_Status build_line_plan(struct scanner *s);
+static void free_line_plan(struct scanner *s);
 static SANE_Status fill_image(struct scanner *s,int side);
 
 static int must_downsample (struct scanner *s);
 static int must_fully_buffer (struct scanner *s);
+static int must_stream_buffer (struct scanner *s);
 static unsigned char calc_bg_color(struct scanner *s);
 
-static SANE_Status buffer_despeck(struct scanner *s, int side);
-static SANE_Status buffer_deskew(struct scanner *s, int side);
-static SANE_Status buffer_crop(struct scanner *s, int side);
-static int buffer_isblank(struct scanner *s, int side);
+static SANE_Status buffer_despeck(struct scanner *s, int side, SANE_Parameters * params);
+static SANE_Status buffer_deskew(struct scanner *s, int side, SANE_Parameters * params);
+static SANE_Status find_deskew(struct scanner *s, int side, SANE_Parameters * params,
+  int partial);
+static SANE_Status buffer_crop(struct scanner *s, int side, SANE_Parameters * params);
+static int buffer_isblank(struct scanner *s, int side, SANE_Parameters * params);
+static int buffer_process(struct scanner *s, int side, SANE_Parameters * params, int * cropped);
+static void buffer_apply(struct scanner *s, int side, SANE_Parameters * params);
+static SANE_Status post_start(struct scanner *s);
+static void post_wait(struct scanner *s);
+
+static void read_ahead_start(struct scanner *s);
+static void read_ahead_stop(struct scanner *s);
+static int read_ahead_get(struct scanner *s, SANE_Status * ret);
+static SANE_Status read_ahead_sync(struct scanner *s);
+
+static int stream_ready(struct scanner *s, int side);
+static void stream_rotate(struct scanner *s, int side);
+static void stream_reset(struct scanner *s, int side);
 
 static SANE_Status load_lut (unsigned char * lut, int in_bits, int out_bits,
   int out_min, int out_max, int slope, int offset);
@@ -638,8 +638,8 @@ sane_open (SANE_String_Const name, SANE_Handle *h)
 			DBG(1, "sane_open: WARNING: adjust_gamma returned "
 					"%d!\n", tmp);
 
-		DBG(10, "sane_open: after adjust_gamma Status = %i\n",
-				sanei_canon_pp_check_status(cs->params.port));
+		tmp = sanei_canon_pp_check_status(cs->params.port);
+		DBG(10, "sane_open: after adjust_gamma Status = %i\n", tmp);
 	}
 
 
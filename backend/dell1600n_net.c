@@ -71,7 +71,7 @@
 #include <netinet/in.h>
 #include <netdb.h>
 
-#include <jpeglib.h>
+#include "../include/sane/sanei_jpeg.h"
 #include <tiffio.h>
 
 /* OS/2... */
@@ -147,14 +147,6 @@ struct PageInfo
   int m_bytesRemaining;        /* number of bytes not yet passed to SANE client */
 };
 
-/* struct for in-memory jpeg decompression */
-struct JpegDataDecompState
-{
-  struct jpeg_decompress_struct m_cinfo;	/* base struct */
-  unsigned char *m_pData;	/* data pointer */
-  unsigned int m_bytesRemaining;	/* amount of unprocessed data */
-};
-
 /* initial ComBuf allocation */
 #define INITIAL_COM_BUF_SIZE 1024
 
@@ -220,12 +212,6 @@ static int ProcessTcpResponse (struct ScannerState *pState,
 /* Process the data from a single scanned page, \return 0 in success, >0 otherwise */
 static int ProcessPageData (struct ScannerState *pState);
 
-/* Libjpeg decompression interface */
-static void JpegDecompInitSource (j_decompress_ptr cinfo);
-static boolean JpegDecompFillInputBuffer (j_decompress_ptr cinfo);
-static void JpegDecompSkipInputData (j_decompress_ptr cinfo, long numBytes);
-static void JpegDecompTermSource (j_decompress_ptr cinfo);
-
 /***********************************************************
  * GLOBALS
  ***********************************************************/
@@ -1785,14 +1771,12 @@ ProcessPageData (struct ScannerState *pState)
 
   FILE *fTmp;
   int fdTmp;
-  struct jpeg_source_mgr jpegSrcMgr;
-  struct JpegDataDecompState jpegCinfo;
-  struct jpeg_error_mgr jpegErr;
-  int numPixels, iPixel, width, height, scanLineSize, imageBytes;
+  SANE_Parameters jpegParams;
+  size_t imageOffset;
+  int numPixels, iPixel, width, height, imageBytes;
   int ret = 0;
   struct PageInfo pageInfo;
 
-  JSAMPLE *pJpegLine = NULL;
   uint32 *pTiffRgba = NULL;
   unsigned char *pOut;
   char tiffErrBuf[1024];
@@ -1813,60 +1797,45 @@ ProcessPageData (struct ScannerState *pState)
       /* decode as JPEG if appropriate */
       {
 
-        jpegSrcMgr.resync_to_restart = jpeg_resync_to_restart;
-        jpegSrcMgr.init_source = JpegDecompInitSource;
-        jpegSrcMgr.fill_input_buffer = JpegDecompFillInputBuffer;
-        jpegSrcMgr.skip_input_data = JpegDecompSkipInputData;
-        jpegSrcMgr.term_source = JpegDecompTermSource;
-
-        jpegCinfo.m_cinfo.err = jpeg_std_error (&jpegErr);
-        jpeg_create_decompress (&jpegCinfo.m_cinfo);
-        jpegCinfo.m_cinfo.src = &jpegSrcMgr;
-        jpegCinfo.m_bytesRemaining = pState->m_buf.m_used;
-        jpegCinfo.m_pData = pState->m_buf.m_pBuf;
-
-        jpeg_read_header (&jpegCinfo.m_cinfo, TRUE);
-        jpeg_start_decompress (&jpegCinfo.m_cinfo);
+        if (sanei_jpeg_get_params (pState->m_buf.m_pBuf, pState->m_buf.m_used,
+                                   &jpegParams) != SANE_STATUS_GOOD)
+          {
+            DBG (1, "ProcessPageData: cannot read JPEG header\n");
+            return 1;
+          } /* if */
 
-        /* allocate space for a single scanline */
-        scanLineSize = jpegCinfo.m_cinfo.output_width
-          * jpegCinfo.m_cinfo.output_components;
+        imageBytes = jpegParams.bytes_per_line * jpegParams.lines;
         DBG (1, "ProcessPageData: image dimensions: %d x %d, line size: %d\n",
-        jpegCinfo.m_cinfo.output_width,
-        jpegCinfo.m_cinfo.output_height, scanLineSize);
+        jpegParams.pixels_per_line, jpegParams.lines,
+        jpegParams.bytes_per_line);
 
-        pJpegLine = calloc (scanLineSize, sizeof (JSAMPLE));
-        if (!pJpegLine)
+        /* make room for the whole page */
+        imageOffset = pState->m_imageData.m_used;
+        if (AppendToComBuf (&pState->m_imageData, NULL, imageBytes))
           {
             DBG (1, "ProcessPageData: memory allocation error\n");
-            ret = 1;
-            goto JPEG_CLEANUP;
+            return 1;
           } /* if */
 
         /* note dimensions - may be different from those previously reported */
-        pState->m_pixelWidth = htonl (jpegCinfo.m_cinfo.output_width);
-        pState->m_pixelHeight = htonl (jpegCinfo.m_cinfo.output_height);
-
-        /* decode scanlines */
-        while (jpegCinfo.m_cinfo.output_scanline
-               < jpegCinfo.m_cinfo.output_height)
+        pState->m_pixelWidth = htonl (jpegParams.pixels_per_line);
+        pState->m_pixelHeight = htonl (jpegParams.lines);
+
+        /* decode straight into the image data, in bands if the scanner
+           put restart markers in the page */
+        if (sanei_jpeg_decode (pState->m_buf.m_pBuf, pState->m_buf.m_used,
+                               pState->m_imageData.m_pBuf + imageOffset,
+                               jpegParams.bytes_per_line, 0)
+            != SANE_STATUS_GOOD)
           {
-            DBG (20, "Reading scanline %d of %d\n",
-                 jpegCinfo.m_cinfo.output_scanline,
-                 jpegCinfo.m_cinfo.output_height);
-
-            /* read scanline */
-            jpeg_read_scanlines (&jpegCinfo.m_cinfo, &pJpegLine, 1);
-
-            /* append to output buffer */
-            ret |= AppendToComBuf (&pState->m_imageData,
-                                   pJpegLine, scanLineSize);
-
-          } /* while */
+            DBG (1, "ProcessPageData: JPEG decoding error\n");
+            pState->m_imageData.m_used = imageOffset;
+            return 1;
+          } /* if */
 
         /* update info for this page */
-        pageInfo.m_width = jpegCinfo.m_cinfo.output_width;
-        pageInfo.m_height = jpegCinfo.m_cinfo.output_height;
+        pageInfo.m_width = jpegParams.pixels_per_line;
+        pageInfo.m_height = jpegParams.lines;
         pageInfo.m_totalSize = pageInfo.m_width * pageInfo.m_height * 3;
         pageInfo.m_bytesRemaining = pageInfo.m_totalSize;
 
@@ -1876,13 +1845,6 @@ ProcessPageData (struct ScannerState *pState)
         ret |= AppendToComBuf( & pState->m_pageInfo, (unsigned char*)& pageInfo, sizeof( pageInfo ) );
         ++( pState->m_numPages );
 
-      JPEG_CLEANUP:
-        jpeg_finish_decompress (&jpegCinfo.m_cinfo);
-        jpeg_destroy_decompress (&jpegCinfo.m_cinfo);
-
-        if (pJpegLine)
-          free (pJpegLine);
-
         return ret;
       } /* case JPEG */
 
@@ -1995,74 +1957,3 @@ ProcessPageData (struct ScannerState *pState)
 } /* ProcessPageData */
 
 /***********************************************************/
-
-void
-JpegDecompInitSource (j_decompress_ptr cinfo)
-/* Libjpeg decompression interface */
-{
-  cinfo->src->bytes_in_buffer = 0;
-
-} /* JpegDecompInitSource */
-
-/***********************************************************/
-
-boolean
-JpegDecompFillInputBuffer (j_decompress_ptr cinfo)
-/* Libjpeg decompression interface */
-{
-  struct JpegDataDecompState *pState = (struct JpegDataDecompState *) cinfo;
-  static const unsigned char eoiByte[] = {
-    0xFF, JPEG_EOI
-  };
-
-  DBG (10, "JpegDecompFillInputBuffer: bytes remaining: %d\n",
-       pState->m_bytesRemaining);
-
-  if (!pState->m_bytesRemaining)
-    {
-
-      /* no input data available so return dummy data */
-      cinfo->src->bytes_in_buffer = 2;
-      cinfo->src->next_input_byte = (const JOCTET *) eoiByte;
-
-    }
-  else
-    {
-
-      /* point to data */
-      cinfo->src->bytes_in_buffer = pState->m_bytesRemaining;
-      cinfo->src->next_input_byte = (const JOCTET *) pState->m_pData;
-
-      /* note that data is now gone */
-      pState->m_bytesRemaining = 0;
-
-    } /* if */
-
-  return TRUE;
-
-} /* JpegDecompFillInputBuffer */
-
-/***********************************************************/
-
-void
-JpegDecompSkipInputData (j_decompress_ptr cinfo, long numBytes)
-/* Libjpeg decompression interface */
-{
-  DBG (10, "JpegDecompSkipInputData: skipping %ld bytes\n", numBytes);
-
-  cinfo->src->bytes_in_buffer -= numBytes;
-  cinfo->src->next_input_byte += numBytes;
-
-} /* JpegDecompSkipInputData */
-
-/***********************************************************/
-
-void
-JpegDecompTermSource (j_decompress_ptr __sane_unused__ cinfo)
-/* Libjpeg decompression interface */
-{
-  /* nothing to do */
-
-} /* JpegDecompTermSource */
-
-/***********************************************************/
@@ -198,8 +198,10 @@
 
 #include "../include/sane/sanei_backend.h"
 #include "../include/sane/sanei_usb.h"
+#include "../include/sane/sanei_perf.h"
 #include "../include/sane/saneopts.h"
 #include "../include/sane/sanei_config.h"
+#include "../include/sane/sanei_binarize.h"
 
 #include "epjitsu.h"
 #include "epjitsu-cmd.h"
@@ -2456,6 +2458,16 @@ sane_start (SANE_Handle handle)
             return ret;
         }
 
+        /* the lut is only used when there is a threshold curve */
+        sanei_binarize_free(&s->dt_binarize);
+        ret = sanei_binarize_init(&s->dt_binarize, s->resolution,
+            s->threshold, s->threshold_curve ? s->dt_lut : NULL, 0);
+        if (ret != SANE_STATUS_GOOD) {
+            DBG (5, "sane_start: ERROR: failed to init binarize\n");
+            sane_cancel((SANE_Handle)s);
+            return ret;
+        }
+
         ret = coarsecal(s);
         if (ret != SANE_STATUS_GOOD) {
             DBG (5, "sane_start: ERROR: failed to coarsecal\n");
@@ -4128,6 +4140,50 @@ six5 (struct scanner *s)
   return ret;
 }
 
+/* builds the column map for descramble_raw(), each output pixel is the */
+/* average of a run of input pixels. the runs are found the same way the */
+/* pixels used to be grouped while descrambling, once per block instead */
+/* of once per row. heads are the read heads side by side in a row, bpp */
+/* is the distance in bytes between two pixels of a head */
+static int
+descramble_map(struct transfer * tp, int heads, int bpp,
+  struct descramble_run * runs)
+{
+    int count = 0;
+    int curr_col = 0;
+    int i, k;
+
+    for (i = 0; i < heads; i++){                  /* read head */
+      int first = 0, ppc = 0;
+
+      for (k = 0; k <= tp->plane_width; k++){    /* column (x) within the read head */
+        int this_col = (k+i*tp->plane_width)*tp->image->x_res/tp->x_res;
+
+        /* going to change output pixel, store the run */
+        if(ppc && curr_col != this_col){
+          runs[count].off = first*bpp + i;
+          runs[count].n = ppc;
+          /* n is small, (sum * weight) >> 24 == sum / n for all 8 bit sums */
+          runs[count].weight = ((1 << 24) + ppc - 1) / ppc;
+          count++;
+
+          ppc = 0;
+          curr_col = this_col;
+        }
+
+        if(k == tp->plane_width || this_col >= tp->image->width_pix){
+          break;
+        }
+
+        if(!ppc)
+          first = k;
+        ppc++;
+      }
+    }
+
+    return count;
+}
+
 /* de-scrambles the raw data from the scanner into the image buffer */
 /* the output image might be lower dpi than input image, so we scale horizontally */
 /* if the input image is mirrored left to right, we do not correct it here */
@@ -4138,6 +4194,9 @@ descramble_raw(struct scanner *s, struct transfer * tp)
     SANE_Status ret = SANE_STATUS_GOOD;
     unsigned char *p_out = tp->image->buffer;
     int height = tp->total_bytes / tp->line_stride;
+    struct descramble_run *runs;
+    int sides, heads, bpp, count;
+    int r_off, g_off, b_off;
     int i, j, k;
 
     /* raw gray data handled in another function */
@@ -4147,135 +4206,59 @@ descramble_raw(struct scanner *s, struct transfer * tp)
 
     DBG(15, "descramble_raw: start\n");
 
+    /* S300 and S1300i: both sides interleaved in one row of rgb planes */
     if (s->model == MODEL_S300 || s->model == MODEL_S1300i) {
-      for (i = 0; i < 2; i++){                   /* page, front/back */
-        for (j = 0; j < height; j++){             /* row (y)*/
-          int curr_col = 0;
-          int r=0, g=0, b=0, ppc=0;
-
-          for (k = 0; k <= tp->plane_width; k++){  /* column (x) */
-            int this_col = k*tp->image->x_res/tp->x_res;
-
-            /* going to change output pixel, dump rgb and reset */
-            if(ppc && curr_col != this_col){
-              *p_out = r/ppc;
-              p_out++;
-
-              *p_out = g/ppc;
-              p_out++;
-
-              *p_out = b/ppc;
-              p_out++;
-
-              r = g = b = ppc = 0;
-
-              curr_col = this_col;
-            }
-
-            if(k == tp->plane_width || this_col >= tp->image->width_pix){
-              break;
-            }
-
-            /*red is first*/
-            r += tp->raw_data[j*tp->line_stride + k*3 + i];
-
-            /*green is second*/
-            g += tp->raw_data[j*tp->line_stride + tp->plane_stride + k*3 + i];
-
-            /*blue is third*/
-            b += tp->raw_data[j*tp->line_stride + 2*tp->plane_stride + k*3 + i];
-
-            ppc++;
-          }
-        }
-      }
+      sides = 2; heads = 1; bpp = 3;
+      r_off = 0; g_off = tp->plane_stride; b_off = 2*tp->plane_stride;
     }
+    /* S1100: one side, bgr planes */
     else if (s->model == MODEL_S1100){
-      for (j = 0; j < height; j++){             /* row (y)*/
-        int curr_col = 0;
-        int r=0, g=0, b=0, ppc=0;
-
-        for (k = 0; k <= tp->plane_width; k++){  /* column (x) */
-          int this_col = k*tp->image->x_res/tp->x_res;
-
-          /* going to change output pixel, dump rgb and reset */
-          if(ppc && curr_col != this_col){
-            *p_out = r/ppc;
-            p_out++;
+      sides = 1; heads = 1; bpp = 1;
+      r_off = tp->plane_stride; g_off = 2*tp->plane_stride; b_off = 0;
+    }
+    /* FI-60F and FI-65F: three read heads interleaved in one row of rgb planes */
+    else {
+      sides = 1; heads = 3; bpp = 3;
+      r_off = 0; g_off = tp->plane_stride; b_off = 2*tp->plane_stride;
+    }
 
-            *p_out = g/ppc;
-            p_out++;
+    runs = malloc((heads * tp->plane_width + 1) * sizeof(*runs));
+    if(!runs){
+      DBG(5, "descramble_raw: no mem\n");
+      return SANE_STATUS_NO_MEM;
+    }
+    count = descramble_map(tp, heads, bpp, runs);
 
-            *p_out = b/ppc;
-            p_out++;
+    for (i = 0; i < sides; i++){                 /* page, front/back */
+      for (j = 0; j < height; j++){               /* row (y)*/
+        const unsigned char *row = tp->raw_data + j*tp->line_stride + i;
 
-            r = g = b = ppc = 0;
+        for (k = 0; k < count; k++){              /* output column (x) */
+          const unsigned char *p_in = row + runs[k].off;
+          unsigned int r, g, b;
+          int n;
 
-            curr_col = this_col;
+          if(runs[k].n == 1){
+            *p_out++ = p_in[r_off];
+            *p_out++ = p_in[g_off];
+            *p_out++ = p_in[b_off];
+            continue;
           }
 
-          if(k == tp->plane_width || this_col >= tp->image->width_pix){
-            break;
+          r = g = b = 0;
+          for (n = 0; n < runs[k].n; n++, p_in += bpp){
+            r += p_in[r_off];
+            g += p_in[g_off];
+            b += p_in[b_off];
           }
-
-          /*red is second*/
-          r += tp->raw_data[j*tp->line_stride + tp->plane_stride + k];
-
-          /*green is third*/
-          g += tp->raw_data[j*tp->line_stride + 2*tp->plane_stride + k];
-
-          /*blue is first*/
-          b += tp->raw_data[j*tp->line_stride + k];
-
-          ppc++;
+          *p_out++ = (r * runs[k].weight) >> 24;
+          *p_out++ = (g * runs[k].weight) >> 24;
+          *p_out++ = (b * runs[k].weight) >> 24;
         }
       }
     }
-    else { /* MODEL_FI60F or MODEL_FI65F */
-
-      for (j = 0; j < height; j++){             /* row (y)*/
-        int curr_col = 0;
-
-        for (i = 0; i < 3; i++){                /* read head */
-          int r=0, g=0, b=0, ppc=0;
 
-          for (k = 0; k <= tp->plane_width; k++){  /* column (x) within the read head */
-            int this_col = (k+i*tp->plane_width)*tp->image->x_res/tp->x_res;
-
-            /* going to change output pixel, dump rgb and reset */
-            if(ppc && curr_col != this_col){
-              *p_out = r/ppc;
-              p_out++;
-
-              *p_out = g/ppc;
-              p_out++;
-
-              *p_out = b/ppc;
-              p_out++;
-
-              r = g = b = ppc = 0;
-
-              curr_col = this_col;
-            }
-
-            if(k == tp->plane_width || this_col >= tp->image->width_pix){
-              break;
-            }
-
-            /*red is first*/
-            r += tp->raw_data[j*tp->line_stride + k*3 + i];
-
-            /*green is second*/
-            g += tp->raw_data[j*tp->line_stride + tp->plane_stride + k*3 + i];
-
-            /*blue is third*/
-            b += tp->raw_data[j*tp->line_stride + 2*tp->plane_stride + k*3 + i];
-
-            ppc++;
-          }
-        }
-      }
-    }
+    free(runs);
 
     DBG(15, "descramble_raw: finish %d\n", ret);
 
@@ -4296,20 +4279,33 @@ descramble_raw_gray(struct scanner *s, struct transfer * tp)
     DBG(15, "descramble_raw_gray: start\n");
 
     if (s->model == MODEL_FI60F || s->model == MODEL_FI65F) {
+      int *col_in = malloc(tp->image->width_pix * sizeof(int));
+
+      if(!col_in){
+        DBG(5, "descramble_raw_gray: no mem\n");
+        return SANE_STATUS_NO_MEM;
+      }
+
+      /* the input byte of each output pixel, same for all rows */
+      for (col_out = 0; col_out < tp->image->width_pix; col_out++){
+        int col = col_out * tp->x_res/tp->image->x_res;
+        int offset = col%tp->plane_width;
+        int step   = col/tp->plane_width;
+
+        col_in[col_out] = offset*3 + step;
+      }
+
       for (row = 0; row < height; row++){
 
         unsigned char *p_in = tp->raw_data + row * tp->line_stride;
         unsigned char *p_out = tp->image->buffer + row * tp->image->width_pix;
 
         for (col_out = 0; col_out < tp->image->width_pix; col_out++){
-          int col_in = col_out * tp->x_res/tp->image->x_res;
-          int offset = col_in%tp->plane_width;
-          int step   = col_in/tp->plane_width;
-
-          *p_out = *(p_in + offset*3 + step);
-          p_out++;
+          p_out[col_out] = p_in[col_in[col_out]];
         }
       }
+
+      free(col_in);
     }
 
     else{
@@ -4530,7 +4526,7 @@ copy_block_to_page(struct scanner *s,int side)
         /* for MODE_LINEART, binarize the gray line stored in the temp image buffer(dt) */
         /* bacause dt.width = page_width, we pass page_width */
         if (s->mode == MODE_LINEART)
-            binarize_line(s, lineStart, page_width);
+            sanei_binarize_line(&s->dt_binarize, s->dt.buffer, lineStart, page_width);
 
         page->bytes_scanned += page->image->width_bytes;
       }
@@ -4541,57 +4537,6 @@ copy_block_to_page(struct scanner *s,int side)
     return ret;
 }
 
-/*uses the threshold/threshold_curve to control binarization*/
-static SANE_Status
-binarize_line(struct scanner *s, unsigned char *lineOut, int width)
-{
-    SANE_Status ret = SANE_STATUS_GOOD;
-    int j, windowX, sum = 0;
-
-    /* ~1mm works best, but the window needs to have odd # of pixels */
-    windowX = 6 * s->resolution / 150;
-    if (!(windowX % 2)) windowX++;
-
-    /*second, prefill the sliding sum*/
-    for (j = 0; j < windowX; j++)
-        sum += s->dt.buffer[j];
-
-    /* third, walk the dt buffer, update the sliding sum, */
-    /* determine threshold, output bits */
-    for (j = 0; j < width; j++)
-    {
-        /*output image location*/
-        int offset = j % 8;
-        unsigned char mask = 0x80 >> offset;
-        int thresh = s->threshold;
-
-        /* move sum/update threshold only if there is a curve*/
-        if (s->threshold_curve)
-        {
-            int addCol  = j + windowX/2;
-            int dropCol = addCol - windowX;
-
-            if (dropCol >= 0 && addCol < width)
-            {
-                sum -= s->dt.buffer[dropCol];
-                sum += s->dt.buffer[addCol];
-            }
-            thresh = s->dt_lut[sum/windowX];
-        }
-
-        /*use average to lookup threshold*/
-        if (s->dt.buffer[j] > thresh)
-          *lineOut &= ~mask;     /* white */
-        else
-          *lineOut |= mask;      /* black */
-
-        if (offset == 7)
-            lineOut++;
-      }
-
-    return ret;
-}
-
 /*
  * @@ Section 4 - SANE cleanup functions
  */
@@ -4621,6 +4566,7 @@ sane_cancel (SANE_Handle handle)
   struct scanner * s = (struct scanner *) handle;
   DBG (10, "sane_cancel: start\n");
   s->started = 0;
+  sanei_perf_dump (STRINGIFY(BACKEND_NAME));
   DBG (10, "sane_cancel: finish\n");
 }
 
@@ -4739,6 +4685,7 @@ teardown_buffers(struct scanner *s)
         free(s->dt.buffer);
 	s->dt.buffer = NULL;
     }
+    sanei_binarize_free(&s->dt_binarize);
 
     /* image buffer to hold frontside data */
     if(s->front.buffer){
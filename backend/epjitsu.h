@@ -80,6 +80,14 @@ struct transfer {
   struct image * image;
 };
 
+/* one output pixel of descramble_raw(), the average of n input pixels */
+/* starting at byte off of a row, weight is 2^24/n rounded up */
+struct descramble_run {
+  int off;
+  int n;
+  unsigned int weight;
+};
+
 struct page {
   int bytes_total;
   int bytes_scanned;
@@ -240,6 +248,7 @@ struct scanner
   /* temporary buffers used by dynamic threshold code */
   struct image  dt;
   unsigned char dt_lut[256];
+  SANEI_Binarize dt_binarize;
 
   /* final-sized front image, always used */
   struct image front;
@@ -381,10 +390,11 @@ static SANE_Status set_window(struct scanner *s, int window);
 static SANE_Status scan(struct scanner *s);
 
 static SANE_Status read_from_scanner(struct scanner *s, struct transfer *tp);
+static int descramble_map(struct transfer * tp, int heads, int bpp,
+  struct descramble_run * runs);
 static SANE_Status descramble_raw_gray(struct scanner *s, struct transfer * tp);
 static SANE_Status descramble_raw(struct scanner *s, struct transfer * tp);
 static SANE_Status copy_block_to_page(struct scanner *s, int side);
-static SANE_Status binarize_line(struct scanner *s, unsigned char *lineOut, int width);
 
 static SANE_Status get_hardware_status (struct scanner *s);
 
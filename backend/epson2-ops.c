@@ -1879,7 +1879,8 @@ read_info_block(Epson_Scanner * s, EpsonDataRec * result)
 
 			sleep(5);	/* for the next attempt */
 
-			DBG(1, "retrying ESC G - %d\n", ++(s->retry_count));
+			++(s->retry_count);
+			DBG(1, "retrying ESC G - %d\n", s->retry_count);
 
 			params[0] = ESC;
 			params[1] = s->hw->cmd->start_scanning;
@@ -16,6 +16,10 @@
 #include "sane/config.h"
 
 #include <math.h>
+#include <setjmp.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "epsonds.h"
 #include "epsonds-jpeg.h"
@@ -23,19 +27,94 @@
 
 #define min(A,B) (((A)<(B)) ? (A) : (B))
 
+/* the compressed data is decoded as it arrives from the scanner, with
+ * libjpeg in suspending mode: when the data runs out the decoder backs
+ * up to the last whole MCU or marker, and is called again once
+ * sane_read got more. With
+ * threads the decoder runs on its own, so it keeps going while we wait
+ * for the next block, and sane_read only picks up the lines.
+ */
+
+/* first size of the decoder input buffer, it grows as needed */
+#define EDS_JPEG_BUFSIZE	(64 * 1024)
+
+/* decoded lines kept for the frontend */
+#define EDS_JPEG_LINES		32
+
+#ifdef USE_PTHREAD
+#define LOCK(src)	pthread_mutex_lock(&(src)->mu)
+#define UNLOCK(src)	pthread_mutex_unlock(&(src)->mu)
+#define SIGNAL(src)	pthread_cond_broadcast(&(src)->cond)
+#else
+#define LOCK(src)
+#define UNLOCK(src)
+#define SIGNAL(src)
+#endif
+
+enum {
+	EDS_JPEG_HEADER,
+	EDS_JPEG_START,
+	EDS_JPEG_SCANLINES
+};
+
 typedef struct
 {
 	struct jpeg_source_mgr pub;
 
 	epsonds_scanner *s;
-	JOCTET *buffer;
+	jmp_buf jmp;
 
-	SANE_Byte *linebuffer;
-	SANE_Int linebuffer_size;
-	SANE_Int linebuffer_index;
+	/* data given to libjpeg, from next_input_byte on it is
+	 * still needed if the decoder suspends */
+	JOCTET *buffer;
+	size_t size;
+	size_t skip;
+
+	/* data from the scanner, not yet given to libjpeg */
+	SANE_Byte *in;
+	size_t in_len, in_size;
+	SANE_Bool in_done;	/* the scanner sent the whole image */
+	SANE_Bool starved;	/* the decoder waits for data */
+
+	/* decoded lines */
+	ring_buffer out;
+	JSAMPROW line;
+	SANE_Int line_size;
+
+	int step;
+	SANE_Bool done;
+	SANE_Status status;	/* EOF or the error, once done */
+
+#ifdef USE_PTHREAD
+	pthread_t thread;
+	pthread_mutex_t mu;
+	pthread_cond_t cond;
+	SANE_Bool stop;
+#endif
 }
 epsonds_src_mgr;
 
+METHODDEF(void)
+jpeg_error_exit(j_common_ptr cinfo)
+{
+	epsonds_src_mgr *src = (epsonds_src_mgr *)cinfo->client_data;
+	char msg[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, msg);
+	DBG(1, "%s: %s\n", __func__, msg);
+
+	longjmp(src->jmp, 1);
+}
+
+METHODDEF(void)
+jpeg_output_message(j_common_ptr cinfo)
+{
+	char msg[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, msg);
+	DBG(5, "%s: %s\n", __func__, msg);
+}
+
 METHODDEF(void)
 jpeg_init_source(j_decompress_ptr __sane_unused__ cinfo)
 {
@@ -46,26 +125,32 @@ jpeg_term_source(j_decompress_ptr __sane_unused__ cinfo)
 {
 }
 
+/* never loads data itself, it would be lost if the decoder backs
+ * up later on: eds_jpeg_refill() does it before the next try
+ */
 METHODDEF(boolean)
 jpeg_fill_input_buffer(j_decompress_ptr cinfo)
 {
 	epsonds_src_mgr *src = (epsonds_src_mgr *)cinfo->src;
-	int avail, size;
 
-	/* read from the scanner or the ring buffer */
+	LOCK(src);
 
-	avail = eds_ring_avail(src->s->current);
-	if (avail == 0) {
+	if (!src->in_done || src->in_len) {
+		src->starved = 1;
+		SIGNAL(src);
+		UNLOCK(src);
 		return FALSE;
 	}
 
-	/* read from scanner if no data? */
-	size = min(1024, avail);
+	UNLOCK(src);
 
-	eds_ring_read(src->s->current, src->buffer, size);
+	/* the image is cut short, end it */
+	WARNMS(cinfo, JWRN_JPEG_EOF);
 
+	src->buffer[0] = (JOCTET) 0xFF;
+	src->buffer[1] = (JOCTET) JPEG_EOI;
 	src->pub.next_input_byte = src->buffer;
-	src->pub.bytes_in_buffer = size;
+	src->pub.bytes_in_buffer = 2;
 
 	return TRUE;
 }
@@ -75,16 +160,210 @@ jpeg_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
 {
 	epsonds_src_mgr *src = (epsonds_src_mgr *)cinfo->src;
 
-	if (num_bytes > 0) {
+	if (num_bytes <= 0)
+		return;
+
+	/* may not suspend here, the rest is skipped by the next fill */
+	if ((size_t) num_bytes > src->pub.bytes_in_buffer) {
+
+		src->skip = (size_t) num_bytes - src->pub.bytes_in_buffer;
+		src->pub.next_input_byte += src->pub.bytes_in_buffer;
+		src->pub.bytes_in_buffer = 0;
+
+		return;
+	}
+
+	src->pub.next_input_byte += (size_t) num_bytes;
+	src->pub.bytes_in_buffer -= (size_t) num_bytes;
+}
+
+/* moves the data from the scanner behind what the decoder still needs */
+static void
+eds_jpeg_refill(j_decompress_ptr cinfo)
+{
+	epsonds_src_mgr *src = (epsonds_src_mgr *)cinfo->src;
+	size_t left = src->pub.bytes_in_buffer;
+	size_t n;
+
+	LOCK(src);
+
+	/* what skip_input_data could not skip yet */
+	if (src->skip && src->in_len) {
+
+		n = min(src->skip, src->in_len);
+
+		memmove(src->in, src->in + n, src->in_len - n);
+		src->in_len -= n;
+		src->skip -= n;
+	}
+
+	if (src->in_len == 0) {
+		UNLOCK(src);
+		return;
+	}
 
-		while (num_bytes > (long)src->pub.bytes_in_buffer) {
-			num_bytes -= (long)src->pub.bytes_in_buffer;
-			jpeg_fill_input_buffer(cinfo);
+	if (left)
+		memmove(src->buffer, src->pub.next_input_byte, left);
+
+	if (left + src->in_len > src->size) {
+
+		JOCTET *buffer = realloc(src->buffer, left + src->in_len);
+		if (buffer == NULL) {
+			UNLOCK(src);
+			ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
 		}
 
-		src->pub.next_input_byte += (size_t) num_bytes;
-		src->pub.bytes_in_buffer -= (size_t) num_bytes;
+		src->buffer = buffer;
+		src->size = left + src->in_len;
+	}
+
+	memcpy(src->buffer + left, src->in, src->in_len);
+
+	src->pub.next_input_byte = src->buffer;
+	src->pub.bytes_in_buffer = left + src->in_len;
+
+	src->in_len = 0;
+	src->starved = 0;
+
+	UNLOCK(src);
+}
+
+static int
+eds_jpeg_done(epsonds_src_mgr *src, SANE_Status status)
+{
+	LOCK(src);
+	src->done = 1;
+	src->status = status;
+	SIGNAL(src);
+	UNLOCK(src);
+
+	return 1;
+}
+
+/* runs the decoder until it needs more data or room for the lines,
+ * returns non zero once the image is decoded or broken
+ */
+static int
+eds_jpeg_decode(epsonds_src_mgr *src)
+{
+	epsonds_scanner *s = src->s;
+	j_decompress_ptr cinfo = &s->jpeg_cinfo;
+	SANE_Status status;
+	SANE_Int room;
+
+	if (setjmp(src->jmp)) {
+		DBG(0, "%s: decompression failed\n", __func__);
+		return eds_jpeg_done(src, SANE_STATUS_IO_ERROR);
+	}
+
+	eds_jpeg_refill(cinfo);
+
+	if (src->step == EDS_JPEG_HEADER) {
+
+		if (jpeg_read_header(cinfo, TRUE) == JPEG_SUSPENDED)
+			return 0;
+
+		src->step = EDS_JPEG_START;
+	}
+
+	if (src->step == EDS_JPEG_START) {
+
+		if (!jpeg_start_decompress(cinfo))
+			return 0;
+
+		DBG(3, "%s: w: %d, h: %d, components: %d\n",
+			__func__,
+			cinfo->output_width, cinfo->output_height,
+			cinfo->output_components);
+
+		src->line_size = cinfo->output_width * cinfo->output_components;
+		src->line = (*cinfo->mem->alloc_large)((j_common_ptr)cinfo,
+			JPOOL_PERMANENT, src->line_size);
+
+		LOCK(src);
+		status = eds_ring_init(&src->out, src->line_size * EDS_JPEG_LINES);
+		UNLOCK(src);
+
+		if (status != SANE_STATUS_GOOD)
+			return eds_jpeg_done(src, status);
+
+		src->step = EDS_JPEG_SCANLINES;
 	}
+
+	while (cinfo->output_scanline < cinfo->output_height) {
+
+		LOCK(src);
+		room = src->out.size - src->out.fill;
+		UNLOCK(src);
+
+		if (room < src->line_size)
+			return 0;
+
+		if (jpeg_read_scanlines(cinfo, &src->line, 1) == 0)
+			return 0;
+
+		LOCK(src);
+		eds_ring_write(&src->out, src->line, src->line_size);
+		SIGNAL(src);
+		UNLOCK(src);
+	}
+
+	/* no jpeg_finish_decompress(), the trailer is of no interest */
+	return eds_jpeg_done(src, SANE_STATUS_EOF);
+}
+
+#ifdef USE_PTHREAD
+
+/* the decoder can go on: it got data, or room for the lines */
+static int
+eds_jpeg_runnable(epsonds_src_mgr *src)
+{
+	if (src->stop)
+		return 1;
+
+	if (src->starved)
+		return src->in_len || src->in_done;
+
+	return src->out.size - src->out.fill >= src->line_size;
+}
+
+static void *
+eds_jpeg_thread(void *arg)
+{
+	epsonds_src_mgr *src = arg;
+	SANE_Bool stop;
+
+	DBG(10, "%s: start\n", __func__);
+
+	do {
+		if (eds_jpeg_decode(src))
+			break;
+
+		LOCK(src);
+		while (!eds_jpeg_runnable(src))
+			pthread_cond_wait(&src->cond, &src->mu);
+		stop = src->stop;
+		UNLOCK(src);
+
+	} while (!stop);
+
+	DBG(10, "%s: finished\n", __func__);
+
+	return NULL;
+}
+
+#endif
+
+static void
+eds_jpeg_free(epsonds_scanner *s, epsonds_src_mgr *src)
+{
+	jpeg_destroy_decompress(&s->jpeg_cinfo);
+	s->jpeg_cinfo.src = NULL;
+
+	free(src->out.ring);
+	free(src->in);
+	free(src->buffer);
+	free(src);
 }
 
 SANE_Status
@@ -92,21 +371,36 @@ eds_jpeg_start(epsonds_scanner *s)
 {
 	epsonds_src_mgr *src;
 
-	s->jpeg_cinfo.err = jpeg_std_error(&s->jpeg_err);
+	/* the frontend did not read the last page to the end */
+	eds_jpeg_finish(s);
 
-	jpeg_create_decompress(&s->jpeg_cinfo);
+	src = calloc(1, sizeof(epsonds_src_mgr));
+	if (src == NULL)
+		return SANE_STATUS_NO_MEM;
 
-	s->jpeg_cinfo.src = (struct jpeg_source_mgr *)(*s->jpeg_cinfo.mem->alloc_small)((j_common_ptr)&s->jpeg_cinfo,
-						JPOOL_PERMANENT, sizeof(epsonds_src_mgr));
+	src->s = s;
+	src->size = EDS_JPEG_BUFSIZE;
+	src->buffer = malloc(src->size);
+	if (src->buffer == NULL) {
+		free(src);
+		return SANE_STATUS_NO_MEM;
+	}
 
-	memset(s->jpeg_cinfo.src, 0x00, sizeof(epsonds_src_mgr));
+	s->jpeg_cinfo.err = jpeg_std_error(&s->jpeg_err);
+	s->jpeg_err.error_exit = jpeg_error_exit;
+	s->jpeg_err.output_message = jpeg_output_message;
+	s->jpeg_cinfo.client_data = src;
+
+	if (setjmp(src->jmp)) {
+		free(src->buffer);
+		free(src);
+		return SANE_STATUS_NO_MEM;
+	}
 
-	src = (epsonds_src_mgr *)s->jpeg_cinfo.src;
-	src->s = s;
+	jpeg_create_decompress(&s->jpeg_cinfo);
 
-	src->buffer = (JOCTET *)(*s->jpeg_cinfo.mem->alloc_small)((j_common_ptr)&s->jpeg_cinfo,
-							JPOOL_PERMANENT,
-							1024 * sizeof(JOCTET));
+	s->jpeg_cinfo.client_data = src;
+	s->jpeg_cinfo.src = &src->pub;
 
 	src->pub.init_source = jpeg_init_source;
 	src->pub.fill_input_buffer = jpeg_fill_input_buffer;
@@ -116,111 +410,161 @@ eds_jpeg_start(epsonds_scanner *s)
 	src->pub.bytes_in_buffer = 0;
 	src->pub.next_input_byte = NULL;
 
-	s->jpeg_header_seen = 0;
+	src->step = EDS_JPEG_HEADER;
+
+#ifdef USE_PTHREAD
+	pthread_mutex_init(&src->mu, NULL);
+	pthread_cond_init(&src->cond, NULL);
+
+	if (pthread_create(&src->thread, NULL, eds_jpeg_thread, src)) {
+
+		DBG(1, "%s: cannot start the decoder\n", __func__);
+
+		pthread_cond_destroy(&src->cond);
+		pthread_mutex_destroy(&src->mu);
+		eds_jpeg_free(s, src);
+
+		return SANE_STATUS_NO_MEM;
+	}
+#endif
 
 	return SANE_STATUS_GOOD;
 }
 
-SANE_Status
-eds_jpeg_read_header(epsonds_scanner *s)
+void
+eds_jpeg_finish(epsonds_scanner *s)
 {
 	epsonds_src_mgr *src = (epsonds_src_mgr *)s->jpeg_cinfo.src;
 
-	if (jpeg_read_header(&s->jpeg_cinfo, TRUE)) {
+	if (src == NULL)
+		return;
 
-		s->jdst = sanei_jpeg_jinit_write_ppm(&s->jpeg_cinfo);
+#ifdef USE_PTHREAD
+	LOCK(src);
+	src->stop = 1;
+	SIGNAL(src);
+	UNLOCK(src);
 
-		if (jpeg_start_decompress(&s->jpeg_cinfo)) {
+	pthread_join(src->thread, NULL);
 
-			int size;
+	pthread_cond_destroy(&src->cond);
+	pthread_mutex_destroy(&src->mu);
+#endif
 
-			DBG(3, "%s: w: %d, h: %d, components: %d\n",
-				__func__,
-				s->jpeg_cinfo.output_width, s->jpeg_cinfo.output_height,
-				s->jpeg_cinfo.output_components);
+	eds_jpeg_free(s, src);
+}
 
-			size = s->jpeg_cinfo.output_width * s->jpeg_cinfo.output_components * 1;
+/* passes what the current ring holds to the decoder */
+SANE_Status
+eds_jpeg_feed(epsonds_scanner *s)
+{
+	epsonds_src_mgr *src = (epsonds_src_mgr *)s->jpeg_cinfo.src;
+	SANE_Int avail = eds_ring_avail(s->current);
 
-			src->linebuffer = (*s->jpeg_cinfo.mem->alloc_large)((j_common_ptr)&s->jpeg_cinfo,
-				JPOOL_PERMANENT, size);
+	if (src == NULL || avail == 0)
+		return SANE_STATUS_GOOD;
 
-			src->linebuffer_size = 0;
-			src->linebuffer_index = 0;
+	LOCK(src);
 
-			s->jpeg_header_seen = 1;
+	/* whatever follows the image */
+	if (src->done) {
+		eds_ring_skip(s->current, avail);
+		UNLOCK(src);
+		return SANE_STATUS_GOOD;
+	}
 
-			return SANE_STATUS_GOOD;
+	if (src->in_len + avail > src->in_size) {
 
-		} else {
-			DBG(0, "%s: decompression failed\n", __func__);
-			return SANE_STATUS_IO_ERROR;
+		SANE_Byte *in = realloc(src->in, src->in_len + avail);
+		if (in == NULL) {
+			UNLOCK(src);
+			return SANE_STATUS_NO_MEM;
 		}
-	} else {
-		DBG(0, "%s: cannot read JPEG header\n", __func__);
-		return SANE_STATUS_IO_ERROR;
+
+		src->in = in;
+		src->in_size = src->in_len + avail;
 	}
-}
 
-void
-eds_jpeg_finish(epsonds_scanner *s)
-{
-	jpeg_destroy_decompress(&s->jpeg_cinfo);
+	eds_ring_read(s->current, src->in + src->in_len, avail);
+	src->in_len += avail;
+
+	SIGNAL(src);
+	UNLOCK(src);
+
+	return SANE_STATUS_GOOD;
 }
 
-void
-eds_jpeg_read(SANE_Handle handle, SANE_Byte *data,
-	   SANE_Int max_length, SANE_Int *length)
+/* the decoder has taken all the data from the scanner so far, the next
+ * block can be fetched while it works on that
+ */
+SANE_Bool
+eds_jpeg_wants_input(epsonds_scanner *s)
 {
-	epsonds_scanner *s = handle;
-
-	struct jpeg_decompress_struct cinfo = s->jpeg_cinfo;
 	epsonds_src_mgr *src = (epsonds_src_mgr *)s->jpeg_cinfo.src;
+	SANE_Bool wants;
 
-	int l;
-
-	*length = 0;
-
-	/* copy from line buffer if available */
-	if (src->linebuffer_size && src->linebuffer_index < src->linebuffer_size) {
+	if (src == NULL)
+		return SANE_FALSE;
 
-		*length = src->linebuffer_size - src->linebuffer_index;
+	LOCK(src);
+	wants = !src->in_len && !src->in_done && !src->done;
+	UNLOCK(src);
 
-		if (*length > max_length)
-			*length = max_length;
-
-		memcpy(data, src->linebuffer + src->linebuffer_index, *length);
-		src->linebuffer_index += *length;
+	return wants;
+}
 
-		return;
-	}
+/* the scanner sent the whole image, whatever is missing is lost */
+void
+eds_jpeg_end_input(epsonds_scanner *s)
+{
+	epsonds_src_mgr *src = (epsonds_src_mgr *)s->jpeg_cinfo.src;
 
-	if (cinfo.output_scanline >= cinfo.output_height) {
-		*length = 0;
+	if (src == NULL)
 		return;
-	}
 
-	/* scanlines of decompressed data will be in s->jdst->buffer
-	 * only one line at time is supported
-	 */
-
-	l = jpeg_read_scanlines(&cinfo, s->jdst->buffer, 1);
-	if (l == 0) {
-		return;
-	}
+	LOCK(src);
+	src->in_done = 1;
+	SIGNAL(src);
+	UNLOCK(src);
+}
 
-	/* from s->jdst->buffer to linebuffer
-	 * linebuffer holds width * bytesperpixel
-	 */
+/* returns decoded data, no data if the decoder waits for the scanner,
+ * or SANE_STATUS_EOF after the last line and the end of the page
+ */
+SANE_Status
+eds_jpeg_read(epsonds_scanner *s, SANE_Byte *data,
+	   SANE_Int max_length, SANE_Int *length)
+{
+	epsonds_src_mgr *src = (epsonds_src_mgr *)s->jpeg_cinfo.src;
+	SANE_Status status = SANE_STATUS_GOOD;
+	SANE_Int avail;
 
-	(*s->jdst->put_pixel_rows)(&cinfo, s->jdst, 1, (char *)src->linebuffer);
+	*length = 0;
 
-	*length = cinfo.output_width * cinfo.output_components * 1;
-	src->linebuffer_size = *length;
-	src->linebuffer_index = 0;
+	/* the image was finished already */
+	if (src == NULL)
+		return SANE_STATUS_EOF;
+
+#ifdef USE_PTHREAD
+	LOCK(src);
+	while (!eds_ring_avail(&src->out) && !src->done
+		&& !(src->starved && !src->in_len && !src->in_done))
+		pthread_cond_wait(&src->cond, &src->mu);
+#else
+	if (!eds_ring_avail(&src->out) && !src->done)
+		eds_jpeg_decode(src);
+#endif
+
+	avail = eds_ring_avail(&src->out);
+	if (avail) {
+		*length = eds_ring_read(&src->out, data, min(max_length, avail));
+		SIGNAL(src);
+	} else if (src->done && (src->in_done || src->status != SANE_STATUS_EOF)) {
+		/* EOF only once the scanner ended the page too */
+		status = src->status;
+	}
 
-	if (*length > max_length)
-		*length = max_length;
+	UNLOCK(src);
 
-	memcpy(data, src->linebuffer + src->linebuffer_index, *length);
-	src->linebuffer_index += *length;
+	return status;
 }
@@ -13,5 +13,7 @@
 
 SANE_Status eds_jpeg_start(epsonds_scanner *s);
 void eds_jpeg_finish(epsonds_scanner *s);
-SANE_Status eds_jpeg_read_header(epsonds_scanner *s);
-void eds_jpeg_read(SANE_Handle handle, SANE_Byte *data, SANE_Int max_length, SANE_Int *length);
+SANE_Status eds_jpeg_feed(epsonds_scanner *s);
+SANE_Bool eds_jpeg_wants_input(epsonds_scanner *s);
+void eds_jpeg_end_input(epsonds_scanner *s);
+SANE_Status eds_jpeg_read(epsonds_scanner *s, SANE_Byte *data, SANE_Int max_length, SANE_Int *length);
@@ -161,6 +161,8 @@ close_scanner(epsonds_scanner *s)
 
 free:
 
+	eds_jpeg_finish(s);
+
 	free(s->front.ring);
 	free(s->back.ring);
 	free(s->line_buffer);
@@ -1343,9 +1345,10 @@ SANE_Status
 sane_read(SANE_Handle handle, SANE_Byte *data, SANE_Int max_length,
 	  SANE_Int *length)
 {
-	SANE_Int read = 0, tries = 3;
+	SANE_Int read = 0;
 	SANE_Int available;
 	SANE_Status status = 0;
+	SANE_Bool fetched = SANE_FALSE;
 	epsonds_scanner *s = (epsonds_scanner *)handle;
 
 	*length = read = 0;
@@ -1358,26 +1361,49 @@ sane_read(SANE_Handle handle, SANE_Byte *data, SANE_Int max_length,
 		return SANE_STATUS_INVAL;
 	}
 
-	/* anything in the buffer? pass it to the frontend */
-	available = eds_ring_avail(s->current);
-	if (available) {
+	/* JPEG data goes to the decoder as soon as it arrives,
+	 * the frontend gets the lines decoded so far
+	 */
+	if (s->mode_jpeg) {
 
-		DBG(18, "reading from ring buffer, %d left\n", available);
+decode_again:
 
-		if (s->mode_jpeg && !s->jpeg_header_seen) {
+		status = eds_jpeg_feed(s);
 
-			status = eds_jpeg_read_header(s);
-			if (status != SANE_STATUS_GOOD && --tries) {
-				goto read_again;
-			}
+		/* the decoder works on what it has while the next block
+		 * comes in, one block per call so the lines keep flowing
+		 */
+		if (status == SANE_STATUS_GOOD && !fetched
+			&& eds_jpeg_wants_input(s)) {
+			fetched = SANE_TRUE;
+			goto read_again;
 		}
 
-		if (s->mode_jpeg) {
-			eds_jpeg_read(handle, data, max_length, &read);
-		} else {
-			eds_copy_image_from_ring(s, data, max_length, &read);
+		if (status == SANE_STATUS_GOOD) {
+			status = eds_jpeg_read(s, data, max_length, &read);
+		}
+
+		if (status != SANE_STATUS_GOOD) {
+			goto cleanup;
 		}
 
+		if (read) {
+			*length = read;
+			return SANE_STATUS_GOOD;
+		}
+
+		/* the decoder needs more data */
+		goto read_again;
+	}
+
+	/* anything in the buffer? pass it to the frontend */
+	available = eds_ring_avail(s->current);
+	if (available) {
+
+		DBG(18, "reading from ring buffer, %d left\n", available);
+
+		eds_copy_image_from_ring(s, data, max_length, &read);
+
 		if (read == 0) {
 			goto read_again;
 		}
@@ -1424,6 +1450,9 @@ read_again:
 
 	/* abort scanning when appropriate */
 	if (status == SANE_STATUS_CANCELLED) {
+		if (s->mode_jpeg) {
+			eds_jpeg_finish(s);
+		}
 		esci2_can(s);
 		return status;
 	}
@@ -1446,22 +1475,28 @@ read_again:
 
 		/* move data to the appropriate ring */
 		status = eds_ring_write(s->backside ? &s->back : &s->front, s->buf, read);
+	}
 
-		if (0 && s->mode_jpeg && !s->jpeg_header_seen
-			&& status == SANE_STATUS_GOOD) {
+	/* continue reading if appropriate */
+	if (status == SANE_STATUS_GOOD) {
+		if (s->mode_jpeg) {
+			goto decode_again;
+		}
+		return status;
+	}
 
-			status = eds_jpeg_read_header(s);
-			if (status != SANE_STATUS_GOOD && --tries) {
-				goto read_again;
-			}
+	/* the image is complete, let the decoder finish it */
+	if (s->mode_jpeg && status == SANE_STATUS_EOF) {
+
+		status = eds_jpeg_feed(s);
+		if (status == SANE_STATUS_GOOD) {
+			eds_jpeg_end_input(s);
+			goto decode_again;
 		}
 	}
 
-	/* continue reading if appropriate */
-	if (status == SANE_STATUS_GOOD)
-		return status;
+cleanup:
 
-	/* cleanup */
 	DBG(5, "** %s: cleaning up\n", __func__);
 
 	if (s->mode_jpeg) {
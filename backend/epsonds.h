@@ -169,10 +169,8 @@ struct epsonds_scanner
 
 	/* jpeg stuff */
 
-	djpeg_dest_ptr jdst;
 	struct jpeg_decompress_struct jpeg_cinfo;
 	struct jpeg_error_mgr jpeg_err;
-	SANE_Bool jpeg_header_seen;
 
 	/* network buffers */
 	unsigned char *netbuf, *netptr;
@@ -637,6 +637,15 @@
 #include <ctype.h> /*isspace*/
 #include <math.h> /*tan*/
 #include <unistd.h> /*usleep*/
+#ifdef HAVE_LIBJPEG
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <jerror.h>
+#endif
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "../include/sane/sanei_backend.h"
 #include "../include/sane/sanei_scsi.h"
@@ -644,6 +653,7 @@
 #include "../include/sane/saneopts.h"
 #include "../include/sane/sanei_config.h"
 #include "../include/sane/sanei_magic.h"
+#include "../include/sane/sanei_perf.h"
 
 #include "fujitsu-scsi.h"
 #include "fujitsu.h"
@@ -721,6 +731,7 @@
 
 /* Also set via config file. */
 static int global_buffer_size = 64 * 1024;
+static int global_read_ahead = 0;
 
 /*
  * used by attach* and sane_get_devices
@@ -818,6 +829,7 @@ sane_get_devices (const SANE_Device *** device_list, SANE_Bool local_only)
 
   /* set this to 64K before reading the file */
   global_buffer_size = 64 * 1024;
+  global_read_ahead = 0;
 
   fp = sanei_config_open (FUJITSU_CONFIG_FILE);
 
@@ -863,6 +875,23 @@ sane_get_devices (const SANE_Device *** device_list, SANE_Bool local_only)
                   DBG (15, "sane_get_devices: setting \"buffer-size\" to %d\n", buf);
                   global_buffer_size = buf;
               }
+
+              /* megabytes for sheets read ahead, 0 to not read ahead */
+              else if ((strncmp (lp, "read-ahead", 10) == 0) && isspace (lp[10])) {
+
+                  int buf;
+                  lp += 10;
+                  lp = sanei_config_skip_whitespace (lp);
+                  buf = atoi (lp);
+
+                  if (buf < 0) {
+                    DBG (5, "sane_get_devices: config option \"read-ahead\" (%d) is < 0, ignoring!\n", buf);
+                    continue;
+                  }
+
+                  DBG (15, "sane_get_devices: setting \"read-ahead\" to %d\n", buf);
+                  global_read_ahead = buf;
+              }
               else {
                   DBG (5, "sane_get_devices: config option \"%s\" unrecognized - ignored.\n", lp);
               }
@@ -983,6 +1012,9 @@ attach_one (const char *device_name, int connType)
   /* scsi command/data buffer */
   s->buffer_size = global_buffer_size;
 
+  /* megabytes for the read-ahead thread */
+  s->read_ahead = global_read_ahead;
+
   /* copy the device name */
   strcpy (s->device_name, device_name);
 
@@ -5786,6 +5818,12 @@ set_sleep_mode(struct fujitsu *s)
 
   DBG (10, "set_sleep_mode: start\n");
 
+  /* the read-ahead thread is using the scanner */
+  if(s->ahead){
+    DBG (5, "set_sleep_mode: busy reading ahead\n");
+    return SANE_STATUS_DEVICE_BUSY;
+  }
+
   memset(cmd,0,cmdLen);
   set_SCSI_opcode(cmd, MODE_SELECT_code);
   set_MSEL_pf(cmd, 1);
@@ -5821,6 +5859,12 @@ set_off_mode(struct fujitsu *s)
 
   DBG (10, "set_off_mode: start\n");
 
+  /* the read-ahead thread is using the scanner */
+  if(s->ahead){
+    DBG (5, "set_off_mode: busy reading ahead\n");
+    return SANE_STATUS_DEVICE_BUSY;
+  }
+
   if (!s->has_cmd_sdiag || !s->has_cmd_rdiag || !s->has_off_mode){
     DBG (5, "set_off_mode: not supported, returning\n");
     return ret;
@@ -5859,6 +5903,12 @@ get_hardware_status (struct fujitsu *s, SANE_Int option)
 
   DBG (10, "get_hardware_status: start\n");
 
+  /* the read-ahead thread is using the scanner, keep the old values */
+  if(s->ahead){
+    DBG (15, "get_hardware_status: reading ahead, not running\n");
+    return ret;
+  }
+
   /* only run this if frontend has already read the last time we got it */
   /* or if we don't care for such bookkeeping (private use) */
   if (!option || s->hw_read[option-OPT_TOP]) {
@@ -6853,6 +6903,9 @@ sane_start (SANE_Handle handle)
       goto errors;
   }
 
+  /* back side processing must be done before we change anything */
+  post_wait(s);
+
   /* low mem mode messes up the side marker, reset it */
   if(s->source == SOURCE_ADF_DUPLEX && s->low_mem
     && s->eof_tx[SIDE_FRONT] && s->eof_tx[SIDE_BACK]
@@ -6863,6 +6916,9 @@ sane_start (SANE_Handle handle)
   /* batch start? initialize struct and scanner */
   if(!s->started){
 
+      /* sheets read ahead in the last batch are gone */
+      read_ahead_stop(s);
+
       /* load side marker */
       if(s->source == SOURCE_ADF_BACK){
         s->side = SIDE_BACK;
@@ -6996,33 +7052,31 @@ sane_start (SANE_Handle handle)
   /* otherwise buffered back page will be lost */
   /* ingest paper with adf (no-op for fb) */
   /* dont call object pos or scan on back side of duplex scan */
-  if(s->side == SIDE_FRONT || s->source == SOURCE_ADF_BACK){
-
-      s->bytes_rx[0]=0;
-      s->bytes_rx[1]=0;
-      s->lines_rx[0]=0;
-      s->lines_rx[1]=0;
-      s->eof_rx[0]=0;
-      s->eof_rx[1]=0;
-      s->ili_rx[0]=0;
-      s->ili_rx[1]=0;
-      s->eom_rx=0;
-
-      s->bytes_tx[0]=0;
-      s->bytes_tx[1]=0;
-      s->eof_tx[0]=0;
-      s->eof_tx[1]=0;
-
-      s->buff_rx[0]=0;
-      s->buff_rx[1]=0;
-      s->buff_tx[0]=0;
-      s->buff_tx[1]=0;
-
-      /* reset jpeg just in case... */
-      s->jpeg_stage = JPEG_STAGE_NONE;
-      s->jpeg_ff_offset = -1;
-      s->jpeg_front_rst = 0;
-      s->jpeg_back_rst = 0;
+  /* the sheet may have been read already, by the read-ahead thread */
+  if((s->side == SIDE_FRONT || s->source == SOURCE_ADF_BACK)
+    && read_ahead_get(s, &ret)
+  ){
+      s->started=1;
+
+      if (ret != SANE_STATUS_GOOD) {
+        DBG (5, "sane_start: ERROR: cannot read ahead\n");
+        goto errors;
+      }
+
+      /* scan size as the scanner gave it for this sheet */
+      ret = get_pixelsize(s,0);
+      if (ret != SANE_STATUS_GOOD) {
+        DBG (5, "sane_start: ERROR: cannot get pixelsize\n");
+        goto errors;
+      }
+  }
+  else if(s->side == SIDE_FRONT || s->source == SOURCE_ADF_BACK){
+
+      /* the buffers of a sheet read ahead only fit that sheet */
+      int resize = s->ahead_sheet;
+      s->ahead_sheet = 0;
+
+      reset_sheet(s);
 
       ret = object_position (s, OP_Feed);
       if (ret != SANE_STATUS_GOOD) {
@@ -7052,7 +7106,7 @@ sane_start (SANE_Handle handle)
          * option combinations can't handle it, so we make a big one */
         if(
           (s->s_mode == MODE_COLOR && s->color_interlace == COLOR_INTERLACE_3091)
-          || must_fully_buffer(s)
+          || must_fully_buffer(s) || must_stream_buffer(s)
         ){
           s->buff_tot[SIDE_FRONT] = s->bytes_tot[SIDE_FRONT];
         }
@@ -7069,8 +7123,9 @@ sane_start (SANE_Handle handle)
 
         /* the back buffer is normally very large, but some scanners or
          * option combinations dont need it, so we make a small one */
-        if(s->low_mem || s->source == SOURCE_ADF_BACK
+        if((s->low_mem || s->source == SOURCE_ADF_BACK
          || s->duplex_interlace == DUPLEX_INTERLACE_NONE)
+         && !must_stream_buffer(s))
           s->buff_tot[SIDE_BACK] = s->buffer_size;
       }
       else{
@@ -7078,10 +7133,10 @@ sane_start (SANE_Handle handle)
         s->buff_tot[SIDE_BACK] = 0;
       }
 
-      /* first page of batch */
+      /* first page of batch, or after sheets read ahead */
       /* make large buffer to hold the images */
       /* and set started flag */
-      if(!s->started){
+      if(!s->started || resize){
           ret = setup_buffers(s);
           if (ret != SANE_STATUS_GOOD) {
               DBG (5, "sane_start: ERROR: cannot load buffers\n");
@@ -7109,49 +7164,100 @@ sane_start (SANE_Handle handle)
    * so we block and buffer. yuck */
   if( must_fully_buffer(s) ){
 
-    /* get image */
-    while(!s->eof_rx[s->side] && !ret){
-      SANE_Int len = 0;
-      ret = sane_read((SANE_Handle)s, NULL, 0, &len);
-    }
+    int blank = 0;
+    int cropped = 0;
 
-    /* check for errors */
-    if (ret != SANE_STATUS_GOOD) {
-      DBG (5, "sane_start: ERROR: cannot buffer image\n");
-      goto errors;
+    /* back side of duplex page was processed with the front side */
+    if(s->side == SIDE_BACK && s->post_done){
+      s->post_done = 0;
+      s->s_params = s->post_params;
+      s->req_driv_crop = s->post_req_driv_crop;
+      s->req_driv_lut = s->post_req_driv_lut;
+      update_u_params(s);
+      cropped = s->post_cropped;
+      blank = s->post_blank;
+      DBG (5, "sane_start: OK: back side already processed\n");
     }
+    else{
+      int driv_crop;
 
-    DBG (5, "sane_start: OK: done buffering\n");
+      /* get image */
+      while(!s->eof_rx[s->side] && !ret){
+        SANE_Int len = 0;
+        ret = sane_read((SANE_Handle)s, NULL, 0, &len);
+      }
 
-    /* hardware deskew will tell image size after transfer */
-    ret = get_pixelsize(s,1);
-    if (ret != SANE_STATUS_GOOD) {
-      DBG (5, "sane_start: ERROR: cannot get final pixelsize\n");
-      goto errors;
+      /* check for errors */
+      if (ret != SANE_STATUS_GOOD) {
+        DBG (5, "sane_start: ERROR: cannot buffer image\n");
+        goto errors;
+      }
+
+      DBG (5, "sane_start: OK: done buffering\n");
+
+      /* hardware deskew will tell image size after transfer */
+      ret = get_pixelsize(s,1);
+      if (ret != SANE_STATUS_GOOD) {
+        DBG (5, "sane_start: ERROR: cannot get final pixelsize\n");
+        goto errors;
+      }
+
+      /* finished buffering, adjust image as required */
+      driv_crop = !s->hwdeskewcrop || s->req_driv_crop;
+      if(s->swdeskew && driv_crop){
+        find_deskew(s,s->side,&s->s_params,0);
+      }
+
+      /* the back side may be ready too, process it while
+       * the user reads this side */
+      if(s->side == SIDE_FRONT && s->source == SOURCE_ADF_DUPLEX){
+        post_start(s);
+      }
+
+      blank = buffer_process(s,s->side,&s->s_params,driv_crop,&cropped);
     }
 
-    /* finished buffering, adjust image as required */
-    if(s->swdeskew && (!s->hwdeskewcrop || s->req_driv_crop)){
-      buffer_deskew(s,s->side);
+    /* need to update user with new size */
+    if(cropped){
+      buffer_apply(s,s->side);
     }
-    if(s->swcrop && (!s->hwdeskewcrop || s->req_driv_crop)){
-      buffer_crop(s,s->side);
+
+    /* Skipping means throwing out this image.
+     * Pretend the user read the whole thing
+     * and call sane_start again.
+     * This assumes we are running in batch mode. */
+    if(blank){
+      s->bytes_tx[s->side] = s->bytes_rx[s->side];
+      s->eof_tx[s->side] = 1;
+      return sane_start(handle);
+    }
+  }
+
+  /* deskew and blank page detection only need to look at the
+   * start of the image, the rest is processed as it arrives */
+  else if( must_stream_buffer(s) ){
+
+    while(!s->eof_rx[s->side] && !ret && !stream_ready(s,s->side)){
+      SANE_Int len = 0;
+      ret = sane_read((SANE_Handle)s, NULL, 0, &len);
     }
-    if(s->swdespeck){
-      buffer_despeck(s,s->side);
+
+    /* check for errors */
+    if (ret != SANE_STATUS_GOOD) {
+      DBG (5, "sane_start: ERROR: cannot buffer image start\n");
+      goto errors;
     }
-    if(s->swskip){
-      /* Skipping means throwing out this image.
-       * Pretend the user read the whole thing
-       * and call sane_start again.
-       * This assumes we are running in batch mode. */
-      if(buffer_isblank(s,s->side)){
-        s->bytes_tx[s->side] = s->bytes_rx[s->side];
-        s->eof_tx[s->side] = 1;
-        return sane_start(handle);
-      }
+
+    /* once the whole image is read, this decides if it is blank */
+    if(!stream_ready(s,s->side)){
+      DBG (5, "sane_start: blank page, skipping\n");
+      stream_reset(s,s->side);
+      s->bytes_tx[s->side] = s->bytes_rx[s->side];
+      s->eof_tx[s->side] = 1;
+      return sane_start(handle);
     }
 
+    DBG (5, "sane_start: OK: done buffering image start\n");
   }
 
   /* check if user cancelled during this start */
@@ -7166,6 +7272,8 @@ sane_start (SANE_Handle handle)
   errors:
     DBG (10, "sane_start: error %d\n", ret);
 
+    read_ahead_stop(s);
+
     /* if we are started, but something went wrong,
      * chances are there is image data inside scanner,
      * which should be discarded via cancel command */
@@ -7364,6 +7472,42 @@ scanner_control_ric (struct fujitsu *s, int bytes, int side)
   return ret;
 }
 
+/*
+ * clears the transfer counters for a new sheet of paper
+ */
+static void
+reset_sheet (struct fujitsu *s)
+{
+  s->bytes_rx[0]=0;
+  s->bytes_rx[1]=0;
+  s->lines_rx[0]=0;
+  s->lines_rx[1]=0;
+  s->eof_rx[0]=0;
+  s->eof_rx[1]=0;
+  s->ili_rx[0]=0;
+  s->ili_rx[1]=0;
+  s->eom_rx=0;
+
+  s->bytes_tx[0]=0;
+  s->bytes_tx[1]=0;
+  s->eof_tx[0]=0;
+  s->eof_tx[1]=0;
+
+  s->buff_rx[0]=0;
+  s->buff_rx[1]=0;
+  s->buff_tx[0]=0;
+  s->buff_tx[1]=0;
+
+  stream_reset(s,SIDE_FRONT);
+  stream_reset(s,SIDE_BACK);
+
+  /* reset jpeg just in case... */
+  s->jpeg_stage = JPEG_STAGE_NONE;
+  s->jpeg_ff_offset = -1;
+  s->jpeg_front_rst = 0;
+  s->jpeg_back_rst = 0;
+}
+
 /*
  * callocs a buffer to hold the scan data
  */
@@ -7375,9 +7519,15 @@ setup_buffers (struct fujitsu *s)
 
   DBG (10, "setup_buffers: start\n");
 
+  /* nothing may still be working on the old buffers */
+  post_wait(s);
+  s->post_done = 0;
+
   for(side=0;side<2;side++){
 
     /* free old mem */
+    stream_reset(s,side);
+
     if (s->buffers[side]) {
       DBG (15, "setup_buffers: free buffer %d.\n",side);
       free(s->buffers[side]);
@@ -7676,24 +7826,35 @@ get_pixelsize(struct fujitsu *s, int actual)
       return SANE_STATUS_GOOD;
     }
 
-    memset(cmd,0,cmdLen);
-    set_SCSI_opcode(cmd, READ_code);
-    set_R_datatype_code (cmd, R_datatype_pixelsize);
-
-    if(s->side == SIDE_BACK){
-      set_R_window_id (cmd, WD_wid_back);
+    /* the read-ahead thread asked when it read the sheet */
+    if (s->ahead_sheet){
+      DBG (15, "get_pixelsize: from read-ahead\n");
+      memcpy(in, s->ahead_psize[s->side][actual], inLen);
+      ret = SANE_STATUS_GOOD;
     }
     else{
-      set_R_window_id (cmd, WD_wid_front);
-    }
-    set_R_xfer_length (cmd, inLen);
+      memset(cmd,0,cmdLen);
+      set_SCSI_opcode(cmd, READ_code);
+      set_R_datatype_code (cmd, R_datatype_pixelsize);
 
-    ret = do_cmd (
-      s, 1, 0,
-      cmd, cmdLen,
-      NULL, 0,
-      in, &inLen
-    );
+      if(s->side == SIDE_BACK){
+        set_R_window_id (cmd, WD_wid_back);
+      }
+      else{
+        set_R_window_id (cmd, WD_wid_front);
+      }
+      set_R_xfer_length (cmd, inLen);
+
+      ret = do_cmd (
+        s, 1, 0,
+        cmd, cmdLen,
+        NULL, 0,
+        in, &inLen
+      );
+
+      /* kept for when the sheet is handed over */
+      memcpy(s->ahead_psize[s->side][actual], in, R_PSIZE_len);
+    }
     if (ret == SANE_STATUS_GOOD){
 
       /* when we are called post-scan, the scanner may give
@@ -7864,6 +8025,9 @@ check_for_cancel(struct fujitsu *s)
 
   if(s->started && s->cancelled){
 
+    /* the thread may be in the middle of a command */
+    read_ahead_stop(s);
+
     /* halt scan */
     if(s->halt_on_cancel){
       DBG (15, "check_for_cancel: halting\n");
@@ -7896,154 +8060,669 @@ check_for_cancel(struct fujitsu *s)
 }
 
 /*
- * Called by SANE to read data.
- *
- * From the SANE spec:
- * This function is used to read image data from the device
- * represented by handle h.  Argument buf is a pointer to a memory
- * area that is at least maxlen bytes long.  The number of bytes
- * returned is stored in *len. A backend must set this to zero when
- * the call fails (i.e., when a status other than SANE_STATUS_GOOD is
- * returned).
- *
- * When the call succeeds, the number of bytes returned can be
- * anywhere in the range from 0 to maxlen bytes.
+ * Read-ahead: during an adf batch, a thread can feed and read the
+ * following sheets while the frontend is busy with the current one.
+ * The read-ahead config option gives the memory to use for this in
+ * megabytes, at least one sheet is read ahead if it is not 0. Each sheet
+ * is read into its own full size buffers, by a private copy of the
+ * scanner struct. A sheet is handed to sane_start as soon as the scanner
+ * has given its size, sane_read then takes the data as the thread
+ * publishes it. While the thread runs, it is the only one talking to the
+ * scanner. The thread stops when it cannot feed a sheet without
+ * reporting it, the sane_start which finds no sheet left feeds one
+ * itself, so more paper can still be loaded while the frontend is busy.
  */
-SANE_Status
-sane_read (SANE_Handle handle, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len)
+#ifdef USE_PTHREAD
+
+struct ahead_sheet
 {
-  struct fujitsu *s = (struct fujitsu *) handle;
-  SANE_Status ret=SANE_STATUS_GOOD;
+  SANE_Status ret;
+  int ready;                    /* size known, buffers allocated */
+  int done;                     /* read to the end, or failed */
+  int blocks;                   /* counts the updates below */
 
-  DBG (10, "sane_read: start\n");
+  int bytes_tot[2];
+  int bytes_rx[2];
+  int lines_rx[2];
+  int eof_rx[2];
+  int ili_rx[2];
+  int eom_rx;
 
-  *len=0;
+  int buff_rx[2];
+  unsigned char * buffers[2];
 
-  /* maybe cancelled? */
-  if(!s->started){
-    DBG (5, "sane_read: not started, call sane_start\n");
-    return SANE_STATUS_CANCELLED;
+  int has_pixelsize;
+  unsigned char psize[2][2][R_PSIZE_len];
+};
+
+struct read_ahead
+{
+  pthread_t thread;
+  pthread_mutex_t mu;
+  pthread_cond_t cond;
+  int running;
+
+  struct fujitsu reader;
+
+  int sheets;                   /* number of sheet slots */
+  struct ahead_sheet * sheet;
+  int head;                     /* oldest sheet fed */
+  int count;                    /* sheets fed, not yet finished by sane_read */
+  int taken;                    /* oldest sheet is given to sane_start */
+  int seen;                     /* its updates already copied */
+
+  int stop;
+  int done;
+};
+
+static void
+ahead_free(struct fujitsu *r)
+{
+  free(r->buffers[SIDE_FRONT]);
+  free(r->buffers[SIDE_BACK]);
+  r->buffers[SIDE_FRONT] = NULL;
+  r->buffers[SIDE_BACK] = NULL;
+}
+
+/* makes the progress of the reader on a sheet visible to sane_read */
+static void
+ahead_publish(struct read_ahead *a, struct ahead_sheet *sh,
+  SANE_Status ret, int done)
+{
+  struct fujitsu *r = &a->reader;
+
+  pthread_mutex_lock(&a->mu);
+  sh->ret = ret;
+  sh->ready = 1;
+  sh->done = done;
+  sh->blocks++;
+  memcpy(sh->bytes_tot, r->bytes_tot, sizeof(sh->bytes_tot));
+  memcpy(sh->bytes_rx, r->bytes_rx, sizeof(sh->bytes_rx));
+  memcpy(sh->lines_rx, r->lines_rx, sizeof(sh->lines_rx));
+  memcpy(sh->eof_rx, r->eof_rx, sizeof(sh->eof_rx));
+  memcpy(sh->ili_rx, r->ili_rx, sizeof(sh->ili_rx));
+  sh->eom_rx = r->eom_rx;
+  memcpy(sh->buff_rx, r->buff_rx, sizeof(sh->buff_rx));
+  sh->buffers[SIDE_FRONT] = r->buffers[SIDE_FRONT];
+  sh->buffers[SIDE_BACK] = r->buffers[SIDE_BACK];
+  sh->has_pixelsize = r->has_pixelsize;
+  memcpy(sh->psize, r->ahead_psize, sizeof(sh->psize));
+  pthread_cond_broadcast(&a->cond);
+  pthread_mutex_unlock(&a->mu);
+}
+
+/* reads the sheet the reader just fed, both sides, to the end. the
+ * scan sizes are asked for in the order sane_start would ask for them,
+ * and each one is published with the block which needs it */
+static SANE_Status
+ahead_read(struct read_ahead *a, struct ahead_sheet *sh)
+{
+  struct fujitsu *r = &a->reader;
+  SANE_Status ret;
+  int side, stop, cur;
+  int eof[2] = {0,0};
+
+  ret = start_scan(r);
+  if(ret){
+    return ret;
   }
 
-  /* sane_start required between sides */
-  if(s->eof_rx[s->side] && s->bytes_tx[s->side] == s->bytes_rx[s->side]){
-    DBG (15, "sane_read: returning eof\n");
-    s->eof_tx[s->side] = 1;
+  r->side = SIDE_FRONT;
+  if(r->source == SOURCE_ADF_BACK){
+    r->side = SIDE_BACK;
+  }
 
-    /* swap sides if user asked for low-mem mode, we are duplexing,
-     * and there is data waiting on the other side */
-    if(s->low_mem && s->source == SOURCE_ADF_DUPLEX
-      && (s->bytes_rx[!s->side] > s->bytes_tx[!s->side]
-        || (s->eof_rx[!s->side] && !s->eof_tx[!s->side])
-      )
-    ){
-      s->side = !s->side;
-    }
+  ret = get_pixelsize(r,0);
+  if(ret){
+    return ret;
+  }
 
-    return SANE_STATUS_EOF;
+  /* the whole sheet is kept, so the buffers are full size */
+  r->bytes_tot[SIDE_FRONT] = 0;
+  r->bytes_tot[SIDE_BACK] = 0;
+  if(r->source != SOURCE_ADF_BACK){
+    r->bytes_tot[SIDE_FRONT] = r->s_params.bytes_per_line * r->s_params.lines;
+  }
+  if(r->source == SOURCE_ADF_DUPLEX || r->source == SOURCE_ADF_BACK){
+    r->bytes_tot[SIDE_BACK] = r->s_params.bytes_per_line * r->s_params.lines;
   }
 
-  /* protect this block from sane_cancel */
-  s->reading = 1;
+  for(side=0;side<2;side++){
+    r->buff_tot[side] = r->bytes_tot[side];
+    if(r->bytes_tot[side]){
+      r->buffers[side] = calloc(1,r->bytes_tot[side]);
+      if(!r->buffers[side]){
+        DBG (5, "ahead_read: Error, no buffer %d.\n",side);
+        return SANE_STATUS_NO_MEM;
+      }
+    }
+  }
 
-  /* ----------------------------------------------
-   * try to read some data from scanner into buffer
-   * these functions are expected not to overrun */
+  /* sane_start can go on */
+  ahead_publish(a, sh, SANE_STATUS_GOOD, 0);
 
-  /* 3091/2 are on crack, get their own duplex reader function */
-  if(s->source == SOURCE_ADF_DUPLEX
-    && s->duplex_interlace == DUPLEX_INTERLACE_3091
-  ){
-    ret = read_from_3091duplex(s);
-    if(ret){
-      DBG(5,"sane_read: 3091 returning %d\n",ret);
-      return ret;
+  for(;;){
+
+    pthread_mutex_lock(&a->mu);
+    stop = a->stop;
+    pthread_mutex_unlock(&a->mu);
+    if(stop){
+      return SANE_STATUS_CANCELLED;
     }
-  } /* end 3091 */
 
-  /* alternating jpeg duplex interlacing */
-  else if(s->source == SOURCE_ADF_DUPLEX
-    && s->s_params.format == SANE_FRAME_JPEG
-    && s->jpeg_interlace == JPEG_INTERLACE_ALT
-  ){
-    ret = read_from_JPEGduplex(s);
+    ret = read_block(r);
     if(ret){
-      DBG(5,"sane_read: jpeg duplex returning %d\n",ret);
       return ret;
     }
-  } /* end alt jpeg */
-
-  /* alternating pnm duplex interlacing */
-  else if(s->source == SOURCE_ADF_DUPLEX
-    && s->s_params.format != SANE_FRAME_JPEG
-    && s->duplex_interlace == DUPLEX_INTERLACE_ALT
-  ){
 
-    /* buffer front side */
-    ret = read_from_scanner(s, SIDE_FRONT);
-    if(ret){
-      DBG(5,"sane_read: front returning %d\n",ret);
-      return ret;
+    /* hardware deskew will tell image size after transfer */
+    for(side=0;side<2;side++){
+      if(r->eof_rx[side] && !eof[side]){
+        eof[side] = 1;
+        if(must_fully_buffer(r)){
+          cur = r->side;
+          r->side = side;
+          ret = get_pixelsize(r,1);
+          r->side = cur;
+          if(ret){
+            return ret;
+          }
+        }
+      }
     }
 
-    /* buffer back side, but don't get too far ahead of the front! */
-    if(s->bytes_rx[SIDE_BACK] < s->bytes_rx[SIDE_FRONT] + s->buffer_size){
-      ret = read_from_scanner(s, SIDE_BACK);
+    /* sane_start asks for the back side size once the front is read */
+    if(r->side == SIDE_FRONT && r->eof_rx[SIDE_FRONT]
+      && r->source == SOURCE_ADF_DUPLEX
+    ){
+      r->side = SIDE_BACK;
+      ret = get_pixelsize(r,0);
       if(ret){
-        DBG(5,"sane_read: back returning %d\n",ret);
         return ret;
       }
     }
-  } /* end alt pnm */
 
-  /* simplex or non-alternating duplex */
-  else{
-    ret = read_from_scanner(s, s->side);
-    if(ret){
-      DBG(5,"sane_read: side %d returning %d\n",s->side,ret);
-      return ret;
+    /* the last block is published with the end of the sheet */
+    if(r->eof_rx[r->side]){
+      return SANE_STATUS_GOOD;
     }
-  } /*end simplex*/
 
-  /* uncommon case, downsample and copy a block from buffer to frontend */
-  if(must_downsample(s)){
-    ret = downsample_from_buffer(s,buf,max_len,len,s->side);
+    ahead_publish(a, sh, SANE_STATUS_GOOD, 0);
   }
+}
 
-  /* common case, memcpy a block from buffer to frontend */
-  else{
-    ret = read_from_buffer(s,buf,max_len,len,s->side);
-  }
+static void *
+read_ahead_thread(void *arg)
+{
+  struct read_ahead *a = arg;
+  struct fujitsu *r = &a->reader;
+  struct ahead_sheet *sh;
+  SANE_Status ret;
 
-  /*finished sending small buffer, reset it*/
-  if(s->buff_tx[s->side] == s->buff_rx[s->side]
-    && s->buff_tot[s->side] < s->bytes_tot[s->side]
-  ){
-    DBG (15, "sane_read: reset buffers\n");
-    s->buff_rx[s->side] = 0;
-    s->buff_tx[s->side] = 0;
-  }
+  DBG (10, "read_ahead_thread: start\n");
 
-  /* check if user cancelled during this read */
-  ret = check_for_cancel(s);
+  for(;;){
 
-  /* swap sides if user asked for low-mem mode, we are duplexing,
-   * and there is data waiting on the other side */
-  if(s->low_mem && s->source == SOURCE_ADF_DUPLEX
-    && (s->bytes_rx[!s->side] > s->bytes_tx[!s->side]
-      || (s->eof_rx[!s->side] && !s->eof_tx[!s->side])
-    )
-  ){
-    s->side = !s->side;
-  }
+    pthread_mutex_lock(&a->mu);
+    while(a->count == a->sheets && !a->stop){
+      pthread_cond_wait(&a->cond, &a->mu);
+    }
+    sh = &a->sheet[(a->head + a->count) % a->sheets];
+    if(a->stop){
+      pthread_mutex_unlock(&a->mu);
+      break;
+    }
+    pthread_mutex_unlock(&a->mu);
 
-  /* unprotect this block from sane_cancel */
-  s->reading = 0;
+    /* out of paper, sane_start tries again when it gets here */
+    reset_sheet(r);
+    ret = object_position(r, OP_Feed);
+    if(ret){
+      DBG (15, "read_ahead_thread: cannot load page %d\n", ret);
+      break;
+    }
+
+    /* the slot is not in use until it is counted */
+    memset(sh, 0, sizeof(*sh));
+    pthread_mutex_lock(&a->mu);
+    a->count++;
+    pthread_mutex_unlock(&a->mu);
+
+    ret = ahead_read(a, sh);
+
+    /* the buffers now belong to the slot */
+    ahead_publish(a, sh, ret, 1);
+    r->buffers[SIDE_FRONT] = NULL;
+    r->buffers[SIDE_BACK] = NULL;
+
+    /* failed, sane_start takes over again */
+    if(ret){
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&a->mu);
+  a->done = 1;
+  pthread_cond_broadcast(&a->cond);
+  pthread_mutex_unlock(&a->mu);
+
+  DBG (10, "read_ahead_thread: finish\n");
+  return NULL;
+}
+
+static void
+read_ahead_stop(struct fujitsu *s)
+{
+  struct read_ahead *a = s->ahead;
+  int i;
+
+  if(!a){
+    return;
+  }
+
+  pthread_mutex_lock(&a->mu);
+  a->stop = 1;
+  pthread_cond_broadcast(&a->cond);
+  pthread_mutex_unlock(&a->mu);
+  pthread_join(a->thread, NULL);
+  a->running = 0;
+
+  DBG (15, "read_ahead_stop: %d sheets dropped\n", a->count - a->taken);
+
+  /* the buffers of a sheet given to sane_start are in s */
+  for(i=a->taken;i<a->count;i++){
+    struct ahead_sheet *sh = &a->sheet[(a->head + i) % a->sheets];
+    free(sh->buffers[SIDE_FRONT]);
+    free(sh->buffers[SIDE_BACK]);
+  }
+  ahead_free(&a->reader);
+  pthread_cond_destroy(&a->cond);
+  pthread_mutex_destroy(&a->mu);
+  free(a->sheet);
+  free(a);
+  s->ahead = NULL;
+}
+
+static void
+read_ahead_start(struct fujitsu *s)
+{
+  struct read_ahead *a;
+  unsigned long size = s->s_params.bytes_per_line * s->s_params.lines;
+  unsigned long limit = (unsigned long)s->read_ahead * 1024 * 1024;
+
+  /* the low memory mode reads the sides in turns, as the user does */
+  if(s->source == SOURCE_FLATBED || s->low_mem){
+    return;
+  }
+  if(s->source == SOURCE_ADF_DUPLEX){
+    size *= 2;
+  }
+  if(!limit || !size){
+    return;
+  }
+
+  a = calloc(1, sizeof(*a));
+  if(!a){
+    DBG (5, "read_ahead_start: not enough memory, not reading ahead\n");
+    return;
+  }
+  a->sheets = limit / size ? limit / size : 1;
+  a->sheet = calloc(a->sheets, sizeof(*a->sheet));
+  if(!a->sheet){
+    DBG (5, "read_ahead_start: not enough memory, not reading ahead\n");
+    free(a);
+    return;
+  }
+
+  /* the thread works on its own copy of the scanner struct */
+  a->reader = *s;
+  a->reader.ahead = NULL;
+  a->reader.buffers[SIDE_FRONT] = NULL;
+  a->reader.buffers[SIDE_BACK] = NULL;
+  a->reader.stream_rot[SIDE_FRONT] = NULL;
+  a->reader.stream_rot[SIDE_BACK] = NULL;
+  a->reader.post_running = 0;
+
+  pthread_mutex_init(&a->mu, NULL);
+  pthread_cond_init(&a->cond, NULL);
+  s->ahead = a;
+  a->running = 1;
+  if(pthread_create(&a->thread, NULL, read_ahead_thread, a)){
+    DBG (5, "read_ahead_start: cannot start thread, not reading ahead\n");
+    pthread_cond_destroy(&a->cond);
+    pthread_mutex_destroy(&a->mu);
+    free(a->sheet);
+    free(a);
+    s->ahead = NULL;
+    return;
+  }
+
+  DBG (15, "read_ahead_start: up to %d sheets\n", a->sheets);
+}
+
+/* copies what the thread has read of the oldest sheet, with the mutex
+ * held. once the sheet is done, its slot is given back to the thread */
+static SANE_Status
+ahead_take(struct fujitsu *s, struct read_ahead *a)
+{
+  struct ahead_sheet *sh = &a->sheet[a->head];
+  SANE_Status ret = sh->ret;
+  int side;
+
+  for(side=0;side<2;side++){
+    s->bytes_tot[side] = sh->bytes_tot[side];
+    s->buff_tot[side] = sh->bytes_tot[side];
+    s->bytes_rx[side] = sh->bytes_rx[side];
+    s->buff_rx[side] = sh->buff_rx[side];
+    s->lines_rx[side] = sh->lines_rx[side];
+    s->eof_rx[side] = sh->eof_rx[side];
+    s->ili_rx[side] = sh->ili_rx[side];
+  }
+  s->eom_rx = sh->eom_rx;
+  s->has_pixelsize = sh->has_pixelsize;
+  memcpy(s->ahead_psize, sh->psize, sizeof(s->ahead_psize));
+  a->seen = sh->blocks;
+
+  if(sh->done){
+    a->head = (a->head + 1) % a->sheets;
+    a->count--;
+    a->taken = 0;
+    pthread_cond_broadcast(&a->cond);
+  }
+
+  return ret;
+}
+
+/* Take the next sheet from the read-ahead thread, starting the thread
+ * if there is none. Waits only until the scanner has given the size of
+ * the sheet, sane_read waits for the data. Returns 0 if there is no
+ * thread, or it has finished and all of its sheets have been taken,
+ * the sheet must then be fed and read directly. */
+static int
+read_ahead_get(struct fujitsu *s, SANE_Status * ret)
+{
+  struct read_ahead *a;
+  struct ahead_sheet *sh;
+  int side;
+
+  if(!s->ahead){
+    read_ahead_start(s);
+  }
+  a = s->ahead;
+  if(!a){
+    return 0;
+  }
+
+  pthread_mutex_lock(&a->mu);
+
+  /* the frontend left the sheet before early, let the thread finish it */
+  if(a->taken){
+    while(!a->sheet[a->head].done){
+      pthread_cond_wait(&a->cond, &a->mu);
+    }
+    ahead_take(s, a);
+  }
+
+  while(!(a->count && a->sheet[a->head].ready) && !a->done){
+    pthread_cond_wait(&a->cond, &a->mu);
+  }
+  if(!a->count){
+    pthread_mutex_unlock(&a->mu);
+    read_ahead_stop(s);
+    return 0;
+  }
+  sh = &a->sheet[a->head];
+
+  /* the sheet before is done, drop it */
+  reset_sheet(s);
+  s->post_done = 0;
+  for(side=0;side<2;side++){
+    free(s->buffers[side]);
+    s->buffers[side] = sh->buffers[side];
+  }
+  s->ahead_sheet = 1;
+  a->taken = 1;
+  *ret = ahead_take(s, a);
+
+  pthread_mutex_unlock(&a->mu);
+
+  return 1;
+}
+
+/* Used by sane_read instead of read_block for a sheet from the thread.
+ * Waits for the thread to read more of it, unless the current side is
+ * complete, and copies the progress. */
+static SANE_Status
+read_ahead_sync(struct fujitsu *s)
+{
+  struct read_ahead *a = s->ahead;
+  SANE_Status ret;
+
+  if(!a){
+    return SANE_STATUS_GOOD;
+  }
+
+  pthread_mutex_lock(&a->mu);
+  if(!a->taken){
+    pthread_mutex_unlock(&a->mu);
+    return SANE_STATUS_GOOD;
+  }
+  while(!a->sheet[a->head].done && a->sheet[a->head].blocks == a->seen
+    && !s->eof_rx[s->side]
+  ){
+    pthread_cond_wait(&a->cond, &a->mu);
+  }
+  ret = ahead_take(s, a);
+  pthread_mutex_unlock(&a->mu);
+
+  return ret;
+}
+
+#else
+
+static void
+read_ahead_stop(struct fujitsu *s)
+{
+  (void) s;
+}
+
+static void
+read_ahead_start(struct fujitsu *s)
+{
+  (void) s;
+}
+
+static int
+read_ahead_get(struct fujitsu *s, SANE_Status * ret)
+{
+  (void) s;
+  (void) ret;
+  return 0;
+}
+
+static SANE_Status
+read_ahead_sync(struct fujitsu *s)
+{
+  (void) s;
+  return SANE_STATUS_GOOD;
+}
+
+#endif
+
+/*
+ * Called by SANE to read data.
+ *
+ * From the SANE spec:
+ * This function is used to read image data from the device
+ * represented by handle h.  Argument buf is a pointer to a memory
+ * area that is at least maxlen bytes long.  The number of bytes
+ * returned is stored in *len. A backend must set this to zero when
+ * the call fails (i.e., when a status other than SANE_STATUS_GOOD is
+ * returned).
+ *
+ * When the call succeeds, the number of bytes returned can be
+ * anywhere in the range from 0 to maxlen bytes.
+ */
+SANE_Status
+sane_read (SANE_Handle handle, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len)
+{
+  struct fujitsu *s = (struct fujitsu *) handle;
+  SANE_Status ret=SANE_STATUS_GOOD;
+
+  DBG (10, "sane_read: start\n");
+
+  *len=0;
+
+  /* maybe cancelled? */
+  if(!s->started){
+    DBG (5, "sane_read: not started, call sane_start\n");
+    return SANE_STATUS_CANCELLED;
+  }
+
+  /* sane_start required between sides */
+  if(s->eof_rx[s->side] && s->bytes_tx[s->side] == s->bytes_rx[s->side]){
+    DBG (15, "sane_read: returning eof\n");
+    s->eof_tx[s->side] = 1;
+    stream_reset(s, s->side);
+
+    /* swap sides if user asked for low-mem mode, we are duplexing,
+     * and there is data waiting on the other side */
+    if(s->low_mem && s->source == SOURCE_ADF_DUPLEX
+      && (s->bytes_rx[!s->side] > s->bytes_tx[!s->side]
+        || (s->eof_rx[!s->side] && !s->eof_tx[!s->side])
+      )
+    ){
+      s->side = !s->side;
+    }
+
+    return SANE_STATUS_EOF;
+  }
+
+  /* protect this block from sane_cancel */
+  s->reading = 1;
+
+  /* try to read some data from scanner into buffer,
+   * or take what the read-ahead thread has read */
+  if(s->ahead_sheet){
+    ret = read_ahead_sync(s);
+  }
+  else{
+    ret = read_block(s);
+  }
+  if(ret){
+    return ret;
+  }
+
+  /* deskew the lines which arrived */
+  stream_rotate(s, SIDE_FRONT);
+  stream_rotate(s, SIDE_BACK);
+
+  /* uncommon case, downsample and copy a block from buffer to frontend */
+  if(must_downsample(s)){
+    ret = downsample_from_buffer(s,buf,max_len,len,s->side);
+  }
+
+  /* common case, memcpy a block from buffer to frontend */
+  else{
+    ret = read_from_buffer(s,buf,max_len,len,s->side);
+  }
+
+  /*finished sending small buffer, reset it*/
+  if(s->buff_tx[s->side] == s->buff_rx[s->side]
+    && s->buff_tot[s->side] < s->bytes_tot[s->side]
+  ){
+    DBG (15, "sane_read: reset buffers\n");
+    s->buff_rx[s->side] = 0;
+    s->buff_tx[s->side] = 0;
+  }
+
+  /* check if user cancelled during this read */
+  ret = check_for_cancel(s);
+
+  /* swap sides if user asked for low-mem mode, we are duplexing,
+   * and there is data waiting on the other side */
+  if(s->low_mem && s->source == SOURCE_ADF_DUPLEX
+    && (s->bytes_rx[!s->side] > s->bytes_tx[!s->side]
+      || (s->eof_rx[!s->side] && !s->eof_tx[!s->side])
+    )
+  ){
+    s->side = !s->side;
+  }
+
+  /* unprotect this block from sane_cancel */
+  s->reading = 0;
 
   DBG (10, "sane_read: finish %d\n", ret);
   return ret;
 }
 
+/* reads a block of data from the scanner into the buffers, using the
+ * reader that suits the way the scanner sends the sides.
+ * these functions are expected not to overrun */
+static SANE_Status
+read_block(struct fujitsu *s)
+{
+  SANE_Status ret=SANE_STATUS_GOOD;
+
+  /* 3091/2 are on crack, get their own duplex reader function */
+  if(s->source == SOURCE_ADF_DUPLEX
+    && s->duplex_interlace == DUPLEX_INTERLACE_3091
+  ){
+    ret = read_from_3091duplex(s);
+    if(ret){
+      DBG(5,"read_block: 3091 returning %d\n",ret);
+      return ret;
+    }
+  } /* end 3091 */
+
+  /* alternating jpeg duplex interlacing */
+  else if(s->source == SOURCE_ADF_DUPLEX
+    && s->s_params.format == SANE_FRAME_JPEG
+    && s->jpeg_interlace == JPEG_INTERLACE_ALT
+  ){
+    ret = read_from_JPEGduplex(s);
+    if(ret){
+      DBG(5,"read_block: jpeg duplex returning %d\n",ret);
+      return ret;
+    }
+  } /* end alt jpeg */
+
+  /* alternating pnm duplex interlacing */
+  else if(s->source == SOURCE_ADF_DUPLEX
+    && s->s_params.format != SANE_FRAME_JPEG
+    && s->duplex_interlace == DUPLEX_INTERLACE_ALT
+  ){
+
+    /* buffer front side */
+    ret = read_from_scanner(s, SIDE_FRONT);
+    if(ret){
+      DBG(5,"read_block: front returning %d\n",ret);
+      return ret;
+    }
+
+    /* buffer back side, but don't get too far ahead of the front! */
+    if(s->bytes_rx[SIDE_BACK] < s->bytes_rx[SIDE_FRONT] + s->buffer_size){
+      ret = read_from_scanner(s, SIDE_BACK);
+      if(ret){
+        DBG(5,"read_block: back returning %d\n",ret);
+        return ret;
+      }
+    }
+  } /* end alt pnm */
+
+  /* simplex or non-alternating duplex */
+  else{
+    ret = read_from_scanner(s, s->side);
+    if(ret){
+      DBG(5,"read_block: side %d returning %d\n",s->side,ret);
+      return ret;
+    }
+  } /*end simplex*/
+
+
+  return ret;
+}
+
 /* bare jpeg images dont contain resolution, but JFIF APP0 does, so we add */
 static SANE_Status
 inject_jfif_header(struct fujitsu *s, int side)
@@ -8860,13 +9539,28 @@ copy_buffer(struct fujitsu *s, unsigned char * buf, int len, int side)
   return ret;
 }
 
+/* number of bytes at the start of s->buffers which may be sent,
+ * lines which still have to be deskewed are held back */
+static int
+buffer_ready(struct fujitsu *s, int side)
+{
+  if(s->stream_rot[side]){
+    int ready = s->stream_lines[side] * s->s_params.bytes_per_line;
+
+    if(ready < s->buff_rx[side])
+      return ready;
+  }
+
+  return s->buff_rx[side];
+}
+
 static SANE_Status
 read_from_buffer(struct fujitsu *s, SANE_Byte * buf,
   SANE_Int max_len, SANE_Int * len, int side)
 {
     SANE_Status ret=SANE_STATUS_GOOD;
     int bytes = max_len;
-    int remain = s->buff_rx[side] - s->buff_tx[side];
+    int remain = buffer_ready(s,side) - s->buff_tx[side];
 
     DBG (10, "read_from_buffer: start\n");
 
@@ -8909,12 +9603,13 @@ downsample_from_buffer(struct fujitsu *s, SANE_Byte * buf,
   SANE_Int max_len, SANE_Int * len, int side)
 {
     SANE_Status ret=SANE_STATUS_GOOD;
+    int rx = buffer_ready(s,side);
 
     DBG (10, "downsample_from_buffer: start %d %d %d %d\n", s->bytes_rx[side], s->bytes_tx[side], s->buff_rx[side], s->buff_tx[side]);
 
     if(s->s_mode == MODE_COLOR && s->u_mode == MODE_GRAYSCALE){
 
-      while(*len < max_len && s->buff_rx[side] - s->buff_tx[side] >= 3){
+      while(*len < max_len && rx - s->buff_tx[side] >= 3){
 
         int gray = 0;
 
@@ -8951,7 +9646,7 @@ downsample_from_buffer(struct fujitsu *s, SANE_Byte * buf,
       /*FIXME: add dynamic threshold? */
       unsigned char thresh = (s->threshold ? s->threshold : 127);
 
-      while(*len < max_len && s->buff_rx[side] - s->buff_tx[side] >= 24){
+      while(*len < max_len && rx - s->buff_tx[side] >= 24){
 
         int i;
         unsigned char out = 0;
@@ -9056,6 +9751,8 @@ sane_cancel (SANE_Handle handle)
   if(!s->reading)
     check_for_cancel(s);
 
+  sanei_perf_dump (STRINGIFY(BACKEND_NAME));
+
   DBG (10, "sane_cancel: finish\n");
 }
 
@@ -9074,6 +9771,8 @@ sane_close (SANE_Handle handle)
   struct fujitsu * s = (struct fujitsu *) handle;
 
   DBG (10, "sane_close: start\n");
+  post_wait(s);
+  read_ahead_stop(s);
   /*clears any held scans*/
   mode_select_buff(s);
   disconnect_fd(s);
@@ -9160,6 +9859,14 @@ sense_handler (int fd, unsigned char * sensed_data, void *arg)
   /* kill compiler warning */
   fd = fd;
 
+#ifdef USE_PTHREAD
+  /* the scsi layer calls us with the open handle, even when
+   * the read-ahead thread sent the command */
+  if(s->ahead && s->ahead->running){
+    s = &s->ahead->reader;
+  }
+#endif
+
   /* copy the rs return data into the scanner struct
      so that the caller can use it if he wants */
   s->rs_info = get_RS_information (sensed_data);
@@ -9794,8 +10501,65 @@ must_fully_buffer(struct fujitsu *s)
   }
 
   if(
-    (s->swdeskew || s->swdespeck || s->swcrop || s->swskip)
+    (s->swdespeck || s->swcrop)
+    && s->s_params.format != SANE_FRAME_JPEG
+  ){
+    return 1;
+  }
+
+  if(
+    (s->swdeskew || s->swskip)
+    && s->s_params.format != SANE_FRAME_JPEG
+    && !can_stream(s)
+  ){
+    return 1;
+  }
+
+#ifdef HAVE_LIBJPEG
+  /* crop and blank detection work on the coefficients of the jpeg */
+  if(
+    (s->swcrop || s->swskip)
+    && s->s_params.format == SANE_FRAME_JPEG
+  ){
+    return 1;
+  }
+#endif
+
+  return 0;
+}
+
+/* deskew and blank page detection only need to see the start of the
+ * image, and can process the rest as it arrives. The image is still
+ * collected in a buffer for the whole page, and must arrive in order */
+static int
+can_stream(struct fujitsu *s)
+{
+  if(s->low_mem || s->ald){
+    return 0;
+  }
+
+  if(s->s_mode == MODE_COLOR && s->color_interlace == COLOR_INTERLACE_3091){
+    return 0;
+  }
+
+  if(s->source == SOURCE_ADF_DUPLEX
+    && s->duplex_interlace == DUPLEX_INTERLACE_3091
+  ){
+    return 0;
+  }
+
+  return 1;
+}
+
+/* certain options need the start of the image
+ * before we can send any of it to the user. */
+static int
+must_stream_buffer(struct fujitsu *s)
+{
+  if(
+    (s->swdeskew || s->swskip)
     && s->s_params.format != SANE_FRAME_JPEG
+    && !must_fully_buffer(s)
   ){
     return 1;
   }
@@ -10028,106 +10792,135 @@ sane_get_select_fd (SANE_Handle h, SANE_Int *fdp)
  * @@ Section 7 - Image processing functions
  */
 
-/* Look in image for likely upper and left paper edges, then rotate
- * image so that upper left corner of paper is upper left of image.
+/* Rotate image so that upper left corner of paper is upper left of
+ * image, using the skew found by find_deskew().
  * FIXME: should we do this before we binarize instead of after? */
 static SANE_Status
-buffer_deskew(struct fujitsu *s, int side)
+buffer_deskew(struct fujitsu *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
 
-  int bg_color = 0xd6;
-
   DBG (10, "buffer_deskew: start\n");
 
+  if(s->deskew_stat[side]){
+    DBG (5, "buffer_deskew: bad findSkew, bailing\n");
+    goto cleanup;
+  }
+
+  ret = sanei_magic_rotate(params,s->buffers[side],
+    s->deskew_vals[side][0],s->deskew_vals[side][1],s->deskew_slope[side],
+    deskew_bg_color(s));
+
+  if(ret){
+    DBG(5,"buffer_deskew: rotate error: %d",ret);
+    ret = SANE_STATUS_GOOD;
+    goto cleanup;
+  }
+
+  cleanup:
+  DBG (10, "buffer_deskew: finish\n");
+  return ret;
+}
+
+/* Load deskew_vals and deskew_slope for the image in buffers[side].
+ * params may describe just the first part of the image, partial is set
+ * then, and the bottom edge of the page is not looked for. */
+static SANE_Status
+find_deskew(struct fujitsu *s, int side, SANE_Parameters * params, int partial)
+{
   /*only find skew on first image from a page, or if first image had error */
-  if(s->side == SIDE_FRONT || s->source == SOURCE_ADF_BACK || s->deskew_stat){
+  if(side == SIDE_FRONT || s->source == SOURCE_ADF_BACK
+    || s->deskew_stat[SIDE_FRONT]){
 
-    s->deskew_stat = sanei_magic_findSkew(
-      &s->s_params,s->buffers[side],s->resolution_x,s->resolution_y,
-      &s->deskew_vals[0],&s->deskew_vals[1],&s->deskew_slope);
+    if(partial){
+      s->deskew_stat[side] = sanei_magic_findSkewTop(
+        params,s->buffers[side],s->resolution_x,s->resolution_y,
+        &s->deskew_vals[side][0],&s->deskew_vals[side][1],
+        &s->deskew_slope[side]);
+    }
+    else{
+      s->deskew_stat[side] = sanei_magic_findSkew(
+        params,s->buffers[side],s->resolution_x,s->resolution_y,
+        &s->deskew_vals[side][0],&s->deskew_vals[side][1],
+        &s->deskew_slope[side]);
+    }
 
-    if(s->deskew_stat){
-      DBG (5, "buffer_deskew: bad findSkew, bailing\n");
-      goto cleanup;
+    if(s->deskew_stat[side]){
+      DBG (5, "find_deskew: bad findSkew\n");
+      return s->deskew_stat[side];
     }
   }
   /* backside images can use a 'flipped' version of frontside data */
   else{
-    s->deskew_slope *= -1;
-    s->deskew_vals[0] = s->s_params.pixels_per_line - s->deskew_vals[0];
+    s->deskew_stat[side] = SANE_STATUS_GOOD;
+    s->deskew_slope[side] = -s->deskew_slope[SIDE_FRONT];
+    s->deskew_vals[side][0]
+      = params->pixels_per_line - s->deskew_vals[SIDE_FRONT][0];
+    s->deskew_vals[side][1] = s->deskew_vals[SIDE_FRONT][1];
   }
 
-  /* tweak the bg color based on scanner settings */
-  if(s->s_mode == MODE_HALFTONE || s->s_mode == MODE_LINEART){
-    if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
-      bg_color = 0xff;
-    else
-      bg_color = 0;
-  }
-  else if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
-    bg_color = 0;
+  return SANE_STATUS_GOOD;
+}
 
-  ret = sanei_magic_rotate(&s->s_params,s->buffers[side],
-    s->deskew_vals[0],s->deskew_vals[1],s->deskew_slope,bg_color);
+/* color of the image corners exposed by deskew */
+static int
+deskew_bg_color(struct fujitsu *s)
+{
+  int bg_color = 0xd6;
 
-  if(ret){
-    DBG(5,"buffer_deskew: rotate error: %d",ret);
-    ret = SANE_STATUS_GOOD;
-    goto cleanup;
+  /* tweak the bg color based on scanner settings */
+  if(s->s_mode == MODE_HALFTONE || s->s_mode == MODE_LINEART){
+    if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
+      bg_color = 0xff;
+    else
+      bg_color = 0;
   }
+  else if(s->bg_color == COLOR_BLACK || s->hwdeskewcrop || s->overscan)
+    bg_color = 0;
 
-  cleanup:
-  DBG (10, "buffer_deskew: finish\n");
-  return ret;
+  return bg_color;
 }
 
 /* Look in image for likely left/right/bottom paper edges, then crop image.
  * Does not attempt to rotate the image, that should be done first.
+ * The new size is left in params, see buffer_apply(). Returns an error
+ * if the image was not cropped.
  * FIXME: should we do this before we binarize instead of after? */
 static SANE_Status
-buffer_crop(struct fujitsu *s, int side)
+buffer_crop(struct fujitsu *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
+  int crop_vals[4];
 
   DBG (10, "buffer_crop: start\n");
 
   ret = sanei_magic_findEdges(
-    &s->s_params,s->buffers[side],s->resolution_x,s->resolution_y,
-    &s->crop_vals[0],&s->crop_vals[1],&s->crop_vals[2],&s->crop_vals[3]);
+    params,s->buffers[side],s->resolution_x,s->resolution_y,
+    &crop_vals[0],&crop_vals[1],&crop_vals[2],&crop_vals[3]);
 
   if(ret){
     DBG (5, "buffer_crop: bad edges, bailing\n");
-    ret = SANE_STATUS_GOOD;
     goto cleanup;
   }
 
   DBG (15, "buffer_crop: t:%d b:%d l:%d r:%d\n",
-    s->crop_vals[0],s->crop_vals[1],s->crop_vals[2],s->crop_vals[3]);
+    crop_vals[0],crop_vals[1],crop_vals[2],crop_vals[3]);
 
   /* if we will later binarize this image, make sure the width
    * is a multiple of 8 pixels, by adjusting the right side */
   if ( must_downsample(s) && s->u_mode < MODE_GRAYSCALE ){
-    s->crop_vals[3] -= (s->crop_vals[3]-s->crop_vals[2]) % 8;
+    crop_vals[3] -= (crop_vals[3]-crop_vals[2]) % 8;
   }
 
   /* now crop the image */
-  ret = sanei_magic_crop(&s->s_params,s->buffers[side],
-      s->crop_vals[0],s->crop_vals[1],s->crop_vals[2],s->crop_vals[3]);
+  ret = sanei_magic_crop(params,s->buffers[side],
+      crop_vals[0],crop_vals[1],crop_vals[2],crop_vals[3]);
 
   if(ret){
     DBG (5, "buffer_crop: bad crop, bailing\n");
-    ret = SANE_STATUS_GOOD;
     goto cleanup;
   }
 
-  /* need to update user with new size */
-  update_u_params(s);
-
-  /* update image size counter to new, smaller size */
-  s->bytes_rx[side] = s->s_params.lines * s->s_params.bytes_per_line;
-  s->buff_rx[side] = s->bytes_rx[side];
-
   cleanup:
   DBG (10, "buffer_crop: finish\n");
   return ret;
@@ -10137,13 +10930,13 @@ buffer_crop(struct fujitsu *s, int side)
  * Replace the spots with the average color of the surrounding pixels.
  * FIXME: should we do this before we binarize instead of after? */
 static SANE_Status
-buffer_despeck(struct fujitsu *s, int side)
+buffer_despeck(struct fujitsu *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
 
   DBG (10, "buffer_despeck: start\n");
 
-  ret = sanei_magic_despeck(&s->s_params,s->buffers[side],s->swdespeck);
+  ret = sanei_magic_despeck(params,s->buffers[side],s->swdespeck);
   if(ret){
     DBG (5, "buffer_despeck: bad despeck, bailing\n");
     ret = SANE_STATUS_GOOD;
@@ -10157,14 +10950,14 @@ buffer_despeck(struct fujitsu *s, int side)
 
 /* Look if image has too few dark pixels.*/
 static int
-buffer_isblank(struct fujitsu *s, int side)
+buffer_isblank(struct fujitsu *s, int side, SANE_Parameters * params)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
   int status = 0;
 
   DBG (10, "buffer_isblank: start\n");
 
-  ret = sanei_magic_isBlank2(&s->s_params, s->buffers[side],
+  ret = sanei_magic_isBlank2(params, s->buffers[side],
     s->resolution_x, s->resolution_y, s->swskip);
 
   if(ret == SANE_STATUS_NO_DOCS){
@@ -10178,3 +10971,663 @@ buffer_isblank(struct fujitsu *s, int side)
   DBG (10, "buffer_isblank: finished\n");
   return status;
 }
+
+#ifdef HAVE_LIBJPEG
+/* Blank detection and cropping of jpeg images are done on the DCT
+ * coefficients, without decoding the image. The DC coefficient of each
+ * 8x8 block of the luminance gives the mean of the block, so the image
+ * is looked at as a thumbnail with one pixel per block. Cropping keeps
+ * the coefficients of the blocks inside the page, and writes them out
+ * again with new huffman codes, so it does not lose any quality. */
+
+struct JPEG_error {
+  struct jpeg_error_mgr pub;
+  jmp_buf jmp;
+};
+
+struct JPEG_dest {
+  struct jpeg_destination_mgr pub;
+  JOCTET * buf;
+  size_t size;
+  size_t len;
+};
+
+static void
+error_exit_JPEG(j_common_ptr cinfo)
+{
+  char msg[JMSG_LENGTH_MAX];
+
+  (*cinfo->err->format_message) (cinfo, msg);
+  DBG (5, "error_exit_JPEG: %s\n", msg);
+  longjmp(((struct JPEG_error *)cinfo->err)->jmp, 1);
+}
+
+static void
+output_message_JPEG(j_common_ptr cinfo)
+{
+  char msg[JMSG_LENGTH_MAX];
+
+  (*cinfo->err->format_message) (cinfo, msg);
+  DBG (15, "output_message_JPEG: %s\n", msg);
+}
+
+/* the whole image is in the buffer already */
+static void
+init_source_JPEG(j_decompress_ptr cinfo)
+{
+  (void) cinfo;
+}
+
+static boolean
+fill_input_JPEG(j_decompress_ptr cinfo)
+{
+  static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+
+  /* truncated image, end it */
+  WARNMS(cinfo, JWRN_JPEG_EOF);
+  cinfo->src->next_input_byte = eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+static void
+skip_input_JPEG(j_decompress_ptr cinfo, long num_bytes)
+{
+  if(num_bytes <= 0){
+    return;
+  }
+  if((size_t)num_bytes > cinfo->src->bytes_in_buffer){
+    num_bytes = cinfo->src->bytes_in_buffer;
+  }
+  cinfo->src->next_input_byte += num_bytes;
+  cinfo->src->bytes_in_buffer -= num_bytes;
+}
+
+static void
+term_source_JPEG(j_decompress_ptr cinfo)
+{
+  (void) cinfo;
+}
+
+static void
+init_dest_JPEG(j_compress_ptr cinfo)
+{
+  struct JPEG_dest * dest = (struct JPEG_dest *)cinfo->dest;
+
+  dest->size = 64 * 1024;
+  dest->buf = malloc(dest->size);
+  if(!dest->buf){
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+  }
+  dest->pub.next_output_byte = dest->buf;
+  dest->pub.free_in_buffer = dest->size;
+}
+
+static boolean
+empty_output_JPEG(j_compress_ptr cinfo)
+{
+  struct JPEG_dest * dest = (struct JPEG_dest *)cinfo->dest;
+  JOCTET * buf = realloc(dest->buf, dest->size * 2);
+
+  if(!buf){
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 1);
+  }
+  dest->buf = buf;
+  dest->pub.next_output_byte = buf + dest->size;
+  dest->pub.free_in_buffer = dest->size;
+  dest->size *= 2;
+  return TRUE;
+}
+
+static void
+term_dest_JPEG(j_compress_ptr cinfo)
+{
+  struct JPEG_dest * dest = (struct JPEG_dest *)cinfo->dest;
+
+  dest->len = dest->size - dest->pub.free_in_buffer;
+}
+
+/* set up cinfo to read the jpeg in buffers[side], and read
+ * its coefficients. Must be called after the setjmp of err. */
+static jvirt_barray_ptr *
+read_coefs_JPEG(struct fujitsu *s, int side, j_decompress_ptr cinfo,
+  struct JPEG_error * err, struct jpeg_source_mgr * src)
+{
+  cinfo->err = jpeg_std_error(&err->pub);
+  err->pub.error_exit = error_exit_JPEG;
+  err->pub.output_message = output_message_JPEG;
+  jpeg_create_decompress(cinfo);
+
+  src->init_source = init_source_JPEG;
+  src->fill_input_buffer = fill_input_JPEG;
+  src->skip_input_data = skip_input_JPEG;
+  src->resync_to_restart = jpeg_resync_to_restart;
+  src->term_source = term_source_JPEG;
+  src->next_input_byte = s->buffers[side];
+  src->bytes_in_buffer = s->buff_rx[side];
+  cinfo->src = src;
+
+  jpeg_read_header(cinfo, TRUE);
+  return jpeg_read_coefficients(cinfo);
+}
+
+/* make an 8 bit gray image with the mean of each luminance block */
+static unsigned char *
+thumbnail_JPEG(j_decompress_ptr cinfo, jvirt_barray_ptr * coefs,
+  int * width, int * height)
+{
+  jpeg_component_info * comp = cinfo->comp_info;
+  int q = comp->quant_table->quantval[0];
+  unsigned char * thumb;
+  int x, y;
+
+  *width = comp->width_in_blocks;
+  *height = comp->height_in_blocks;
+
+  thumb = malloc(*width * *height);
+  if(!thumb){
+    DBG (5, "thumbnail_JPEG: no thumb\n");
+    return NULL;
+  }
+
+  for(y=0; y<*height; y++){
+    JBLOCKARRAY row = (*cinfo->mem->access_virt_barray)
+      ((j_common_ptr)cinfo, coefs[0], y, 1, FALSE);
+
+    for(x=0; x<*width; x++){
+      /* the DC coefficient is 8 times the mean, less 128 */
+      int mean = row[0][x][0] * q / 8 + 128;
+
+      if(mean < 0)
+        mean = 0;
+      if(mean > 255)
+        mean = 255;
+      thumb[y * *width + x] = mean;
+    }
+  }
+
+  return thumb;
+}
+
+/* Look for the paper edges in a thumbnail of the jpeg, then keep the
+ * blocks inside. The left and top edges move to a whole number of
+ * MCUs, which is the only place a jpeg can be cut without decoding.
+ * The new image replaces the old one, its size is left in params and
+ * jpeg_len, see buffer_apply(). Returns an error if not cropped. */
+static SANE_Status
+buffer_crop_JPEG(struct fujitsu *s, int side, SANE_Parameters * params)
+{
+  SANE_Status ret = SANE_STATUS_INVAL;
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct dst;
+  struct JPEG_error err;
+  struct jpeg_source_mgr srcmgr;
+  struct JPEG_dest destmgr;
+  jvirt_barray_ptr * coefs;
+  SANE_Parameters tparams;
+  unsigned char * volatile thumb = NULL;
+  JBLOCK * volatile tmp = NULL;
+  volatile int have_dst = 0;
+  int crop_vals[4];
+  int mcu_w, mcu_h, left, top, right, bot;
+  int ci, y;
+
+  DBG (10, "buffer_crop_JPEG: start\n");
+
+  memset(&destmgr, 0, sizeof(destmgr));
+
+  if(setjmp(err.jmp)){
+    DBG (5, "buffer_crop_JPEG: jpeg error, bailing\n");
+    ret = SANE_STATUS_IO_ERROR;
+    goto cleanup;
+  }
+
+  coefs = read_coefs_JPEG(s, side, &src, &err, &srcmgr);
+
+  /* look for the edges in the thumbnail */
+  thumb = thumbnail_JPEG(&src, coefs, &tparams.pixels_per_line,
+    &tparams.lines);
+  if(!thumb){
+    ret = SANE_STATUS_NO_MEM;
+    goto cleanup;
+  }
+  tparams.format = SANE_FRAME_GRAY;
+  tparams.depth = 8;
+  tparams.bytes_per_line = tparams.pixels_per_line;
+  tparams.last_frame = 1;
+
+  ret = sanei_magic_findEdges(
+    &tparams,thumb,s->resolution_x/DCTSIZE,s->resolution_y/DCTSIZE,
+    &crop_vals[0],&crop_vals[1],&crop_vals[2],&crop_vals[3]);
+
+  if(ret){
+    DBG (5, "buffer_crop_JPEG: bad edges, bailing\n");
+    goto cleanup;
+  }
+
+  DBG (15, "buffer_crop_JPEG: blocks t:%d b:%d l:%d r:%d\n",
+    crop_vals[0],crop_vals[1],crop_vals[2],crop_vals[3]);
+
+  /* whole MCUs at the top left, whole blocks at the bottom right */
+  mcu_w = src.max_h_samp_factor * DCTSIZE;
+  mcu_h = src.max_v_samp_factor * DCTSIZE;
+  left = crop_vals[2] * DCTSIZE / mcu_w * mcu_w;
+  top = crop_vals[0] * DCTSIZE / mcu_h * mcu_h;
+  right = (crop_vals[3] + 1) * DCTSIZE;
+  bot = (crop_vals[1] + 1) * DCTSIZE;
+  if(right > (int)src.image_width)
+    right = src.image_width;
+  if(bot > (int)src.image_height)
+    bot = src.image_height;
+
+  if(left == 0 && top == 0
+    && right == (int)src.image_width && bot == (int)src.image_height){
+    DBG (5, "buffer_crop_JPEG: nothing to crop\n");
+    ret = SANE_STATUS_INVAL;
+    goto cleanup;
+  }
+
+  /* move the blocks to keep to the top left, in place */
+  for(ci=0; ci<src.num_components; ci++){
+    jpeg_component_info * comp = src.comp_info + ci;
+    int xoff = left / mcu_w * comp->h_samp_factor;
+    int yoff = top / mcu_h * comp->v_samp_factor;
+    int w = comp->width_in_blocks - xoff;
+
+    if(!xoff && !yoff)
+      continue;
+
+    tmp = realloc(tmp, w * sizeof(JBLOCK));
+    if(!tmp){
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+
+    for(y=0; y + yoff < (int)comp->height_in_blocks; y++){
+      JBLOCKARRAY row = (*src.mem->access_virt_barray)
+        ((j_common_ptr)&src, coefs[ci], y + yoff, 1, FALSE);
+      memcpy(tmp, row[0] + xoff, w * sizeof(JBLOCK));
+
+      row = (*src.mem->access_virt_barray)
+        ((j_common_ptr)&src, coefs[ci], y, 1, TRUE);
+      memcpy(row[0], tmp, w * sizeof(JBLOCK));
+    }
+  }
+
+  /* write the blocks out as a smaller image */
+  dst.err = &err.pub;
+  jpeg_create_compress(&dst);
+  have_dst = 1;
+
+  destmgr.pub.init_destination = init_dest_JPEG;
+  destmgr.pub.empty_output_buffer = empty_output_JPEG;
+  destmgr.pub.term_destination = term_dest_JPEG;
+  dst.dest = &destmgr.pub;
+
+  jpeg_copy_critical_parameters(&src, &dst);
+  dst.image_width = right - left;
+  dst.image_height = bot - top;
+  dst.restart_interval = src.restart_interval;
+  dst.write_JFIF_header = TRUE;
+  dst.density_unit = 1;
+  dst.X_density = s->resolution_x;
+  dst.Y_density = s->resolution_y;
+
+  jpeg_write_coefficients(&dst, coefs);
+  jpeg_finish_compress(&dst);
+  jpeg_finish_decompress(&src);
+
+  /* the new image is smaller, unless the huffman tables were better */
+  if(destmgr.len > (size_t)s->buff_tot[side]){
+    DBG (5, "buffer_crop_JPEG: cropped image too large, bailing\n");
+    ret = SANE_STATUS_NO_MEM;
+    goto cleanup;
+  }
+
+  memcpy(s->buffers[side], destmgr.buf, destmgr.len);
+  s->jpeg_len[side] = destmgr.len;
+
+  params->pixels_per_line = dst.image_width;
+  params->lines = dst.image_height;
+  params->bytes_per_line = dst.image_width * dst.num_components;
+  ret = SANE_STATUS_GOOD;
+
+  DBG (15, "buffer_crop_JPEG: l:%d t:%d w:%d h:%d len:%d\n",
+    left, top, params->pixels_per_line, params->lines, s->jpeg_len[side]);
+
+  cleanup:
+  if(have_dst)
+    jpeg_destroy_compress(&dst);
+  jpeg_destroy_decompress(&src);
+  free(destmgr.buf);
+  free(tmp);
+  free(thumb);
+
+  DBG (10, "buffer_crop_JPEG: finish\n");
+  return ret;
+}
+
+/* Look if the jpeg has too few dark pixels. Same as
+ * sanei_magic_isBlank2(), but with the mean of each block. The half
+ * inch squares are a whole number of blocks, so this only differs for
+ * color, where the luminance is used */
+static int
+buffer_isblank_JPEG(struct fujitsu *s, int side, SANE_Parameters * params)
+{
+  struct jpeg_decompress_struct src;
+  struct JPEG_error err;
+  struct jpeg_source_mgr srcmgr;
+  jvirt_barray_ptr * coefs;
+  unsigned char * volatile thumb = NULL;
+  volatile int status = 0;
+  int width, height;
+
+  /* .25 inch, in blocks */
+  int xquarter = s->resolution_x/4/8;
+  int yquarter = s->resolution_y/4/8;
+  int xhalf = xquarter*2;
+  int yhalf = yquarter*2;
+  int xblocks, yblocks, xb, yb, x, y;
+  double thresh = s->swskip / 100;
+
+  (void) params;
+
+  DBG (10, "buffer_isblank_JPEG: start\n");
+
+  if(setjmp(err.jmp)){
+    DBG (5, "buffer_isblank_JPEG: jpeg error, not blank\n");
+    status = 0;
+    goto cleanup;
+  }
+
+  coefs = read_coefs_JPEG(s, side, &src, &err, &srcmgr);
+  thumb = thumbnail_JPEG(&src, coefs, &width, &height);
+  if(!thumb){
+    goto cleanup;
+  }
+
+  xblocks = xhalf ? (width-xhalf)/xhalf : 0;
+  yblocks = yhalf ? (height-yhalf)/yhalf : 0;
+  status = 1;
+
+  for(yb=0; yb<yblocks && status; yb++){
+    for(xb=0; xb<xblocks; xb++){
+
+      /* count darkness of the blocks in this square */
+      int sum = 0;
+      double darkness;
+
+      for(y=0; y<yhalf; y++){
+        unsigned char * ptr = thumb
+          + (yquarter + yb*yhalf + y) * width + xquarter + xb*xhalf;
+        for(x=0; x<xhalf; x++){
+          sum += 255 - ptr[x];
+        }
+      }
+      darkness = (double)sum/(xhalf*yhalf)/255;
+
+      /* square was darker than thresh, keep image */
+      if(darkness > thresh){
+        DBG (15, "buffer_isblank_JPEG: not blank %f %d %d\n",
+          darkness, yb, xb);
+        status = 0;
+        break;
+      }
+    }
+  }
+
+  if(status){
+    DBG (5, "buffer_isblank_JPEG: blank!\n");
+  }
+
+  cleanup:
+  jpeg_destroy_decompress(&src);
+  free(thumb);
+
+  DBG (10, "buffer_isblank_JPEG: finished\n");
+  return status;
+}
+#endif
+
+/* Adjust a fully buffered image as required, once find_deskew() has run.
+ * Only changes buffers[side] and params, so it can run in a thread for
+ * one side while the other is sent. driv_crop is set if software deskew
+ * and crop may be used. Sets
+ * cropped if the size changed, returns 1 if the image is blank and
+ * should be skipped. */
+static int
+buffer_process(struct fujitsu *s, int side, SANE_Parameters * params,
+  int driv_crop, int * cropped)
+{
+  *cropped = 0;
+
+  if(s->s_params.format == SANE_FRAME_JPEG){
+#ifdef HAVE_LIBJPEG
+    if(s->swcrop && driv_crop && !buffer_crop_JPEG(s,side,params)){
+      *cropped = 1;
+    }
+    if(s->swskip){
+      return buffer_isblank_JPEG(s,side,params);
+    }
+#endif
+    return 0;
+  }
+
+  if(s->swdeskew && driv_crop){
+    buffer_deskew(s,side,params);
+  }
+  if(s->swcrop && driv_crop && !buffer_crop(s,side,params)){
+    *cropped = 1;
+  }
+  if(s->swdespeck){
+    buffer_despeck(s,side,params);
+  }
+  if(s->swskip){
+    return buffer_isblank(s,side,params);
+  }
+  return 0;
+}
+
+/* tell the user about the new size of a cropped image in s_params */
+static void
+buffer_apply(struct fujitsu *s, int side)
+{
+  update_u_params(s);
+
+  /* update image size counter to new, smaller size */
+  if(s->s_params.format == SANE_FRAME_JPEG){
+    s->bytes_rx[side] = s->jpeg_len[side];
+  }
+  else{
+    s->bytes_rx[side] = s->s_params.lines * s->s_params.bytes_per_line;
+  }
+  s->buff_rx[side] = s->bytes_rx[side];
+}
+
+#ifdef USE_PTHREAD
+static void *
+post_thread(void *arg)
+{
+  struct fujitsu *s = arg;
+  int driv_crop = !s->hwdeskewcrop || s->post_req_driv_crop;
+
+  DBG (10, "post_thread: start\n");
+
+  if(s->swdeskew && driv_crop){
+    find_deskew(s,SIDE_BACK,&s->post_params,0);
+  }
+  s->post_blank = buffer_process(s,SIDE_BACK,&s->post_params,
+    driv_crop,&s->post_cropped);
+
+  DBG (10, "post_thread: finish\n");
+  return NULL;
+}
+#endif
+
+/* Called when the front side of a fully buffered duplex page has been
+ * read and processed far enough that its skew is known. If the back side
+ * has been read completely too, asks the scanner for its size and starts
+ * processing it, so that it is done by the time the user has read the
+ * front side. Otherwise, or without threads, the back side is processed
+ * when it is started. */
+static SANE_Status
+post_start(struct fujitsu *s)
+{
+#ifdef USE_PTHREAD
+  SANE_Parameters s_params = s->s_params;
+  SANE_Parameters u_params = s->u_params;
+  int req_driv_crop = s->req_driv_crop;
+  int req_driv_lut = s->req_driv_lut;
+  SANE_Status ret;
+
+  DBG (10, "post_start: start\n");
+
+  if(s->post_done || !s->eof_rx[SIDE_BACK]
+    || s->buff_tot[SIDE_BACK] < s->bytes_tot[SIDE_BACK]){
+    DBG (10, "post_start: back side not buffered\n");
+    return SANE_STATUS_GOOD;
+  }
+
+  /* hardware deskew will tell image size after transfer */
+  s->side = SIDE_BACK;
+  ret = get_pixelsize(s,1);
+  s->side = SIDE_FRONT;
+
+  s->post_params = s->s_params;
+  s->post_req_driv_crop = s->req_driv_crop;
+  s->post_req_driv_lut = s->req_driv_lut;
+
+  s->s_params = s_params;
+  s->u_params = u_params;
+  s->req_driv_crop = req_driv_crop;
+  s->req_driv_lut = req_driv_lut;
+
+  if (ret != SANE_STATUS_GOOD) {
+    DBG (5, "post_start: cannot get back pixelsize, processing later\n");
+    return SANE_STATUS_GOOD;
+  }
+
+  if(pthread_create(&s->post_thread, NULL, post_thread, s)){
+    DBG (5, "post_start: cannot start thread, processing later\n");
+    return SANE_STATUS_GOOD;
+  }
+  s->post_running = 1;
+  s->post_done = 1;
+
+  DBG (10, "post_start: finish\n");
+#else
+  (void) s;
+#endif
+  return SANE_STATUS_GOOD;
+}
+
+/* Wait for the back side processing started by post_start(), the
+ * results stay in post_params and post_blank until the back side is
+ * started. Must be called before anything else touches the scanner
+ * struct or the image buffers. */
+static void
+post_wait(struct fujitsu *s)
+{
+  if(!s->post_running){
+    return;
+  }
+
+  DBG (10, "post_wait: waiting\n");
+#ifdef USE_PTHREAD
+  pthread_join(s->post_thread, NULL);
+#endif
+  s->post_running = 0;
+}
+
+/* Called while the start of the image is being read. Finds the skew
+ * once the first inch has arrived, and checks for a block that is not
+ * blank as lines get deskewed. Returns 1 once sending can start, or 0
+ * if the whole image has been read and it is blank. */
+static int
+stream_ready(struct fujitsu *s, int side)
+{
+  SANE_Parameters params = s->s_params;
+  int lines = s->bytes_rx[side] / s->s_params.bytes_per_line;
+
+  if(s->eof_rx[side]){
+    lines = s->s_params.lines;
+  }
+
+  if(s->swdeskew && !s->stream_skew[side]){
+
+    if(lines < s->resolution_y && !s->eof_rx[side]){
+      return 0;
+    }
+
+    s->stream_skew[side] = 1;
+
+    params.lines = lines;
+    if(find_deskew(s,side,&params,lines < s->s_params.lines)){
+      DBG (5, "stream_ready: bad findSkew, not rotating\n");
+    }
+    else if(sanei_magic_rotateStart(&s->s_params,s->buffers[side],
+      s->deskew_vals[side][0],s->deskew_vals[side][1],s->deskew_slope[side],
+      deskew_bg_color(s),SANE_FALSE,&s->stream_rot[side])
+    ){
+      DBG (5, "stream_ready: cannot rotate\n");
+    }
+
+    stream_rotate(s,side);
+  }
+
+  if(s->swskip && !s->stream_ink[side]){
+
+    if(s->stream_rot[side]){
+      lines = s->stream_lines[side];
+    }
+
+    /* only look again once another row of 1/2 inch blocks is ready */
+    if(lines < s->stream_checked[side] + s->resolution_y/2
+      && lines < s->s_params.lines){
+      return 0;
+    }
+    s->stream_checked[side] = lines;
+
+    params.lines = lines;
+    if(sanei_magic_isBlank2(&params, s->buffers[side],
+      s->resolution_x, s->resolution_y, s->swskip) != SANE_STATUS_NO_DOCS
+    ){
+      s->stream_ink[side] = 1;
+    }
+    else{
+      if(lines >= s->s_params.lines)
+        DBG (5, "stream_ready: blank!\n");
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* deskew as many lines as have arrived */
+static void
+stream_rotate(struct fujitsu *s, int side)
+{
+  int lines = s->bytes_rx[side] / s->s_params.bytes_per_line;
+
+  if(!s->stream_rot[side]){
+    return;
+  }
+
+  if(s->eof_rx[side]){
+    lines = s->s_params.lines;
+  }
+
+  s->stream_lines[side] = sanei_magic_rotateLines(s->stream_rot[side], lines);
+}
+
+static void
+stream_reset(struct fujitsu *s, int side)
+{
+  sanei_magic_rotateFinish(s->stream_rot[side]);
+  s->stream_rot[side] = NULL;
+  s->stream_lines[side] = 0;
+  s->stream_skew[side] = 0;
+  s->stream_ink[side] = 0;
+  s->stream_checked[side] = 0;
+}
@@ -147,6 +147,7 @@ struct fujitsu
   /* --------------------------------------------------------------------- */
   /* immutable values which are set during reading of config file.         */
   int buffer_size;
+  int read_ahead;               /* megabytes for sheets read ahead */
   int connection;               /* hardware interface type */
 
   /* --------------------------------------------------------------------- */
@@ -566,11 +567,36 @@ struct fujitsu
 
   /* --------------------------------------------------------------------- */
   /* values used by the software enhancment code (deskew, crop, etc)       */
-  SANE_Status deskew_stat;
-  int deskew_vals[2];
-  double deskew_slope;
+  /* per side, the back side can reuse the front side values */
+  SANE_Status deskew_stat[2];
+  int deskew_vals[2][2];
+  double deskew_slope[2];
+
+  /* deskew and blank detection done while the image is read */
+  SANEI_Magic_Rotator * stream_rot[2];
+  int stream_lines[2];
+  int stream_skew[2];
+  int stream_ink[2];
+  int stream_checked[2];
+
+  /* the back side of a fully buffered duplex page is processed in a
+   * thread while the front side is sent to the user */
+  int post_running;
+  int post_done;
+  int post_blank;
+  int post_cropped;
+  int post_req_driv_crop;
+  int post_req_driv_lut;
+  SANE_Parameters post_params;
+#ifdef USE_PTHREAD
+  pthread_t post_thread;
+#endif
 
-  int crop_vals[4];
+  /* following sheets of an adf batch read by a thread, see read_ahead_start.
+   * the scan sizes the scanner gave for a sheet are kept with it */
+  struct read_ahead * ahead;
+  int ahead_sheet;
+  unsigned char ahead_psize[2][2][R_PSIZE_len];
 
   /* --------------------------------------------------------------------- */
   /* values used by the compression functions, esp. jpeg with duplex       */
@@ -579,6 +605,7 @@ struct fujitsu
   int jpeg_front_rst;
   int jpeg_back_rst;
   int jpeg_x_byte;
+  int jpeg_len[2];      /* size of a jpeg after software crop */
 
   /* --------------------------------------------------------------------- */
   /* values which used by the command and data sending functions (scsi/usb)*/
@@ -810,6 +837,8 @@ static SANE_Status set_off_mode(struct fujitsu *s);
 
 static int must_downsample (struct fujitsu *s);
 static int must_fully_buffer (struct fujitsu *s);
+static int can_stream (struct fujitsu *s);
+static int must_stream_buffer (struct fujitsu *s);
 static int get_page_width (struct fujitsu *s);
 static int get_page_height (struct fujitsu *s);
 static int get_ipc_mode (struct fujitsu *s);
@@ -828,6 +857,7 @@ static SANE_Status start_scan (struct fujitsu *s);
 
 static SANE_Status check_for_cancel(struct fujitsu *s);
 
+static SANE_Status read_block(struct fujitsu *s);
 static SANE_Status read_from_JPEGduplex(struct fujitsu *s);
 static SANE_Status read_from_3091duplex(struct fujitsu *s);
 static SANE_Status read_from_scanner(struct fujitsu *s, int side);
@@ -836,17 +866,39 @@ static SANE_Status copy_3091(struct fujitsu *s, unsigned char * buf, int len, in
 static SANE_Status copy_JPEG(struct fujitsu *s, unsigned char * buf, int len, int side);
 static SANE_Status copy_buffer(struct fujitsu *s, unsigned char * buf, int len, int side);
 
+static int buffer_ready(struct fujitsu *s, int side);
 static SANE_Status read_from_buffer(struct fujitsu *s, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len, int side);
 static SANE_Status downsample_from_buffer(struct fujitsu *s, SANE_Byte * buf, SANE_Int max_len, SANE_Int * len, int side);
 
+static void reset_sheet (struct fujitsu *s);
 static SANE_Status setup_buffers (struct fujitsu *s);
 
+static void read_ahead_start (struct fujitsu *s);
+static void read_ahead_stop (struct fujitsu *s);
+static int read_ahead_get (struct fujitsu *s, SANE_Status * ret);
+static SANE_Status read_ahead_sync (struct fujitsu *s);
+
 static SANE_Status get_hardware_status (struct fujitsu *s, SANE_Int option);
 
-static SANE_Status buffer_deskew(struct fujitsu *s, int side);
-static SANE_Status buffer_crop(struct fujitsu *s, int side);
-static SANE_Status buffer_despeck(struct fujitsu *s, int side);
-static int buffer_isblank(struct fujitsu *s, int side);
+static SANE_Status find_deskew(struct fujitsu *s, int side, SANE_Parameters * params,
+  int partial);
+static int deskew_bg_color(struct fujitsu *s);
+static SANE_Status buffer_deskew(struct fujitsu *s, int side, SANE_Parameters * params);
+static SANE_Status buffer_crop(struct fujitsu *s, int side, SANE_Parameters * params);
+static SANE_Status buffer_despeck(struct fujitsu *s, int side, SANE_Parameters * params);
+static int buffer_isblank(struct fujitsu *s, int side, SANE_Parameters * params);
+#ifdef HAVE_LIBJPEG
+static SANE_Status buffer_crop_JPEG(struct fujitsu *s, int side, SANE_Parameters * params);
+static int buffer_isblank_JPEG(struct fujitsu *s, int side, SANE_Parameters * params);
+#endif
+static int buffer_process(struct fujitsu *s, int side, SANE_Parameters * params, int driv_crop, int * cropped);
+static void buffer_apply(struct fujitsu *s, int side);
+static SANE_Status post_start(struct fujitsu *s);
+static void post_wait(struct fujitsu *s);
+
+static int stream_ready(struct fujitsu *s, int side);
+static void stream_rotate(struct fujitsu *s, int side);
+static void stream_reset(struct fujitsu *s, int side);
 
 static void hexdump (int level, char *comment, unsigned char *p, int l);
 
@@ -64,6 +64,14 @@
 #include "genesys.h"
 #include "../include/sane/sanei_config.h"
 #include "../include/sane/sanei_magic.h"
+#include "../include/sane/sanei_calib.h"
+#include "../include/sane/sanei_perf.h"
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 #include "genesys_devices.c"
 
 static SANE_Int num_devices = 0;
@@ -1759,8 +1767,13 @@ genesys_coarse_calibration (Genesys_Device * dev)
   return status;
 }
 
+/* number of components summed at once by genesys_average_data */
+#define AVERAGE_BLOCK 512
+
 /* Averages image data.
    average_data and calibration_data are little endian 16 bit words.
+   The lines are summed block by block, walking each line in memory order
+   so the inner loop can be vectorized.
  */
 #ifndef UNIT_TESTING
 static
@@ -1771,25 +1784,82 @@ genesys_average_data (uint8_t * average_data,
                       uint32_t lines,
 		      uint32_t pixel_components_per_line)
 {
-  uint32_t x, y;
-  uint32_t sum;
+  uint32_t x, y, i, count;
+  uint32_t sum[AVERAGE_BLOCK];
+  uint8_t *src;
 
-  for (x = 0; x < pixel_components_per_line; x++)
+  for (x = 0; x < pixel_components_per_line; x += AVERAGE_BLOCK)
     {
-      sum = 0;
+      count = pixel_components_per_line - x;
+      if (count > AVERAGE_BLOCK)
+	count = AVERAGE_BLOCK;
+
+      memset (sum, 0, count * sizeof (uint32_t));
+      src = calibration_data + x * 2;
       for (y = 0; y < lines; y++)
 	{
-	  sum += calibration_data[(x + y * pixel_components_per_line) * 2];
-	  sum +=
-	    calibration_data[(x + y * pixel_components_per_line) * 2 +
-			     1] * 256;
+#ifdef WORDS_BIGENDIAN
+	  for (i = 0; i < count; i++)
+	    sum[i] += src[i * 2] | (src[i * 2 + 1] << 8);
+#else
+	  for (i = 0; i < count; i++)
+	    sum[i] += ((uint16_t *) src)[i];
+#endif
+	  src += pixel_components_per_line * 2;
+	}
+
+      for (i = 0; i < count; i++)
+	{
+	  sum[i] /= lines;
+	  *average_data++ = sum[i] & 255;
+	  *average_data++ = sum[i] / 256;
 	}
-      sum /= lines;
-      *average_data++ = sum & 255;
-      *average_data++ = sum / 256;
     }
 }
 
+/**
+ * drop shading coefficients, they no longer match the averages
+ * @param shading shading coefficients cache to clear
+ */
+static void
+genesys_shading_cache_clear (Genesys_Shading_Cache * shading)
+{
+  FREE_IFNOT_NULL (shading->data);
+  shading->length = 0;
+  shading->valid = SANE_FALSE;
+}
+
+/**
+ * copy shading coefficients from one cache to another
+ * @param dst cache to fill, its previous data is freed
+ * @param src cache to copy
+ * @return SANE_STATUS_GOOD if OK, SANE_STATUS_NO_MEM if the copy of the
+ * data couldn't be allocated, dst is cleared in this case
+ */
+static SANE_Status
+genesys_shading_cache_copy (Genesys_Shading_Cache * dst,
+			    Genesys_Shading_Cache * src)
+{
+  genesys_shading_cache_clear (dst);
+  if (!src->valid)
+    return SANE_STATUS_GOOD;
+
+  dst->data = malloc (src->length);
+  if (!dst->data)
+    return SANE_STATUS_NO_MEM;
+
+  memcpy (dst->data, src->data, src->length);
+  dst->xres = src->xres;
+  dst->pixels = src->pixels;
+  dst->channels = src->channels;
+  dst->coeff = src->coeff;
+  dst->dpihw = src->dpihw;
+  memcpy (dst->exposure, src->exposure, sizeof (dst->exposure));
+  dst->length = src->length;
+  dst->valid = SANE_TRUE;
+  return SANE_STATUS_GOOD;
+}
+
 /**
  * scans a white area with motor and lamp off to get the per CCD pixel offset
  * that will be used to compute shading coefficient
@@ -1813,6 +1883,7 @@ genesys_dark_shading_calibration (Genesys_Device * dev)
   channels = dev->calib_channels;
 
   FREE_IFNOT_NULL (dev->dark_average_data);
+  genesys_shading_cache_clear (&dev->shading);
 
   dev->average_size = channels * 2 * pixels_per_line;
 
@@ -1941,6 +2012,7 @@ genesys_dummy_dark_shading (Genesys_Device * dev)
   channels = dev->calib_channels;
 
   FREE_IFNOT_NULL (dev->dark_average_data);
+  genesys_shading_cache_clear (&dev->shading);
 
   dev->average_size = channels * 2 * pixels_per_line;
   dev->dark_average_data = malloc (dev->average_size);
@@ -2041,6 +2113,7 @@ genesys_white_shading_calibration (Genesys_Device * dev)
 
   if (dev->white_average_data)
     free (dev->white_average_data);
+  genesys_shading_cache_clear (&dev->shading);
 
   dev->white_average_data = malloc (channels * 2 * pixels_per_line);
   if (!dev->white_average_data)
@@ -2190,6 +2263,7 @@ genesys_dark_white_shading_calibration (Genesys_Device * dev)
 
   if (dev->white_average_data)
     free (dev->white_average_data);
+  genesys_shading_cache_clear (&dev->shading);
 
   dev->average_size = channels * 2 * pixels_per_line;
 
@@ -2861,6 +2935,7 @@ genesys_send_shading_coefficient (Genesys_Device * dev)
   unsigned int factor;
   unsigned int cmat[3];		/**> matrix of color channels */
   unsigned int coeff, target_code, words_per_color = 0;
+  unsigned int dpihw;
 
   DBGSTART;
 
@@ -2872,7 +2947,8 @@ genesys_send_shading_coefficient (Genesys_Device * dev)
    * to the next one, which allow to write the 3 channels in 1 write
    * during genesys_send_shading_coefficient, some values are words, other bytes
    * hence the x2 factor */
-  switch (sanei_genesys_read_reg_from_set (dev->reg, 0x05) >> 6)
+  dpihw = sanei_genesys_read_reg_from_set (dev->reg, 0x05) >> 6;
+  switch (dpihw)
     {
       /* 600 dpi */
     case 0:
@@ -2900,6 +2976,39 @@ genesys_send_shading_coefficient (Genesys_Device * dev)
       words_per_color = 0x5400;
     }
 
+  /* TARGET/(Wn-Dn) = white gain -> ~1.xxx then it is multiplied by 0x2000
+     or 0x4000 to give an integer
+     Wn = white average for column n
+     Dn = dark average for column n
+   */
+  if (dev->model->cmd_set->get_gain4_bit (dev->calib_reg))
+    coeff = 0x4000;
+  else
+    coeff = 0x2000;
+
+  /* coefficients computed from the same averages for the same setup are
+   * still valid, no need to compute them again */
+  if (dev->shading.valid
+      && dev->shading.xres == dev->settings.xres
+      && dev->shading.pixels == pixels_per_line
+      && dev->shading.channels == channels
+      && dev->shading.coeff == coeff
+      && dev->shading.dpihw == dpihw
+      && !memcmp (dev->shading.exposure, dev->sensor.regs_0x10_0x1d,
+		  sizeof (dev->shading.exposure)))
+    {
+      DBG (DBG_info, "%s: using cached shading coefficients\n", __func__);
+      status = genesys_send_offset_and_shading (dev, dev->shading.data,
+						dev->shading.length);
+      if (status != SANE_STATUS_GOOD)
+	{
+	  DBG (DBG_error, "%s: failed to send shading data: %s\n", __func__,
+	       sane_strstatus (status));
+	}
+      DBGCOMPLETED;
+      return SANE_STATUS_GOOD;
+    }
+
   length = words_per_color * 3 * 2;
 
   /* allocate computed size */
@@ -2911,16 +3020,6 @@ genesys_send_shading_coefficient (Genesys_Device * dev)
     }
   memset (shading_data, 0, length);
 
-  /* TARGET/(Wn-Dn) = white gain -> ~1.xxx then it is multiplied by 0x2000
-     or 0x4000 to give an integer
-     Wn = white average for column n
-     Dn = dark average for column n
-   */
-  if (dev->model->cmd_set->get_gain4_bit (dev->calib_reg))
-    coeff = 0x4000;
-  else
-    coeff = 0x2000;
-
   /* compute avg factor */
   if(dev->settings.xres>dev->sensor.optical_res)
     {
@@ -3125,13 +3224,26 @@ genesys_send_shading_coefficient (Genesys_Device * dev)
       break;
     default:
       DBG (DBG_error, "%s: sensor %d not supported\n", __func__, dev->model->ccd_type);
+      free (shading_data);
       return SANE_STATUS_UNSUPPORTED;
       break;
     }
 
+  /* keep the coefficients for the next scans with the same setup */
+  genesys_shading_cache_clear (&dev->shading);
+  dev->shading.xres = dev->settings.xres;
+  dev->shading.pixels = pixels_per_line;
+  dev->shading.channels = channels;
+  dev->shading.coeff = coeff;
+  dev->shading.dpihw = dpihw;
+  memcpy (dev->shading.exposure, dev->sensor.regs_0x10_0x1d,
+	  sizeof (dev->shading.exposure));
+  dev->shading.length = length;
+  dev->shading.data = shading_data;
+  dev->shading.valid = SANE_TRUE;
+
   /* do the actual write of shading calibration data to the scanner */
   status = genesys_send_offset_and_shading (dev, shading_data, length);
-  free (shading_data);
   if (status != SANE_STATUS_GOOD)
     {
       DBG (DBG_error, "%s: failed to send shading data: %s\n", __func__,
@@ -3194,6 +3306,11 @@ genesys_restore_calibration (Genesys_Device * dev)
 	  memcpy (dev->white_average_data,
 		  cache->white_average_data, dev->average_size);
 
+	  /* coefficients computed from these averages, if any */
+	  status = genesys_shading_cache_copy (&dev->shading, &cache->shading);
+	  if (status != SANE_STATUS_GOOD)
+	    return status;
+
 
         if(dev->model->cmd_set->send_shading_data==NULL)
           {
@@ -3296,6 +3413,9 @@ genesys_save_calibration (Genesys_Device * dev)
   cache->calib_channels = dev->calib_channels;
   memcpy (cache->dark_average_data, dev->dark_average_data, cache->average_size);
   memcpy (cache->white_average_data, dev->white_average_data, cache->average_size);
+  status = genesys_shading_cache_copy (&cache->shading, &dev->shading);
+  if (status != SANE_STATUS_GOOD)
+    return status;
 #ifdef HAVE_SYS_TIME_H
   gettimeofday(&time,NULL);
   cache->last_calibration = time.tv_sec;
@@ -3702,6 +3822,7 @@ genesys_sheetfed_calibration (Genesys_Device * dev)
   if (!(dev->model->flags & GENESYS_FLAG_DARK_CALIBRATION))
     {
       FREE_IFNOT_NULL (dev->dark_average_data);
+      genesys_shading_cache_clear (&dev->shading);
       dev->dark_average_data = malloc (dev->average_size);
       memset (dev->dark_average_data, 0x0f, dev->average_size);
       /* XXX STEF XXX
@@ -4124,6 +4245,19 @@ genesys_start_scan (Genesys_Device * dev, SANE_Bool lamp_off)
           DBG (DBG_error, "genesys_start_scan: failed to build lut\n");
           return status;
         }
+
+      /* the lut is only used when there is a threshold curve */
+      sanei_binarize_free (&dev->binarize);
+      status = sanei_binarize_init (&dev->binarize, dev->settings.xres,
+                                    dev->settings.threshold,
+                                    dev->settings.threshold_curve ?
+                                    dev->lineart_lut : NULL,
+                                    SANEI_BINARIZE_NORMALIZE);
+      if (status != SANE_STATUS_GOOD)
+        {
+          DBG (DBG_error, "genesys_start_scan: failed to set up lineart\n");
+          return status;
+        }
     }
 
   status = dev->model->cmd_set->init_regs_for_scan (dev);
@@ -4239,7 +4373,48 @@ genesys_start_scan (Genesys_Device * dev, SANE_Bool lamp_off)
   return SANE_STATUS_GOOD;
 }
 
-/* this is _not_ a ringbuffer.
+#if defined(HAVE_MMAP) && defined(MFD_CLOEXEC)
+/* map the same pages twice in a row, reading or writing past the end of
+ * the first mapping wraps to its start */
+static SANE_Byte *
+genesys_buffer_map_mirror (size_t ring)
+{
+  SANE_Byte *base;
+  int fd;
+
+  fd = memfd_create ("genesys-buffer", MFD_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate (fd, ring) < 0)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  base = mmap (NULL, 2 * ring, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+	       -1, 0);
+  if (base == MAP_FAILED)
+    {
+      close (fd);
+      return NULL;
+    }
+  if (mmap (base, ring, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	    fd, 0) == MAP_FAILED
+      || mmap (base + ring, ring, PROT_READ | PROT_WRITE,
+	       MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+      munmap (base, 2 * ring);
+      close (fd);
+      return NULL;
+    }
+
+  /* the mappings keep the memory */
+  close (fd);
+  return base;
+}
+#endif
+
+/* when the buffer couldn't be mirrored, this is _not_ a ringbuffer.
    if we need a block which does not fit at the end of our available data,
    we move the available data to the beginning.
  */
@@ -4247,11 +4422,32 @@ genesys_start_scan (Genesys_Device * dev, SANE_Bool lamp_off)
 SANE_Status
 sanei_genesys_buffer_alloc (Genesys_Buffer * buf, size_t size)
 {
-  buf->buffer = (SANE_Byte *) malloc (size);
+  buf->buffer = NULL;
+  buf->ring = 0;
+#if defined(HAVE_MMAP) && defined(MFD_CLOEXEC)
+  {
+    long page = sysconf (_SC_PAGESIZE);
+    size_t ring;
+
+    if (page > 0 && size > 0)
+      {
+	ring = (size + page - 1) / page * page;
+	buf->buffer = genesys_buffer_map_mirror (ring);
+	if (buf->buffer)
+	  buf->ring = ring;
+	else
+	  DBG (DBG_info, "%s: can't mirror buffer, using a linear one\n",
+	       __func__);
+      }
+  }
+#endif
+  if (!buf->buffer)
+    buf->buffer = (SANE_Byte *) malloc (size);
   if (!buf->buffer)
     return SANE_STATUS_NO_MEM;
   buf->avail = 0;
   buf->pos = 0;
+  buf->ready = 0;
   buf->size = size;
   return SANE_STATUS_GOOD;
 }
@@ -4260,20 +4456,40 @@ SANE_Status
 sanei_genesys_buffer_free (Genesys_Buffer * buf)
 {
   SANE_Byte *tmp = buf->buffer;
+  size_t ring = buf->ring;
   buf->avail = 0;
   buf->size = 0;
   buf->pos = 0;
+  buf->ready = 0;
+  buf->ring = 0;
   buf->buffer = NULL;
   if (tmp)
-    free (tmp);
+    {
+#if defined(HAVE_MMAP) && defined(MFD_CLOEXEC)
+      if (ring)
+	munmap (tmp, 2 * ring);
+      else
+#endif
+	free (tmp);
+    }
   return SANE_STATUS_GOOD;
 }
 
 SANE_Byte *
 sanei_genesys_buffer_get_write_pos (Genesys_Buffer * buf, size_t size)
 {
+  size_t end;
+
   if (buf->avail + size > buf->size)
     return NULL;
+  if (buf->ring)
+    {
+      /* the mirror makes the free space contiguous */
+      end = buf->pos + buf->avail;
+      if (end >= buf->ring)
+	end -= buf->ring;
+      return buf->buffer + end;
+    }
   if (buf->pos + buf->avail + size > buf->size)
     {
       memmove (buf->buffer, buf->buffer + buf->pos, buf->avail);
@@ -4304,6 +4520,12 @@ sanei_genesys_buffer_consume (Genesys_Buffer * buf, size_t size)
     return SANE_STATUS_INVAL;
   buf->avail -= size;
   buf->pos += size;
+  if (buf->ring && buf->pos >= buf->ring)
+    buf->pos -= buf->ring;
+  if (buf->ready > size)
+    buf->ready -= size;
+  else
+    buf->ready = 0;
   return SANE_STATUS_GOOD;
 }
 
@@ -4521,6 +4743,255 @@ genesys_fill_segmented_buffer (Genesys_Device * dev, uint8_t *work_buffer_dst, s
     return SANE_STATUS_GOOD;
 }
 
+/* ------------------------------------------------------------------------ */
+/*                  background reading of the scan data                     */
+/* ------------------------------------------------------------------------ */
+
+/* The scan data is read by a thread into a small queue of buffers while
+ * sane_read converts the data read before, so that the scanner's internal
+ * buffer doesn't fill up and the head doesn't have to stop and back up
+ * while we are busy converting. Only used for the plain data path, odd/even,
+ * segmented and interpolated reads and sheetfed scanners stay synchronous.
+ * Setting SANE_GENESYS_READER_THREAD to 0 disables it. */
+
+#ifdef USE_PTHREAD
+
+#define GENESYS_READER_BUFFERS 4
+
+typedef struct Genesys_Reader
+{
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  Genesys_Device *dev;
+
+  SANE_Byte *data[GENESYS_READER_BUFFERS];
+  size_t len[GENESYS_READER_BUFFERS];
+  unsigned int head;		/* index of the oldest filled buffer */
+  unsigned int count;		/* number of filled buffers */
+  size_t pos;			/* bytes already taken from the head buffer */
+
+  size_t left;			/* bytes still to read from the scanner */
+  SANE_Bool stop;		/* set to make the thread finish */
+  SANE_Bool done;		/* set by the thread when it has finished */
+  SANE_Status status;		/* status of the failed read, if any */
+
+  unsigned int full_waits;	/* times the thread waited for a free buffer */
+  unsigned int empty_waits;	/* times sane_read waited for data */
+} Genesys_Reader;
+
+static void *
+genesys_reader_thread (void *arg)
+{
+  Genesys_Reader *reader = arg;
+  Genesys_Device *dev = reader->dev;
+  SANE_Status status = SANE_STATUS_GOOD;
+  unsigned int slot;
+  size_t size, len;
+  SANE_Bool stop;
+
+  while (reader->left > 0)
+    {
+      pthread_mutex_lock (&reader->mutex);
+      while (reader->count == GENESYS_READER_BUFFERS && !reader->stop)
+	{
+	  reader->full_waits++;
+	  pthread_cond_wait (&reader->cond, &reader->mutex);
+	}
+      slot = (reader->head + reader->count) % GENESYS_READER_BUFFERS;
+      stop = reader->stop;
+      pthread_mutex_unlock (&reader->mutex);
+      if (stop)
+	break;
+
+      /* same sizes as the synchronous reads: multiples of 256 bytes,
+       * the last one rounded up */
+      len = reader->left;
+      if (len > BULKIN_MAXSIZE)
+	len = BULKIN_MAXSIZE;
+      size = (len + 0xff) & ~0xff;
+
+      status = dev->model->cmd_set->bulk_read_data (dev, 0x45,
+						    reader->data[slot], size);
+
+      pthread_mutex_lock (&reader->mutex);
+      if (status != SANE_STATUS_GOOD)
+	{
+	  pthread_mutex_unlock (&reader->mutex);
+	  break;
+	}
+      reader->len[slot] = len;
+      reader->left -= len;
+      reader->count++;
+      pthread_cond_signal (&reader->cond);
+      pthread_mutex_unlock (&reader->mutex);
+    }
+
+  pthread_mutex_lock (&reader->mutex);
+  reader->status = status;
+  reader->done = SANE_TRUE;
+  pthread_cond_signal (&reader->cond);
+  pthread_mutex_unlock (&reader->mutex);
+  return NULL;
+}
+
+/** @brief wait for the reader thread and release it
+ * Must be done before any other command is sent to the scanner.
+ */
+static void
+genesys_reader_stop (Genesys_Device * dev)
+{
+  Genesys_Reader *reader = dev->reader;
+  int i;
+
+  if (!reader)
+    return;
+
+  pthread_mutex_lock (&reader->mutex);
+  reader->stop = SANE_TRUE;
+  pthread_cond_signal (&reader->cond);
+  pthread_mutex_unlock (&reader->mutex);
+  pthread_join (reader->thread, NULL);
+
+  DBG (DBG_info,
+       "%s: reader waited %u times for a free buffer, sane_read %u times "
+       "for data\n", __func__, reader->full_waits, reader->empty_waits);
+
+  pthread_cond_destroy (&reader->cond);
+  pthread_mutex_destroy (&reader->mutex);
+  for (i = 0; i < GENESYS_READER_BUFFERS; i++)
+    free (reader->data[i]);
+  free (reader);
+  dev->reader = NULL;
+}
+
+/** @brief start reading the scan data in a thread
+ * Does nothing when the data has to be read synchronously, errors only
+ * disable the read ahead.
+ */
+static void
+genesys_reader_start (Genesys_Device * dev)
+{
+  Genesys_Reader *reader;
+  const char *env;
+  int i;
+
+  env = getenv ("SANE_GENESYS_READER_THREAD");
+  if (env && atoi (env) == 0)
+    return;
+  if (dev->model->is_sheetfed == SANE_TRUE || dev->line_interp > 0
+      || dev->segnb > 1 || dev->read_bytes_left == 0)
+    return;
+
+  reader = calloc (1, sizeof (Genesys_Reader));
+  if (!reader)
+    return;
+  for (i = 0; i < GENESYS_READER_BUFFERS; i++)
+    {
+      reader->data[i] = malloc (BULKIN_MAXSIZE);
+      if (!reader->data[i])
+	{
+	  while (i--)
+	    free (reader->data[i]);
+	  free (reader);
+	  return;
+	}
+    }
+  reader->dev = dev;
+  reader->left = dev->read_bytes_left;
+  reader->status = SANE_STATUS_GOOD;
+  pthread_mutex_init (&reader->mutex, NULL);
+  pthread_cond_init (&reader->cond, NULL);
+
+  if (pthread_create (&reader->thread, NULL, genesys_reader_thread, reader))
+    {
+      DBG (DBG_warn, "%s: can't start reader thread, reading synchronously\n",
+	   __func__);
+      pthread_cond_destroy (&reader->cond);
+      pthread_mutex_destroy (&reader->mutex);
+      for (i = 0; i < GENESYS_READER_BUFFERS; i++)
+	free (reader->data[i]);
+      free (reader);
+      return;
+    }
+  dev->reader = reader;
+  DBG (DBG_info, "%s: reading %lu bytes in a thread\n", __func__,
+       (u_long) reader->left);
+}
+
+/** @brief take data read by the reader thread
+ * Waits until enough data has been read.
+ */
+static SANE_Status
+genesys_reader_read (Genesys_Device * dev, uint8_t * buffer, size_t size)
+{
+  Genesys_Reader *reader = dev->reader;
+  SANE_Status status = SANE_STATUS_GOOD;
+  size_t len;
+
+  pthread_mutex_lock (&reader->mutex);
+  while (size > 0)
+    {
+      if (reader->count == 0)
+	{
+	  if (reader->done)
+	    {
+	      status = reader->status;
+	      if (status == SANE_STATUS_GOOD)
+		status = SANE_STATUS_EOF;
+	      break;
+	    }
+	  reader->empty_waits++;
+	  pthread_cond_wait (&reader->cond, &reader->mutex);
+	  continue;
+	}
+
+      /* copying doesn't need the lock, the thread doesn't touch
+       * filled buffers */
+      len = reader->len[reader->head] - reader->pos;
+      if (len > size)
+	len = size;
+      pthread_mutex_unlock (&reader->mutex);
+      memcpy (buffer, reader->data[reader->head] + reader->pos, len);
+      buffer += len;
+      size -= len;
+      pthread_mutex_lock (&reader->mutex);
+
+      reader->pos += len;
+      if (reader->pos == reader->len[reader->head])
+	{
+	  reader->pos = 0;
+	  reader->head = (reader->head + 1) % GENESYS_READER_BUFFERS;
+	  reader->count--;
+	  pthread_cond_signal (&reader->cond);
+	}
+    }
+  pthread_mutex_unlock (&reader->mutex);
+  return status;
+}
+
+#else /* USE_PTHREAD */
+
+static void
+genesys_reader_start (Genesys_Device __sane_unused__ * dev)
+{
+}
+
+static void
+genesys_reader_stop (Genesys_Device __sane_unused__ * dev)
+{
+}
+
+static SANE_Status
+genesys_reader_read (Genesys_Device __sane_unused__ * dev,
+		     uint8_t __sane_unused__ * buffer,
+		     size_t __sane_unused__ size)
+{
+  return SANE_STATUS_UNSUPPORTED;
+}
+
+#endif /* USE_PTHREAD */
+
 /**
  *
  */
@@ -4594,6 +5065,13 @@ genesys_fill_read_buffer (Genesys_Device * dev)
       /* multi-segment sensors processing */
       status = genesys_fill_segmented_buffer (dev, work_buffer_dst, size);
     }
+  else if (dev->reader)
+    {
+      /* data read ahead by the reader thread */
+      status = genesys_reader_read (dev, work_buffer_dst,
+				    size > dev->read_bytes_left ?
+				    dev->read_bytes_left : size);
+    }
   else /* regular case with no extra copy */
     {
       status = dev->model->cmd_set->bulk_read_data (dev, 0x45, work_buffer_dst, size);
@@ -4612,6 +5090,7 @@ genesys_fill_read_buffer (Genesys_Device * dev)
   dev->read_bytes_left -= size;
 
   RIE (sanei_genesys_buffer_produce (&(dev->read_buffer), size));
+  SANEI_PERF_HWM ("read_buffer", 0, dev->read_buffer.avail);
 
   DBGCOMPLETED;
 
@@ -4627,7 +5106,7 @@ genesys_read_ordered_data (Genesys_Device * dev, SANE_Byte * destination,
 			   size_t * len)
 {
   SANE_Status status;
-  size_t bytes, extra;
+  size_t bytes, extra, src_avail;
   unsigned int channels, depth, src_pixels;
   unsigned int ccd_shift[12], shift_count;
   uint8_t *work_buffer_src;
@@ -4638,6 +5117,7 @@ genesys_read_ordered_data (Genesys_Device * dev, SANE_Byte * destination,
   unsigned int needs_ccd;
   unsigned int needs_shrink;
   unsigned int needs_reverse;
+  unsigned int reorder_in_place;
   Genesys_Buffer *src_buffer;
   Genesys_Buffer *dst_buffer;
 
@@ -4723,6 +5203,7 @@ genesys_read_ordered_data (Genesys_Device * dev, SANE_Byte * destination,
        && !(dev->model->flags & GENESYS_FLAG_MUST_WAIT)
        && dev->parking == SANE_FALSE)
         {
+          genesys_reader_stop (dev);
           dev->model->cmd_set->slow_back_home (dev, SANE_FALSE);
           dev->parking = SANE_TRUE;
         }
@@ -4799,6 +5280,7 @@ Problems with the first approach:
     }
 
   src_buffer = &(dev->read_buffer);
+  src_avail = src_buffer->avail;
 
 /* maybe reorder components/bytes */
   if (needs_reorder)
@@ -4810,21 +5292,39 @@ Problems with the first approach:
 	  return SANE_STATUS_INVAL;
 	}
 
-      dst_buffer = &(dev->lines_buffer);
+      /* swapping components or bytes within a pixel is done in the read
+       * buffer, only the planar cis lines need to go to another buffer.
+       * The already converted part of the read buffer is kept in
+       * its ready count */
+      reorder_in_place = channels != 3 || !dev->model->is_cis;
 
-      work_buffer_src = sanei_genesys_buffer_get_read_pos (src_buffer);
-      bytes = src_buffer->avail;
+      if (reorder_in_place)
+	{
+	  dst_buffer = src_buffer;
+	  work_buffer_src = sanei_genesys_buffer_get_read_pos (src_buffer)
+	    + src_buffer->ready;
+	  bytes = src_buffer->avail - src_buffer->ready;
+	}
+      else
+	{
+	  dst_buffer = &(dev->lines_buffer);
+	  work_buffer_src = sanei_genesys_buffer_get_read_pos (src_buffer);
+	  bytes = src_buffer->avail;
 
 /*how many bytes can be processed here?*/
 /*we are greedy. we work as much as possible*/
-      if (bytes > dst_buffer->size - dst_buffer->avail)
-	bytes = dst_buffer->size - dst_buffer->avail;
+	  if (bytes > dst_buffer->size - dst_buffer->avail)
+	    bytes = dst_buffer->size - dst_buffer->avail;
+	}
 
       dst_lines = (bytes * 8) / (src_pixels * channels * depth);
       bytes = (dst_lines * src_pixels * channels * depth) / 8;
 
-      work_buffer_dst = sanei_genesys_buffer_get_write_pos (dst_buffer,
-							    bytes);
+      if (reorder_in_place)
+	work_buffer_dst = work_buffer_src;
+      else
+	work_buffer_dst = sanei_genesys_buffer_get_write_pos (dst_buffer,
+							      bytes);
 
       DBG (DBG_info, "genesys_read_ordered_data: reordering %d lines\n",
 	   dst_lines);
@@ -4927,11 +5427,17 @@ Problems with the first approach:
 	      return SANE_STATUS_IO_ERROR;
 	    }
 
-	  RIE (sanei_genesys_buffer_produce (dst_buffer, bytes));
+	  if (reorder_in_place)
+	    src_buffer->ready += bytes;
+	  else
+	    {
+	      RIE (sanei_genesys_buffer_produce (dst_buffer, bytes));
 
-	  RIE (sanei_genesys_buffer_consume (src_buffer, bytes));
+	      RIE (sanei_genesys_buffer_consume (src_buffer, bytes));
+	    }
 	}
       src_buffer = dst_buffer;
+      src_avail = reorder_in_place ? src_buffer->ready : src_buffer->avail;
     }
 
 /* maybe reverse effects of ccd layout */
@@ -4947,7 +5453,7 @@ Problems with the first approach:
       dst_buffer = &(dev->shrink_buffer);
 
       work_buffer_src = sanei_genesys_buffer_get_read_pos (src_buffer);
-      bytes = src_buffer->avail;
+      bytes = src_avail;
 
       extra =
 	(dev->current_setup.max_shift * src_pixels * channels * depth) / 8;
@@ -4999,6 +5505,7 @@ Problems with the first approach:
 	  RIE (sanei_genesys_buffer_consume (src_buffer, bytes));
 	}
       src_buffer = dst_buffer;
+      src_avail = src_buffer->avail;
     }
 
 /* maybe shrink(or enlarge) lines */
@@ -5008,7 +5515,7 @@ Problems with the first approach:
       dst_buffer = &(dev->out_buffer);
 
       work_buffer_src = sanei_genesys_buffer_get_read_pos (src_buffer);
-      bytes = src_buffer->avail;
+      bytes = src_avail;
 
 /*lines in input*/
       dst_lines = (bytes * 8) / (src_pixels * channels * depth);
@@ -5068,10 +5575,11 @@ Problems with the first approach:
 
 	}
       src_buffer = dst_buffer;
+      src_avail = src_buffer->avail;
     }
 
   /* move data to destination */
-  bytes = src_buffer->avail;
+  bytes = src_avail;
   if (bytes > *len)
     bytes = *len;
   work_buffer_src = sanei_genesys_buffer_get_read_pos (src_buffer);
@@ -5107,6 +5615,7 @@ Problems with the first approach:
   /* end scan if all needed data have been read */
    if(dev->total_bytes_read >= dev->total_bytes_to_read)
     {
+      genesys_reader_stop (dev);
       dev->model->cmd_set->end_scan (dev, dev->reg, SANE_TRUE);
       if (dev->model->is_sheetfed == SANE_TRUE)
         {
@@ -6341,12 +6850,28 @@ probe_genesys_devices (void)
 }
 
 /**
- * This should be changed if one of the substructures of
-   Genesys_Calibration_Cache change, but it must be changed if there are
-   changes that don't change size -- at least for now, as we store most
-   of Genesys_Calibration_Cache as is.
+ * Version of the layout of the calibration records kept in the
+ * calibration store. This must be changed if one of the substructures of
+ * Genesys_Calibration_Record change, but it must be changed if there are
+ * changes that don't change size.
 */
-#define CALIBRATION_VERSION 1
+#define CALIBRATION_VERSION 2
+
+/**
+ * layout of a calibration cache entry in the calibration store, it is
+ * followed by the white and then the dark average data
+ */
+typedef struct
+{
+  Genesys_Current_Setup used_setup;
+  time_t last_calibration;
+  Genesys_Frontend frontend;
+  /* the gamma (and later) fields are not stored */
+  uint8_t sensor[offsetof (Genesys_Sensor, gamma[0])];
+  size_t calib_pixels;
+  size_t calib_channels;
+  size_t average_size;
+} Genesys_Calibration_Record;
 
 /**
  * reads previously cached calibration data
@@ -6355,40 +6880,33 @@ probe_genesys_devices (void)
 SANE_Status
 sanei_genesys_read_calibration (Genesys_Device * dev)
 {
-  FILE *fp;
-  uint8_t vers = 0;
-  uint32_t size = 0;
+  SANEI_Calib *calib;
+  Genesys_Calibration_Record record;
   struct Genesys_Calibration_Cache *cache;
-  SANE_Status status=SANE_STATUS_GOOD;
+  SANE_Status status;
+  const void *data;
+  const char *key;
+  size_t size;
+  int index;
 
   DBGSTART;
 
-  /* open calibration cache file */
-  fp = fopen (dev->calib_file, "rb");
-  if (!fp)
+  if (access (dev->calib_file, F_OK) != 0)
     {
       DBG (DBG_info, "Calibration: Cannot open %s\n", dev->calib_file);
       DBGCOMPLETED;
       return SANE_STATUS_IO_ERROR;
     }
 
-  /* these two checks ensure that most bad things cannot happen */
-  fread (&vers, 1, 1, fp);
-  if (vers != CALIBRATION_VERSION)
-    {
-      DBG (DBG_info, "Calibration: Bad version\n");
-      fclose (fp);
-      DBGCOMPLETED;
-      return SANE_STATUS_INVAL;
-    }
-  fread (&size, 4, 1, fp);
-  if (size != sizeof (struct Genesys_Calibration_Cache))
+  status = sanei_calib_open (dev->calib_file, dev->model->name,
+			     CALIBRATION_VERSION, &calib);
+  if (status != SANE_STATUS_GOOD)
     {
-      DBG (DBG_info,
-	   "Calibration: Size of calibration cache struct differs\n");
-      fclose (fp);
+      DBG (DBG_info, "Calibration: %s is not a valid calibration file\n",
+	   dev->calib_file);
+      sanei_calib_close (calib);
       DBGCOMPLETED;
-      return SANE_STATUS_INVAL;
+      return status;
     }
 
   /* clear device calibration cache */
@@ -6399,45 +6917,42 @@ sanei_genesys_read_calibration (Genesys_Device * dev)
       free(cache);
     }
 
-  /* loop on cache records in file */
-  while (!feof (fp) && status==SANE_STATUS_GOOD)
+  /* loop on cache records in store */
+  index = 0;
+  while (sanei_calib_next (calib, &index, &key, &data, &size)
+	 == SANE_STATUS_GOOD)
     {
-      DBG (DBG_info, "sanei_genesys_read_calibration: reading one record\n");
-      cache = (struct Genesys_Calibration_Cache *) malloc (sizeof (*cache));
+      DBG (DBG_info, "sanei_genesys_read_calibration: reading record %s\n",
+	   key);
+      if (size < sizeof (record))
+	{
+	  DBG (DBG_warn, "sanei_genesys_read_calibration: partial calibration record\n");
+	  continue;
+	}
+      memcpy (&record, data, sizeof (record));
+      if (size != sizeof (record) + 2 * record.average_size)
+	{
+	  DBG (DBG_warn, "sanei_genesys_read_calibration: partial calibration record\n");
+	  continue;
+	}
 
+      cache = (struct Genesys_Calibration_Cache *) malloc (sizeof (*cache));
       if (!cache)
 	{
 	  DBG (DBG_error,
 	       "sanei_genesys_read_calibration: could not allocate cache struct\n");
+	  status = SANE_STATUS_NO_MEM;
 	  break;
 	}
+      memset (cache, 0, sizeof (*cache));
 
-#define BILT1( x )							\
-      do								\
-	{								\
-	  if ((x) < 1)							\
-	    {								\
-	      free(cache);						\
-	      DBG (DBG_warn, "sanei_genesys_read_calibration: partial calibration record\n"); \
-              status=SANE_STATUS_EOF;                                   \
-	      break;							\
-	    }								\
-	} while(0)
-
-
-      if (fread (&cache->used_setup, sizeof (cache->used_setup), 1, fp) < 1)
-	{			/* eof is only detected here */
-	  free (cache);
-          status=SANE_STATUS_GOOD;
-	  break;
-	}
-      BILT1 (fread (&cache->last_calibration, sizeof (cache->last_calibration), 1, fp));
-      BILT1 (fread (&cache->frontend, sizeof (cache->frontend), 1, fp));
-      /* the gamma (and later) fields are not stored */
-      BILT1 (fread (&cache->sensor, offsetof (Genesys_Sensor, gamma[0]), 1, fp));
-      BILT1 (fread (&cache->calib_pixels, sizeof (cache->calib_pixels), 1, fp));
-      BILT1 (fread (&cache->calib_channels, sizeof (cache->calib_channels), 1, fp));
-      BILT1 (fread (&cache->average_size, sizeof (cache->average_size), 1, fp));
+      memcpy (&cache->used_setup, &record.used_setup, sizeof (cache->used_setup));
+      cache->last_calibration = record.last_calibration;
+      memcpy (&cache->frontend, &record.frontend, sizeof (cache->frontend));
+      memcpy (&cache->sensor, record.sensor, sizeof (record.sensor));
+      cache->calib_pixels = record.calib_pixels;
+      cache->calib_channels = record.calib_channels;
+      cache->average_size = record.average_size;
 
       cache->white_average_data = (uint8_t *) malloc (cache->average_size);
       cache->dark_average_data = (uint8_t *) malloc (cache->average_size);
@@ -6453,31 +6968,18 @@ sanei_genesys_read_calibration (Genesys_Device * dev)
 	  break;
 	}
 
-      if (fread (cache->white_average_data, cache->average_size, 1, fp) < 1)
-	{
-          status=SANE_STATUS_EOF;
-	  DBG (DBG_warn, "sanei_genesys_read_calibration: partial calibration record\n");
-	  free (cache->white_average_data);
-	  free (cache->dark_average_data);
-	  free (cache);
-	  break;
-	}
-      if (fread (cache->dark_average_data, cache->average_size, 1, fp) < 1)
-	{
-	  DBG (DBG_warn, "sanei_genesys_read_calibration: partial calibration record\n");
-	  free (cache->white_average_data);
-	  free (cache->dark_average_data);
-	  free (cache);
-          status=SANE_STATUS_EOF;
-	  break;
-	}
-#undef BILT1
+      memcpy (cache->white_average_data,
+	      (const uint8_t *) data + sizeof (record), cache->average_size);
+      memcpy (cache->dark_average_data,
+	      (const uint8_t *) data + sizeof (record) + cache->average_size,
+	      cache->average_size);
+
       DBG (DBG_info, "sanei_genesys_read_calibration: adding record to list\n");
       cache->next = dev->calibration_cache;
       dev->calibration_cache = cache;
     }
 
-  fclose (fp);
+  sanei_calib_close (calib);
   DBGCOMPLETED;
   return status;
 }
@@ -6485,40 +6987,74 @@ sanei_genesys_read_calibration (Genesys_Device * dev)
 static void
 write_calibration (Genesys_Device * dev)
 {
-  FILE *fp;
-  uint8_t vers = 0;
-  uint32_t size = 0;
+  SANEI_Calib *calib;
+  Genesys_Calibration_Record *record;
   struct Genesys_Calibration_Cache *cache;
+  uint8_t *data;
+  char key[24];
+  int i, lifetime;
+#ifdef HAVE_SYS_TIME_H
+  struct timeval time;
+#endif
 
   DBGSTART;
-  fp = fopen (dev->calib_file, "wb");
-  if (!fp)
+
+  /* an invalid file is replaced like a missing one */
+  if (sanei_calib_open (dev->calib_file, dev->model->name,
+			CALIBRATION_VERSION, &calib) == SANE_STATUS_NO_MEM)
     {
-      DBG (DBG_info, "write_calibration: Cannot open %s for writing\n", dev->calib_file);
+      DBG (DBG_error, "write_calibration: failed to open calibration store\n");
       return;
     }
+  sanei_calib_clear (calib);
 
-  vers = CALIBRATION_VERSION;
-  fwrite (&vers, 1, 1, fp);
-  size = sizeof (struct Genesys_Calibration_Cache);
-  fwrite (&size, 4, 1, fp);
+#ifdef HAVE_SYS_TIME_H
+  gettimeofday (&time, NULL);
+#endif
 
-  for (cache = dev->calibration_cache; cache; cache = cache->next)
+  for (cache = dev->calibration_cache, i = 0; cache; cache = cache->next)
     {
-      fwrite (&cache->used_setup, sizeof (cache->used_setup), 1, fp);
-      fwrite (&cache->last_calibration, sizeof (cache->last_calibration), 1, fp);
-      fwrite (&cache->frontend, sizeof (cache->frontend), 1, fp);
-      /* the gamma (and later) fields are not stored */
-      fwrite (&cache->sensor, offsetof (Genesys_Sensor, gamma[0]), 1, fp);
+      /* entries expire when the cache entry itself would */
+      lifetime = 0;
+#ifdef HAVE_SYS_TIME_H
+      if (dev->settings.expiration_time > 0)
+	{
+	  lifetime = cache->last_calibration
+	    + dev->settings.expiration_time * 60 - time.tv_sec;
+	  if (lifetime <= 0)
+	    continue;
+	}
+#endif
 
-      fwrite (&cache->calib_pixels, sizeof (cache->calib_pixels), 1, fp);
-      fwrite (&cache->calib_channels, sizeof (cache->calib_channels), 1, fp);
-      fwrite (&cache->average_size, sizeof (cache->average_size), 1, fp);
-      fwrite (cache->white_average_data, cache->average_size, 1, fp);
-      fwrite (cache->dark_average_data, cache->average_size, 1, fp);
-    }
+      data = malloc (sizeof (*record) + 2 * cache->average_size);
+      if (!data)
+	{
+	  DBG (DBG_error, "write_calibration: failed to allocate record\n");
+	  break;
+	}
+      record = (Genesys_Calibration_Record *) data;
+      memset (record, 0, sizeof (*record));
+      memcpy (&record->used_setup, &cache->used_setup, sizeof (record->used_setup));
+      record->last_calibration = cache->last_calibration;
+      memcpy (&record->frontend, &cache->frontend, sizeof (record->frontend));
+      memcpy (record->sensor, &cache->sensor, sizeof (record->sensor));
+      record->calib_pixels = cache->calib_pixels;
+      record->calib_channels = cache->calib_channels;
+      record->average_size = cache->average_size;
+      memcpy (data + sizeof (*record), cache->white_average_data,
+	      cache->average_size);
+      memcpy (data + sizeof (*record) + cache->average_size,
+	      cache->dark_average_data, cache->average_size);
+
+      snprintf (key, sizeof (key), "cache-%d", i++);
+      sanei_calib_put (calib, key, data,
+		       sizeof (*record) + 2 * cache->average_size, lifetime);
+      free (data);
+    }
+
+  if (sanei_calib_close (calib) != SANE_STATUS_GOOD)
+    DBG (DBG_info, "write_calibration: Cannot write %s\n", dev->calib_file);
   DBGCOMPLETED;
-  fclose (fp);
 }
 
 /** @brief buffer scanned picture
@@ -6690,13 +7226,11 @@ sane_init (SANE_Int * version_code, SANE_Auth_Callback authorize)
   /* init sanei_magic */
   sanei_magic_init();
 
-  DBG (DBG_info, "sane_init: %s endian machine\n",
 #ifdef WORDS_BIGENDIAN
-       "big"
+  DBG (DBG_info, "sane_init: big endian machine\n");
 #else
-       "little"
+  DBG (DBG_info, "sane_init: little endian machine\n");
 #endif
-    );
 
   /* set up to no devices at first */
   num_devices = 0;
@@ -6908,9 +7442,13 @@ sane_open (SANE_String_Const devicename, SANE_Handle * handle)
   s->dev->binarize_buffer.buffer = NULL;
   s->dev->local_buffer.buffer = NULL;
   s->dev->parking = SANE_FALSE;
+  s->dev->reader = NULL;
+  memset (&s->dev->binarize, 0, sizeof (s->dev->binarize));
   s->dev->read_active = SANE_FALSE;
   s->dev->white_average_data = NULL;
   s->dev->dark_average_data = NULL;
+  s->dev->shading.data = NULL;
+  s->dev->shading.valid = SANE_FALSE;
   s->dev->calibration_cache = NULL;
   s->dev->calib_file = NULL;
   s->dev->img_buffer = NULL;
@@ -6980,6 +7518,8 @@ sane_close (SANE_Handle handle)
       return;			/* oops, not a handle we know about */
     }
 
+  genesys_reader_stop (s->dev);
+
   /* eject document for sheetfed scanners */
   if (s->dev->model->is_sheetfed == SANE_TRUE)
     {
@@ -7018,6 +7558,7 @@ sane_close (SANE_Handle handle)
       next_cache = cache->next;
       free (cache->dark_average_data);
       free (cache->white_average_data);
+      genesys_shading_cache_clear (&cache->shading);
       free (cache);
     }
 
@@ -7027,8 +7568,10 @@ sane_close (SANE_Handle handle)
   sanei_genesys_buffer_free (&(s->dev->out_buffer));
   sanei_genesys_buffer_free (&(s->dev->binarize_buffer));
   sanei_genesys_buffer_free (&(s->dev->local_buffer));
+  sanei_binarize_free (&s->dev->binarize);
   FREE_IFNOT_NULL (s->dev->white_average_data);
   FREE_IFNOT_NULL (s->dev->dark_average_data);
+  genesys_shading_cache_clear (&s->dev->shading);
   FREE_IFNOT_NULL (s->dev->calib_file);
 
   /* free allocated gamma tables */
@@ -7560,6 +8103,7 @@ set_option_value (Genesys_Scanner * s, int option, void *val,
 	      next_cache = cache->next;
 	      free (cache->dark_average_data);
 	      free (cache->white_average_data);
+	      genesys_shading_cache_clear (&cache->shading);
 	      free (cache);
 	    }
 	}
@@ -7733,6 +8277,9 @@ sane_start (SANE_Handle handle)
 
   s->scanning = SANE_TRUE;
 
+  /* keep the data flowing while sane_read converts it */
+  genesys_reader_start (s->dev);
+
   /* allocate intermediate buffer when doing dynamic lineart */
   if(s->dev->settings.dynamic_lineart==SANE_TRUE)
     {
@@ -7855,6 +8402,7 @@ sane_read (SANE_Handle handle, SANE_Byte * buf, SANE_Int max_len,
        && !(dev->model->flags & GENESYS_FLAG_MUST_WAIT)
        && dev->parking == SANE_FALSE)
         {
+          genesys_reader_stop (dev);
           dev->model->cmd_set->slow_back_home (dev, SANE_FALSE);
           dev->parking = SANE_TRUE;
         }
@@ -7947,6 +8495,11 @@ sane_cancel (SANE_Handle handle)
       s->dev->binary=NULL;
     }
 
+  sanei_perf_dump (STRINGIFY(BACKEND_NAME));
+
+  /* no command may be sent while the thread is reading */
+  genesys_reader_stop (s->dev);
+
   s->scanning = SANE_FALSE;
   s->dev->read_active = SANE_FALSE;
   if(s->dev->img_buffer!=NULL)
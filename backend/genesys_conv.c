@@ -90,95 +90,6 @@ genesys_reverse_bits(
     return SANE_STATUS_GOOD;
 }
 
-/**
- * uses the threshold/threshold_curve to control software binarization
- * This code was taken from the epjistsu backend by m. allan noah
- * @param dev device set up for the scan
- * @param src pointer to raw data
- * @param dst pointer where to store result
- * @param width width of the processed line
- * */
-static SANE_Status
-binarize_line(Genesys_Device * dev, uint8_t *src, uint8_t *dst, int width)
-{
-  int j, windowX, sum = 0;
-  int thresh;
-  int offset, addCol, dropCol;
-  unsigned char mask;
-
-  int x;
-  uint8_t min, max;
-
-  /* normalize line */
-  min = 255;
-  max = 0;
-    for (x = 0; x < width; x++)
-      {
-	if (src[x] > max)
-	  {
-	    max = src[x];
-	  }
-	if (src[x] < min)
-	  {
-	    min = src[x];
-	  }
-      }
-
-    /* safeguard against dark or white areas */
-    if(min>80)
-	    min=0;
-    if(max<80)
-	    max=255;
-    for (x = 0; x < width; x++)
-      {
-	src[x] = ((src[x] - min) * 255) / (max - min);
-      }
-
-  /* ~1mm works best, but the window needs to have odd # of pixels */
-  windowX = (6 * dev->settings.xres) / 150;
-  if (!(windowX % 2))
-    windowX++;
-
-  /* second, prefill the sliding sum */
-  for (j = 0; j < windowX; j++)
-    sum += src[j];
-
-  /* third, walk the input buffer, update the sliding sum, */
-  /* determine threshold, output bits */
-  for (j = 0; j < width; j++)
-    {
-      /* output image location */
-      offset = j % 8;
-      mask = 0x80 >> offset;
-      thresh = dev->settings.threshold;
-
-      /* move sum/update threshold only if there is a curve */
-      if (dev->settings.threshold_curve)
-	{
-	  addCol = j + windowX / 2;
-	  dropCol = addCol - windowX;
-
-	  if (dropCol >= 0 && addCol < width)
-	    {
-	      sum -= src[dropCol];
-	      sum += src[addCol];
-	    }
-	  thresh = dev->lineart_lut[sum / windowX];
-	}
-
-      /* use average to lookup threshold */
-      if (src[j] > thresh)
-	*dst &= ~mask;		/* white */
-      else
-	*dst |= mask;		/* black */
-
-      if (offset == 7)
-	dst++;
-    }
-
-  return SANE_STATUS_GOOD;
-}
-
 /**
  * software lineart using data from a 8 bit gray scan. We assume true gray
  * or monochrome scan as input.
@@ -193,6 +104,7 @@ genesys_gray_lineart(
     uint8_t threshold)
 {
   size_t y;
+  SANE_Status status;
 
   DBG (DBG_io2, "genesys_gray_lineart: converting %lu lines of %lu pixels\n",
        (unsigned long)lines, (unsigned long)pixels);
@@ -200,12 +112,21 @@ genesys_gray_lineart(
 
   for (y = 0; y < lines; y++)
     {
-      binarize_line (dev, src_data + y * pixels, dst_data, pixels);
+      status = sanei_binarize_line (&dev->binarize, src_data + y * pixels,
+				    dst_data, pixels);
+      if (status != SANE_STATUS_GOOD)
+	return status;
       dst_data += pixels / 8;
     }
   return SANE_STATUS_GOOD;
 }
 
+/* the 4 bits of the index with each bit doubled, 1010 --> 1100 1100 */
+static const uint8_t double_bits[16] = {
+  0x00, 0x03, 0x0c, 0x0f, 0x30, 0x33, 0x3c, 0x3f,
+  0xc0, 0xc3, 0xcc, 0xcf, 0xf0, 0xf3, 0xfc, 0xff
+};
+
 /** @brief shrink or grow scanned data to fit the final scan size
  * This function shrinks the scanned data it the required resolution is lower than the hardware one,
  * or grows it in case it is the opposite like when motor resolution is higher than
@@ -221,7 +142,7 @@ genesys_shrink_lines_1 (
     unsigned int channels)
 {
   unsigned int dst_x, src_x, y, c, cnt;
-  unsigned int avg[3], val;
+  unsigned int avg[3];
   uint8_t *src = (uint8_t *) src_data;
   uint8_t *dst = (uint8_t *) dst_data;
 
@@ -264,30 +185,9 @@ genesys_shrink_lines_1 (
 	      /* double and interleave on line */
 	      for (c = 0; c < src_pixels/8; c++)
 		{
-		  /* first 4 bits */
-		  val = 0;
-		  val |= (*src & 0x80) >> 0;	/* X___ ____ --> X___ ____ */
-		  val |= (*src & 0x80) >> 1;	/* X___ ____ --> _X__ ____ */
-		  val |= (*src & 0x40) >> 1;	/* _X__ ____ --> __X_ ____ */
-		  val |= (*src & 0x40) >> 2;	/* _X__ ____ --> ___X ____ */
-		  val |= (*src & 0x20) >> 2;	/* __X_ ____ --> ____ X___ */
-		  val |= (*src & 0x20) >> 3;	/* __X_ ____ --> ____ _X__ */
-		  val |= (*src & 0x10) >> 3;	/* ___X ____ --> ____ __X_ */
-		  val |= (*src & 0x10) >> 4;	/* ___X ____ --> ____ ___X */
-		  *dst = val;
-		  dst++;
-
-		  /* last for bits */
-		  val = 0;
-		  val |= (*src & 0x08) << 4;	/* ____ X___ --> X___ ____ */
-		  val |= (*src & 0x08) << 3;	/* ____ X___ --> _X__ ____ */
-		  val |= (*src & 0x04) << 3;	/* ____ _X__ --> __X_ ____ */
-		  val |= (*src & 0x04) << 2;	/* ____ _X__ --> ___X ____ */
-		  val |= (*src & 0x02) << 2;	/* ____ __X_ --> ____ X___ */
-		  val |= (*src & 0x02) << 1;	/* ____ __X_ --> ____ _X__ */
-		  val |= (*src & 0x01) << 1;	/* ____ ___X --> ____ __X_ */
-		  val |= (*src & 0x01) << 0;	/* ____ ___X --> ____ ___X */
-		  *dst = val;
+		  /* first 4 bits, then the last 4 bits */
+		  *dst++ = double_bits[*src >> 4];
+		  *dst = double_bits[*src & 0x0f];
 		  dst++;
 		  src++;
 		}
@@ -45,55 +45,56 @@
  * Conversion filters for genesys backend
  */
 
-static SANE_Status
-FUNC_NAME(genesys_reorder_components_cis) (
+/*
+ * The kernels below work on whole components. Scanner data is little
+ * endian, so 16 bit components are swapped on big endian hosts while
+ * they are moved anyway.
+ */
+#if defined(DOUBLE_BYTE) && defined(WORDS_BIGENDIAN)
+#  define HOST_COMPONENT(v) ((COMPONENT_TYPE) (((v) >> 8) | ((v) << 8)))
+#else
+#  define HOST_COMPONENT(v) (v)
+#endif
+
+/* interleave the three color planes of cis lines, first, second and
+ * third are the indices of the planes in output order */
+static void
+FUNC_NAME(genesys_interleave_planes) (
     uint8_t *src_data,
     uint8_t *dst_data,
     unsigned int lines,
-    unsigned int pixels)
+    unsigned int pixels,
+    unsigned int first,
+    unsigned int third)
 {
     unsigned int x, y;
-    uint8_t *src[3];
-    uint8_t *dst = dst_data;
-    unsigned int rest = pixels * 2 * BYTES_PER_COMPONENT;
-
-    src[0] = src_data + pixels * BYTES_PER_COMPONENT * 0;
-    src[1] = src_data + pixels * BYTES_PER_COMPONENT * 1;
-    src[2] = src_data + pixels * BYTES_PER_COMPONENT * 2;
+    COMPONENT_TYPE *src = (COMPONENT_TYPE *)src_data;
+    COMPONENT_TYPE *dst = (COMPONENT_TYPE *)dst_data;
+    COMPONENT_TYPE *c0, *c1, *c2;
 
     for(y = 0; y < lines; y++) {
+	c0 = src + pixels * first;
+	c1 = src + pixels;
+	c2 = src + pixels * third;
 	for(x = 0; x < pixels; x++) {
-
-#ifndef DOUBLE_BYTE
-	    *dst++ = *src[0]++;
-	    *dst++ = *src[1]++;
-	    *dst++ = *src[2]++;
-#else
-#  ifndef WORDS_BIGENDIAN
-	    *dst++ = *src[0]++;
-	    *dst++ = *src[0]++;
-	    *dst++ = *src[1]++;
-	    *dst++ = *src[1]++;
-	    *dst++ = *src[2]++;
-	    *dst++ = *src[2]++;
-#  else
-	    *dst++ = src[0][1];
-	    *dst++ = src[0][0];
-	    *dst++ = src[1][1];
-	    *dst++ = src[1][0];
-	    *dst++ = src[2][1];
-	    *dst++ = src[2][0];
-	    src[0] += 2;
-	    src[1] += 2;
-	    src[2] += 2;
-#  endif
-#endif
+	    dst[0] = HOST_COMPONENT(c0[x]);
+	    dst[1] = HOST_COMPONENT(c1[x]);
+	    dst[2] = HOST_COMPONENT(c2[x]);
+	    dst += 3;
 	}
-
-	src[0] += rest;
-	src[1] += rest;
-	src[2] += rest;
+	src += pixels * 3;
     }
+}
+
+static SANE_Status
+FUNC_NAME(genesys_reorder_components_cis) (
+    uint8_t *src_data,
+    uint8_t *dst_data,
+    unsigned int lines,
+    unsigned int pixels)
+{
+    FUNC_NAME(genesys_interleave_planes) (src_data, dst_data, lines, pixels,
+					 0, 2);
     return SANE_STATUS_GOOD;
 }
 
@@ -104,47 +105,8 @@ FUNC_NAME(genesys_reorder_components_cis_bgr) (
     unsigned int lines,
     unsigned int pixels)
 {
-    unsigned int x, y;
-    uint8_t *src[3];
-    uint8_t *dst = dst_data;
-    unsigned int rest = pixels * 2 * BYTES_PER_COMPONENT;
-
-    src[0] = src_data + pixels * BYTES_PER_COMPONENT * 0;
-    src[1] = src_data + pixels * BYTES_PER_COMPONENT * 1;
-    src[2] = src_data + pixels * BYTES_PER_COMPONENT * 2;
-
-    for(y = 0; y < lines; y++) {
-	for(x = 0; x < pixels; x++) {
-#ifndef DOUBLE_BYTE
-	    *dst++ = *src[2]++;
-	    *dst++ = *src[1]++;
-	    *dst++ = *src[0]++;
-#else
-#  ifndef WORDS_BIGENDIAN
-	    *dst++ = *src[2]++;
-	    *dst++ = *src[2]++;
-	    *dst++ = *src[1]++;
-	    *dst++ = *src[1]++;
-	    *dst++ = *src[0]++;
-	    *dst++ = *src[0]++;
-#  else
-	    *dst++ = src[2][1];
-	    *dst++ = src[2][0];
-	    *dst++ = src[1][1];
-	    *dst++ = src[1][0];
-	    *dst++ = src[0][1];
-	    *dst++ = src[0][0];
-	    src[0] += 2;
-	    src[1] += 2;
-	    src[2] += 2;
-#  endif
-#endif
-	}
-
-	src[0] += rest;
-	src[1] += rest;
-	src[2] += rest;
-    }
+    FUNC_NAME(genesys_interleave_planes) (src_data, dst_data, lines, pixels,
+					 2, 0);
     return SANE_STATUS_GOOD;
 }
 
@@ -156,35 +118,18 @@ FUNC_NAME(genesys_reorder_components_bgr) (
     unsigned int pixels)
 {
     unsigned int c;
-    uint8_t *src = src_data;
-    uint8_t *dst = dst_data;
+    COMPONENT_TYPE *src = (COMPONENT_TYPE *)src_data;
+    COMPONENT_TYPE *dst = (COMPONENT_TYPE *)dst_data;
+    COMPONENT_TYPE r;
 
+    /* src and dst may be the same buffer */
     for(c = 0; c < lines * pixels; c++) {
-
-#ifndef DOUBLE_BYTE
-	*dst++ = src[2];
-	*dst++ = src[1];
-	*dst++ = src[0];
+	r = src[2];
+	dst[1] = HOST_COMPONENT(src[1]);
+	dst[2] = HOST_COMPONENT(src[0]);
+	dst[0] = HOST_COMPONENT(r);
 	src += 3;
-#else
-#  ifndef WORDS_BIGENDIAN
-	*dst++ = src[2 * 2 + 0];
-	*dst++ = src[2 * 2 + 1];
-	*dst++ = src[1 * 2 + 0];
-	*dst++ = src[1 * 2 + 1];
-	*dst++ = src[0 * 2 + 0];
-	*dst++ = src[0 * 2 + 1];
-#  else
-	*dst++ = src[2 * 2 + 1];
-	*dst++ = src[2 * 2 + 0];
-	*dst++ = src[1 * 2 + 1];
-	*dst++ = src[1 * 2 + 0];
-	*dst++ = src[0 * 2 + 1];
-	*dst++ = src[0 * 2 + 0];
-#  endif
-	src += 3 * 2;
-#endif
-
+	dst += 3;
     }
     return SANE_STATUS_GOOD;
 }
@@ -201,10 +146,13 @@ FUNC_NAME(genesys_reorder_components_endian) (
     unsigned int c;
     uint8_t *src = src_data;
     uint8_t *dst = dst_data;
+    uint8_t b;
 
+    /* src and dst may be the same buffer */
     for(c = 0; c < lines * pixels * channels; c++) {
+	b = src[0];
 	*dst++ = src[1];
-	*dst++ = src[0];
+	*dst++ = b;
 	src += 2;
     }
 return SANE_STATUS_GOOD;
@@ -228,7 +176,6 @@ FUNC_NAME(genesys_reverse_ccd) (
     COMPONENT_TYPE *dstp;
     unsigned int pitch = components_per_line;
     unsigned int ccd_shift_pitch[12];
-    unsigned int *csp;
 
     for (c = 0; c < component_count; c++)
 	ccd_shift_pitch[c] = ccd_shift[c] * pitch;
@@ -269,14 +216,17 @@ FUNC_NAME(genesys_reverse_ccd) (
     srcp = src;
     dstp = dst;
     for (y = 0; y < lines; y++) {
-	for (x = 0; x < pitch; x += component_count) {
-	    csp = ccd_shift_pitch;
-	    for (c = 0; c < component_count && c + x < pitch; c++) {
-		*dstp = srcp[*csp++];
-		dstp++;
-		srcp++;
-	    }
+	/* whole groups of components first, then the rest of the line */
+	for (x = 0; x + component_count <= pitch; x += component_count) {
+	    for (c = 0; c < component_count; c++)
+		dstp[c] = srcp[c + ccd_shift_pitch[c]];
+	    dstp += component_count;
+	    srcp += component_count;
 	}
+	for (c = 0; c + x < pitch; c++)
+	    dstp[c] = srcp[c + ccd_shift_pitch[c]];
+	dstp += c;
+	srcp += c;
     }
     return SANE_STATUS_GOOD;
 }
@@ -290,56 +240,94 @@ FUNC_NAME(genesys_shrink_lines) (
     unsigned int dst_pixels,
     unsigned int channels)
 {
-    unsigned int dst_x, src_x, y, c, cnt;
+    unsigned int dst_x, src_x, y, c, i, cnt;
     unsigned int avg[3];
     unsigned int count;
+    unsigned int *runs;
     COMPONENT_TYPE *src = (COMPONENT_TYPE *)src_data;
     COMPONENT_TYPE *dst = (COMPONENT_TYPE *)dst_data;
 
+    /* the number of source pixels per destination pixel (or copies of
+       each source pixel) is the same for every line, so it is
+       calculated once */
+    runs = malloc (((src_pixels > dst_pixels ? dst_pixels : src_pixels) + 1)
+		   * sizeof (unsigned int));
+    if (!runs)
+	return SANE_STATUS_NO_MEM;
+
     if (src_pixels > dst_pixels) {
 /*average*/
-	for (c = 0; c < channels; c++)
-	    avg[c] = 0;
-	for(y = 0; y < lines; y++) {
-	    cnt = src_pixels / 2;
-	    src_x = 0;
-	    for (dst_x = 0; dst_x < dst_pixels; dst_x++) {
-		count = 0;
-		while (cnt < src_pixels && src_x < src_pixels) {
-		    cnt += dst_pixels;
+	cnt = src_pixels / 2;
+	src_x = 0;
+	for (dst_x = 0; dst_x < dst_pixels; dst_x++) {
+	    count = 0;
+	    while (cnt < src_pixels && src_x < src_pixels) {
+		cnt += dst_pixels;
+		src_x++;
+		count++;
+	    }
+	    cnt -= src_pixels;
+	    runs[dst_x] = count;
+	}
 
-		    for (c = 0; c < channels; c++)
-			avg[c] += *src++;
-		    src_x++;
-		    count++;
+	for(y = 0; y < lines; y++) {
+	    if (channels == 3) {
+		for (dst_x = 0; dst_x < dst_pixels; dst_x++) {
+		    count = runs[dst_x];
+		    avg[0] = avg[1] = avg[2] = 0;
+		    for (i = 0; i < count; i++) {
+			avg[0] += src[0];
+			avg[1] += src[1];
+			avg[2] += src[2];
+			src += 3;
+		    }
+		    dst[0] = avg[0] / count;
+		    dst[1] = avg[1] / count;
+		    dst[2] = avg[2] / count;
+		    dst += 3;
 		}
-		cnt -= src_pixels;
-
-		for (c = 0; c < channels; c++) {
-		    *dst++ = avg[c] / count;
-		    avg[c] = 0;
+	    } else {
+		for (dst_x = 0; dst_x < dst_pixels; dst_x++) {
+		    count = runs[dst_x];
+		    for (c = 0; c < channels; c++)
+			avg[c] = 0;
+		    for (i = 0; i < count; i++)
+			for (c = 0; c < channels; c++)
+			    avg[c] += *src++;
+		    for (c = 0; c < channels; c++)
+			*dst++ = avg[c] / count;
 		}
 	    }
 	}
     } else {
 /*interpolate. copy pixels*/
+	cnt = dst_pixels / 2;
+	dst_x = 0;
+	for (src_x = 0; src_x < src_pixels; src_x++) {
+	    count = 0;
+	    while ((cnt < dst_pixels || src_x + 1 == src_pixels) &&
+		   dst_x < dst_pixels) {
+		cnt += src_pixels;
+		dst_x++;
+		count++;
+	    }
+	    cnt -= dst_pixels;
+	    runs[src_x] = count;
+	}
+
 	for(y = 0; y < lines; y++) {
-	    cnt = dst_pixels / 2;
-	    dst_x = 0;
 	    for (src_x = 0; src_x < src_pixels; src_x++) {
-		for (c = 0; c < channels; c++)
-		    avg[c] = *src++;
-		while ((cnt < dst_pixels || src_x + 1 == src_pixels) &&
-		       dst_x < dst_pixels) {
-		    cnt += src_pixels;
-
+		count = runs[src_x];
+		for (i = 0; i < count; i++)
 		    for (c = 0; c < channels; c++)
-			*dst++ = avg[c];
-		    dst_x++;
-		}
-		cnt -= dst_pixels;
+			*dst++ = src[c];
+		src += channels;
 	    }
 	}
     }
+
+    free (runs);
     return SANE_STATUS_GOOD;
 }
+
+#undef HOST_COMPONENT
@@ -78,6 +78,7 @@
 
 #include "../include/sane/sanei_backend.h"
 #include "../include/sane/sanei_usb.h"
+#include "../include/sane/sanei_binarize.h"
 
 #include "../include/_stdint.h"
 
@@ -730,14 +731,41 @@ typedef struct Genesys_Current_Setup
     SANE_Int max_shift;	/* max shift of any ccd component, including staggered pixels*/
 } Genesys_Current_Setup;
 
+/**
+ * FIFO used between the conversion steps of a scan. When the system
+ * allows it the memory is mapped twice in a row, so that the data and the
+ * free space are always contiguous and the buffer works as a ring without
+ * moving data. Otherwise the data is moved to the start of the buffer when
+ * a block doesn't fit at its end.
+ */
 typedef struct Genesys_Buffer
 {
   SANE_Byte *buffer;
   size_t size;
   size_t pos;	/* current position in read buffer */
   size_t avail;	/* data bytes currently in buffer */
+  size_t ring;	/* size of one mapping of a mirrored buffer, 0 if not mirrored */
+  size_t ready;	/* bytes at pos already converted in place */
 } Genesys_Buffer;
 
+/**
+ * Shading coefficients computed from the dark and white averages. They
+ * only depend on the averages and on the values of the key, so they are
+ * kept and sent again as long as the key doesn't change.
+ */
+typedef struct Genesys_Shading_Cache
+{
+  SANE_Bool valid;	/**< data matches the current averages */
+  int xres;		/**< scan resolution used to compute the data */
+  size_t pixels;	/**< number of calibration pixels */
+  size_t channels;	/**< number of calibration channels */
+  unsigned int coeff;	/**< 0x2000 or 0x4000 depending on the GAIN4 bit */
+  unsigned int dpihw;	/**< sensor hardware dpi setting from REG05 */
+  uint8_t exposure[6];	/**< sensor exposure registers 0x10-0x15 */
+  unsigned int length;	/**< size of data in bytes */
+  uint8_t *data;
+} Genesys_Shading_Cache;
+
 struct Genesys_Calibration_Cache
 {
   Genesys_Current_Setup used_setup;/* used to check if entry is compatible */
@@ -751,6 +779,7 @@ struct Genesys_Calibration_Cache
   size_t average_size;
   uint8_t *white_average_data;
   uint8_t *dark_average_data;
+  Genesys_Shading_Cache shading; /**< not stored in the calibration file */
 
   struct Genesys_Calibration_Cache *next;
 };
@@ -790,6 +819,7 @@ struct Genesys_Device
   size_t calib_resolution;
   uint8_t *white_average_data;
   uint8_t *dark_average_data;
+  Genesys_Shading_Cache shading; /**< coefficients computed from the averages */
   uint16_t dark[3];
 
   SANE_Bool already_initialized;
@@ -809,6 +839,8 @@ struct Genesys_Device
   Genesys_Buffer local_buffer;    /**< local buffer for gray data during dynamix lineart */
 
   size_t read_bytes_left;	/**< bytes to read from scanner */
+  struct Genesys_Reader *reader; /**< thread reading the scan data ahead,
+				   NULL when reading in sane_read */
 
   size_t total_bytes_read;	/**< total bytes read sent to frontend */
   size_t total_bytes_to_read;	/**< total bytes read to be sent to frontend */
@@ -818,6 +850,7 @@ struct Genesys_Device
 
   /**< look up table used in dynamic rasterization */
   unsigned char lineart_lut[256];
+  SANEI_Binarize binarize;	/**< software lineart conversion state */
 
   Genesys_Calibration_Cache *calibration_cache;
 
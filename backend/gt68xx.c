@@ -107,6 +107,7 @@
 
 #include "../include/sane/sanei_backend.h"
 #include "../include/sane/sanei_config.h"
+#include "../include/sane/sanei_calib.h"
 
 #ifndef SANE_I18N
 #define SANE_I18N(text) text
@@ -2534,205 +2534,276 @@ gt68xx_clear_calibration (GT68xx_Scanner * scanner)
   return SANE_STATUS_GOOD;
 }
 
+/* version of the layout of the records in the calibration store */
+#define GT68XX_CALIBRATION_VERSION 1
+
+/* size of a calibrator in a calibration record */
+static size_t
+gt68xx_calibrator_size (GT68xx_Calibrator * cal)
+{
+  if (cal == NULL)
+    return sizeof (SANE_Int);
+  return 2 * sizeof (SANE_Int)
+    + cal->width * 2 * (sizeof (unsigned int) + sizeof (double));
+}
+
+/* append a calibrator to a calibration record, a missing one is stored as
+ * a zero width */
+static uint8_t *
+gt68xx_calibrator_store (GT68xx_Calibrator * cal, uint8_t * ptr)
+{
+  SANE_Int nullwidth = 0;
+
+  if (cal == NULL)
+    {
+      memcpy (ptr, &nullwidth, sizeof (SANE_Int));
+      return ptr + sizeof (SANE_Int);
+    }
+
+  memcpy (ptr, &cal->width, sizeof (SANE_Int));
+  ptr += sizeof (SANE_Int);
+  memcpy (ptr, &cal->white_level, sizeof (SANE_Int));
+  ptr += sizeof (SANE_Int);
+  memcpy (ptr, cal->k_white, cal->width * sizeof (unsigned int));
+  ptr += cal->width * sizeof (unsigned int);
+  memcpy (ptr, cal->k_black, cal->width * sizeof (unsigned int));
+  ptr += cal->width * sizeof (unsigned int);
+  memcpy (ptr, cal->white_line, cal->width * sizeof (double));
+  ptr += cal->width * sizeof (double);
+  memcpy (ptr, cal->black_line, cal->width * sizeof (double));
+  ptr += cal->width * sizeof (double);
+  return ptr;
+}
+
+/* read a calibrator back from a calibration record, *ptr is moved past
+ * it. A zero width gives a NULL calibrator. */
+static SANE_Status
+gt68xx_calibrator_load (GT68xx_Calibrator ** cal, const uint8_t ** ptr,
+			const uint8_t * end)
+{
+  SANE_Status status;
+  SANE_Int width, level;
+
+  *cal = NULL;
+  if (end - *ptr < (long) sizeof (SANE_Int))
+    return SANE_STATUS_INVAL;
+  memcpy (&width, *ptr, sizeof (SANE_Int));
+  *ptr += sizeof (SANE_Int);
+  if (width == 0)
+    return SANE_STATUS_GOOD;
+
+  if (width < 0 || end - *ptr < (long) sizeof (SANE_Int)
+      || (unsigned long) (end - *ptr - sizeof (SANE_Int)) <
+      width * 2 * (sizeof (unsigned int) + sizeof (double)))
+    return SANE_STATUS_INVAL;
+  memcpy (&level, *ptr, sizeof (SANE_Int));
+  *ptr += sizeof (SANE_Int);
+
+  status = gt68xx_calibrator_new (width, level, cal);
+  if (status != SANE_STATUS_GOOD)
+    return status;
+
+  memcpy ((*cal)->k_white, *ptr, width * sizeof (unsigned int));
+  *ptr += width * sizeof (unsigned int);
+  memcpy ((*cal)->k_black, *ptr, width * sizeof (unsigned int));
+  *ptr += width * sizeof (unsigned int);
+  memcpy ((*cal)->white_line, *ptr, width * sizeof (double));
+  *ptr += width * sizeof (double);
+  memcpy ((*cal)->black_line, *ptr, width * sizeof (double));
+  *ptr += width * sizeof (double);
+  return SANE_STATUS_GOOD;
+}
+
 static SANE_Status
 gt68xx_write_calibration (GT68xx_Scanner * scanner)
 {
+  SANE_Status status;
+  SANEI_Calib *calib;
+  GT68xx_Calibration *c;
   char *fname;
-  FILE *fcal;
+  char key[16];
+  uint8_t *data, *ptr;
+  size_t size;
   int i;
-  SANE_Int nullwidth = 0;
 
   if (scanner->calibrated == SANE_FALSE)
     {
       return SANE_STATUS_GOOD;
     }
 
-  /* open file */
+  /* open store, an invalid file is replaced */
   fname = gt68xx_calibration_file (scanner);
-  fcal = fopen (fname, "wb");
+  status = sanei_calib_open (fname, scanner->dev->model->name,
+			     GT68XX_CALIBRATION_VERSION, &calib);
   free (fname);
-  if (fcal == NULL)
+  if (status == SANE_STATUS_NO_MEM)
+    return status;
+  sanei_calib_clear (calib);
+
+  /* the store checks the byte order, the records are in native layout */
+  size = sizeof (GT68xx_AFE_Parameters) + sizeof (GT68xx_Exposure_Parameters);
+  data = malloc (size);
+  if (data == NULL)
     {
-      DBG (1,
-	   "gt68xx_write_calibration: failed to open calibration file for writing %s\n",
-	   strerror (errno));
-      return SANE_STATUS_IO_ERROR;
+      sanei_calib_close (calib);
+      return SANE_STATUS_NO_MEM;
     }
+  memcpy (data, &(scanner->afe_params), sizeof (GT68xx_AFE_Parameters));
+  memcpy (data + sizeof (GT68xx_AFE_Parameters), &(scanner->exposure_params),
+	  sizeof (GT68xx_Exposure_Parameters));
+  status = sanei_calib_put (calib, "parameters", data, size, 0);
+  free (data);
 
-  /* TODO we save check endianness and word alignment in case of a home
-   * directory used trough different archs */
-  fwrite (&(scanner->afe_params), sizeof (GT68xx_AFE_Parameters), 1, fcal);
-  fwrite (&(scanner->exposure_params), sizeof (GT68xx_Exposure_Parameters), 1,
-	  fcal);
-  for (i = 0; i < MAX_RESOLUTIONS && scanner->calibrations[i].dpi > 0; i++)
+  for (i = 0;
+       status == SANE_STATUS_GOOD && i < MAX_RESOLUTIONS
+       && scanner->calibrations[i].dpi > 0; i++)
     {
+      c = &scanner->calibrations[i];
       DBG (1, "gt68xx_write_calibration: saving %d dpi calibration\n",
-	   scanner->calibrations[i].dpi);
-      fwrite (&(scanner->calibrations[i].dpi), sizeof (SANE_Int), 1, fcal);
-      fwrite (&(scanner->calibrations[i].pixel_x0), sizeof (SANE_Int), 1,
-	      fcal);
-
-      fwrite (&(scanner->calibrations[i].red->width), sizeof (SANE_Int), 1,
-	      fcal);
-      fwrite (&(scanner->calibrations[i].red->white_level), sizeof (SANE_Int),
-	      1, fcal);
-      fwrite (scanner->calibrations[i].red->k_white, sizeof (unsigned int),
-	      scanner->calibrations[i].red->width, fcal);
-      fwrite (scanner->calibrations[i].red->k_black, sizeof (unsigned int),
-	      scanner->calibrations[i].red->width, fcal);
-      fwrite (scanner->calibrations[i].red->white_line, sizeof (double),
-	      scanner->calibrations[i].red->width, fcal);
-      fwrite (scanner->calibrations[i].red->black_line, sizeof (double),
-	      scanner->calibrations[i].red->width, fcal);
-
-      fwrite (&(scanner->calibrations[i].green->width), sizeof (SANE_Int), 1,
-	      fcal);
-      fwrite (&(scanner->calibrations[i].green->white_level),
-	      sizeof (SANE_Int), 1, fcal);
-      fwrite (scanner->calibrations[i].green->k_white, sizeof (unsigned int),
-	      scanner->calibrations[i].green->width, fcal);
-      fwrite (scanner->calibrations[i].green->k_black, sizeof (unsigned int),
-	      scanner->calibrations[i].green->width, fcal);
-      fwrite (scanner->calibrations[i].green->white_line, sizeof (double),
-	      scanner->calibrations[i].green->width, fcal);
-      fwrite (scanner->calibrations[i].green->black_line, sizeof (double),
-	      scanner->calibrations[i].green->width, fcal);
-
-      fwrite (&(scanner->calibrations[i].blue->width), sizeof (SANE_Int), 1,
-	      fcal);
-      fwrite (&(scanner->calibrations[i].blue->white_level),
-	      sizeof (SANE_Int), 1, fcal);
-      fwrite (scanner->calibrations[i].blue->k_white, sizeof (unsigned int),
-	      scanner->calibrations[i].blue->width, fcal);
-      fwrite (scanner->calibrations[i].blue->k_black, sizeof (unsigned int),
-	      scanner->calibrations[i].blue->width, fcal);
-      fwrite (scanner->calibrations[i].blue->white_line, sizeof (double),
-	      scanner->calibrations[i].blue->width, fcal);
-      fwrite (scanner->calibrations[i].blue->black_line, sizeof (double),
-	      scanner->calibrations[i].blue->width, fcal);
-
-      if (scanner->calibrations[i].gray != NULL)
+	   c->dpi);
+
+      size = 2 * sizeof (SANE_Int)
+	+ gt68xx_calibrator_size (c->red)
+	+ gt68xx_calibrator_size (c->green)
+	+ gt68xx_calibrator_size (c->blue)
+	+ gt68xx_calibrator_size (c->gray);
+      data = malloc (size);
+      if (data == NULL)
 	{
-	  fwrite (&(scanner->calibrations[i].gray->width), sizeof (SANE_Int),
-		  1, fcal);
-	  fwrite (&(scanner->calibrations[i].gray->white_level),
-		  sizeof (SANE_Int), 1, fcal);
-	  fwrite (scanner->calibrations[i].gray->k_white,
-		  sizeof (unsigned int), scanner->calibrations[i].gray->width,
-		  fcal);
-	  fwrite (scanner->calibrations[i].gray->k_black,
-		  sizeof (unsigned int), scanner->calibrations[i].gray->width,
-		  fcal);
-	  fwrite (scanner->calibrations[i].gray->white_line, sizeof (double),
-		  scanner->calibrations[i].gray->width, fcal);
-	  fwrite (scanner->calibrations[i].gray->black_line, sizeof (double),
-		  scanner->calibrations[i].gray->width, fcal);
-	}
-      else
-	{
-	  fwrite (&nullwidth, sizeof (SANE_Int), 1, fcal);
+	  status = SANE_STATUS_NO_MEM;
+	  break;
 	}
+
+      ptr = data;
+      memcpy (ptr, &c->dpi, sizeof (SANE_Int));
+      ptr += sizeof (SANE_Int);
+      memcpy (ptr, &c->pixel_x0, sizeof (SANE_Int));
+      ptr += sizeof (SANE_Int);
+      ptr = gt68xx_calibrator_store (c->red, ptr);
+      ptr = gt68xx_calibrator_store (c->green, ptr);
+      ptr = gt68xx_calibrator_store (c->blue, ptr);
+      gt68xx_calibrator_store (c->gray, ptr);
+
+      snprintf (key, sizeof (key), "dpi-%d", i);
+      status = sanei_calib_put (calib, key, data, size, 0);
+      free (data);
     }
-  DBG (5, "gt68xx_write_calibration: wrote %d calibrations\n", i);
 
-  fclose (fcal);
-  return SANE_STATUS_GOOD;
+  if (status != SANE_STATUS_GOOD)
+    {
+      /* don't write an incomplete calibration */
+      sanei_calib_clear (calib);
+    }
+  else
+    DBG (5, "gt68xx_write_calibration: wrote %d calibrations\n", i);
+
+  if (sanei_calib_close (calib) != SANE_STATUS_GOOD)
+    {
+      DBG (1,
+	   "gt68xx_write_calibration: failed to write calibration file\n");
+      return SANE_STATUS_IO_ERROR;
+    }
+  return status;
 }
 
 static SANE_Status
 gt68xx_read_calibration (GT68xx_Scanner * scanner)
 {
+  SANE_Status status;
+  SANEI_Calib *calib;
+  GT68xx_Calibration *c;
+  const uint8_t *ptr, *end;
+  const void *data;
+  const char *key;
   char *fname;
-  FILE *fcal;
-  int i;
-  SANE_Int width, level;
+  size_t size;
+  int i, index;
 
   scanner->calibrated = SANE_FALSE;
   fname = gt68xx_calibration_file (scanner);
-  fcal = fopen (fname, "rb");
-  free (fname);
-  if (fcal == NULL)
+  if (access (fname, F_OK) != 0)
     {
       DBG (1,
 	   "gt68xx_read_calibration: failed to open calibration file for reading %s\n",
 	   strerror (errno));
+      free (fname);
       return SANE_STATUS_IO_ERROR;
     }
+  status = sanei_calib_open (fname, scanner->dev->model->name,
+			     GT68XX_CALIBRATION_VERSION, &calib);
+  free (fname);
+  if (status != SANE_STATUS_GOOD)
+    {
+      DBG (1, "gt68xx_read_calibration: invalid calibration file\n");
+      sanei_calib_close (calib);
+      return status;
+    }
 
-  /* TODO we should check endiannes and word alignment in case of a home
-   * directory used trough different archs */
-
-  /* TODO check for errors */
-  fread (&(scanner->afe_params), sizeof (GT68xx_AFE_Parameters), 1, fcal);
-  fread (&(scanner->exposure_params), sizeof (GT68xx_Exposure_Parameters), 1,
-	 fcal);
+  status = sanei_calib_get (calib, "parameters", &data, &size);
+  if (status != SANE_STATUS_GOOD
+      || size != sizeof (GT68xx_AFE_Parameters)
+      + sizeof (GT68xx_Exposure_Parameters))
+    {
+      DBG (1, "gt68xx_read_calibration: no calibration parameters\n");
+      sanei_calib_close (calib);
+      return SANE_STATUS_INVAL;
+    }
+  memcpy (&(scanner->afe_params), data, sizeof (GT68xx_AFE_Parameters));
+  memcpy (&(scanner->exposure_params),
+	  (const uint8_t *) data + sizeof (GT68xx_AFE_Parameters),
+	  sizeof (GT68xx_Exposure_Parameters));
 
   /* loop on calibrators */
   i = 0;
-  fread (&(scanner->calibrations[i].dpi), sizeof (SANE_Int), 1, fcal);
-  while (!feof (fcal) && scanner->calibrations[i].dpi > 0)
-    {
-      fread (&(scanner->calibrations[i].pixel_x0), sizeof (SANE_Int), 1,
-	     fcal);
-
-      fread (&width, sizeof (SANE_Int), 1, fcal);
-      fread (&level, sizeof (SANE_Int), 1, fcal);
-      gt68xx_calibrator_new (width, level, &(scanner->calibrations[i].red));
-      fread (scanner->calibrations[i].red->k_white, sizeof (unsigned int),
-	     width, fcal);
-      fread (scanner->calibrations[i].red->k_black, sizeof (unsigned int),
-	     width, fcal);
-      fread (scanner->calibrations[i].red->white_line, sizeof (double), width,
-	     fcal);
-      fread (scanner->calibrations[i].red->black_line, sizeof (double), width,
-	     fcal);
-
-      fread (&width, sizeof (SANE_Int), 1, fcal);
-      fread (&level, sizeof (SANE_Int), 1, fcal);
-      gt68xx_calibrator_new (width, level, &(scanner->calibrations[i].green));
-      fread (scanner->calibrations[i].green->k_white, sizeof (unsigned int),
-	     width, fcal);
-      fread (scanner->calibrations[i].green->k_black, sizeof (unsigned int),
-	     width, fcal);
-      fread (scanner->calibrations[i].green->white_line, sizeof (double),
-	     width, fcal);
-      fread (scanner->calibrations[i].green->black_line, sizeof (double),
-	     width, fcal);
-
-      fread (&width, sizeof (SANE_Int), 1, fcal);
-      fread (&level, sizeof (SANE_Int), 1, fcal);
-      gt68xx_calibrator_new (width, level, &(scanner->calibrations[i].blue));
-      fread (scanner->calibrations[i].blue->k_white, sizeof (unsigned int),
-	     width, fcal);
-      fread (scanner->calibrations[i].blue->k_black, sizeof (unsigned int),
-	     width, fcal);
-      fread (scanner->calibrations[i].blue->white_line, sizeof (double),
-	     width, fcal);
-      fread (scanner->calibrations[i].blue->black_line, sizeof (double),
-	     width, fcal);
-
-      fread (&width, sizeof (SANE_Int), 1, fcal);
-      if (width > 0)
+  index = 0;
+  while (i < MAX_RESOLUTIONS
+	 && sanei_calib_next (calib, &index, &key, &data, &size) ==
+	 SANE_STATUS_GOOD)
+    {
+      if (strncmp (key, "dpi-", 4) != 0)
+	continue;
+
+      c = &scanner->calibrations[i];
+      ptr = data;
+      end = ptr + size;
+      if (size < 2 * sizeof (SANE_Int))
+	continue;
+      memcpy (&c->dpi, ptr, sizeof (SANE_Int));
+      ptr += sizeof (SANE_Int);
+      memcpy (&c->pixel_x0, ptr, sizeof (SANE_Int));
+      ptr += sizeof (SANE_Int);
+
+      c->red = c->green = c->blue = c->gray = NULL;
+      if (c->dpi <= 0
+	  || gt68xx_calibrator_load (&c->red, &ptr, end) != SANE_STATUS_GOOD
+	  || gt68xx_calibrator_load (&c->green, &ptr, end) != SANE_STATUS_GOOD
+	  || gt68xx_calibrator_load (&c->blue, &ptr, end) != SANE_STATUS_GOOD
+	  || gt68xx_calibrator_load (&c->gray, &ptr, end) != SANE_STATUS_GOOD
+	  || !c->red || !c->green || !c->blue)
 	{
-	  fread (&level, sizeof (SANE_Int), 1, fcal);
-	  gt68xx_calibrator_new (width, level,
-				 &(scanner->calibrations[i].gray));
-	  fread (scanner->calibrations[i].gray->k_white,
-		 sizeof (unsigned int), width, fcal);
-	  fread (scanner->calibrations[i].gray->k_black,
-		 sizeof (unsigned int), width, fcal);
-	  fread (scanner->calibrations[i].gray->white_line, sizeof (double),
-		 width, fcal);
-	  fread (scanner->calibrations[i].gray->black_line, sizeof (double),
-		 width, fcal);
+	  DBG (1, "gt68xx_read_calibration: skipping invalid record %s\n",
+	       key);
+	  if (c->red)
+	    gt68xx_calibrator_free (c->red);
+	  if (c->green)
+	    gt68xx_calibrator_free (c->green);
+	  if (c->blue)
+	    gt68xx_calibrator_free (c->blue);
+	  if (c->gray)
+	    gt68xx_calibrator_free (c->gray);
+	  c->red = c->green = c->blue = c->gray = NULL;
+	  c->dpi = 0;
+	  continue;
 	}
-      /* prepare for nex resolution */
+
+      /* prepare for next resolution */
       i++;
-      fread (&(scanner->calibrations[i].dpi), sizeof (SANE_Int), 1, fcal);
     }
+  if (i < MAX_RESOLUTIONS)
+    scanner->calibrations[i].dpi = 0;
 
   DBG (5, "gt68xx_read_calibration: read %d calibrations\n", i);
-  fclose (fcal);
+  sanei_calib_close (calib);
 
   scanner->val[OPT_QUALITY_CAL].w = SANE_TRUE;
   scanner->val[OPT_NEED_CALIBRATION_SW].w = SANE_FALSE;
@@ -2740,5 +2811,4 @@ gt68xx_read_calibration (GT68xx_Scanner * scanner)
   return SANE_STATUS_GOOD;
 }
 
-
 /* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
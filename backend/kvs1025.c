@@ -25,6 +25,7 @@
 #include "../include/sane/saneopts.h"
 #include "../include/sane/sanei.h"
 #include "../include/sane/sanei_usb.h"
+#include "../include/sane/sanei_perf.h"
 #include "../include/sane/sanei_backend.h"
 #include "../include/sane/sanei_config.h"
 #include "../include/lassert.h"
@@ -437,6 +438,8 @@ sane_cancel (SANE_Handle handle)
   dev->scanning = 0;
 
   kv_close (dev);
+
+  sanei_perf_dump (STRINGIFY(BACKEND_NAME));
 }
 
 SANE_Status
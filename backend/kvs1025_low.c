@@ -58,11 +58,11 @@ kv_free (KV_DEV ** pdev)
   kv_close (dev);
 
   DBG (DBG_proc, "kv_free : free image buffer 0 \n");
-  if (dev->img_buffers[0])
-    free (dev->img_buffers[0]);
+  if (dev->img_buffers0[0])
+    free (dev->img_buffers0[0]);
   DBG (DBG_proc, "kv_free : free image buffer 1 \n");
-  if (dev->img_buffers[1])
-    free (dev->img_buffers[1]);
+  if (dev->img_buffers0[1])
+    free (dev->img_buffers0[1]);
   DBG (DBG_proc, "kv_free : free scsi device name\n");
   if (dev->scsi_device_name)
     free (dev->scsi_device_name);
@@ -737,6 +737,8 @@ CMD_request_sense (PKV_DEV dev)
 /* Scan routines */
 
 /* Allocate image buffer for one page (1 or 2 sides) */
+/* Image data is read straight into the buffers, so there is room for the
+   12 byte USB header in front, and for a full read past the end */
 
 SANE_Status
 AllocateImageBuffer (PKV_DEV dev)
@@ -755,40 +757,79 @@ AllocateImageBuffer (PKV_DEV dev)
       DBG (DBG_proc, "AllocateImageBuffer: size(%c)=%d\n",
 	   i ? 'B' : 'F', size[i]);
 
-      if (dev->img_buffers[i] == NULL)
+      if (dev->img_buffers0[i] == NULL)
 	{
-	  p = (SANE_Byte *) malloc (size[i]);
+	  p = (SANE_Byte *) malloc (12 + size[i] + SCSI_BUFFER_SIZE);
 	  if (p == NULL)
 	    {
 	      return SANE_STATUS_NO_MEM;
 	    }
-	  dev->img_buffers[i] = p;
+	  dev->img_buffers0[i] = p;
 	}
       else
 	{
-	  p = (SANE_Byte *) realloc (dev->img_buffers[i], size[i]);
+	  p = (SANE_Byte *) realloc (dev->img_buffers0[i],
+				     12 + size[i] + SCSI_BUFFER_SIZE);
 	  if (p == NULL)
 	    {
 	      return SANE_STATUS_NO_MEM;
 	    }
 	  else
 	    {
-	      dev->img_buffers[i] = p;
+	      dev->img_buffers0[i] = p;
 	    }
 	}
+      dev->img_buffers[i] = dev->img_buffers0[i] + 12;
     }
   DBG (DBG_proc, "AllocateImageBuffer: exit\n");
 
   return SANE_STATUS_GOOD;
 }
 
+/* Read the next chunk of one side to pt in the image buffer. The USB
+   header lands in the 12 bytes in front of pt, which hold image data
+   already read, so they are saved and put back. */
+static SANE_Status
+ReadImageChunk (PKV_DEV dev, int page, int side, SANE_Byte * pt,
+		int *size, PKV_CMD_RESPONSE rs)
+{
+  SANE_Byte head[12];
+  SANE_Status status;
+
+  memcpy (head, pt - 12, 12);
+  status = CMD_read_image (dev, page, side, pt, size, rs);
+  memcpy (pt - 12, head, 12);
+  if (status)
+    {
+      return status;
+    }
+  if (rs->status)
+    {
+      if (get_RS_sense_key (rs->sense))
+	{
+	  DBG (DBG_error, "Error reading image data, "
+	       "sense_key=%d, ASC=%d, ASCQ=%d",
+	       get_RS_sense_key (rs->sense),
+	       get_RS_ASC (rs->sense), get_RS_ASCQ (rs->sense));
+
+	  if (get_RS_sense_key (rs->sense) == 3)
+	    {
+	      if (!get_RS_ASCQ (rs->sense))
+		return SANE_STATUS_NO_DOCS;
+	      return SANE_STATUS_JAMMED;
+	    }
+	  return SANE_STATUS_IO_ERROR;
+	}
+    }
+  return SANE_STATUS_GOOD;
+}
+
 /* Read image data from scanner dev->img_buffers[0],
    for the simplex page */
 SANE_Status
 ReadImageDataSimplex (PKV_DEV dev, int page)
 {
   int bytes_to_read = dev->bytes_to_read[0];
-  SANE_Byte *buffer = (SANE_Byte *) dev->buffer;
   int buff_size = SCSI_BUFFER_SIZE;
   SANE_Byte *pt = dev->img_buffers[0];
   KV_CMD_RESPONSE rs;
@@ -801,38 +842,18 @@ ReadImageDataSimplex (PKV_DEV dev, int page)
       int size = buff_size;
       SANE_Status status;
       DBG (DBG_error, "Bytes left = %d\n", bytes_to_read);
-      status = CMD_read_image (dev, page, SIDE_FRONT, buffer, &size, &rs);
+      status = ReadImageChunk (dev, page, SIDE_FRONT, pt, &size, &rs);
       if (status)
 	{
 	  return status;
 	}
-      if (rs.status)
-	{
-	  if (get_RS_sense_key (rs.sense))
-	    {
-	      DBG (DBG_error, "Error reading image data, "
-		   "sense_key=%d, ASC=%d, ASCQ=%d",
-		   get_RS_sense_key (rs.sense),
-		   get_RS_ASC (rs.sense), get_RS_ASCQ (rs.sense));
-
-	      if (get_RS_sense_key (rs.sense) == 3)
-		{
-		  if (!get_RS_ASCQ (rs.sense))
-		    return SANE_STATUS_NO_DOCS;
-		  return SANE_STATUS_JAMMED;
-		}
-	      return SANE_STATUS_IO_ERROR;
-	    }
-
-	}
-      /* copy data to image buffer */
+      /* data past the image is overwritten by the next read */
       if (size > bytes_to_read)
 	{
 	  size = bytes_to_read;
 	}
       if (size > 0)
 	{
-	  memcpy (pt, buffer, size);
 	  bytes_to_read -= size;
 	  pt += size;
 	  dev->img_size[0] += size;
@@ -851,7 +872,6 @@ SANE_Status
 ReadImageDataDuplex (PKV_DEV dev, int page)
 {
   int bytes_to_read[2];
-  SANE_Byte *buffer = (SANE_Byte *) dev->buffer;
   int buff_size[2];
   SANE_Byte *pt[2];
   KV_CMD_RESPONSE rs;
@@ -882,39 +902,20 @@ ReadImageDataDuplex (PKV_DEV dev, int page)
       DBG (DBG_error, "Bytes left (F) = %d\n", bytes_to_read[0]);
       DBG (DBG_error, "Bytes left (B) = %d\n", bytes_to_read[1]);
 
-      status = CMD_read_image (dev, page, sides[current_side],
-			       buffer, &size, &rs);
+      status = ReadImageChunk (dev, page, sides[current_side],
+			       pt[current_side], &size, &rs);
       if (status)
 	{
 	  return status;
 	}
-      if (rs.status)
-	{
-	  if (get_RS_sense_key (rs.sense))
-	    {
-	      DBG (DBG_error, "Error reading image data, "
-		   "sense_key=%d, ASC=%d, ASCQ=%d",
-		   get_RS_sense_key (rs.sense),
-		   get_RS_ASC (rs.sense), get_RS_ASCQ (rs.sense));
-
-	      if (get_RS_sense_key (rs.sense) == 3)
-		{
-		  if (!get_RS_ASCQ (rs.sense))
-		    return SANE_STATUS_NO_DOCS;
-		  return SANE_STATUS_JAMMED;
-		}
-	      return SANE_STATUS_IO_ERROR;
-	    }
-	}
 
-      /* copy data to image buffer */
+      /* data past the image is overwritten by the next read */
       if (size > bytes_to_read[current_side])
 	{
 	  size = bytes_to_read[current_side];
 	}
       if (size > 0)
 	{
-	  memcpy (pt[current_side], buffer, size);
 	  bytes_to_read[current_side] -= size;
 	  pt[current_side] += size;
 	  dev->img_size[current_side] += size;
@@ -208,8 +208,9 @@ typedef struct kv_scanner_dev
   Option_Value val[OPT_NUM_OPTIONS];
   SANE_Bool option_set;
 
-  /* Image buffer */
-  SANE_Byte *img_buffers[2];
+  /* Image buffer, the image data is read straight into it */
+  SANE_Byte *img_buffers0[2];
+  SANE_Byte *img_buffers[2];	/* img_buffers = img_buffers0 + 12 */
   SANE_Byte *img_pt[2];
   int img_size[2];
 } KV_DEV, *PKV_DEV;
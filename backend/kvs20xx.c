@@ -11,8 +11,12 @@
 
 #include "../include/sane/config.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "../include/sane/sanei_backend.h"
 #include "../include/sane/sanei_scsi.h"
@@ -24,6 +28,11 @@
 #include "kvs20xx.h"
 #include "kvs20xx_cmd.h"
 
+#define KVS20XX_CONFIG_FILE "kvs20xx.conf"
+
+/* megabytes for pages read ahead, set via config file */
+static int read_ahead_size = 0;
+
 struct known_device
 {
   const SANE_Int id;
@@ -57,6 +66,59 @@ static const struct known_device known_devices[] = {
   },
 };
 
+/* the scanners are found by their ids, the config file only has options */
+static void
+read_config (void)
+{
+  char line[PATH_MAX];
+  const char *lp;
+  char *word;
+  FILE *fp;
+
+  read_ahead_size = 0;
+
+  fp = sanei_config_open (KVS20XX_CONFIG_FILE);
+  if (!fp)
+    return;
+
+  while (sanei_config_read (line, sizeof (line), fp))
+    {
+      word = NULL;
+      lp = sanei_config_get_string (line, &word);
+      if (!word || word[0] == '#' || strcmp (word, "option"))
+	{
+	  free (word);
+	  continue;
+	}
+      free (word);
+      word = NULL;
+      lp = sanei_config_get_string (lp, &word);
+
+      if (word && !strcmp (word, "read-ahead"))
+	{
+	  int mb;
+
+	  free (word);
+	  word = NULL;
+	  sanei_config_get_string (lp, &word);
+	  mb = word ? atoi (word) : 0;
+	  if (mb < 0)
+	    DBG (DBG_WARN, "read_config: read-ahead %d MB is < 0, ignoring\n",
+		 mb);
+	  else
+	    {
+	      DBG (DBG_INFO, "read_config: read-ahead %d MB\n", mb);
+	      read_ahead_size = mb;
+	    }
+	}
+      else
+	DBG (DBG_WARN, "read_config: unknown option %s\n",
+	     word ? word : "");
+      free (word);
+    }
+  fclose (fp);
+}
+
 SANE_Status
 sane_init (SANE_Int __sane_unused__ * version_code,
 	   SANE_Auth_Callback __sane_unused__ authorize)
@@ -69,6 +131,8 @@ sane_init (SANE_Int __sane_unused__ * version_code,
   /* Initialize USB */
   sanei_usb_init ();
 
+  read_config ();
+
   return SANE_STATUS_GOOD;
 }
 
@@ -79,6 +143,8 @@ sane_init (SANE_Int __sane_unused__ * version_code,
 static SANE_Device **devlist = NULL;
 static unsigned curr_scan_dev = 0;
 
+static void read_ahead_stop (struct scanner *s);
+
 void
 sane_exit (void)
 {
@@ -224,6 +290,7 @@ sane_open (SANE_String_Const devname, SANE_Handle * handle)
   s->file = h;
   s->bus = bus;
   s->id = id;
+  s->read_ahead = read_ahead_size;
   kvs20xx_init_options (s);
   *handle = s;
   for (i = 0; i < 3; i++)
@@ -276,6 +343,7 @@ sane_close (SANE_Handle handle)
 {
   struct scanner *s = (struct scanner *) handle;
   int i;
+  read_ahead_stop (s);
   if (s->bus == USB)
     {
       sanei_usb_release_interface (s->file, 0);
@@ -325,6 +393,236 @@ wait_document (struct scanner *s)
   return SANE_STATUS_NO_DOCS;
 }
 
+/* Read page into data, both sides in duplex mode */
+static SANE_Status
+read_page (struct scanner *s, unsigned page, u8 * data)
+{
+  SANE_Status st = SANE_STATUS_GOOD;
+  unsigned side = SIDE_FRONT;
+  unsigned read, mx;
+
+  DBG (DBG_INFO, "start: %d\n", page);
+
+  if (s->val[DUPLEX].w)
+    {
+      for (mx = s->side_size * 2; !st; mx -= read, side ^= SIDE_BACK)
+	st = kvs20xx_read_image_data (s, page, side,
+				      &data[s->side_size * 2 - mx], mx,
+				      &read);
+    }
+  else
+    {
+      for (mx = s->side_size; !st; mx -= read)
+	st = kvs20xx_read_image_data (s, page, SIDE_FRONT,
+				      &data[s->side_size - mx], mx, &read);
+    }
+  return st == SANE_STATUS_EOF ? SANE_STATUS_GOOD : st;
+}
+
+/*
+ * Read-ahead: in continuous mode the scanner keeps feeding sheets, so a
+ * thread can fetch the following pages while the frontend is busy with
+ * the current one. The read-ahead config option gives the memory to use
+ * for this in megabytes, at least one page is read ahead if it is not 0.
+ * While the thread runs, it is the only one talking to the scanner.
+ * The thread stops when the feeder is empty without reporting it, the
+ * sane_start which finds no page left checks for paper itself, so more
+ * sheets can still be loaded while the frontend is busy.
+ */
+#ifdef USE_PTHREAD
+
+struct read_ahead
+{
+  pthread_t thread;
+  pthread_mutex_t mu;
+  pthread_cond_t cond;
+
+  unsigned pages;		/* number of page buffers */
+  u8 **data;
+  SANE_Status *status;		/* status of each page read */
+  unsigned head;		/* oldest page read */
+  unsigned count;		/* pages read, not yet taken */
+  unsigned page;		/* next page to read */
+
+  int stop;
+  int done;
+};
+
+static void *
+read_ahead_thread (void *arg)
+{
+  struct scanner *s = arg;
+  struct read_ahead *a = s->ahead;
+  SANE_Status st;
+  unsigned slot;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&a->mu);
+      while (a->count == a->pages && !a->stop)
+	pthread_cond_wait (&a->cond, &a->mu);
+      slot = (a->head + a->count) % a->pages;
+      if (a->stop)
+	{
+	  pthread_mutex_unlock (&a->mu);
+	  break;
+	}
+      pthread_mutex_unlock (&a->mu);
+
+      /* out of paper, sane_start checks again when it gets here */
+      if (kvs20xx_document_exist (s))
+	break;
+      st = read_page (s, a->page, a->data[slot]);
+
+      pthread_mutex_lock (&a->mu);
+      a->status[slot] = st;
+      a->count++;
+      a->page++;
+      pthread_cond_signal (&a->cond);
+      pthread_mutex_unlock (&a->mu);
+
+      /* failed, sane_start takes over again */
+      if (st)
+	break;
+    }
+
+  pthread_mutex_lock (&a->mu);
+  a->done = 1;
+  pthread_cond_signal (&a->cond);
+  pthread_mutex_unlock (&a->mu);
+  return NULL;
+}
+
+static void
+read_ahead_stop (struct scanner *s)
+{
+  struct read_ahead *a = s->ahead;
+  unsigned i;
+
+  if (!a)
+    return;
+
+  pthread_mutex_lock (&a->mu);
+  a->stop = 1;
+  pthread_cond_signal (&a->cond);
+  pthread_mutex_unlock (&a->mu);
+  pthread_join (a->thread, NULL);
+
+  DBG (DBG_INFO, "read_ahead_stop: %u pages dropped\n", a->count);
+
+  pthread_cond_destroy (&a->cond);
+  pthread_mutex_destroy (&a->mu);
+  for (i = 0; i < a->pages; i++)
+    free (a->data[i]);
+  free (a->data);
+  free (a->status);
+  free (a);
+  s->ahead = NULL;
+}
+
+static void
+read_ahead_start (struct scanner *s)
+{
+  struct read_ahead *a;
+  unsigned long size = s->side_size * (s->val[DUPLEX].w ? 2 : 1);
+  unsigned long limit = (unsigned long) s->read_ahead * 1024 * 1024;
+  unsigned i;
+
+  if (!limit || !size || strcmp (s->val[FEEDER_MODE].s, "continuous"))
+    return;
+
+  a = calloc (1, sizeof (*a));
+  if (!a)
+    return;
+  a->pages = limit / size ? limit / size : 1;
+  a->data = calloc (a->pages, sizeof (*a->data));
+  a->status = calloc (a->pages, sizeof (*a->status));
+  a->page = s->page;
+  if (!a->data || !a->status)
+    goto fail;
+  for (i = 0; i < a->pages; i++)
+    {
+      a->data[i] = malloc (size);
+      if (!a->data[i])
+	goto fail;
+    }
+
+  pthread_mutex_init (&a->mu, NULL);
+  pthread_cond_init (&a->cond, NULL);
+  s->ahead = a;
+  if (pthread_create (&a->thread, NULL, read_ahead_thread, s))
+    {
+      pthread_cond_destroy (&a->cond);
+      pthread_mutex_destroy (&a->mu);
+      s->ahead = NULL;
+      goto fail;
+    }
+  DBG (DBG_INFO, "read_ahead_start: up to %u pages\n", a->pages);
+  return;
+
+fail:
+  DBG (DBG_WARN, "read_ahead_start: not enough memory, not reading ahead\n");
+  if (a->data)
+    for (i = 0; i < a->pages; i++)
+      free (a->data[i]);
+  free (a->data);
+  free (a->status);
+  free (a);
+}
+
+/* Take the next page from the read-ahead thread, swapping its buffer
+ * with s->data. Returns 0 if the thread has finished and all of its
+ * pages have been taken, the page must then be read directly. */
+static int
+read_ahead_get (struct scanner *s, SANE_Status * st)
+{
+  struct read_ahead *a = s->ahead;
+  u8 *data;
+
+  if (!a)
+    return 0;
+
+  pthread_mutex_lock (&a->mu);
+  while (!a->count && !a->done)
+    pthread_cond_wait (&a->cond, &a->mu);
+  if (!a->count)
+    {
+      pthread_mutex_unlock (&a->mu);
+      read_ahead_stop (s);
+      return 0;
+    }
+  data = a->data[a->head];
+  a->data[a->head] = s->data;
+  s->data = data;
+  *st = a->status[a->head];
+  a->head = (a->head + 1) % a->pages;
+  a->count--;
+  pthread_cond_signal (&a->cond);
+  pthread_mutex_unlock (&a->mu);
+  return 1;
+}
+
+#else
+
+static void
+read_ahead_stop (struct scanner __sane_unused__ * s)
+{
+}
+
+static void
+read_ahead_start (struct scanner __sane_unused__ * s)
+{
+}
+
+static int
+read_ahead_get (struct scanner __sane_unused__ * s,
+		SANE_Status __sane_unused__ * st)
+{
+  return 0;
+}
+
+#endif
+
 /* Start scanning */
 SANE_Status
 sane_start (SANE_Handle handle)
@@ -332,10 +630,14 @@ sane_start (SANE_Handle handle)
   struct scanner *s = (struct scanner *) handle;
   SANE_Status st;
   int duplex = s->val[DUPLEX].w;
+  int direct = 0;
 
   if (!s->scanning)
     {
       unsigned dummy_length;
+
+      read_ahead_stop (s);
+
       st = kvs20xx_test_unit_ready (s);
       if (st)
 	return st;
@@ -389,12 +691,12 @@ sane_start (SANE_Handle handle)
 	  s->scanning = 0;
 	  return SANE_STATUS_NO_MEM;
 	}
+
+      read_ahead_start (s);
     }
 
   if (duplex)
     {
-      unsigned side = SIDE_FRONT;
-      unsigned read, mx;
       if (s->side == SIDE_FRONT && s->read == s->side_size - s->dummy_size)
 	{
 	  s->side = SIDE_BACK;
@@ -405,33 +707,30 @@ sane_start (SANE_Handle handle)
       s->read = 0;
       s->dummy_size = s->saved_dummy_size;
       s->side = SIDE_FRONT;
-      st = kvs20xx_document_exist (s);
-      if (st)
-	return st;
-      for (mx = s->side_size * 2; !st; mx -= read, side ^= SIDE_BACK)
-	st = kvs20xx_read_image_data (s, s->page, side,
-				      &s->data[s->side_size * 2 - mx], mx,
-				      &read);
     }
   else
     {
-      unsigned read, mx;
       s->read = 0;
+    }
+
+  if (!read_ahead_get (s, &st))
+    {
       st = kvs20xx_document_exist (s);
       if (st)
 	return st;
-      DBG (DBG_INFO, "start: %d\n", s->page);
-
-      for (mx = s->side_size; !st; mx -= read)
-	st = kvs20xx_read_image_data (s, s->page, SIDE_FRONT,
-				      &s->data[s->side_size - mx], mx, &read);
+      st = read_page (s, s->page, s->data);
+      direct = 1;
     }
-  if (st && st != SANE_STATUS_EOF)
+  if (st)
     {
       s->scanning = 0;
       return st;
     }
   s->page++;
+
+  /* paper was loaded after the thread found the feeder empty */
+  if (direct)
+    read_ahead_start (s);
   return SANE_STATUS_GOOD;
 }
 
@@ -525,6 +824,7 @@ void
 sane_cancel (SANE_Handle handle)
 {
   struct scanner *s = (struct scanner *) handle;
+  read_ahead_stop (s);
   s->scanning = 0;
 }
 
@@ -106,6 +106,8 @@ struct scanner
   unsigned read;
   unsigned dummy_size;
   unsigned saved_dummy_size;
+  int read_ahead;		/* megabytes for pages read ahead */
+  struct read_ahead *ahead;	/* pages read in the background, or NULL */
 };
 
 struct window
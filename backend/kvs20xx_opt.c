@@ -590,6 +590,9 @@ sane_control_option (SANE_Handle handle, SANE_Int option,
 	  return SANE_STATUS_GOOD;
 
 	case FEED_TIMEOUT:
+	  /* the read-ahead thread is using the scanner */
+	  if (s->ahead)
+	    return SANE_STATUS_DEVICE_BUSY;
 	  s->val[option].w = *(SANE_Word *) val;
 	  return kvs20xx_set_timeout (s, s->val[option].w);
 
@@ -30,6 +30,11 @@
 
 #define DATA_TAIL 0x200
 
+#define KVS40XX_CONFIG_FILE "kvs40xx.conf"
+
+/* pages the reader may run ahead, set via config file */
+static int read_ahead_pages = 1;
+
 struct known_device
 {
   const SANE_Int id;
@@ -66,96 +71,270 @@ static const struct known_device known_devices[] = {
   },
 };
 
-static inline SANE_Status buf_init(struct buf *b, SANE_Int sz)
+/* The reader thread and the frontend share the chunk queues and the page
+   counters without a lock. The mutex is only taken to sleep when there is
+   nothing to read, or when the reader is as many pages ahead as allowed. */
+#ifdef __ATOMIC_ACQUIRE
+static inline struct chunk *load_next(struct chunk **p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_next(struct chunk **p, struct chunk *c)
+{
+	__atomic_store_n(p, c, __ATOMIC_RELEASE);
+}
+
+static inline int load_int(int *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_int(int *p, int v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+#else
+/* no atomic builtins, fall back to a lock */
+static pthread_mutex_t atomic_mu = PTHREAD_MUTEX_INITIALIZER;
+
+static inline struct chunk *load_next(struct chunk **p)
+{
+	struct chunk *c;
+	pthread_mutex_lock(&atomic_mu);
+	c = *p;
+	pthread_mutex_unlock(&atomic_mu);
+	return c;
+}
+
+static inline void store_next(struct chunk **p, struct chunk *c)
+{
+	pthread_mutex_lock(&atomic_mu);
+	*p = c;
+	pthread_mutex_unlock(&atomic_mu);
+}
+
+static inline int load_int(int *p)
+{
+	int v;
+	pthread_mutex_lock(&atomic_mu);
+	v = *p;
+	pthread_mutex_unlock(&atomic_mu);
+	return v;
+}
+
+static inline void store_int(int *p, int v)
+{
+	pthread_mutex_lock(&atomic_mu);
+	*p = v;
+	pthread_mutex_unlock(&atomic_mu);
+}
+#endif
+
+static inline void wake(struct scanner *s, pthread_cond_t * cond)
+{
+	pthread_mutex_lock(&s->mu);
+	pthread_cond_broadcast(cond);
+	pthread_mutex_unlock(&s->mu);
+}
+
+/* the queue starts with an empty chunk, which is already read */
+static inline SANE_Status buf_init(struct buf *b)
 {
-	const int num = sz / BUF_SIZE + 1;
-	b->buf = (u8 **) realloc(b->buf, num * sizeof(u8 *));
-	if (!b->buf)
+	b->head = b->tail = (struct chunk *) calloc(1, sizeof(struct chunk));
+	if (!b->head)
 		return SANE_STATUS_NO_MEM;
-	memset(b->buf, 0, num * sizeof(void *));
-	b->size = b->head = b->tail = 0;
-	b->sem = 0;
-	b->st = SANE_STATUS_GOOD;
-	pthread_cond_init(&b->cond, NULL);
-	pthread_mutex_init(&b->mu, NULL);
+	b->pos = 0;
+	b->fill = NULL;
 	return SANE_STATUS_GOOD;
 }
 
+/* only when the reader is not running */
 static inline void buf_deinit(struct buf *b)
 {
-	int i;
-	if (!b->buf)
-		return;
-	for (i = b->head; i < b->tail; i++)
-		if (b->buf[i])
-			free(b->buf[i]);
-	free(b->buf);
-	b->buf = NULL;
-	b->head = b->tail = 0;
+	while (b->head) {
+		struct chunk *c = b->head;
+		b->head = c->next;
+		free(c);
+	}
+	free(b->fill);
+	b->tail = b->fill = NULL;
 }
 
-static inline SANE_Status new_buf(struct buf *b, u8 ** p)
+/* reader: the chunk to read the data into */
+static inline u8 *new_buf(struct buf *b)
 {
-	b->buf[b->tail] = (u8 *) malloc(BUF_SIZE);
-	if (!b->buf[b->tail])
-		return SANE_STATUS_NO_MEM;
-	*p = b->buf[b->tail];
-	++b->tail;
-	return SANE_STATUS_GOOD;
+	if (!b->fill)
+		b->fill = (struct chunk *) malloc(sizeof(struct chunk)
+						  + BUF_SIZE);
+	return b->fill ? chunk_data(b->fill) : NULL;
+}
+
+/* reader: queue the chunk filled with sz bytes */
+static inline void push_buf(struct scanner *s, struct buf *b,
+			    unsigned sz, SANE_Status st)
+{
+	struct chunk *c = b->fill;
+	c->next = NULL;
+	c->size = sz;
+	c->st = st;
+	b->fill = NULL;
+	store_next(&b->tail->next, c);
+	b->tail = c;
+	wake(s, &s->data_cond);
 }
 
-static inline SANE_Status buf_get_err(struct buf *b)
+/* reader: end the side of the page with an error */
+static inline void buf_set_st(struct scanner *s, struct buf *b,
+			      SANE_Status st)
 {
-	return b->size ? SANE_STATUS_GOOD : b->st;
+	if (!b->fill)
+		b->fill = (struct chunk *) malloc(sizeof(struct chunk));
+	if (b->fill)
+		push_buf(s, b, 0, st);
 }
 
-static inline void buf_set_st(struct buf *b, SANE_Status st)
+/* frontend: the chunk to read from, head if it has data left or ends
+   the side, otherwise the next one as soon as it is queued */
+static inline struct chunk *get_buf(struct scanner *s, struct buf *b)
 {
-	pthread_mutex_lock(&b->mu);
-	b->st = st;
-	if (buf_get_err(b))
-		pthread_cond_signal(&b->cond);
-	pthread_mutex_unlock(&b->mu);
+	struct chunk *c;
+	if (b->pos < b->head->size || b->head->st)
+		return b->head;
+
+	c = load_next(&b->head->next);
+	if (!c) {
+		pthread_mutex_lock(&s->mu);
+		while (!(c = load_next(&b->head->next)))
+			pthread_cond_wait(&s->data_cond, &s->mu);
+		pthread_mutex_unlock(&s->mu);
+	}
+	free(b->head);
+	b->head = c;
+	b->pos = 0;
+	return c;
 }
 
-static inline void buf_cancel(struct buf *b)
+/* frontend: drop what is left of the side of the current page */
+static inline void pop_buf(struct scanner *s, struct buf *b)
 {
-	buf_set_st(b, SANE_STATUS_CANCELLED);
+	struct chunk *c;
+	for (c = get_buf(s, b); !c->st; c = get_buf(s, b))
+		b->pos = c->size;
+	if (c->st == SANE_STATUS_EOF) {
+		c->st = SANE_STATUS_GOOD;
+		b->pos = c->size;
+	}
 }
 
-static inline void push_buf(struct buf *b, SANE_Int sz)
+/* reader: wait until the frontend has taken enough pages to read page,
+   returns nonzero when asked to stop */
+static inline int wait_room(struct scanner *s, int page)
 {
-	pthread_mutex_lock(&b->mu);
-	b->sem++;
-	b->size += sz;
-	pthread_cond_signal(&b->cond);
-	pthread_mutex_unlock(&b->mu);
+	int stop, old;
+	if (page - load_int(&s->taken) < s->depth)
+		return load_int(&s->stop);
+
+	/* a cancelled wait would leave the mutex locked */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old);
+	pthread_mutex_lock(&s->mu);
+	while (!(stop = load_int(&s->stop))
+	       && page - load_int(&s->taken) >= s->depth)
+		pthread_cond_wait(&s->room_cond, &s->mu);
+	pthread_mutex_unlock(&s->mu);
+	pthread_setcancelstate(old, NULL);
+	return stop;
 }
 
-static inline u8 *get_buf(struct buf *b, SANE_Int * sz)
+/* frontend: the reader may drop page and go on */
+static inline void page_done(struct scanner *s, int page)
 {
-	SANE_Status err = buf_get_err(b);
-	if (err)
-		return NULL;
+	store_int(&s->taken, page + 1);
+	wake(s, &s->room_cond);
+}
+
+/* frontend: wait until the reader is done with page */
+static inline struct page *wait_page(struct scanner *s, int page)
+{
+	if (load_int(&s->done) <= page) {
+		pthread_mutex_lock(&s->mu);
+		while (load_int(&s->done) <= page)
+			pthread_cond_wait(&s->data_cond, &s->mu);
+		pthread_mutex_unlock(&s->mu);
+	}
+	return &s->pages[page % MAX_AHEAD];
+}
 
-	pthread_mutex_lock(&b->mu);
-	while (!b->sem && !buf_get_err(b))
-		pthread_cond_wait(&b->cond, &b->mu);
-	b->sem--;
-	err = buf_get_err(b);
-	if (!err) {
-		*sz = b->size < BUF_SIZE ? b->size : BUF_SIZE;
-		b->size -= *sz;
+static inline void reader_join(struct scanner *s)
+{
+	if (s->thread) {
+		pthread_join(s->thread, NULL);
+		s->thread = 0;
 	}
-	pthread_mutex_unlock(&b->mu);
-	return err ? NULL : b->buf[b->head];
 }
 
-static inline void pop_buf(struct buf *b)
+static inline void reader_stop(struct scanner *s)
 {
-	free(b->buf[b->head]);
-	b->buf[b->head] = NULL;
-	++b->head;
+	if (s->thread) {
+		store_int(&s->stop, 1);
+		wake(s, &s->room_cond);
+		pthread_cancel(s->thread);
+		reader_join(s);
+		store_int(&s->stop, 0);
+	}
+}
+
+/* the scanners are found by their ids, the config file only has options */
+static void
+read_config (void)
+{
+  char line[PATH_MAX];
+  const char *lp;
+  char *word;
+  FILE *fp;
+
+  read_ahead_pages = 1;
+
+  fp = sanei_config_open (KVS40XX_CONFIG_FILE);
+  if (!fp)
+    return;
+
+  while (sanei_config_read (line, sizeof (line), fp))
+    {
+      word = NULL;
+      lp = sanei_config_get_string (line, &word);
+      if (!word || word[0] == '#' || strcmp (word, "option"))
+	{
+	  free (word);
+	  continue;
+	}
+      free (word);
+      word = NULL;
+      lp = sanei_config_get_string (lp, &word);
+
+      if (word && !strcmp (word, "read-ahead"))
+	{
+	  int pages;
+
+	  free (word);
+	  word = NULL;
+	  sanei_config_get_string (lp, &word);
+	  pages = word ? atoi (word) : 0;
+	  if (pages < 1 || pages > MAX_AHEAD)
+	    DBG (DBG_WARN, "read_config: read-ahead %d pages is not in 1..%d, "
+		 "ignoring\n", pages, MAX_AHEAD);
+	  else
+	    {
+	      DBG (DBG_INFO, "read_config: read-ahead %d pages\n", pages);
+	      read_ahead_pages = pages;
+	    }
+	}
+      else
+	DBG (DBG_WARN, "read_config: unknown option %s\n",
+	     word ? word : "");
+      free (word);
+    }
+  fclose (fp);
 }
 
 SANE_Status
@@ -170,6 +349,8 @@ sane_init (SANE_Int __sane_unused__ * version_code,
   /* Initialize USB */
   sanei_usb_init ();
 
+  read_config ();
+
   return SANE_STATUS_GOOD;
 }
 
@@ -323,6 +504,9 @@ sane_open (SANE_String_Const devname, SANE_Handle * handle)
   if (!s)
     return SANE_STATUS_NO_MEM;
   memset (s, 0, sizeof (struct scanner));
+  pthread_mutex_init (&s->mu, NULL);
+  pthread_cond_init (&s->data_cond, NULL);
+  pthread_cond_init (&s->room_cond, NULL);
   s->buffer = malloc (MAX_READ_DATA_SIZE + BULK_HEADER_SIZE);
   if (!s->buffer)
     return SANE_STATUS_NO_MEM;
@@ -330,6 +514,7 @@ sane_open (SANE_String_Const devname, SANE_Handle * handle)
   s->file = h;
   s->bus = bus;
   s->id = id;
+  s->read_ahead = read_ahead_pages;
   strcpy (s->name, devname);
   *handle = s;
   for (i = 0; i < 3; i++)
@@ -394,6 +579,7 @@ sane_close (SANE_Handle handle)
 {
   struct scanner *s = (struct scanner *) handle;
   unsigned i;
+  reader_stop (s);
   hopper_down (s);
   if (s->bus == USB)
     {
@@ -411,6 +597,9 @@ sane_close (SANE_Handle handle)
 
   for (i = 0; i < sizeof (s->buf) / sizeof (s->buf[0]); i++)
     buf_deinit (&s->buf[i]);
+  pthread_cond_destroy (&s->room_cond);
+  pthread_cond_destroy (&s->data_cond);
+  pthread_mutex_destroy (&s->mu);
 
   free (s->buffer);
   free (s);
@@ -448,9 +637,8 @@ wait_document (struct scanner *s)
   return SANE_STATUS_NO_DOCS;
 }
 
-static SANE_Status read_image_duplex(SANE_Handle handle)
+static SANE_Status read_image_duplex(struct scanner *s, int page)
 {
-	struct scanner *s = (struct scanner *) handle;
 	SANE_Status st = SANE_STATUS_GOOD;
 	unsigned read, side;
 	int i;
@@ -464,92 +652,113 @@ static SANE_Status read_image_duplex(SANE_Handle handle)
 		a[i].mx = BUF_SIZE;
 		a[i].eof = 0;
 		a[i].buf = &s->buf[i];
-		st = new_buf(&s->buf[i], &a[i].p);
-		if (st)
-			goto err;
+		a[i].p = new_buf(&s->buf[i]);
+		if (!a[i].p)
+			return SANE_STATUS_NO_MEM;
 	}
 	for (b = &a[0], side = SIDE_FRONT; (!a[0].eof || !a[1].eof);) {
 		pthread_testcancel();
 		if (b->mx == 0) {
-			push_buf(b->buf, BUF_SIZE);
-			st = new_buf(b->buf, &b->p);
-			if (st)
-				goto err;
+			push_buf(s, b->buf, BUF_SIZE, SANE_STATUS_GOOD);
+			b->p = new_buf(b->buf);
+			if (!b->p)
+				return SANE_STATUS_NO_MEM;
 			b->mx = BUF_SIZE;
 		}
 
-		st = kvs40xx_read_image_data(s, s->page, side,
+		st = kvs40xx_read_image_data(s, page, side,
 					     b->p + BUF_SIZE - b->mx, b->mx,
 					     &read);
 		b->mx -= read;
 		if (st) {
 			if (st != INCORRECT_LENGTH
 			    && st != SANE_STATUS_EOF)
-				goto err;
+				return st;
 
 			if (st == SANE_STATUS_EOF) {
 				b->eof = 1;
-				push_buf(b->buf, BUF_SIZE - b->mx);
+				push_buf(s, b->buf, BUF_SIZE - b->mx,
+					 SANE_STATUS_EOF);
 			}
 			side ^= SIDE_BACK;
 			b = &a[side == SIDE_FRONT ? 0 : 1];
 		}
 	}
-
-      err:
-	for (i = 0; i < 2; i++)
-		buf_set_st(&s->buf[i], st);
-	return st;
+	return SANE_STATUS_GOOD;
 }
 
-static SANE_Status read_image_simplex(SANE_Handle handle)
+static SANE_Status read_image_simplex(struct scanner *s, int page)
 {
-	struct scanner *s = (struct scanner *) handle;
 	SANE_Status st = SANE_STATUS_GOOD;
 
 	for (; (!st || st == INCORRECT_LENGTH);) {
 		unsigned read, mx;
-		unsigned char *p = NULL;
-		st = new_buf(&s->buf[0], &p);
+		unsigned char *p = new_buf(&s->buf[0]);
+		if (!p)
+			return SANE_STATUS_NO_MEM;
 		for (read = 0, mx = BUF_SIZE; mx &&
 		     (!st || st == INCORRECT_LENGTH); mx -= read) {
 			pthread_testcancel();
-			st = kvs40xx_read_image_data(s, s->page, SIDE_FRONT,
+			st = kvs40xx_read_image_data(s, page, SIDE_FRONT,
 						     p + BUF_SIZE - mx, mx,
 						     &read);
 		}
-		push_buf(&s->buf[0], BUF_SIZE - mx);
+		if (st && st != INCORRECT_LENGTH && st != SANE_STATUS_EOF)
+			return st;
+		push_buf(s, &s->buf[0], BUF_SIZE - mx, st == SANE_STATUS_EOF ?
+			 SANE_STATUS_EOF : SANE_STATUS_GOOD);
 	}
-	buf_set_st(&s->buf[0], st);
-	return st;
+	return SANE_STATUS_GOOD;
 }
 
-static SANE_Status read_data(struct scanner *s)
+/* The reader thread. It reads the pages from s->done on, up to s->depth
+   pages ahead of the frontend in continuous mode, or a single page. */
+static void *read_data(void *arg)
 {
+	struct scanner *s = (struct scanner *) arg;
 	SANE_Status st;
 	int duplex = s->val[DUPLEX].w;
-	s->read = 0;
-	s->side = SIDE_FRONT;
-
-	st = duplex ? read_image_duplex(s) : read_image_simplex(s);
-	if (st && (st != SANE_STATUS_EOF))
-		goto err;
-
-	st = kvs40xx_read_picture_element(s, SIDE_FRONT, &s->params);
-	if (st)
-		goto err;
-	if (!s->params.lines) {
-		st = SANE_STATUS_INVAL;
-		goto err;
-	}
+	int continuous = !strcmp(s->val[FEEDER_MODE].s,
+				 SANE_I18N("continuous"));
+	int page = s->done;
 
-	sane_get_parameters(s, NULL);
+	for (;;) {
+		struct page *p = &s->pages[page % MAX_AHEAD];
+		unsigned data_avalible = 0;
 
-	s->page++;
-	return SANE_STATUS_GOOD;
-      err:
-	s->scanning = 0;
-	return st;
+		if (wait_room(s, page))
+			return NULL;
+
+		do {
+			pthread_testcancel();
+			st = get_buffer_status(s, &data_avalible);
+		} while (!st && !data_avalible && !load_int(&s->stop));
+		if (!st && !data_avalible)
+			return NULL;
+
+		if (!st)
+			st = duplex ? read_image_duplex(s, page)
+			    : read_image_simplex(s, page);
+		if (!st)
+			st = kvs40xx_read_picture_element(s, SIDE_FRONT,
+							  &p->params);
+		if (!st && !p->params.lines)
+			st = SANE_STATUS_INVAL;
+
+		p->st = st;
+		store_int(&s->done, ++page);
+		wake(s, &s->data_cond);
+		if (st)
+			break;
+		if (!continuous)
+			return NULL;
+	}
+
+	/* the frontend sees the error where it is reading */
+	buf_set_st(s, &s->buf[0], st);
+	if (duplex)
+		buf_set_st(s, &s->buf[1], st);
+	return NULL;
 }
 
 /* Start scanning */
@@ -559,16 +768,16 @@ sane_start (SANE_Handle handle)
   struct scanner *s = (struct scanner *) handle;
   SANE_Status st = SANE_STATUS_GOOD;
   int duplex = s->val[DUPLEX].w, i;
-  unsigned data_avalible;
+  int continuous = !strcmp (s->val[FEEDER_MODE].s, SANE_I18N ("continuous"));
   int start = 0;
+  struct chunk *c;
 
-  if (s->thread)
-    {
-      pthread_join (s->thread, NULL);
-      s->thread = 0;
-    }
   if (!s->scanning)
     {
+      reader_stop (s);
+      for (i = 0; i < 2; i++)
+	buf_deinit (&s->buf[i]);
+
       st = kvs40xx_test_unit_ready (s);
       if (st)
 	return st;
@@ -612,10 +821,24 @@ sane_start (SANE_Handle handle)
 	    return st;
 	}
 
+      for (i = 0; i < 2; i++)
+	{
+	  st = buf_init (&s->buf[i]);
+	  if (st)
+	    return st;
+	}
+
+      s->depth = s->read_ahead;
+      if (s->depth < 1)
+	s->depth = 1;
+      if (s->depth > MAX_AHEAD)
+	s->depth = MAX_AHEAD;
+
       start = 1;
       s->scanning = 1;
       s->page = 0;
-      s->read = 0;
+      s->done = 0;
+      s->taken = 0;
       s->side = SIDE_FRONT;
       sane_get_parameters (s, NULL);
     }
@@ -623,33 +846,45 @@ sane_start (SANE_Handle handle)
   if (duplex && s->side == SIDE_FRONT && !start)
     {
       s->side = SIDE_BACK;
-      s->read = 0;
       return SANE_STATUS_GOOD;
     }
-	do {
-		st = get_buffer_status(s, &data_avalible);
-		if (st)
-			goto err;
-
-	} while (!data_avalible);
 
-  for (i = 0; i < (duplex ? 2 : 1); i++)
+  if (!start)
     {
-      st = buf_init (&s->buf[i], s->side_size);
-      if (st)
-	goto err;
+      /* whatever the frontend did not read of the last page */
+      for (i = 0; i < (duplex ? 2 : 1); i++)
+	pop_buf (s, &s->buf[i]);
+      page_done (s, s->page);
+      s->page++;
+      s->side = SIDE_FRONT;
+      if (!continuous)
+	reader_join (s);
     }
 
-  if (pthread_create (&s->thread, NULL, (void *(*)(void *)) read_data, s))
+  if (!s->thread
+      && pthread_create (&s->thread, NULL, read_data, s))
     {
+      s->thread = 0;
       st = SANE_STATUS_IO_ERROR;
       goto err;
     }
 
+  /* wait for the first data, or the error the reader stopped with */
+  c = get_buf (s, &s->buf[0]);
+  if (c->st && c->st != SANE_STATUS_EOF)
+    {
+      st = c->st;
+      goto err;
+    }
+
   if (s->val[CROP].b || s->val[LENGTHCTL].b || s->val[LONG_PAPER].b)
     {
-      pthread_join (s->thread, NULL);
-      s->thread = 0;
+      struct page *p = wait_page (s, s->page);
+      st = p->st;
+      if (st)
+	goto err;
+      s->params = p->params;
+      sane_get_parameters (s, NULL);
     }
 
   return SANE_STATUS_GOOD;
@@ -665,52 +900,35 @@ sane_read(SANE_Handle handle, SANE_Byte * buf,
 	struct scanner *s = (struct scanner *) handle;
 	int duplex = s->val[DUPLEX].w;
 	struct buf *b = s->side == SIDE_FRONT ? &s->buf[0] : &s->buf[1];
-	SANE_Status err = buf_get_err(b);
-	SANE_Int inbuf = 0;
+	struct chunk *c;
+	SANE_Status err;
 	*len = 0;
 
 	if (!s->scanning)
 		return SANE_STATUS_EOF;
-	if (err)
-		goto out;
-
-	if (s->read) {
-		*len =
-		    max_len <
-		    (SANE_Int) s->read ? max_len : (SANE_Int) s->read;
-		memcpy(buf, s->data + BUF_SIZE - s->read, *len);
-		s->read -= *len;
-
-		if (!s->read)
-			pop_buf(b);
-		goto out;
-	}
-
-	s->data = get_buf(b, &inbuf);
-	if (!s->data)
-		goto out;
 
-	*len = max_len < inbuf ? max_len : inbuf;
-	if (*len > BUF_SIZE)
-		*len = BUF_SIZE;
-	memcpy(buf, s->data, *len);
-	s->read = inbuf > BUF_SIZE ? BUF_SIZE - *len : inbuf - *len;
+	c = get_buf(s, b);
+	if (b->pos < c->size) {
+		*len = c->size - b->pos;
+		if (*len > max_len)
+			*len = max_len;
+		memcpy(buf, chunk_data(c) + b->pos, *len);
+		b->pos += *len;
+		return SANE_STATUS_GOOD;
+	}
 
-	if (!s->read)
-		pop_buf(b);
-      out:
-	err = *len ? SANE_STATUS_GOOD : buf_get_err(b);
+	err = c->st;
 	if (err == SANE_STATUS_EOF) {
-		if (strcmp(s->val[FEEDER_MODE].s, SANE_I18N("continuous"))) {
-			if (!duplex || s->side == SIDE_BACK)
+		if (!duplex || s->side == SIDE_BACK) {
+			page_done(s, s->page);
+			if (strcmp(s->val[FEEDER_MODE].s,
+				   SANE_I18N("continuous"))) {
 				s->scanning = 0;
+				reader_join(s);
+			}
 		}
-		buf_deinit(b);
-	} else if (err) {
-		unsigned i;
-		for (i = 0; i < sizeof(s->buf) / sizeof(s->buf[0]); i++)
-			buf_deinit(&s->buf[i]);
-	}
+	} else if (err)
+		s->scanning = 0;
 	return err;
 }
 
@@ -719,16 +937,11 @@ sane_cancel (SANE_Handle handle)
 {
   unsigned i;
   struct scanner *s = (struct scanner *) handle;
+  reader_stop (s);
   if (s->scanning && !strcmp (s->val[FEEDER_MODE].s, SANE_I18N ("continuous")))
     {
       stop_adf (s);
     }
-  if (s->thread)
-    {
-      pthread_cancel (s->thread);
-      pthread_join (s->thread, NULL);
-      s->thread = 0;
-    }
   for (i = 0; i < sizeof (s->buf) / sizeof (s->buf[0]); i++)
     buf_deinit (&s->buf[i]);
   s->scanning = 0;
@@ -111,18 +111,36 @@ typedef enum
 } KV_OPTION;
 
 
+/* A chunk of image data, the data follows the header. The last chunk of
+   a side of a page carries SANE_STATUS_EOF, or the error the reader
+   stopped with. */
+struct chunk
+{
+  struct chunk *next;
+  unsigned size;
+  SANE_Status st;
+};
+
+#define chunk_data(c) ((u8 *) ((c) + 1))
+
+/* Queue of the chunks of one side, filled by the reader thread and
+   emptied by sane_read. Each end is only touched by its own thread. */
 struct buf
 {
-  u8 **buf;
-  volatile int head;
-  volatile int tail;
-  volatile unsigned size;
-  volatile int sem;
-  volatile SANE_Status st;
-  pthread_mutex_t mu;
-  pthread_cond_t cond;
+  struct chunk *head;		/* being read by the frontend */
+  unsigned pos;			/* bytes of head already read */
+  struct chunk *tail;		/* last chunk queued by the reader */
+  struct chunk *fill;		/* being filled by the reader */
 };
 
+struct page
+{
+  SANE_Parameters params;
+  SANE_Status st;
+};
+
+#define MAX_AHEAD 8
+
 struct scanner
 {
   char name[128];
@@ -137,9 +155,16 @@ struct scanner
   SANE_Parameters params;
   u8 *buffer;
   struct buf buf[2];
-  u8 *data;
+  struct page pages[MAX_AHEAD];	/* indexed by page % MAX_AHEAD */
+  int read_ahead;		/* pages read ahead, from the config file */
+  int depth;			/* pages the reader may run ahead */
+  int done;			/* pages finished by the reader */
+  int taken;			/* pages finished by the frontend */
+  int stop;
+  pthread_mutex_t mu;
+  pthread_cond_t data_cond;	/* the reader queued something */
+  pthread_cond_t room_cond;	/* the frontend took a page */
   unsigned side_size;
-  unsigned read;
   pthread_t thread;
 };
 
@@ -1027,6 +1027,9 @@ sane_control_option (SANE_Handle handle, SANE_Int option,
 	  return SANE_STATUS_GOOD;
 
 	case FEED_TIMEOUT:
+	  /* the reader thread is using the scanner */
+	  if (s->thread)
+	    return SANE_STATUS_DEVICE_BUSY;
 	  s->val[option].w = *(SANE_Word *) val;
 	  return kvs40xx_set_timeout (s, s->val[option].w);
 
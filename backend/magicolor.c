@@ -2049,7 +2049,8 @@ mc_network_discovery(const char*host)
 		while (timercmp(&nowtime, &endtime, <)) {
 			int fds = 0, block = 0;
 			fd_set fdset;
-			DBG(1, "    loop=%d\n", i++);
+			DBG(1, "    loop=%d\n", i);
+			i++;
 			timeout.tv_sec = 0;
 			/* Use a 125ms timeout for select. If we get a response,
 			 * the loop will be entered earlier again, anyway */
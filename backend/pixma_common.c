@@ -365,29 +365,20 @@ pixma_rgb_to_gray (uint8_t * gptr, uint8_t * sptr, unsigned w, unsigned c)
 }
 
 /**
- * This code was taken from the genesys backend
- * uses threshold and threshold_curve to control software binarization
- * @param sp    device set up for the scan
+ * uses threshold and threshold_curve to control software binarization,
+ * see sanei_binarize.h
+ * @param s     device set up for the scan
  * @param dst   pointer where to store result
  * @param src   pointer to raw data
  * @param width width of the processed line
  * @param c     1 for 1-channel single-byte data,
  *              3 for 3-channel single-byte data,
  *              6 for double-byte data
+ * @return pointer after the complete bytes of the result
  * */
 uint8_t *
-pixma_binarize_line(pixma_scan_param_t * sp, uint8_t * dst, uint8_t * src, unsigned width, unsigned c)
+pixma_binarize_line(pixma_t * s, uint8_t * dst, uint8_t * src, unsigned width, unsigned c)
 {
-  unsigned j, x, windowX, sum = 0;
-  unsigned threshold;
-  unsigned offset, addCol;
-  int dropCol, offsetX;
-  unsigned char mask;
-  uint8_t min, max;
-
-  /* PDBG (pixma_dbg (4, "*pixma_binarize_line***** src = %u, dst = %u, width = %u, c = %u, threshold = %u, threshold_curve = %u *****\n",
-                      src, dst, width, c, sp->threshold, sp->threshold_curve)); */
-
   /* 16 bit grayscale not supported */
   if (c == 6)
     {
@@ -396,84 +387,16 @@ pixma_binarize_line(pixma_scan_param_t * sp, uint8_t * dst, uint8_t * src, unsig
     }
 
   /* first, color convert to grayscale */
-    if (c != 1)
+  if (c != 1)
+    {
       pixma_rgb_to_gray(dst, src, width, c);
+      src = dst;
+    }
 
-  /* second, normalize line */
-    min = 255;
-    max = 0;
-    for (x = 0; x < width; x++)
-      {
-        if (src[x] > max)
-          {
-            max = src[x];
-          }
-        if (src[x] < min)
-          {
-            min = src[x];
-          }
-      }
-
-    /* safeguard against dark or white areas */
-    if(min>80)
-        min=0;
-    if(max<80)
-        max=255;
-    for (x = 0; x < width; x++)
-      {
-        src[x] = ((src[x] - min) * 255) / (max - min);
-      }
-
-  /* third, create sliding window, prefill the sliding sum */
-    /* ~1mm works best, but the window needs to have odd # of pixels */
-    windowX = (6 * sp->xdpi) / 150;
-    if (!(windowX % 2))
-      windowX++;
-
-    /* to avoid conflicts with *dst start with offset */
-    offsetX = 1 + (windowX / 2) / 8;
-    for (j = offsetX; j <= windowX; j++)
-      sum += src[j];
-    /* PDBG (pixma_dbg (4, " *pixma_binarize_line***** windowX = %u, startX = %u, sum = %u\n",
-                     windowX, startX, sum)); */
-
-  /* fourth, walk the input buffer, output bits */
-    for (j = 0; j < width; j++)
-      {
-        /* output image location */
-        offset = j % 8;
-        mask = 0x80 >> offset;
-        threshold = sp->threshold;
-
-        /* move sum/update threshold only if there is a curve */
-        if (sp->threshold_curve)
-          {
-            addCol = j + windowX / 2;
-            dropCol = addCol - windowX;
-
-            if (dropCol >= offsetX && addCol < width)
-              {
-                sum += src[addCol];
-                sum -= (sum < src[dropCol] ? sum : src[dropCol]);       /* no negative sum */
-              }
-            threshold = sp->lineart_lut[sum / windowX];
-            /* PDBG (pixma_dbg (4, " *pixma_binarize_line***** addCol = %u, dropCol = %d, sum = %u, windowX = %u, lut-element = %d, threshold = %u\n",
-                             addCol, dropCol, sum, windowX, sum/windowX, threshold)); */
-          }
-
-        /* lookup threshold */
-        if (src[j] > threshold)
-            *dst &= ~mask;      /* white */
-        else
-            *dst |= mask;       /* black */
-
-        if (offset == 7)
-            dst++;
-      }
-
-  /* PDBG (pixma_dbg (4, " *pixma_binarize_line***** ready: src = %u, dst = %u *****\n", src, dst)); */
+  /* then normalize and threshold the gray line */
+  sanei_binarize_line (&s->binarize, src, dst, width);
 
-  return dst;
+  return dst + width / 8;
 }
 
 /**
@@ -821,6 +744,7 @@ pixma_close (pixma_t * s)
       pixma_disconnect (s->io);
     }
   *p = s->next;
+  sanei_binarize_free (&s->binarize);
   free (s);
 }
 
@@ -828,6 +752,7 @@ int
 pixma_scan (pixma_t * s, pixma_scan_param_t * sp)
 {
   int error;
+  SANE_Status status;
 
   error = pixma_check_scan_param (s, sp);
   if (error < 0)
@@ -837,6 +762,14 @@ pixma_scan (pixma_t * s, pixma_scan_param_t * sp)
     {
       load_lut(sp->lineart_lut, 8, 8, 50, 205,
                sp->threshold_curve, sp->threshold-127);
+
+      /* the lut is only used when there is a threshold curve */
+      sanei_binarize_free (&s->binarize);
+      status = sanei_binarize_init (&s->binarize, sp->xdpi, sp->threshold,
+                                    sp->threshold_curve ? sp->lineart_lut : NULL,
+                                    SANEI_BINARIZE_NORMALIZE);
+      if (status != SANE_STATUS_GOOD)
+        return (status == SANE_STATUS_NO_MEM) ? PIXMA_ENOMEM : PIXMA_EINVAL;
     }
 
 #ifndef NDEBUG
@@ -47,6 +47,7 @@
 
 #include <time.h>		/* time_t */
 #include "pixma.h"
+#include "../include/sane/sanei_binarize.h"
 
 
 /*! \defgroup subdriver Subdriver Interface
@@ -125,6 +126,7 @@ struct pixma_t
   pixma_imagebuf_t imagebuf;
   unsigned scanning:1;
   unsigned underrun:1;
+  SANEI_Binarize binarize;	/* software lineart conversion state */
 };
 
 /** \addtogroup subdriver
@@ -192,7 +194,7 @@ void pixma_sleep (unsigned long usec);
 void pixma_get_time (time_t * sec, uint32_t * usec);
 uint8_t * pixma_r_to_ir (uint8_t * gptr, uint8_t * sptr, unsigned w, unsigned c);
 uint8_t * pixma_rgb_to_gray (uint8_t * gptr, uint8_t * sptr, unsigned w, unsigned c);
-uint8_t * pixma_binarize_line(pixma_scan_param_t *, uint8_t * dst, uint8_t * src, unsigned width, unsigned c);
+uint8_t * pixma_binarize_line(pixma_t *, uint8_t * dst, uint8_t * src, unsigned width, unsigned c);
 /**@}*/
 
 /** \name Command related functions */
@@ -765,7 +765,7 @@ iclass_fill_buffer (pixma_t * s, pixma_imagebuf_t * ib)
             sptr = mf->blkptr;
             dptr = mf->lineptr;
             for (i = 0; i < n; i++, sptr += mf->raw_width)
-              dptr = pixma_binarize_line (s->param, dptr, sptr, s->param->line_size, 1);
+              dptr = pixma_binarize_line (s, dptr, sptr, s->param->line_size, 1);
           }
           else if (s->param->channels != 1 &&
                   mf->generation == 1 &&
@@ -1188,7 +1188,7 @@ post_process_image_data (pixma_t * s, pixma_imagebuf_t * ib)
 
           /* Color / Gray to Lineart convert */
           if (s->param->software_lineart)
-              cptr = gptr = pixma_binarize_line (s->param, gptr, cptr, s->param->w, c);
+              cptr = gptr = pixma_binarize_line (s, gptr, cptr, s->param->w, c);
           /* Color to Grayscale convert for CCD sensor */
           else if (is_ccd_grayscale (s))
               cptr = gptr = pixma_rgb_to_gray (gptr, cptr, s->param->w, c);
@@ -1731,7 +1731,7 @@ static unsigned post_process_image_data (pixma_t * s, pixma_imagebuf_t * ib)
 
       /* Color to Lineart convert for CCD sensor */
       if (is_lineart (s))
-        cptr = gptr = pixma_binarize_line (s->param, gptr, cptr, s->param->w, c);
+        cptr = gptr = pixma_binarize_line (s, gptr, cptr, s->param->w, c);
 #ifndef TPUIR_USE_RGB
       /* save IR only for CCD sensor */
       else if (is_tpuir (s))
@@ -78,6 +78,13 @@
 # endif
 #endif
 
+/* messages that are always printed by the kernel module */
+#ifdef __KERNEL__
+# define _DBG_PRINT(level, ...)	_PRINT(__VA_ARGS__)
+#else
+# define _DBG_PRINT(level, ...)	DBG(level, __VA_ARGS__)
+#endif
+
 /* different debug level */
 #define DBG_LOW         0x01
 #define DBG_MEDIUM      0x02
@@ -211,11 +211,7 @@ static int detectSetupBuffers( pScanData ps )
      */
     if ( 0 == ps->TotalBufferRequire ) {
 
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
         "pt_drv: asic 0x%x probably not supported\n", ps->sCaps.AsicID);
 
         return _E_ALLOC;  /* Out of memory */
@@ -230,11 +226,7 @@ static int detectSetupBuffers( pScanData ps )
 
         if ( NULL == ps->driverbuf ) {
 
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
              "pt_drv: Not enough kernel memory %d\n",
                     ps->TotalBufferRequire);
             return _E_ALLOC;  /* Out of memory */
@@ -382,11 +374,7 @@ static int detectAsic98001( pScanData ps )
 
 	return detectScannerConnection( ps );
 #else
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
 			"!!!! WARNING, have a look at function detectAsic98001() !!!!\n" );
    	ps->sCaps.AsicID  =  _ASIC_IS_98001;
   	ps->sCaps.wIOBase = ps->IO.pbSppDataPort;
@@ -436,11 +424,7 @@ _LOC int DetectScanner( pScanData ps, int mode )
 
             /* read Register 0x18 (AsicID Register) of Asic9800x based devices */
 #ifdef _ASIC_98001_SIM
-#ifdef __KERNEL__
-			_PRINT(
-#else
-			DBG( DBG_HIGH,
-#endif
+			_DBG_PRINT( DBG_HIGH,
 						"!!!! WARNING, SW-Emulation active !!!!\n" );
             asic = _ASIC_IS_98001;
 #else
@@ -1290,11 +1290,7 @@ static Bool imageP98003ReadOneImageLine( pScanData ps )
 
     } while( !MiscCheckTimer( &timer ));
 
-#ifdef __KERNEL__
-	_PRINT(
-#else
-	DBG( DBG_HIGH,
-#endif
+	_DBG_PRINT( DBG_HIGH,
 	"Timeout - Scanner malfunction !!\n" );
 	MotorToHomePosition(ps);
 
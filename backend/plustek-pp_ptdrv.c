@@ -861,43 +861,23 @@ static int ptdrvInit( int devno )
 		MiscStartTimer( &toTimer[ps->devno], (_SECOND * ps->warmup));
 
 		if( 0 == ps->lampoff )
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_LOW,
-#endif
+		_DBG_PRINT( DBG_LOW,
 					"pt_drv%u: Lamp-Timer switched off.\n", devno );
 		else {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_LOW,
-#endif
+		_DBG_PRINT( DBG_LOW,
 					"pt_drv%u: Lamp-Timer set to %u seconds.\n",
 														devno, ps->lampoff );
 		}
 
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_LOW,
-#endif
+		_DBG_PRINT( DBG_LOW,
 				"pt_drv%u: WarmUp period set to %u seconds.\n",
 														devno, ps->warmup );
 
 		if( 0 == ps->lOffonEnd ) {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_LOW,
-#endif
+		_DBG_PRINT( DBG_LOW,
 				"pt_drv%u: Lamp untouched on driver unload.\n", devno );
 		} else {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_LOW,
-#endif
+		_DBG_PRINT( DBG_LOW,
 				"pt_drv%u: Lamp switch-off on driver unload.\n", devno );
 		}
 
@@ -1289,31 +1269,19 @@ static int ptdrvRead( pScanData ps, pUChar buffer, int count )
 	int 	retval      = _OK;
 
 #ifdef _ASIC_98001_SIM
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_LOW,
-#endif
+		_DBG_PRINT( DBG_LOW,
 					"pt_drv : Software-Emulation active, can't read!\n" );
 	return _E_INVALID;
 #endif
 
 	if((NULL == buffer) || (NULL == ps)) {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
 						"pt_drv :  Internal NULL-pointer!\n" );
 		return _E_NULLPTR;
 	}
 
 	if( 0 == count ) {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
 			"pt_drv%u: reading 0 bytes makes no sense!\n", ps->devno );
 		return _E_INVALID;
 	}
@@ -1327,11 +1295,7 @@ static int ptdrvRead( pScanData ps, pUChar buffer, int count )
 	 * when using the cat /dev/pt_drv command!
 	 */
    	if (!(ps->DataInf.dwVxdFlag & _VF_ENVIRONMENT_READY)) {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
 			"pt_drv%u:  Cannot read, driver not initialized!\n",ps->devno);
 		return _E_SEQUENCE;
 	}
@@ -1342,11 +1306,7 @@ static int ptdrvRead( pScanData ps, pUChar buffer, int count )
 	ps->Scan.bp.pMonoBuf = _KALLOC( ps->DataInf.dwAppPhyBytesPerLine, GFP_KERNEL);
 
 	if ( NULL == ps->Scan.bp.pMonoBuf ) {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
 			"pt_drv%u:  Not enough memory available!\n", ps->devno );
     	return _E_ALLOC;
 	}
@@ -1357,11 +1317,7 @@ static int ptdrvRead( pScanData ps, pUChar buffer, int count )
 		scaleBuf = _KALLOC( ps->DataInf.dwAppPhyBytesPerLine, GFP_KERNEL);
 		if ( NULL == scaleBuf ) {
 			_KFREE( ps->Scan.bp.pMonoBuf );
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
 			"pt_drv%u:  Not enough memory available!\n", ps->devno );
     		return _E_ALLOC;
 		}
@@ -1408,11 +1364,7 @@ static int ptdrvRead( pScanData ps, pUChar buffer, int count )
 
     retval = ps->Calibration( ps );
 	if( _OK != retval ) {
-#ifdef __KERNEL__
-		_PRINT(
-#else
-		DBG( DBG_HIGH,
-#endif
+		_DBG_PRINT( DBG_HIGH,
 			"pt_drv%u: calibration failed, result = %i\n",
 														ps->devno, retval );
 		goto ReadFinished;
@@ -1057,6 +1057,11 @@ usbDev_stopScan( Plustek_Device *dev )
 		dev->scanning.pScanBuffer = NULL;
 		usb_StartLampTimer( dev );
 	}
+
+	if( NULL != dev->scanning.pScaleIdx ) {
+		free( dev->scanning.pScaleIdx );
+		dev->scanning.pScaleIdx = NULL;
+	}
 	return 0;
 }
 
@@ -1341,7 +1346,8 @@ usbDev_Prepare( Plustek_Device *dev, SANE_Byte *buf )
 		}
 
 		/* set a funtion to process the RAW data... */
-		usb_GetImageProc( dev );
+		if( !usb_GetImageProc( dev ))
+			return _E_ALLOC;
 
 		if( scan->sParam.bSource == SOURCE_ADF )
 			scan->dwFlag |= SCANFLAG_StillModule;
@@ -634,6 +634,9 @@ typedef struct ScanDef
 	/** Image processing routine according to the scan mode  */
 	void (*pfnProcess)(struct Plustek_Device*);
 
+	u_long* pScaleIdx;        /**< source pixel of each user pixel,
+	                           *   NULL if not scaling            */
+
 	u_long* pScanBuffer;      /**< our scan buffer */
 
 	u_long  dwLinesPerScanBufs;
@@ -33,6 +33,8 @@
  * - 0.51 - added usb_ColorDuplicateGray16_2(), usb_ColorScaleGray16_2()
  *          usb_BWScaleFromColor_2() and usb_BWDuplicateFromColor_2()
  * - 0.52 - cleanup
+ * - 0.53 - replaced the copy and scale functions by a set of pixel kernels
+ *          and a per-scan scaling table
  * .
  * <hr>
  * This file is part of the SANE package.
@@ -75,6 +77,10 @@
  * <hr>
  */
 
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 #define _SCALER  1000
 
 static u_char   bShift, Shift;
@@ -82,10 +88,6 @@ static u_short  wSum, Mask;
 
 /*
  */
-static u_char BitTable[8] = {
-	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
-};
-
 static u_char BitsReverseTable[256] = {
 	0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
 	0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
@@ -339,467 +341,361 @@ static int usb_GetScaler( ScanDef *scan )
 	return (int)(1.0/ratio * _SCALER);
 }
 
-/******************************* the copy functions **************************/
+/******************************* the pixel kernels ***************************/
 
-/** do a simple memcopy from scan-buffer to user buffer
+/* All copy and scale functions are built from the kernels below. A kernel
+ * moves the samples of one channel into the user buffer. The source is
+ * addressed with a stride in bytes, so the same kernel serves the pixel
+ * interleaved lines of CCD devices and the line interleaved ones of CIS
+ * devices. The destination is addressed with a step in samples, which is
+ * negative for the mirrored ADF images. When scaling, idx is the index
+ * table built by usb_GetImageProc(), which gives the source pixel of each
+ * user pixel, otherwise it is NULL and the pixels are copied one by one.
  */
-static void usb_ColorDuplicate8( Plustek_Device *dev )
-{
-	int      next;
-	u_long   dw, pixels;
-	ScanDef *scan = &dev->scanning;
 
-	usb_AverageColorByte( dev );
+/** 8 bit samples
+ */
+static inline void usb_PixByte( u_char *dst, long step, const u_char *src,
+                                u_long stride, const u_long *idx,
+                                u_long pixels )
+{
+	u_long dw;
 
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
+	if( idx ) {
+		for( dw = 0; dw < pixels; dw++, dst += step )
+			*dst = src[idx[dw] * stride];
 
-	for( dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next ) {
+	} else if( step == 1 && stride == 1 ) {
+		memcpy( dst, src, pixels );
 
-		scan->UserBuf.pb_rgb[pixels].Red   = scan->Red.pcb[dw].a_bColor[0];
-		scan->UserBuf.pb_rgb[pixels].Green = scan->Green.pcb[dw].a_bColor[0];
-		scan->UserBuf.pb_rgb[pixels].Blue  = scan->Blue.pcb[dw].a_bColor[0];
+	} else {
+		for( dw = 0; dw < pixels; dw++, dst += step, src += stride )
+			*dst = *src;
 	}
 }
 
-/** reorder from rgb line to rgb pixel (CIS scanner)
+/** 16 bit samples, the scanner delivers them MSB first, ls is the shift
+ *  for right aligned data
  */
-static void usb_ColorDuplicate8_2( Plustek_Device *dev )
+static inline void usb_PixWord( u_short *dst, long step, const u_char *src,
+                                u_long stride, const u_long *idx,
+                                u_long pixels, u_char ls )
 {
-	int      next;
-	u_long   dw, pixels;
-	ScanDef *scan = &dev->scanning;
+	u_long         dw;
+	const HiLoDef *p;
 
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next  = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
+	if( idx ) {
+		for( dw = 0; dw < pixels; dw++, dst += step ) {
+			p    = (const HiLoDef*)(src + idx[dw] * stride);
+			*dst = _PHILO2WORD(p) >> ls;
+		}
+		return;
 	}
 
-	for( dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next ) {
+	dw = 0;
+#if defined(__SSE2__)
+	if( step == 1 && stride == 2 ) {
+
+		__m128i v, sh = _mm_cvtsi32_si128( ls );
 
-		scan->UserBuf.pb_rgb[pixels].Red   = (u_char)scan->Red.pb[dw];
-		scan->UserBuf.pb_rgb[pixels].Green = (u_char)scan->Green.pb[dw];
-		scan->UserBuf.pb_rgb[pixels].Blue  = (u_char)scan->Blue.pb[dw];
+		for( ; dw + 8 <= pixels; dw += 8, dst += 8, src += 16 ) {
+			v = _mm_loadu_si128((const __m128i*)src );
+			v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ));
+			_mm_storeu_si128((__m128i*)dst, _mm_srl_epi16( v, sh ));
+		}
+	}
+#endif
+	for( ; dw < pixels; dw++, dst += step, src += stride ) {
+		p    = (const HiLoDef*)src;
+		*dst = _PHILO2WORD(p) >> ls;
 	}
 }
 
-/**
+/** 8 bit samples to 16 bit, the sum of a pixel and its left neighbour
  */
-static void usb_ColorDuplicate16( Plustek_Device *dev )
+static inline void usb_PixPseudo( u_short *dst, long step, const u_char *src,
+                                  u_long stride, const u_long *idx,
+                                  u_long pixels )
 {
-	int       next;
-	u_char    ls;
-	u_long    dw, pixels;
-	ScanDef  *scan = &dev->scanning;
-	SANE_Bool swap = usb_HostSwap();
-
-	usb_AverageColorWord( dev );
+	u_long  dw, k;
+	u_short prev;
 
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
+	if( idx ) {
+		for( dw = 0; dw < pixels; dw++, dst += step ) {
+			k    = idx[dw];
+			prev = src[(k ? k - 1 : 0) * stride];
+			*dst = (prev + src[k * stride]) << bShift;
+		}
 	} else {
-		next  = 1;
-		pixels = 0;
+		prev = *src;
+		for( dw = 0; dw < pixels; dw++, dst += step, src += stride ) {
+			*dst = (prev + *src) << bShift;
+			prev = *src;
+		}
 	}
+}
 
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
-
-		if( swap ) {
-			scan->UserBuf.pw_rgb[pixels].Red =
-			                  _HILO2WORD(scan->Red.pcw[dw].HiLo[0]) >> ls;
-			scan->UserBuf.pw_rgb[pixels].Green =
-			                  _HILO2WORD(scan->Green.pcw[dw].HiLo[0]) >> ls;
-			scan->UserBuf.pw_rgb[pixels].Blue =
-			                  _HILO2WORD(scan->Blue.pcw[dw].HiLo[0]) >> ls;
+/** 8 bit samples to 1 bit, each non zero sample sets its bit, an incomplete
+ *  last byte is not written
+ */
+static inline void usb_PixBits( u_char *dst, long step, const u_char *src,
+                                u_long stride, const u_long *idx,
+                                u_long pixels )
+{
+	u_char d;
+	u_long dw, j;
+
+	for( dw = 0; dw + 8 <= pixels; dw += 8, dst += step ) {
+
+		d = 0;
+		if( idx ) {
+			for( j = dw; j < dw + 8; j++ )
+				d = (d << 1) | (src[idx[j] * stride] != 0);
 		} else {
-			scan->UserBuf.pw_rgb[pixels].Red  = scan->Red.pw[dw]   >> ls;
-			scan->UserBuf.pw_rgb[pixels].Green= scan->Green.pw[dw] >> ls;
-			scan->UserBuf.pw_rgb[pixels].Blue = scan->Blue.pw[dw]  >> ls;
+			for( j = dw; j < dw + 8; j++ )
+				d = (d << 1) | (src[j * stride] != 0);
 		}
+		*dst = d;
 	}
 }
 
-/**
+/** returns the index of the first user buffer pixel to write and sets the
+ *  direction, ADF images are mirrored
  */
-static void usb_ColorDuplicate16_2( Plustek_Device *dev )
+static u_long usb_DstStart( ScanDef *scan, long *next )
 {
-	int       next;
-	u_char    ls;
-	HiLoDef   tmp;
-	u_long    dw, pixels;
-	ScanDef  *scan = &dev->scanning;
-	SANE_Bool swap = usb_HostSwap();
-
-	usb_AverageColorWord( dev );
-
 	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
+		*next = -1;
+		return scan->sParam.Size.dwPixels - 1;
+	}
+	*next = 1;
+	return 0;
+}
+
+/** returns the channel used for gray and lineart scans in color mode
+ */
+static u_char *usb_GraySource( ScanDef *scan )
+{
+	switch( scan->fGrayFromColor ) {
+		case 1:  return scan->Red.pb;
+		case 3:  return scan->Blue.pb;
+		default: return scan->Green.pb;
 	}
+}
 
+/** returns the shift for 16 bit data
+ */
+static u_char usb_WordShift( ScanDef *scan )
+{
 	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
+		return Shift;
+	return 0;
+}
 
-	for( dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
+/** build the index table for scaling, the DDA (digital differential
+ *  analyzer) walk is done once per scan instead of once per line
+ */
+static SANE_Bool usb_BuildScaleTable( ScanDef *scan )
+{
+	int     izoom, ddax;
+	u_long  dw, pixels, bitsput;
 
-		if( swap ) {
-			tmp = *((HiLoDef*)&scan->Red.pw[dw]);
-			scan->UserBuf.pw_rgb[pixels].Red = _HILO2WORD(tmp) >> ls;
+	pixels = scan->sParam.Size.dwPixels;
 
-			tmp = *((HiLoDef*)&scan->Green.pw[dw]);
-			scan->UserBuf.pw_rgb[pixels].Green = _HILO2WORD(tmp) >> ls;
+	scan->pScaleIdx = (u_long*)malloc((pixels ? pixels : 1) * sizeof(u_long));
+	if( NULL == scan->pScaleIdx ) {
+		DBG( _DBG_ERROR, "Can't allocate scaling table!\n" );
+		return SANE_FALSE;
+	}
 
-			tmp = *((HiLoDef*)&scan->Blue.pw[dw]);
-			scan->UserBuf.pw_rgb[pixels].Blue = _HILO2WORD(tmp) >> ls;
+	izoom = usb_GetScaler( scan );
 
-		} else {
+	for( bitsput = 0, ddax = 0, dw = 0; dw < pixels; bitsput++ ) {
 
-			scan->UserBuf.pw_rgb[pixels].Red   = scan->Red.pw[dw]   >> ls;
-			scan->UserBuf.pw_rgb[pixels].Green = scan->Green.pw[dw] >> ls;
-			scan->UserBuf.pw_rgb[pixels].Blue  = scan->Blue.pw[dw]  >> ls;
+		ddax -= _SCALER;
+
+		while((ddax < 0) && (dw < pixels)) {
+			scan->pScaleIdx[dw++] = bitsput;
+			ddax += izoom;
 		}
 	}
+	return SANE_TRUE;
 }
 
-/**
+/***************************** the copy functions ****************************/
+
+/** RGB, 8 bit
  */
-static void usb_ColorDuplicatePseudo16( Plustek_Device *dev )
+static void usb_Color8( Plustek_Device *dev )
 {
-	int      next;
-	u_short  wR, wG, wB;
-	u_long   dw, pixels;
-	ScanDef *scan = &dev->scanning;
-
-	usb_AverageColorByte( dev );
+	long        next;
+	u_long      stride;
+	RGBByteDef *dst;
+	ScanDef    *scan = &dev->scanning;
 
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
+	if( usb_IsCISDevice(dev)) {
+		stride = 1;
 	} else {
-		next   = 1;
-		pixels = 0;
+		stride = sizeof(ColorByteDef);
+		usb_AverageColorByte( dev );
 	}
 
-	wR = (u_short)scan->Red.pcb[0].a_bColor[0];
-	wG = (u_short)scan->Green.pcb[0].a_bColor[0];
-	wB = (u_short)scan->Blue.pcb[0].a_bColor[0];
+	dst  = scan->UserBuf.pb_rgb + usb_DstStart( scan, &next );
+	next = next * sizeof(RGBByteDef);
 
-	for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
+	usb_PixByte( &dst->Red,   next, scan->Red.pb,   stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels );
+	usb_PixByte( &dst->Green, next, scan->Green.pb, stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels );
+	usb_PixByte( &dst->Blue,  next, scan->Blue.pb,  stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels );
+}
+
+/** RGB, 16 bit
+ */
+static void usb_Color16( Plustek_Device *dev )
+{
+	long          next;
+	u_char        ls;
+	u_long        stride;
+	RGBUShortDef *dst;
+	ScanDef      *scan = &dev->scanning;
+
+	usb_AverageColorWord( dev );
 
-		scan->UserBuf.pw_rgb[pixels].Red   =
-		                        (wR + scan->Red.pcb[dw].a_bColor[0]) << bShift;
-		scan->UserBuf.pw_rgb[pixels].Green =
-		                      (wG + scan->Green.pcb[dw].a_bColor[0]) << bShift;
-		scan->UserBuf.pw_rgb[pixels].Blue  =
-		                       (wB + scan->Blue.pcb[dw].a_bColor[0]) << bShift;
+	stride = usb_IsCISDevice(dev) ? sizeof(u_short) : sizeof(ColorWordDef);
+	ls     = usb_WordShift( scan );
+	dst    = scan->UserBuf.pw_rgb + usb_DstStart( scan, &next );
+	next   = next * 3;
 
-		wR = (u_short)scan->Red.pcb[dw].a_bColor[0];
-		wG = (u_short)scan->Green.pcb[dw].a_bColor[0];
-		wB = (u_short)scan->Blue.pcb[dw].a_bColor[0];
-	}
+	usb_PixWord( &dst->Red,   next, scan->Red.pb,   stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels, ls );
+	usb_PixWord( &dst->Green, next, scan->Green.pb, stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels, ls );
+	usb_PixWord( &dst->Blue,  next, scan->Blue.pb,  stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels, ls );
 }
 
-/**
+/** RGB, 8 bit scanned, 16 bit delivered
  */
-static void usb_ColorDuplicateGray( Plustek_Device *dev )
+static void usb_ColorPseudo16( Plustek_Device *dev )
 {
-	int      next;
-	u_long   dw, pixels;
-	ScanDef *scan = &dev->scanning;
+	long          next;
+	u_long        stride;
+	RGBUShortDef *dst;
+	ScanDef      *scan = &dev->scanning;
 
 	usb_AverageColorByte( dev );
 
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
+	stride = usb_IsCISDevice(dev) ? 1 : sizeof(ColorByteDef);
+	dst    = scan->UserBuf.pw_rgb + usb_DstStart( scan, &next );
+	next   = next * 3;
 
-	switch(scan->fGrayFromColor) {
-
-	case 1:
-		for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-			scan->UserBuf.pb[pixels] = scan->Red.pcb[dw].a_bColor[0];
-		break;
-	case 2:
-		for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-			scan->UserBuf.pb[pixels] = scan->Green.pcb[dw].a_bColor[0];
-		break;
-	case 3:
-		for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-			scan->UserBuf.pb[pixels] = scan->Blue.pcb[dw].a_bColor[0];
-		break;
-	}
+	usb_PixPseudo( &dst->Red,   next, scan->Red.pb,   stride,
+	               scan->pScaleIdx, scan->sParam.Size.dwPixels );
+	usb_PixPseudo( &dst->Green, next, scan->Green.pb, stride,
+	               scan->pScaleIdx, scan->sParam.Size.dwPixels );
+	usb_PixPseudo( &dst->Blue,  next, scan->Blue.pb,  stride,
+	               scan->pScaleIdx, scan->sParam.Size.dwPixels );
 }
 
-/**
+/** gray, 8 bit, taken from one of the color channels
  */
-static void usb_ColorDuplicateGray_2( Plustek_Device *dev )
+static void usb_ColorGray( Plustek_Device *dev )
 {
-	int      next;
-	u_long   dw, pixels;
+	long     next;
+	u_long   stride;
+	u_char  *dst;
 	ScanDef *scan = &dev->scanning;
 
 	usb_AverageColorByte( dev );
 
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
+	stride = usb_IsCISDevice(dev) ? 1 : sizeof(ColorByteDef);
 
-	switch(scan->fGrayFromColor)
-	{
-	case 1:
-		for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-			scan->UserBuf.pb[pixels] = scan->Red.pb[dw];
-		break;
-	case 3:
-		for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-			scan->UserBuf.pb[pixels] = scan->Blue.pb[dw];
-		break;
-	default:
-		for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-			scan->UserBuf.pb[pixels] = scan->Green.pb[dw];
-		break;
-	}
+	dst = scan->UserBuf.pb + usb_DstStart( scan, &next );
+	usb_PixByte( dst, next, usb_GraySource( scan ), stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels );
 }
 
-/**
+/** gray, 16 bit, taken from one of the color channels
  */
-static void usb_ColorDuplicateGray16( Plustek_Device *dev )
+static void usb_ColorGray16( Plustek_Device *dev )
 {
-	int       next;
-	u_char    ls;
-	u_long    dw, pixels;
-	ScanDef  *scan = &dev->scanning;
-	SANE_Bool swap = usb_HostSwap();
+	long     next;
+	u_long   stride;
+	u_short *dst;
+	ScanDef *scan = &dev->scanning;
 
 	usb_AverageColorWord( dev );
 
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	switch(scan->fGrayFromColor) {
+	stride = usb_IsCISDevice(dev) ? sizeof(u_short) : sizeof(ColorWordDef);
 
-	case 1:
-		if( swap ) {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-				scan->UserBuf.pw[pixels] =
-				                   _HILO2WORD(scan->Red.pcw[dw].HiLo[0]) >> ls;
-		} else {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-				scan->UserBuf.pw[pixels] = scan->Red.pw[dw] >> ls;
-		}
-		break;
-	case 2:
-		if( swap ) {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-				scan->UserBuf.pw[pixels] =
-				                 _HILO2WORD(scan->Green.pcw[dw].HiLo[0]) >> ls;
-		} else {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-				scan->UserBuf.pw[pixels] = scan->Green.pw[dw] >> ls;
-		}
-		break;
-	case 3:
-		if( swap ) {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-				scan->UserBuf.pw[pixels] =
-				                   _HILO2WORD(scan->Blue.pcw[dw].HiLo[0]) >> ls;
-		} else {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next)
-				scan->UserBuf.pw[pixels] = scan->Blue.pw[dw] >> ls;
-		}
-		break;
-	}
+	dst = scan->UserBuf.pw + usb_DstStart( scan, &next );
+	usb_PixWord( dst, next, usb_GraySource( scan ), stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels,
+	             usb_WordShift( scan ));
 }
 
-/**
+/** lineart, generated from one of the color channels
  */
-static void usb_ColorDuplicateGray16_2( Plustek_Device *dev )
+static void usb_BWFromColor( Plustek_Device *dev )
 {
-	int       next;
-	u_char    ls;
-	u_long    dw, pixels;
-	HiLoDef   tmp;
-	ScanDef  *scan = &dev->scanning;
-	SANE_Bool swap = usb_HostSwap();
+	long     next;
+	u_long   stride;
+	u_char  *dst;
+	ScanDef *scan = &dev->scanning;
 
-	usb_AverageColorWord( dev );
+	stride = usb_IsCISDevice(dev) ? 1 : sizeof(ColorByteDef);
 
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	switch(scan->fGrayFromColor) {
-	case 1:
-		if( swap ) {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
-				tmp = *((HiLoDef*)&scan->Red.pw[dw]);
-				scan->UserBuf.pw[pixels] = _HILO2WORD(tmp) >> ls;
-			}
-		} else {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
-				scan->UserBuf.pw[pixels] = scan->Red.pw[dw] >> ls;
-			}
-		}
-		break;
-	case 2:
-		if( swap ) {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
-				tmp = *((HiLoDef*)&scan->Green.pw[dw]);
-				scan->UserBuf.pw[pixels] = _HILO2WORD(tmp) >> ls;
-			}
-		} else {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
-				scan->UserBuf.pw[pixels] = scan->Green.pw[dw] >> ls;
-			}
-		}
-		break;
-	case 3:
-		if( swap ) {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
-				tmp = *((HiLoDef*)&scan->Blue.pw[dw]);
-				scan->UserBuf.pw[pixels] = _HILO2WORD(tmp) >> ls;
-			}
-		} else {
-			for (dw = 0; dw < scan->sParam.Size.dwPixels; dw++, pixels += next) {
-				scan->UserBuf.pw[pixels] = scan->Blue.pw[dw] >> ls;
-			}
-		}
-		break;
-	}
+	dst = scan->UserBuf.pb + usb_DstStart( scan, &next );
+	usb_PixBits( dst, next, usb_GraySource( scan ), stride,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels );
 }
 
-/**
+/** gray, 8 bit
  */
-static void usb_GrayDuplicate8( Plustek_Device *dev )
+static void usb_Gray8( Plustek_Device *dev )
 {
-	u_char  *dest, *src;
-	u_long   pixels;
+	long     next;
+	u_char  *dst;
 	ScanDef *scan = &dev->scanning;
 
 	usb_AverageGrayByte( dev );
 
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-
-		pixels = scan->sParam.Size.dwPixels;
-		src    = scan->Green.pb;
-		dest   = scan->UserBuf.pb + pixels - 1;
-
-		for(; pixels; pixels--, src++, dest--)
-			*dest = *src;
-	} else {
-		memcpy( scan->UserBuf.pb, scan->Green.pb, scan->sParam.Size.dwBytes );
-	}
+	dst = scan->UserBuf.pb + usb_DstStart( scan, &next );
+	usb_PixByte( dst, next, scan->Green.pb, 1,
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels );
 }
 
-/**
+/** gray, 16 bit
  */
-static void usb_GrayDuplicate16( Plustek_Device *dev )
+static void usb_Gray16( Plustek_Device *dev )
 {
-	int       next;
-	u_char    ls;
-	u_short  *dest;
-	u_long    pixels;
-	HiLoDef  *pwm;
-	ScanDef  *scan = &dev->scanning;
-	SANE_Bool swap = usb_HostSwap();
+	long     next;
+	u_short *dst;
+	ScanDef *scan = &dev->scanning;
 
 	usb_AverageGrayWord( dev );
 
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next = -1;
-		dest = scan->UserBuf.pw + scan->sParam.Size.dwPixels - 1;
-	} else {
-		next = 1;
-		dest = scan->UserBuf.pw;
-	}
-
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	pwm = scan->Green.philo;
-	for( pixels=scan->sParam.Size.dwPixels; pixels--; pwm++, dest += next ) {
-		if( swap )
-			*dest = (_PHILO2WORD(pwm)) >> ls;
-		else
-			*dest = (_PLOHI2WORD(pwm)) >> ls;
-	}
+	dst = scan->UserBuf.pw + usb_DstStart( scan, &next );
+	usb_PixWord( dst, next, scan->Green.pb, sizeof(u_short),
+	             scan->pScaleIdx, scan->sParam.Size.dwPixels,
+	             usb_WordShift( scan ));
 }
 
-/**
+/** gray, 8 bit scanned, 16 bit delivered
  */
-static void usb_GrayDuplicatePseudo16( Plustek_Device *dev )
+static void usb_GrayPseudo16( Plustek_Device *dev )
 {
-	u_char  *src;
-	int      next;
-	u_short  g;
-	u_short *dest;
-	u_long   pixels;
+	long     next;
+	u_short *dst;
 	ScanDef *scan = &dev->scanning;
 
 	usb_AverageGrayByte( dev );
 
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		next = -1;
-		dest = scan->UserBuf.pw + scan->sParam.Size.dwPixels - 1;
-	} else {
-		next = 1;
-		dest = scan->UserBuf.pw;
-	}
-
-	src = scan->Green.pb;
-	g = (u_short)*src;
-
-	for( pixels=scan->sParam.Size.dwPixels; pixels--; src++, dest += next ) {
-
-		*dest = (g + *src) << bShift;
-		g = (u_short)*src;
-	}
+	dst = scan->UserBuf.pw + usb_DstStart( scan, &next );
+	usb_PixPseudo( dst, next, scan->Green.pb, 1,
+	               scan->pScaleIdx, scan->sParam.Size.dwPixels );
 }
 
 /** copy binary data to the user buffer
@@ -818,1076 +714,157 @@ static void usb_BWDuplicate( Plustek_Device *dev )
 	}
 }
 
-/** generate binary data from one of the three color inputs according to the
- *  value in fGrayFromColor (CCD version)
+/**
  */
-static void usb_BWDuplicateFromColor( Plustek_Device *dev )
+static void usb_BWScale( Plustek_Device *dev )
 {
-	int           next;
-	u_char        d, s, *dest;
-	u_short       j;
-	u_long        pixels;
-	ColorByteDef *src;
-	ScanDef      *scan = &dev->scanning;
+	u_char   tmp, *dest, *src;
+	int      izoom, ddax;
+	u_long   i, dw;
+	ScanDef *scan = &dev->scanning;
 
+	src = scan->Green.pb;
 	if( scan->sParam.bSource == SOURCE_ADF ) {
-		dest = scan->UserBuf.pb + scan->sParam.Size.dwPixels - 1;
-		next = -1;
+		int iSum = wSum;
+		usb_ReverseBitStream(scan->Green.pb, scan->UserBuf.pb,
+		                     scan->sParam.Size.dwValidPixels,
+		                     scan->dwBytesLine, scan->sParam.PhyDpi.x,
+		                     scan->sParam.UserDpi.x, 1 );
+		wSum = iSum;
+		return;
 	} else {
 		dest = scan->UserBuf.pb;
-		next = 1;
-	}
-
-	switch(scan->fGrayFromColor) {
-		case 1:  src = scan->Red.pcb;   break;
-		case 3:  src = scan->Blue.pcb;  break;
-		default: src = scan->Green.pcb; break;
 	}
 
-	d = j = 0;
-	for( pixels = scan->sParam.Size.dwPixels; pixels; pixels--, src++ ) {
-
-		s = src->a_bColor[0];
-		if( s != 0 )
-			d |= BitTable[j];
-		j++;
-		if( j == 8 ) {
-			*dest = d;
-			dest += next;
+	izoom = usb_GetScaler( scan );
 
-			d = j = 0;
-		}
-	}
-}
+	memset( dest, 0, scan->dwBytesLine );
+	ddax = 0;
+	dw   = 0;
 
-/** generate binary data from one of the three color inputs according to the
- *  value in fGrayFromColor (CIS version)
- */
-static void usb_BWDuplicateFromColor_2( Plustek_Device *dev )
-{
-	int      next;
-	u_char   d, *dest, *src;
-	u_short  j;
-	u_long   pixels;
-	ScanDef *scan = &dev->scanning;
+	for( i = 0; i < scan->sParam.Size.dwValidPixels; i++ ) {
 
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		dest = scan->UserBuf.pb + scan->sParam.Size.dwPixels - 1;
-		next = -1;
-	} else {
-		dest = scan->UserBuf.pb;
-		next = 1;
-	}
+		ddax -= _SCALER;
 
-	switch(scan->fGrayFromColor) {
-		case 1:  src = scan->Red.pb;   break;
-		case 3:  src = scan->Blue.pb;  break;
-		default: src = scan->Green.pb; break;
-	}
+		while( ddax < 0 ) {
 
-	d = j = 0;
-	for( pixels = scan->sParam.Size.dwPixels; pixels; pixels--, src++ ) {
+			tmp = src[(i>>3)];
 
-		if( *src != 0 )
-			d |= BitTable[j];
-		j++;
-		if( j == 8 ) {
-			*dest = d;
-			dest += next;
+			if((dw>>3) < scan->sParam.Size.dwValidPixels ) {
 
-			d = j = 0;
+				if( 0 != (tmp &= (1 << ((~(i & 0x7))&0x7))))
+					dest[dw>>3] |= (1 << ((~(dw & 0x7))&0x7));
+			}
+			dw++;
+			ddax += izoom;
 		}
 	}
 }
 
-/************************** the scaling functions ****************************/
-
-/**
+/** function to select the apropriate pixel copy function and to set up the
+ *  scaling table
  */
-static void usb_ColorScaleGray( Plustek_Device *dev )
+static SANE_Bool usb_GetImageProc( Plustek_Device *dev )
 {
-	int           izoom, ddax, next;
-	u_long        dw, pixels;
-	ColorByteDef *src;
-	ScanDef      *scan = &dev->scanning;
+	SANE_Bool scale;
+	const char *name;
+	ScanDef  *scan = &dev->scanning;
+	DCapsDef *sc   = &dev->usbDev.Caps;
+	HWDef    *hw   = &dev->usbDev.HwSetting;
 
-	usb_AverageColorByte( dev );
+	bShift = 0;
 
-	dw = scan->sParam.Size.dwPixels;
+	scale = (scan->sParam.UserDpi.x != scan->sParam.PhyDpi.x);
 
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
+	switch( scan->sParam.bDataType ) {
 
-	switch(scan->fGrayFromColor) {
-		case 1:  src = scan->Red.pcb;   break;
-		case 3:  src = scan->Blue.pcb;  break;
-		default: src = scan->Green.pcb; break;
-	}
+		case SCANDATATYPE_Color:
+			if (scan->sParam.bBitDepth > 8) {
+				if (scan->fGrayFromColor) {
+					scan->pfnProcess = usb_ColorGray16;
+					name = "ColorGray16";
+				} else {
+					scan->pfnProcess = usb_Color16;
+					name = "Color16";
+				}
+			} else if (scan->dwFlag & SCANFLAG_Pseudo48) {
+				scan->pfnProcess = usb_ColorPseudo16;
+				name = "ColorPseudo16";
+			} else if (scan->fGrayFromColor > 7 ) {
+				scan->pfnProcess = usb_BWFromColor;
+				name = "BWFromColor";
+			} else if (scan->fGrayFromColor) {
+				scan->pfnProcess = usb_ColorGray;
+				name = "ColorGray";
+			} else {
+				scan->pfnProcess = usb_Color8;
+				name = "Color8";
+			}
+			break;
+
+		case SCANDATATYPE_Gray:
+			if (scan->sParam.bBitDepth > 8) {
+				scan->pfnProcess = usb_Gray16;
+				name = "Gray16";
+			} else if (scan->dwFlag & SCANFLAG_Pseudo48) {
+				scan->pfnProcess = usb_GrayPseudo16;
+				name = "GrayPseudo16";
+			} else {
+				scan->pfnProcess = usb_Gray8;
+				name = "Gray8";
+			}
+			break;
 
-	izoom = usb_GetScaler( scan );
+		default:
+			if( scale ) {
+				scan->pfnProcess = usb_BWScale;
+				name = "BWScale";
+			} else {
+				scan->pfnProcess = usb_BWDuplicate;
+				name = "BWDuplicate";
+			}
+			break;
+	}
+	DBG( _DBG_INFO, "ImageProc is: %s (%s)\n",
+	                name, scale ? "scaled" : "copied" );
 
-	for( ddax = 0; dw; src++ ) {
+	if( NULL != scan->pScaleIdx ) {
+		free( scan->pScaleIdx );
+		scan->pScaleIdx = NULL;
+	}
+	if( scale && scan->sParam.bDataType != SCANDATATYPE_BW &&
+	    !usb_BuildScaleTable( scan ))
+		return SANE_FALSE;
 
-		ddax -= _SCALER;
-		while((ddax < 0) && (dw > 0)) {
+	if( scan->sParam.bBitDepth == 8 ) {
 
-			scan->UserBuf.pb[pixels] = src->a_bColor[0];
+		if( scan->dwFlag & SCANFLAG_Pseudo48 ) {
+			if( scan->dwFlag & SCANFLAG_RightAlign ) {
+				bShift = 5;
+			} else {
 
-			pixels += next;
-			ddax   += izoom;
-			dw--;
+				/* this should fix the Bearpaw/U12 discrepancy
+				 * in general the fix is needed, but not for the U12
+				 * why? - no idea!
+				 */
+				if(_WAF_BSHIFT7_BUG == (_WAF_BSHIFT7_BUG & sc->workaroundFlag))
+					bShift = 0; /* Holger Bischof 16.12.2001 */
+				else
+					bShift = 7;
+			}
+			DBG( _DBG_INFO, "bShift adjusted: %u\n", bShift );
 		}
 	}
-}
-
-/**
- */
-static void usb_ColorScaleGray_2( Plustek_Device *dev )
-{
-	u_char  *src;
-	int      izoom, ddax, next;
-	u_long   dw, pixels;
-	ScanDef *scan = &dev->scanning;
 
-	usb_AverageColorByte( dev );
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
+	if( _LM9833 == hw->chip ) {
+		Shift = 0;
+		Mask  = 0xFFFF;
 	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	switch(scan->fGrayFromColor) {
-		case 1:  src = scan->Red.pb;   break;
-		case 3:  src = scan->Blue.pb;  break;
-		default: src = scan->Green.pb; break;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	for( ddax = 0; dw; src++ ) {
-
-		ddax -= _SCALER;
-		while((ddax < 0) && (dw > 0)) {
-
-			scan->UserBuf.pb[pixels] = *src;
-
-			pixels += next;
-			ddax   += izoom;
-			dw--;
-		}
+		Shift = 2;
+		Mask  = 0xFFFC;
 	}
-}
 
-/**
- */
-static void usb_ColorScaleGray16( Plustek_Device *dev )
-{
-	u_char    ls;
-	int       izoom, ddax, next;
-	u_long    dw, pixels, bitsput;
-	SANE_Bool swap = usb_HostSwap();
-	ScanDef  *scan = &dev->scanning;
-
-	usb_AverageColorByte( dev );
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	switch( scan->fGrayFromColor ) {
-
-	case 1:
-		for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-			ddax -= _SCALER;
-
-			while((ddax < 0) && (dw > 0)) {
-				if( swap ) {
-					scan->UserBuf.pw[pixels] =
-					        _HILO2WORD(scan->Red.pcw[bitsput].HiLo[0]) >> ls;
-				} else {
-					scan->UserBuf.pw[pixels] = scan->Red.pw[bitsput] >> ls;
-				}
-				pixels += next;
-				ddax   += izoom;
-				dw--;
-			}
-		}
-		break;
-
-	case 2:
-		for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-			ddax -= _SCALER;
-
-			while((ddax < 0) && (dw > 0)) {
-				if( swap ) {
-					scan->UserBuf.pw[pixels] =
-					      _HILO2WORD(scan->Green.pcw[bitsput].HiLo[0]) >> ls;
-				} else {
-					scan->UserBuf.pw[pixels] = scan->Green.pw[bitsput] >> ls;
-				}
-				pixels += next;
-				ddax   += izoom;
-				dw--;
-			}
-		}
-		break;
-
-	case 3:
-		for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-			ddax -= _SCALER;
-
-			while((ddax < 0) && (dw > 0)) {
-				if( swap ) {
-					scan->UserBuf.pw[pixels] =
-					       _HILO2WORD(scan->Blue.pcw[bitsput].HiLo[0]) >> ls;
-				} else {
-					scan->UserBuf.pw[pixels] = scan->Blue.pw[bitsput] >> ls;
-				}
-				pixels += next;
-				ddax   += izoom;
-				dw--;
-			}
-		}
-		break;
-	}
-}
-
-/**
- */
-static void usb_ColorScaleGray16_2( Plustek_Device *dev )
-{
-	u_char    ls;
-	int       izoom, ddax, next;
-	u_long    dw, pixels, bitsput;
-	HiLoDef   tmp;
-	SANE_Bool swap = usb_HostSwap();
-	ScanDef  *scan = &dev->scanning;
-
-	usb_AverageColorByte( dev );
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	switch( scan->fGrayFromColor ) {
-
-	case 1:
-		for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-			ddax -= _SCALER;
-
-			while((ddax < 0) && (dw > 0)) {
-				if( swap ) {
-					tmp = *((HiLoDef*)&scan->Red.pw[bitsput]);
-					scan->UserBuf.pw[pixels] = _HILO2WORD(tmp) >> ls;
-				} else {
-					scan->UserBuf.pw[pixels] = scan->Red.pw[dw] >> ls;
-				}
-				pixels += next;
-				ddax   += izoom;
-				dw--;
-			}
-		}
-		break;
-
-	case 2:
-		for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-			ddax -= _SCALER;
-
-			while((ddax < 0) && (dw > 0)) {
-				if( swap ) {
-					tmp = *((HiLoDef*)&scan->Green.pw[bitsput]);
-					scan->UserBuf.pw[pixels] = _HILO2WORD(tmp) >> ls;
-				} else {
-					scan->UserBuf.pw[pixels] = scan->Green.pw[bitsput] >> ls;
-				}
-				pixels += next;
-				ddax   += izoom;
-				dw--;
-			}
-		}
-		break;
-
-	case 3:
-		for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-			ddax -= _SCALER;
-
-			while((ddax < 0) && (dw > 0)) {
-				if( swap ) {
-					tmp = *((HiLoDef*)&scan->Blue.pw[bitsput]);
-					scan->UserBuf.pw[pixels] = _HILO2WORD(tmp) >> ls;
-				} else {
-					scan->UserBuf.pw[pixels] = scan->Blue.pw[bitsput] >> ls;
-				}
-				pixels += next;
-				ddax   += izoom;
-				dw--;
-			}
-		}
-		break;
-	}
-}
-
-/** here we copy and scale from scanner world to user world...
- */
-static void usb_ColorScale8( Plustek_Device *dev )
-{
-	int      izoom, ddax, next;
-	u_long   dw, pixels, bitsput;
-    ScanDef *scan = &dev->scanning;
-
-	usb_AverageColorByte( dev );
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (dw > 0)) {
-
-			scan->UserBuf.pb_rgb[pixels].Red =
-			                            scan->Red.pcb[bitsput].a_bColor[0];
-			scan->UserBuf.pb_rgb[pixels].Green =
-			                            scan->Green.pcb[bitsput].a_bColor[0];
-			scan->UserBuf.pb_rgb[pixels].Blue =
-			                            scan->Blue.pcb[bitsput].a_bColor[0];
-			pixels += next;
-			ddax   += izoom;
-			dw--;
-		}
-	}
-}
-
-static void usb_ColorScale8_2( Plustek_Device *dev )
-{
-	int      izoom, ddax, next;
-	u_long   dw, pixels, bitsput;
-	ScanDef *scan = &dev->scanning;
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (dw > 0)) {
-
-			scan->UserBuf.pb_rgb[pixels].Red   = scan->Red.pb[bitsput];
-			scan->UserBuf.pb_rgb[pixels].Green = scan->Green.pb[bitsput];
-			scan->UserBuf.pb_rgb[pixels].Blue  = scan->Blue.pb[bitsput];
-
-			pixels += next;
-			ddax   += izoom;
-			dw--;
-		}
-	}
-}
-
-/**
- */
-static void usb_ColorScale16( Plustek_Device *dev )
-{
-	u_char    ls;
-	int       izoom, ddax, next;
-	u_long    dw, pixels, bitsput;
-	SANE_Bool swap = usb_HostSwap();
-	ScanDef  *scan = &dev->scanning;
-
-	usb_AverageColorWord( dev );
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (dw > 0)) {
-
-			if( swap ) {
-
-				scan->UserBuf.pw_rgb[pixels].Red =
-				          _HILO2WORD(scan->Red.pcw[bitsput].HiLo[0]) >> ls;
-
-				scan->UserBuf.pw_rgb[pixels].Green =
-					      _HILO2WORD(scan->Green.pcw[bitsput].HiLo[0]) >> ls;
-
-				scan->UserBuf.pw_rgb[pixels].Blue =
-					      _HILO2WORD(scan->Blue.pcw[bitsput].HiLo[0]) >> ls;
-
-			} else {
-
-				scan->UserBuf.pw_rgb[pixels].Red   = scan->Red.pw[bitsput]>>ls;
-				scan->UserBuf.pw_rgb[pixels].Green = scan->Green.pw[bitsput] >> ls;
-				scan->UserBuf.pw_rgb[pixels].Blue  = scan->Blue.pw[bitsput] >> ls;
-			}
-			pixels += next;
-			ddax   += izoom;
-			dw--;
-		}
-	}
-}
-
-/**
- */
-static void usb_ColorScale16_2( Plustek_Device *dev )
-{
-	u_char     ls;
-	HiLoDef    tmp;
-	int        izoom, ddax, next;
-	u_long     dw, pixels, bitsput;
-	SANE_Bool  swap = usb_HostSwap();
-	ScanDef   *scan = &dev->scanning;
-
-	usb_AverageColorWord( dev );
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (dw > 0)) {
-
-			if( swap ) {
-
-				tmp = *((HiLoDef*)&scan->Red.pw[bitsput]);
-				scan->UserBuf.pw_rgb[pixels].Red = _HILO2WORD(tmp) >> ls;
-
-				tmp = *((HiLoDef*)&scan->Green.pw[bitsput]);
-				scan->UserBuf.pw_rgb[pixels].Green = _HILO2WORD(tmp) >> ls;
-
-				tmp = *((HiLoDef*)&scan->Blue.pw[bitsput]);
-				scan->UserBuf.pw_rgb[pixels].Blue = _HILO2WORD(tmp) >> ls;
-
-			} else {
-
-				scan->UserBuf.pw_rgb[pixels].Red   = scan->Red.pw[bitsput] >> ls;
-				scan->UserBuf.pw_rgb[pixels].Green = scan->Green.pw[bitsput] >> ls;
-				scan->UserBuf.pw_rgb[pixels].Blue  = scan->Blue.pw[bitsput] >> ls;
-			}
-			pixels += next;
-			ddax   += izoom;
-			dw--;
-		}
-	}
-}
-
-/**
- */
-static void usb_ColorScalePseudo16( Plustek_Device *dev )
-{
-	int      izoom, ddax, next;
-	u_short  wR, wG, wB;
-	u_long   dw, pixels, bitsput;
-	ScanDef *scan = &dev->scanning;
-
-	usb_AverageColorByte( dev );
-
-	dw = scan->sParam.Size.dwPixels;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next   = -1;
-		pixels = scan->sParam.Size.dwPixels - 1;
-	} else {
-		next   = 1;
-		pixels = 0;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	wR = (u_short)scan->Red.pcb[0].a_bColor[0];
-	wG = (u_short)scan->Green.pcb[0].a_bColor[1];
-	wB = (u_short)scan->Blue.pcb[0].a_bColor[2];
-
-	for( bitsput = 0, ddax = 0; dw; bitsput++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (dw > 0)) {
-
-			scan->UserBuf.pw_rgb[pixels].Red =
-				(wR + scan->Red.pcb[bitsput].a_bColor[0]) << bShift;
-
-			scan->UserBuf.pw_rgb[pixels].Green =
-				(wG + scan->Green.pcb[bitsput].a_bColor[0]) << bShift;
-
-			scan->UserBuf.pw_rgb[pixels].Blue =
-				(wB + scan->Blue.pcb[bitsput].a_bColor[0]) << bShift;
-
-			pixels += next;
-			ddax   += izoom;
-			dw--;
-		}
-
-		wR = (u_short)scan->Red.pcb[bitsput].a_bColor[0];
-		wG = (u_short)scan->Green.pcb[bitsput].a_bColor[0];
-		wB = (u_short)scan->Blue.pcb[bitsput].a_bColor[0];
-	}
-}
-
-/**
- */
-static void usb_BWScale( Plustek_Device *dev )
-{
-	u_char   tmp, *dest, *src;
-	int      izoom, ddax;
-	u_long   i, dw;
-	ScanDef *scan = &dev->scanning;
-
-	src = scan->Green.pb;
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		int iSum = wSum;
-		usb_ReverseBitStream(scan->Green.pb, scan->UserBuf.pb,
-		                     scan->sParam.Size.dwValidPixels,
-		                     scan->dwBytesLine, scan->sParam.PhyDpi.x,
-		                     scan->sParam.UserDpi.x, 1 );
-		wSum = iSum;
-		return;
-	} else {
-		dest = scan->UserBuf.pb;
-	}
-
-	izoom = usb_GetScaler( scan );
-
-	memset( dest, 0, scan->dwBytesLine );
-	ddax = 0;
-	dw   = 0;
-
-	for( i = 0; i < scan->sParam.Size.dwValidPixels; i++ ) {
-
-		ddax -= _SCALER;
-
-		while( ddax < 0 ) {
-
-			tmp = src[(i>>3)];
-
-			if((dw>>3) < scan->sParam.Size.dwValidPixels ) {
-
-				if( 0 != (tmp &= (1 << ((~(i & 0x7))&0x7))))
-					dest[dw>>3] |= (1 << ((~(dw & 0x7))&0x7));
-			}
-			dw++;
-			ddax += izoom;
-		}
-	}
-}
-
-/**
- */
-static void usb_BWScaleFromColor( Plustek_Device *dev )
-{
-	u_char        d, s, *dest;
-	u_short       j;
-	u_long        pixels;
-	int           izoom, ddax, next;
-	ColorByteDef *src;
-	ScanDef      *scan = &dev->scanning;
-
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		dest = scan->UserBuf.pb + scan->sParam.Size.dwPixels - 1;
-		next = -1;
-	} else {
-		dest = scan->UserBuf.pb;
-		next = 1;
-	}
-
-	/* setup the source buffer */
-	switch(scan->fGrayFromColor) {
-	case 1:  src = scan->Red.pcb;   break;
-	case 3:  src = scan->Blue.pcb;  break;
-	default: src = scan->Green.pcb; break;
-	}
-
-	izoom = usb_GetScaler( scan );
-	ddax  = 0;
-
-	d = j = 0;
-	for( pixels = scan->sParam.Size.dwPixels; pixels; src++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (pixels > 0)) {
-
-			s = src->a_bColor[0];
-			if( s != 0 )
-				d |= BitTable[j];
-			j++;
-			if( j == 8 ) {
-				*dest = d;
-				dest += next;
-				d = j = 0;
-			}
-			ddax   += izoom;
-			pixels--;
-		}
-	}
-}
-
-/**
- */
-static void usb_BWScaleFromColor_2( Plustek_Device *dev )
-{
-	u_char        d, *dest, *src;
-	u_short       j;
-	u_long        pixels;
-	int           izoom, ddax, next;
-	ScanDef      *scan = &dev->scanning;
-
-	if (scan->sParam.bSource == SOURCE_ADF) {
-		dest = scan->UserBuf.pb + scan->sParam.Size.dwPixels - 1;
-		next = -1;
-	} else {
-		dest = scan->UserBuf.pb;
-		next = 1;
-	}
-
-	/* setup the source buffer */
-	switch(scan->fGrayFromColor) {
-	case 1:  src = scan->Red.pb;   break;
-	case 3:  src = scan->Blue.pb;  break;
-	default: src = scan->Green.pb; break;
-	}
-
-	izoom = usb_GetScaler( scan );
-	ddax  = 0;
-
-	d = j = 0;
-	for( pixels = scan->sParam.Size.dwPixels; pixels; src++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (pixels > 0)) {
-
-			if( *src != 0 )
-				d |= BitTable[j];
-			j++;
-			if( j == 8 ) {
-				*dest = d;
-				dest += next;
-				d = j = 0;
-			}
-			ddax   += izoom;
-			pixels--;
-		}
-	}
-}
-
-/**
- */
-static void usb_GrayScale8( Plustek_Device *dev )
-{
-	u_char  *dest, *src;
-	int      izoom, ddax, next;
-	u_long   pixels;
-	ScanDef *scan = &dev->scanning;
-
-	usb_AverageGrayByte( dev );
-
-	src = scan->Green.pb;
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		dest = scan->UserBuf.pb + scan->sParam.Size.dwPixels - 1;
-		next = -1;
-	} else {
-		dest = scan->UserBuf.pb;
-		next = 1;
-	}
-
-	izoom = usb_GetScaler( scan );
-	ddax  = 0;
-
-	for( pixels = scan->sParam.Size.dwPixels; pixels; src++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (pixels > 0)) {
-
-			*dest = *src;
-			dest += next;
-			ddax   += izoom;
-			pixels--;
-		}
-	}
-}
-
-/**
- */
-static void usb_GrayScale16( Plustek_Device *dev )
-{
-	u_char    ls;
-	int       izoom, ddax, next;
-	u_short  *dest;
-	u_long    pixels;
-	HiLoDef  *pwm;
-	ScanDef  *scan = &dev->scanning;
-	SANE_Bool swap = usb_HostSwap();
-
-	usb_AverageGrayWord( dev);
-
-	pwm  = scan->Green.philo;
-	wSum = scan->sParam.PhyDpi.x;
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next = -1;
-		dest = scan->UserBuf.pw + scan->sParam.Size.dwPixels - 1;
-	} else {
-		next = 1;
-		dest = scan->UserBuf.pw;
-	}
-
-	izoom = usb_GetScaler( scan );
-	ddax  = 0;
-
-	if( scan->dwFlag & SCANFLAG_RightAlign )
-		ls = Shift;
-	else
-		ls = 0;
-
-	for( pixels = scan->sParam.Size.dwPixels; pixels; pwm++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (pixels > 0)) {
-
-			if( swap )
-				*dest = _PHILO2WORD(pwm) >> ls;
-			else
-				*dest = _PLOHI2WORD(pwm) >> ls;
-
-			dest += next;
-			ddax += izoom;
-			pixels--;
-		}
-	}
-}
-
-/**
- */
-static void usb_GrayScalePseudo16( Plustek_Device *dev )
-{
-	u_char  *src;
-	int      izoom, ddax, next;
-	u_short *dest, g;
-	u_long   pixels;
-	ScanDef *scan = &dev->scanning;
-
-	usb_AverageGrayByte( dev );
-
-	if( scan->sParam.bSource == SOURCE_ADF ) {
-		next = -1;
-		dest = scan->UserBuf.pw + scan->sParam.Size.dwPixels - 1;
-	} else {
-		next = 1;
-		dest = scan->UserBuf.pw;
-	}
-
-	src = scan->Green.pb;
-	g   = (u_short)*src;
-
-	izoom = usb_GetScaler( scan );
-	ddax  = 0;
-
-	for( pixels = scan->sParam.Size.dwPixels; pixels; src++ ) {
-
-		ddax -= _SCALER;
-
-		while((ddax < 0) && (pixels > 0)) {
-
-			*dest = (g + *src) << bShift;
-			dest += next;
-			ddax += izoom;
-			pixels--;
-		}
-		g = (u_short)*src;
-	}
-}
-
-/** function to select the apropriate pixel copy function
- */
-static void usb_GetImageProc( Plustek_Device *dev )
-{
-    ScanDef  *scan = &dev->scanning;
-	DCapsDef *sc   = &dev->usbDev.Caps;
-	HWDef    *hw   = &dev->usbDev.HwSetting;
-
-	bShift = 0;
-
-	if( scan->sParam.UserDpi.x != scan->sParam.PhyDpi.x ) {
-
-		/* Pixel scaling... */
-		switch( scan->sParam.bDataType ) {
-
-			case SCANDATATYPE_Color:
-				if (scan->sParam.bBitDepth > 8) {
-
-					if( usb_IsCISDevice(dev)){
-						scan->pfnProcess = usb_ColorScale16_2;
-						DBG( _DBG_INFO, "ImageProc is: ColorScale16_2\n" );
-					} else {
-						scan->pfnProcess = usb_ColorScale16;
-						DBG( _DBG_INFO, "ImageProc is: ColorScale16\n" );
-					}
-					if (scan->fGrayFromColor) {
-						if( usb_IsCISDevice(dev)){
-							scan->pfnProcess = usb_ColorScaleGray16_2;
-							DBG( _DBG_INFO, "ImageProc is: ColorScaleGray16_2\n" );
-						} else {
-							scan->pfnProcess = usb_ColorScaleGray16;
-							DBG( _DBG_INFO, "ImageProc is: ColorScaleGray16\n" );
-						}
-					}
-				} else if (scan->dwFlag & SCANFLAG_Pseudo48) {
-					scan->pfnProcess = usb_ColorScalePseudo16;
-					DBG( _DBG_INFO, "ImageProc is: ColorScalePseudo16\n" );
-
-				} else if (scan->fGrayFromColor) {
-
-					if( usb_IsCISDevice(dev)){
-						if (scan->fGrayFromColor > 7 ) {
-							scan->pfnProcess = usb_BWScaleFromColor_2;
-							DBG( _DBG_INFO, "ImageProc is: BWScaleFromColor_2\n" );
-						} else {
-							scan->pfnProcess = usb_ColorScaleGray_2;
-							DBG( _DBG_INFO, "ImageProc is: ColorScaleGray_2\n" );
-						}
-					} else {
-						if (scan->fGrayFromColor > 7 ) {
-							scan->pfnProcess = usb_BWScaleFromColor;
-							DBG( _DBG_INFO, "ImageProc is: BWScaleFromColor\n" );
-						} else {
-							scan->pfnProcess = usb_ColorScaleGray;
-							DBG( _DBG_INFO, "ImageProc is: ColorScaleGray\n" );
-						}
-					}
-				} else {
-
-					if( usb_IsCISDevice(dev)){
-						scan->pfnProcess = usb_ColorScale8_2;
-						DBG( _DBG_INFO, "ImageProc is: ColorScale8_2\n" );
-					} else {
-						scan->pfnProcess = usb_ColorScale8;
-						DBG( _DBG_INFO, "ImageProc is: ColorScale8\n" );
-					}
-				}
-				break;
-
-			case SCANDATATYPE_Gray:
-				if (scan->sParam.bBitDepth > 8) {
-					scan->pfnProcess = usb_GrayScale16;
-					DBG( _DBG_INFO, "ImageProc is: GrayScale16\n" );
-				} else {
-
-					if (scan->dwFlag & SCANFLAG_Pseudo48) {
-						scan->pfnProcess = usb_GrayScalePseudo16;
-						DBG( _DBG_INFO, "ImageProc is: GrayScalePseudo16\n" );
-					} else {
-						scan->pfnProcess = usb_GrayScale8;
-						DBG( _DBG_INFO, "ImageProc is: GrayScale8\n" );
-					}
-				}
-				break;
-
-			default:
-				scan->pfnProcess = usb_BWScale;
-				DBG( _DBG_INFO, "ImageProc is: BWScale\n" );
-				break;
-		}
-
-	} else {
-
-		/* Pixel copy */
-		switch( scan->sParam.bDataType ) {
-
-			case SCANDATATYPE_Color:
-				if (scan->sParam.bBitDepth > 8) {
-					if( usb_IsCISDevice(dev)){
-						scan->pfnProcess = usb_ColorDuplicate16_2;
-						DBG( _DBG_INFO, "ImageProc is: ColorDuplicate16_2\n" );
-					} else {
-						scan->pfnProcess = usb_ColorDuplicate16;
-						DBG( _DBG_INFO, "ImageProc is: ColorDuplicate16\n" );
-					}
-					if (scan->fGrayFromColor) {
-						if( usb_IsCISDevice(dev)){
-							scan->pfnProcess = usb_ColorDuplicateGray16_2;
-							DBG( _DBG_INFO, "ImageProc is: ColorDuplicateGray16_2\n" );
-						} else {
-							scan->pfnProcess = usb_ColorDuplicateGray16;
-							DBG( _DBG_INFO, "ImageProc is: ColorDuplicateGray16\n" );
-						}
-					}
-				} else if (scan->dwFlag & SCANFLAG_Pseudo48) {
-					scan->pfnProcess = usb_ColorDuplicatePseudo16;
-					DBG( _DBG_INFO, "ImageProc is: ColorDuplicatePseudo16\n" );
-				} else if (scan->fGrayFromColor) {
-					if( usb_IsCISDevice(dev)){
-						if (scan->fGrayFromColor > 7 ) {
-							scan->pfnProcess = usb_BWDuplicateFromColor_2;
-							DBG( _DBG_INFO, "ImageProc is: BWDuplicateFromColor_2\n" );
-						} else {
-							scan->pfnProcess = usb_ColorDuplicateGray_2;
-							DBG( _DBG_INFO, "ImageProc is: ColorDuplicateGray_2\n" );
-						}
-					} else {
-						if (scan->fGrayFromColor > 7 ) {
-							scan->pfnProcess = usb_BWDuplicateFromColor;
-							DBG( _DBG_INFO, "ImageProc is: BWDuplicateFromColor\n" );
-						} else {
-							scan->pfnProcess = usb_ColorDuplicateGray;
-							DBG( _DBG_INFO, "ImageProc is: ColorDuplicateGray\n" );
-						}
-					}
-				} else {
-					if( usb_IsCISDevice(dev)){
-						scan->pfnProcess = usb_ColorDuplicate8_2;
-						DBG( _DBG_INFO, "ImageProc is: ColorDuplicate8_2\n" );
-					} else {
-						scan->pfnProcess = usb_ColorDuplicate8;
-						DBG( _DBG_INFO, "ImageProc is: ColorDuplicate8\n" );
-					}
-				}
-				break;
-
-			case SCANDATATYPE_Gray:
-				if (scan->sParam.bBitDepth > 8) {
-					scan->pfnProcess = usb_GrayDuplicate16;
-					DBG( _DBG_INFO, "ImageProc is: GrayDuplicate16\n" );
-				} else {
-					if (scan->dwFlag & SCANFLAG_Pseudo48) {
-						scan->pfnProcess = usb_GrayDuplicatePseudo16;
-						DBG( _DBG_INFO, "ImageProc is: GrayDuplicatePseudo16\n" );
-					} else {
-						scan->pfnProcess = usb_GrayDuplicate8;
-						DBG( _DBG_INFO, "ImageProc is: GrayDuplicate8\n" );
-					}
-				}
-				break;
-
-			default:
-				scan->pfnProcess = usb_BWDuplicate;
-				DBG( _DBG_INFO, "ImageProc is: BWDuplicate\n" );
-				break;
-		}
-	}
-
-	if( scan->sParam.bBitDepth == 8 ) {
-
-		if( scan->dwFlag & SCANFLAG_Pseudo48 ) {
-			if( scan->dwFlag & SCANFLAG_RightAlign ) {
-				bShift = 5;
-			} else {
-
-				/* this should fix the Bearpaw/U12 discrepancy
-				 * in general the fix is needed, but not for the U12
-				 * why? - no idea!
-				 */
-				if(_WAF_BSHIFT7_BUG == (_WAF_BSHIFT7_BUG & sc->workaroundFlag))
-					bShift = 0; /* Holger Bischof 16.12.2001 */
-				else
-					bShift = 7;
-			}
-			DBG( _DBG_INFO, "bShift adjusted: %u\n", bShift );
-		}
-	}
-
-	if( _LM9833 == hw->chip ) {
-		Shift = 0;
-		Mask  = 0xFFFF;
-	} else {
-		Shift = 2;
-		Mask  = 0xFFFC;
-	}
+	return SANE_TRUE;
 }
 
 /**
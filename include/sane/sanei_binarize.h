@@ -0,0 +1,142 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+*/
+
+
+/** @file sanei_binarize.h
+ * Conversion of gray lines to lineart.
+ *
+ * Backends which scan lineart in gray and convert it in software share
+ * this code. Every line may be normalized first: its darkest and brightest
+ * values are stretched to the full range, unless the line is mostly dark or
+ * mostly bright. A pixel is then black when its value is not above the
+ * threshold. The threshold is either fixed or looked up in a table from the
+ * average of a window of about 1 mm centered on the pixel, which follows
+ * the local background of the page. Instead of a plain comparison, the
+ * rounding error can be diffused to the neighbouring pixels (Floyd-Steinberg
+ * dithering) to render gray areas.
+ *
+ * Bits are packed most significant bit first, a set bit is black. The
+ * output may overwrite the input line.
+ *
+ * Typical use:
+ * @code
+ * SANEI_Binarize bin;
+ *
+ * if (sanei_binarize_init (&bin, xdpi, threshold, curve ? lut : NULL,
+ *                          SANEI_BINARIZE_NORMALIZE) != SANE_STATUS_GOOD)
+ *   return SANE_STATUS_NO_MEM;
+ * for (y = 0; y < lines; y++)
+ *   sanei_binarize_line (&bin, gray + y * width, out + y * width / 8, width);
+ * sanei_binarize_free (&bin);
+ * @endcode
+ */
+
+#ifndef SANEI_BINARIZE_H
+#define SANEI_BINARIZE_H
+
+#include "../include/sane/sane.h"
+
+/** Stretch the values of every line to the full range before converting */
+#define SANEI_BINARIZE_NORMALIZE 1
+/** Diffuse the error of every pixel to its neighbours */
+#define SANEI_BINARIZE_DITHER    2
+
+/** State of a conversion, the fields are private */
+typedef struct
+{
+  int window;			/* width of the averaging window */
+  int threshold;		/* threshold used without table */
+  int flags;
+  SANE_Bool dynamic;		/* threshold from the window average */
+  unsigned char lut[256];	/* threshold for each window average */
+
+  int width;			/* line width the buffers are sized for */
+  unsigned char *sum_lut;	/* threshold for each window sum */
+  unsigned char *thresh;	/* thresholds of the current line */
+  int *error;			/* errors diffused to the next line */
+} SANEI_Binarize;
+
+/** Prepare a conversion.
+ *
+ * The threshold table for the window is allocated here, the line buffers
+ * by the first call of sanei_binarize_line().
+ *
+ * @param bin conversion state
+ * @param dpi horizontal resolution, gives the window width
+ * @param threshold fixed threshold, used when lut is NULL
+ * @param lut threshold for each average of the window, 256 entries, or
+ * NULL for a fixed threshold. The table is copied.
+ * @param flags SANEI_BINARIZE_NORMALIZE and SANEI_BINARIZE_DITHER
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_INVAL - if dpi is not positive
+ * - SANE_STATUS_NO_MEM - if the threshold table couldn't be allocated
+ */
+extern SANE_Status
+sanei_binarize_init (SANEI_Binarize * bin, int dpi, int threshold,
+		     const unsigned char *lut, int flags);
+
+/** Convert a line.
+ *
+ * @param bin conversion state
+ * @param src 8 bit gray line, modified when normalizing
+ * @param dst lineart line, (width + 7) / 8 bytes. It may start at src,
+ * but not after it. The unused bits of the last byte are kept.
+ * @param width number of pixels
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_NO_MEM - if the buffers for the line width couldn't be
+ *   allocated
+ */
+extern SANE_Status
+sanei_binarize_line (SANEI_Binarize * bin, unsigned char *src,
+		     unsigned char *dst, int width);
+
+/** Release the buffers of a conversion.
+ *
+ * The state may be used again after sanei_binarize_init().
+ *
+ * @param bin conversion state
+ */
+extern void sanei_binarize_free (SANEI_Binarize * bin);
+
+#endif /* SANEI_BINARIZE_H */
@@ -0,0 +1,206 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+*/
+
+/** @file sanei_calib.h
+ * Persistent calibration store.
+ *
+ * Backends that calibrate in software can keep the results of a
+ * calibration between sessions and skip warm-up and calibration while a
+ * stored entry is still valid.
+ *
+ * A store is one file, usually in ~/.sane, holding the entries of one
+ * device. Each entry is identified by a key string chosen by the backend,
+ * typically built from the sensor mode (resolution, color mode, scan
+ * source). Conditions which make a calibration unusable, e.g. a lamp
+ * temperature range, are best made part of the key as well. Every entry
+ * carries its creation time and an optional lifetime, expired entries are
+ * not returned and are dropped when the store is written.
+ *
+ * The file starts with a header giving the store format version, the
+ * byte order, the device identification and the version of the record
+ * layout used by the backend. Header and entries are protected by a CRC.
+ * A file written for another device, by another version, on a machine
+ * with another byte order or with a bad CRC is ignored as a whole, a
+ * corrupted entry is skipped. The file is mapped into memory when the
+ * system allows it, so the stored data is not copied when reading.
+ *
+ * Typical use:
+ * @code
+ * SANEI_Calib *calib;
+ * const void *data;
+ * size_t size;
+ *
+ * sanei_calib_open (path, serial, MY_CALIB_VERSION, &calib);
+ * if (sanei_calib_get (calib, "color-600", &data, &size) == SANE_STATUS_GOOD
+ *     && size == sizeof (my_calibration))
+ *   memcpy (&my_calibration, data, size);
+ * else
+ *   {
+ *     do_calibration (&my_calibration);
+ *     sanei_calib_put (calib, "color-600", &my_calibration,
+ *                      sizeof (my_calibration), 60 * 60);
+ *   }
+ * sanei_calib_close (calib);
+ * @endcode
+ */
+
+#ifndef SANEI_CALIB_H
+#define SANEI_CALIB_H
+
+#include <stddef.h>
+
+#include "../include/sane/sane.h"
+
+/** Opaque handle of an opened calibration store */
+typedef struct SANEI_Calib SANEI_Calib;
+
+/** Open a calibration store.
+ *
+ * Loads the entries of the store file if it exists and is valid for the
+ * device. A missing or invalid file gives an empty store, the file is
+ * only created or replaced by sanei_calib_sync() or sanei_calib_close().
+ *
+ * @param path file name of the store
+ * @param device identification of the device, e.g. its serial number or
+ * model name, at most 63 characters are used
+ * @param format version of the layout of the data stored by the backend,
+ * to be increased when this layout changes
+ * @param calib returns the handle of the store
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success, also if the file doesn't exist
+ * - SANE_STATUS_INVAL - if the file exists but isn't a valid store for
+ *   the device and format. An empty store is returned anyway, writing it
+ *   replaces the file.
+ * - SANE_STATUS_NO_MEM - if the store couldn't be allocated
+ */
+extern SANE_Status
+sanei_calib_open (const char *path, const char *device, int format,
+		  SANEI_Calib ** calib);
+
+/** Look up an entry.
+ *
+ * The returned data is owned by the store and is valid until the entry is
+ * replaced or removed, or the store is closed. It is aligned for any basic
+ * type.
+ *
+ * @param calib store handle
+ * @param key entry key
+ * @param data returns a pointer to the stored data
+ * @param size returns the size of the stored data
+ *
+ * @return
+ * - SANE_STATUS_GOOD - if a valid entry was found
+ * - SANE_STATUS_UNSUPPORTED - if there is no such entry or it has expired
+ */
+extern SANE_Status
+sanei_calib_get (SANEI_Calib * calib, const char *key, const void **data,
+		 size_t * size);
+
+/** Walk through the valid entries of the store.
+ *
+ * @param calib store handle
+ * @param index position in the store, set it to 0 to get the first entry.
+ * It is updated to point past the returned entry.
+ * @param key returns the key of the entry
+ * @param data returns a pointer to the stored data, see sanei_calib_get()
+ * @param size returns the size of the stored data
+ *
+ * @return
+ * - SANE_STATUS_GOOD - if an entry was returned
+ * - SANE_STATUS_EOF - if there are no more entries
+ */
+extern SANE_Status
+sanei_calib_next (SANEI_Calib * calib, int *index, const char **key,
+		  const void **data, size_t * size);
+
+/** Add or replace an entry.
+ *
+ * @param calib store handle
+ * @param key entry key
+ * @param data data to store, it is copied
+ * @param size size of the data
+ * @param lifetime number of seconds the entry stays valid, 0 if it
+ * never expires
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_NO_MEM - if the entry couldn't be allocated
+ */
+extern SANE_Status
+sanei_calib_put (SANEI_Calib * calib, const char *key, const void *data,
+		 size_t size, int lifetime);
+
+/** Remove an entry.
+ *
+ * @param calib store handle
+ * @param key entry key
+ */
+extern void sanei_calib_remove (SANEI_Calib * calib, const char *key);
+
+/** Remove all the entries of the store.
+ *
+ * @param calib store handle
+ */
+extern void sanei_calib_clear (SANEI_Calib * calib);
+
+/** Write the store to its file if it has been changed.
+ *
+ * Expired entries are dropped. The new content is written to a temporary
+ * file which then replaces the store file, so that a crash can't leave a
+ * truncated store behind. An empty store removes the file.
+ *
+ * @param calib store handle
+ *
+ * @return
+ * - SANE_STATUS_GOOD - on success
+ * - SANE_STATUS_IO_ERROR - if the file couldn't be written
+ */
+extern SANE_Status sanei_calib_sync (SANEI_Calib * calib);
+
+/** Write the store if needed and release it.
+ *
+ * @param calib store handle
+ *
+ * @return the status of sanei_calib_sync()
+ */
+extern SANE_Status sanei_calib_close (SANEI_Calib * calib);
+
+#endif /* SANEI_CALIB_H */
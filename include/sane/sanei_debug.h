@@ -36,11 +36,22 @@
  * Print a message at debug level `level' or higher using a printf-like
  * function. Example: DBG(1, "sane_open: opening fd \%d\\n", fd).
  *
+ * The level is compared to DBG_LEVEL inline, so the arguments are
+ * neither evaluated nor formatted unless the message is printed.
+ *
  * @param level debug level
  * @param fmt format (see man 3 printf for details)
  * @param ... additional arguments
  */
 
+/** @def SANEI_DEBUG_MAX_LEVEL
+ * Highest debug level compiled in.
+ *
+ * If defined at compile-time (e.g. CPPFLAGS=-DSANEI_DEBUG_MAX_LEVEL=5),
+ * DBG calls with a constant level above this value are removed by the
+ * compiler. By default all levels are compiled in.
+ */
+
 /** @def IF_DBG(x)
  * Compile code only if debugging is enabled.
  *
@@ -140,8 +151,20 @@ DBG_LOCAL (int level, const char *msg, ...)
 
 # endif /* !STUBS */
 
+# ifdef SANEI_DEBUG_MAX_LEVEL
+#  define DBG_ENABLED(level) \
+  ((int) (level) <= SANEI_DEBUG_MAX_LEVEL && (int) (level) <= DBG_LEVEL)
+# else
+#  define DBG_ENABLED(level) ((int) (level) <= DBG_LEVEL)
+# endif
+
+# ifdef STUBS
+#  define DBG           DBG_LOCAL
+# else
                                   /** @hideinitializer*/
-# define DBG            DBG_LOCAL
+#  define DBG(level, ...) \
+  (DBG_ENABLED (level) ? DBG_LOCAL (level, __VA_ARGS__) : (void) 0)
+# endif /* STUBS */
 
 extern void sanei_init_debug (const char * backend, int * debug_level_var);
 
@@ -48,6 +48,11 @@ SANEI_IR_bufptr;
 /** Initialize sanei_ir.
  *
  * Call this before any other sanei_ir function.
+ *
+ * The filters split large images into bands of rows which are processed
+ * by one thread per CPU. The environment variable SANE_IR_THREADS can
+ * be set to limit (or raise) the number of threads. The results do not
+ * depend on it.
  */
 extern void sanei_ir_init (void);
 
@@ -261,6 +266,7 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
  * @return
  * - SANE_STATUS_GOOD - success
  * - SANE_STATUS_NO_MEM - if out of memory
+ * - SANE_STATUS_INVAL - win_size is even
  *
  * This routine follows the concept of Crnojevic's MAD (median of the absolute deviations
  * from the median) filter. The first median filter step is replaced with a mean filter.
@@ -325,6 +331,29 @@ sanei_ir_manhattan_dist (const SANE_Parameters * params,
 			unsigned int *idx_map, unsigned int erode);
 
 
+/**
+ * @brief Calculates minimal Euclidean distances for an image mask
+ *
+ * @param[in]  params pointer to image description
+ * @param[in]  mask_img pointer to binary image (0, 255)
+ * @param[out] dist_map integer pointer to map of closest distances
+ * @param[out] idx_map integer pointer to indices of closest pixels
+ * @param[in]  erode == 0: closest pixel has value 0, != 0: is 255
+ *
+ * Same as sanei_ir_manhattan_dist, but the distances are Euclidean ones
+ * rounded to the closest integer, so dilating by thresholding the
+ * distance yields discs instead of diamonds. The closest pixel is found
+ * deterministically and the image is processed in parallel bands.
+ *
+ * @ref Felzenszwalb P. F., Huttenlocher D. P. (2012) "Distance
+ *      Transforms of Sampled Functions", Theory of Computing 8: 415-428
+ */
+void
+sanei_ir_euclidean_dist (const SANE_Parameters * params,
+			 const SANE_Uint * mask_img, unsigned int *dist_map,
+			 unsigned int *idx_map, unsigned int erode);
+
+
 /**
  * @brief Dilate or erode a mask image
  *
@@ -334,6 +363,8 @@ sanei_ir_manhattan_dist (const SANE_Parameters * params,
  * @param      idx_map integer pointer to indices of closest pixels
  * @param[in]  by number of pixels, > 0 dilate, < 0 erode
  *
+ * The distances are calculated by sanei_ir_euclidean_dist.
+ *
  * @note by > 0 will enlarge the 0 valued area
  */
 void
@@ -349,7 +380,7 @@ sanei_ir_dilate (const SANE_Parameters * params, SANE_Uint * mask_img,
  * @param[out] edges pointer to array holding top, bottom, left
  *             and right edges
  *
- * The distance map as calculated by sanei_ir_manhattan_dist contains
+ * The distance map as calculated by sanei_ir_euclidean_dist contains
  * distances to the next clean pixel. Dark margins are detected as dirt.
  * So the first/last rows/columns tell us how to crop. This is rather
  * fast if the distance map has been calculated anyhow.
@@ -375,6 +406,7 @@ sanei_ir_find_crop (const SANE_Parameters * params,
  * @return
  * - SANE_STATUS_GOOD - success
  * - SANE_STATUS_NO_MEM - if out of memory
+ * - SANE_STATUS_INVAL - win_size is even
  *
  * The main purpose of this routine is to replace dirty pixels.
  * As spin-off it obtains half of what is needed for film grain
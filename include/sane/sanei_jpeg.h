@@ -52,4 +52,20 @@ struct djpeg_dest_struct {
 
 EXTERN(djpeg_dest_ptr) sanei_jpeg_jinit_write_ppm JPP((j_decompress_ptr cinfo));
 
+/* Decoding a whole image held in memory, without the ppm module.
+ * sanei_jpeg_get_params() tells the size of the image, which
+ * sanei_jpeg_decode() writes into out, with rows bytes_per_line apart.
+ * If the image has restart markers at the start of MCU rows, up to
+ * threads bands are decoded at once, 0 means one per processor. */
+
+#include "sane/sane.h"
+
+EXTERN(SANE_Status) sanei_jpeg_get_params JPP((const JOCTET * data,
+					       size_t len,
+					       SANE_Parameters * params));
+EXTERN(SANE_Status) sanei_jpeg_decode JPP((const JOCTET * data, size_t len,
+					   SANE_Byte * out,
+					   SANE_Int bytes_per_line,
+					   int threads));
+
 /* miscellaneous useful macros */
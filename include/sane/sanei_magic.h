@@ -97,6 +97,30 @@ extern SANE_Status
 sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
   int dpiX, int dpiY, int * centerX, int * centerY, double * finSlope);
 
+/** Find the skew of the media from the start of an image
+ *
+ * Like sanei_magic_findSkew(), for an image which is still being read.
+ * The last line of the buffer is where reading stopped, not the bottom
+ * edge of the media, so only the top and left edges are searched.
+ *
+ * @param params describes the part of the image read so far
+ * @param buffer contains image data
+ * @param dpiX horizontal resolution
+ * @param dpiY vertical resolution
+ * @param[out] centerX horizontal coordinate of center of rotation
+ * @param[out] centerY vertical coordinate of center of rotation
+ * @param[out] finSlope slope of rotation
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_NO_MEM - not enough memory
+ * - SANE_STATUS_INVAL - invalid image parameters
+ * - SANE_STATUS_UNSUPPORTED - slope angle too shallow to detect
+ */
+extern SANE_Status
+sanei_magic_findSkewTop(SANE_Parameters * params, SANE_Byte * buffer,
+  int dpiX, int dpiY, int * centerX, int * centerY, double * finSlope);
+
 /** Correct the skew of the media inside the image, via simple rotation
  *
  * @param params describes image
@@ -115,6 +139,82 @@ extern SANE_Status
 sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
   int centerX, int centerY, double slope, int bg_color);
 
+/** Correct the skew of the media inside the image, enhanced version
+ *
+ * Same as sanei_magic_rotate(), but optionally interpolates between
+ * the four nearest source pixels, which gives smoother edges on gray
+ * and color images. Binary images are never interpolated.
+ *
+ * @param params describes image
+ * @param buffer contains image data
+ * @param centerX horizontal coordinate of center of rotation
+ * @param centerY vertical coordinate of center of rotation
+ * @param slope slope of rotation
+ * @param bg_color the replacement color for edges exposed by rotation
+ * @param smooth use bilinear instead of nearest neighbor sampling
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_NO_MEM - not enough memory
+ * - SANE_STATUS_INVAL - invalid image parameters
+ */
+extern SANE_Status
+sanei_magic_rotate2 (SANE_Parameters * params, SANE_Byte * buffer,
+  int centerX, int centerY, double slope, int bg_color, SANE_Bool smooth);
+
+/** Opaque state of a rotation done while the image arrives */
+typedef struct sanei_magic_rotator SANEI_Magic_Rotator;
+
+/** Prepare to correct the skew of an image which is still being read
+ *
+ * Lets a backend start sending the deskewed image before all of it has
+ * arrived. The slope and center are usually found by calling
+ * sanei_magic_findSkewTop() on the first inch or so of the image, with the
+ * lines member of a copy of params set to the number of lines read.
+ *
+ * The image is rotated in place by sanei_magic_rotateLines(), so buffer
+ * must be large enough for the whole image.
+ *
+ * @param params describes the complete image
+ * @param buffer will contain the complete image data
+ * @param centerX horizontal coordinate of center of rotation
+ * @param centerY vertical coordinate of center of rotation
+ * @param slope slope of rotation
+ * @param bg_color the replacement color for edges exposed by rotation
+ * @param smooth use bilinear instead of nearest neighbor sampling
+ * @param[out] rotator state to pass to the other rotate functions
+ *
+ * @return
+ * - SANE_STATUS_GOOD - success
+ * - SANE_STATUS_NO_MEM - not enough memory
+ * - SANE_STATUS_INVAL - invalid image parameters
+ */
+extern SANE_Status
+sanei_magic_rotateStart (SANE_Parameters * params, SANE_Byte * buffer,
+  int centerX, int centerY, double slope, int bg_color, SANE_Bool smooth,
+  SANEI_Magic_Rotator ** rotator);
+
+/** Rotate as much of the image as the lines read so far allow
+ *
+ * Output lines are finished in order, each one needs the source lines
+ * up to a small distance below it, which depends on the slope.
+ *
+ * @param rotator state from sanei_magic_rotateStart()
+ * @param lines number of lines at the start of the buffer which contain
+ * image data, all lines of the image once it has been read completely
+ *
+ * @return number of lines at the start of the buffer which are rotated
+ */
+extern int
+sanei_magic_rotateLines (SANEI_Magic_Rotator * rotator, int lines);
+
+/** Free the state of a rotation
+ *
+ * @param rotator state from sanei_magic_rotateStart(), may be NULL
+ */
+extern void
+sanei_magic_rotateFinish (SANEI_Magic_Rotator * rotator);
+
 /** Find the edges of the media inside the image, parallel to image edges
  *
  * @param params describes image
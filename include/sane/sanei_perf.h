@@ -0,0 +1,152 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+*/
+
+/** @file sanei_perf.h
+ * Lightweight per-scan performance counters.
+ *
+ * The counters are collected only if the environment variable SANE_PERF
+ * is set. Its value names the file the counters are appended to as one
+ * JSON object per scan ("-" or "stderr" write to stderr). When SANE_PERF
+ * is not set, every macro below costs a single load and compare.
+ *
+ * Each counter is identified by a static name and an integer index (e.g.
+ * a device number or endpoint) and accumulates:
+ * - the number of events (transfers, calls)
+ * - the number of bytes moved
+ * - the time spent, in microseconds
+ * - the highest value reported, e.g. a buffer fill level
+ *
+ * sanei_usb, sanei_scsi, sanei_wire and sanei_magic update their own
+ * counters. Backends add theirs and call sanei_perf_dump() from
+ * sane_cancel() to emit and reset the counters of the finished scan.
+ *
+ * Typical use:
+ * @code
+ * SANEI_Perf_Time start;
+ *
+ * SANEI_PERF_START (start);
+ * status = read_from_device (s, buf, &len);
+ * SANEI_PERF_IO ("read", 0, len, start);
+ * SANEI_PERF_HWM ("buffer", 0, s->bytes_buffered);
+ * @endcode
+ */
+
+#ifndef SANEI_PERF_H
+#define SANEI_PERF_H
+
+#include <stddef.h>
+
+/** Timestamp in microseconds, only meaningful while counters are enabled */
+typedef unsigned long long SANEI_Perf_Time;
+
+/** Non-zero if the counters are enabled. Read only. */
+extern int sanei_perf_enabled;
+
+/** Initialize sanei_perf.
+ *
+ * Checks the SANE_PERF environment variable. It is safe to call this
+ * more than once; sanei_usb_init(), sanei_scsi_open(), sanei_w_init() and
+ * sanei_magic_init() already do so.
+ */
+extern void sanei_perf_init (void);
+
+/** Get the current timestamp of the monotonic clock.
+ *
+ * @return microseconds since an unspecified starting point
+ */
+extern SANEI_Perf_Time sanei_perf_now (void);
+
+/** Record a completed transfer.
+ *
+ * @param name counter name, must be a string literal or otherwise static
+ * @param index counter index, e.g. the device number
+ * @param bytes number of bytes transferred
+ * @param start timestamp taken before the transfer was started
+ */
+extern void sanei_perf_io (const char *name, int index, size_t bytes,
+			   SANEI_Perf_Time start);
+
+/** Record the time spent in a section, e.g. image post-processing.
+ *
+ * @param name counter name, must be a string literal or otherwise static
+ * @param index counter index
+ * @param start timestamp taken when the section was entered
+ */
+extern void sanei_perf_time (const char *name, int index,
+			     SANEI_Perf_Time start);
+
+/** Record a level and keep its maximum, e.g. a buffer high-water mark.
+ *
+ * @param name counter name, must be a string literal or otherwise static
+ * @param index counter index
+ * @param value current level
+ */
+extern void sanei_perf_hwm (const char *name, int index, size_t value);
+
+/** Write all counters as one JSON object and reset them.
+ *
+ * Does nothing if the counters are disabled or no counter has been
+ * updated since the last dump.
+ *
+ * @param backend name of the calling backend, used as "backend" member
+ */
+extern void sanei_perf_dump (const char *backend);
+
+/** Reset all counters without writing them */
+extern void sanei_perf_reset (void);
+
+/** @name Hot path macros
+ * These only evaluate their arguments if the counters are enabled.
+ * @{
+ */
+#define SANEI_PERF_START(t) \
+  ((t) = sanei_perf_enabled ? sanei_perf_now () : 0)
+
+#define SANEI_PERF_IO(name, index, bytes, t) \
+  do { if (sanei_perf_enabled) sanei_perf_io (name, index, bytes, t); } while (0)
+
+#define SANEI_PERF_TIME(name, index, t) \
+  do { if (sanei_perf_enabled) sanei_perf_time (name, index, t); } while (0)
+
+#define SANEI_PERF_HWM(name, index, value) \
+  do { if (sanei_perf_enabled) sanei_perf_hwm (name, index, value); } while (0)
+/* @} */
+
+#endif /* SANEI_PERF_H */
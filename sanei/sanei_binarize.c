@@ -0,0 +1,407 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+
+
+   Conversion of gray lines to lineart, see sanei_binarize.h
+*/
+
+#include "../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define BACKEND_NAME sanei_binarize	/* name of this module for debugging */
+
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_debug.h"
+#include "../include/sane/sanei_binarize.h"
+
+#if defined(__SSE2__)
+/* bits of the index in reverse order, to turn the least significant bit
+ * first masks of SSE2 into lineart bytes */
+static unsigned char reverse_bits[256];
+static SANE_Bool reverse_bits_ready = SANE_FALSE;
+
+static void
+init_reverse_bits (void)
+{
+  int i, j, r;
+
+  for (i = 0; i < 256; i++)
+    {
+      r = 0;
+      for (j = 0; j < 8; j++)
+	if (i & (1 << j))
+	  r |= 0x80 >> j;
+      reverse_bits[i] = r;
+    }
+  reverse_bits_ready = SANE_TRUE;
+}
+#endif
+
+SANE_Status
+sanei_binarize_init (SANEI_Binarize * bin, int dpi, int threshold,
+		     const unsigned char *lut, int flags)
+{
+  int i;
+
+  DBG_INIT ();
+
+  memset (bin, 0, sizeof (*bin));
+
+  if (dpi <= 0)
+    {
+      DBG (1, "sanei_binarize_init: invalid resolution %d\n", dpi);
+      return SANE_STATUS_INVAL;
+    }
+
+  /* ~1mm works best, but the window needs to have odd # of pixels */
+  bin->window = (6 * dpi) / 150;
+  if (!(bin->window % 2))
+    bin->window++;
+
+  bin->threshold = threshold;
+  bin->flags = flags;
+  if (lut)
+    {
+      bin->dynamic = SANE_TRUE;
+      memcpy (bin->lut, lut, sizeof (bin->lut));
+
+      /* the table gives the threshold for the sum of the window directly,
+       * no division per pixel is needed */
+      bin->sum_lut = malloc (255 * bin->window + 1);
+      if (!bin->sum_lut)
+	{
+	  DBG (1, "sanei_binarize_init: can't allocate the window table\n");
+	  return SANE_STATUS_NO_MEM;
+	}
+      for (i = 0; i <= 255 * bin->window; i++)
+	bin->sum_lut[i] = bin->lut[i / bin->window];
+    }
+
+#if defined(__SSE2__)
+  if (!reverse_bits_ready)
+    init_reverse_bits ();
+#endif
+
+  DBG (10, "sanei_binarize_init: window %d, threshold %d%s, flags 0x%x\n",
+       bin->window, threshold, lut ? " with curve" : "", flags);
+  return SANE_STATUS_GOOD;
+}
+
+void
+sanei_binarize_free (SANEI_Binarize * bin)
+{
+  free (bin->sum_lut);
+  free (bin->thresh);
+  free (bin->error);
+  bin->sum_lut = NULL;
+  bin->thresh = NULL;
+  bin->error = NULL;
+  bin->width = 0;
+}
+
+/* size the buffers for lines of the given width */
+static SANE_Status
+prepare (SANEI_Binarize * bin, int width)
+{
+  /* sanei_binarize_init failed */
+  if (bin->dynamic && !bin->sum_lut)
+    return SANE_STATUS_NO_MEM;
+
+  if (width <= bin->width)
+    return SANE_STATUS_GOOD;
+
+  free (bin->thresh);
+  free (bin->error);
+  bin->error = NULL;
+  bin->width = 0;
+  bin->thresh = malloc (width);
+  if (!bin->thresh)
+    return SANE_STATUS_NO_MEM;
+
+  if (bin->flags & SANEI_BINARIZE_DITHER)
+    {
+      /* errors of the next and of the current line, with a spare entry
+       * at both ends */
+      bin->error = calloc (2 * (width + 2), sizeof (int));
+      if (!bin->error)
+	return SANE_STATUS_NO_MEM;
+    }
+
+  bin->width = width;
+  return SANE_STATUS_GOOD;
+}
+
+/* stretch the values of the line to the full range */
+static void
+normalize (unsigned char *src, int width)
+{
+  unsigned char table[256];
+  int x, min = 255, max = 0;
+
+  x = 0;
+#if defined(__SSE2__)
+  if (width >= 16)
+    {
+      __m128i vmin = _mm_set1_epi8 ((char) 0xff);
+      __m128i vmax = _mm_setzero_si128 ();
+      unsigned char m[16];
+      int i;
+
+      for (; x + 16 <= width; x += 16)
+	{
+	  __m128i v = _mm_loadu_si128 ((const __m128i *) (src + x));
+	  vmin = _mm_min_epu8 (vmin, v);
+	  vmax = _mm_max_epu8 (vmax, v);
+	}
+      _mm_storeu_si128 ((__m128i *) m, vmin);
+      for (i = 0; i < 16; i++)
+	if (m[i] < min)
+	  min = m[i];
+      _mm_storeu_si128 ((__m128i *) m, vmax);
+      for (i = 0; i < 16; i++)
+	if (m[i] > max)
+	  max = m[i];
+    }
+#endif
+  for (; x < width; x++)
+    {
+      if (src[x] > max)
+	max = src[x];
+      if (src[x] < min)
+	min = src[x];
+    }
+
+  /* safeguard against dark or white areas */
+  if (min > 80)
+    min = 0;
+  if (max < 80)
+    max = 255;
+  if (max == min)
+    return;
+
+  /* all the values lie between min and max */
+  for (x = min; x <= max; x++)
+    table[x] = ((x - min) * 255) / (max - min);
+  for (x = 0; x < width; x++)
+    src[x] = table[src[x]];
+}
+
+/* threshold of every pixel from the sum of the window centered on it. The
+ * window is moved inside the line at both ends. */
+static void
+dynamic_thresholds (SANEI_Binarize * bin, const unsigned char *src,
+		    int width)
+{
+  unsigned char *thresh = bin->thresh;
+  const unsigned char *sum_lut = bin->sum_lut;
+  int window = bin->window;
+  int half, j, sum = 0;
+
+  /* narrow lines get the widest window which fits */
+  if (window > width)
+    {
+      window = width % 2 ? width : width - 1;
+      sum_lut = NULL;
+    }
+  half = window / 2;
+
+  for (j = 0; j < window; j++)
+    sum += src[j];
+
+  if (!sum_lut)
+    {
+      for (j = 0; j < width; j++)
+	thresh[j] = bin->lut[sum / window];
+      return;
+    }
+
+  for (j = 0; j <= half && j < width; j++)
+    thresh[j] = sum_lut[sum];
+  for (; j < width - half; j++)
+    {
+      sum += src[j + half] - src[j - half - 1];
+      thresh[j] = sum_lut[sum];
+    }
+  for (; j < width; j++)
+    thresh[j] = sum_lut[sum];
+}
+
+/* pack 8 pixels at a time, a pixel is black if it isn't above its
+ * threshold */
+static void
+threshold_line (const unsigned char *src, const unsigned char *thresh,
+		int fixed, unsigned char *dst, int width)
+{
+  int j = 0, k;
+  unsigned int bits;
+
+#if defined(__SSE2__)
+  {
+    __m128i vt = _mm_set1_epi8 ((char) fixed);
+    int mask;
+
+    for (; j + 16 <= width; j += 16)
+      {
+	__m128i v = _mm_loadu_si128 ((const __m128i *) (src + j));
+	if (thresh)
+	  vt = _mm_loadu_si128 ((const __m128i *) (thresh + j));
+	/* v <= t when max (v, t) == t */
+	mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_max_epu8 (v, vt), vt));
+	*dst++ = reverse_bits[mask & 0xff];
+	*dst++ = reverse_bits[mask >> 8];
+      }
+  }
+#endif
+
+  for (; j + 8 <= width; j += 8)
+    {
+      bits = 0;
+      if (thresh)
+	for (k = 0; k < 8; k++)
+	  bits = (bits << 1) | (src[j + k] <= thresh[j + k]);
+      else
+	for (k = 0; k < 8; k++)
+	  bits = (bits << 1) | (src[j + k] <= fixed);
+      *dst++ = bits;
+    }
+
+  /* the remaining bits of the last byte are left alone */
+  if (j < width)
+    {
+      unsigned int mask = 0;
+
+      bits = 0;
+      for (k = 0; j + k < width; k++)
+	{
+	  bits |= (src[j + k] <= (thresh ? thresh[j + k] : fixed)) << (7 - k);
+	  mask |= 0x80 >> k;
+	}
+      *dst = (*dst & ~mask) | bits;
+    }
+}
+
+/* Floyd-Steinberg error diffusion, the threshold of every pixel is
+ * compared to its value plus the errors it received */
+static void
+dither_line (SANEI_Binarize * bin, const unsigned char *src,
+	     const unsigned char *thresh, int fixed, unsigned char *dst,
+	     int width)
+{
+  int *cur, *next;
+  int j, value, error, right = 0;
+  unsigned int bits = 0, mask;
+
+  /* errors received from the previous line, and given to the next one */
+  cur = bin->error;
+  next = bin->error + bin->width + 2;
+  memset (next, 0, (width + 2) * sizeof (int));
+
+  for (j = 0; j < width; j++)
+    {
+      value = src[j] + (cur[j + 1] + right) / 16;
+      if (value <= (thresh ? thresh[j] : fixed))
+	{
+	  bits |= 1;
+	  error = value;
+	}
+      else
+	error = value - 255;
+
+      right = 7 * error;
+      next[j] += 3 * error;
+      next[j + 1] += 5 * error;
+      next[j + 2] += error;
+
+      if ((j & 7) == 7)
+	{
+	  *dst++ = bits;
+	  bits = 0;
+	}
+      else
+	bits <<= 1;
+    }
+
+  if (width & 7)
+    {
+      bits <<= 7 - (width & 7);
+      mask = (0xff00 >> (width & 7)) & 0xff;
+      *dst = (*dst & ~mask) | bits;
+    }
+
+  memcpy (cur, next, (width + 2) * sizeof (int));
+}
+
+SANE_Status
+sanei_binarize_line (SANEI_Binarize * bin, unsigned char *src,
+		     unsigned char *dst, int width)
+{
+  SANE_Status status;
+
+  if (width <= 0)
+    return SANE_STATUS_GOOD;
+
+  status = prepare (bin, width);
+  if (status != SANE_STATUS_GOOD)
+    {
+      DBG (1, "sanei_binarize_line: can't allocate buffers for %d pixels\n",
+	   width);
+      return status;
+    }
+
+  if (bin->flags & SANEI_BINARIZE_NORMALIZE)
+    normalize (src, width);
+
+  if (bin->dynamic)
+    dynamic_thresholds (bin, src, width);
+
+  if (bin->flags & SANEI_BINARIZE_DITHER)
+    dither_line (bin, src, bin->dynamic ? bin->thresh : NULL,
+		 bin->threshold, dst, width);
+  else
+    threshold_line (src, bin->dynamic ? bin->thresh : NULL,
+		    bin->threshold, dst, width);
+
+  return SANE_STATUS_GOOD;
+}
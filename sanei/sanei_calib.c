@@ -0,0 +1,719 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+
+   Persistent calibration store, see sanei_calib.h
+*/
+
+#include "../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#define BACKEND_NAME sanei_calib	/* name of this module for debugging */
+
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_debug.h"
+#include "../include/sane/sanei_calib.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* version of the file layout below */
+#define CALIB_VERSION 1
+#define CALIB_MAGIC "SANECAL"
+/* reads differently on a machine with another byte order */
+#define CALIB_BYTE_ORDER 0x01020304
+#define CALIB_DEVICE_SIZE 64
+
+/* everything in the file is aligned on this */
+#define CALIB_ALIGN 8
+#define CALIB_PAD(n) \
+  (((size_t) (n) + CALIB_ALIGN - 1) & ~((size_t) CALIB_ALIGN - 1))
+
+/* file header, all the fields are in the byte order of the machine
+ * which wrote the file */
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t format;		/* record layout version of the backend */
+  uint32_t count;		/* number of entries following the header */
+  char device[CALIB_DEVICE_SIZE];
+  uint32_t reserved;
+  uint32_t crc;			/* of the header with crc set to 0 */
+}
+Calib_File_Header;
+
+/* entry header, followed by the key and the data, each of them padded
+ * to CALIB_ALIGN */
+typedef struct
+{
+  uint32_t key_size;		/* including the terminating 0 */
+  uint32_t crc;			/* of the entry header with crc set to 0,
+				   the key and the data */
+  uint64_t size;
+  int64_t created;
+  int64_t expires;		/* 0 if the entry never expires */
+}
+Calib_File_Entry;
+
+typedef struct
+{
+  char *key;
+  void *data;
+  size_t size;
+  time_t created;
+  time_t expires;
+  SANE_Bool owned;		/* key and data are allocated, else they
+				   point into the file contents */
+}
+Calib_Entry;
+
+struct SANEI_Calib
+{
+  char *path;
+  char device[CALIB_DEVICE_SIZE];
+  int format;
+
+  void *contents;		/* file contents the entries may point to */
+  size_t contents_size;
+  SANE_Bool mapped;		/* contents is mapped, else allocated */
+
+  Calib_Entry *entries;
+  int count;
+  int alloc;
+
+  SANE_Bool dirty;		/* the file needs to be written */
+};
+
+static uint32_t crc_table[256];
+
+static void
+crc_init (void)
+{
+  uint32_t c;
+  int n, k;
+
+  if (crc_table[1])
+    return;
+
+  for (n = 0; n < 256; n++)
+    {
+      c = n;
+      for (k = 0; k < 8; k++)
+	c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      crc_table[n] = c;
+    }
+}
+
+/* standard CRC-32, pass 0 to start and the previous result to continue */
+static uint32_t
+crc_update (uint32_t crc, const void *data, size_t size)
+{
+  const uint8_t *p = data;
+
+  crc = ~crc;
+  while (size--)
+    crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint32_t
+entry_crc (Calib_File_Entry * e, const char *key, const void *data)
+{
+  Calib_File_Entry tmp = *e;
+  uint32_t crc;
+
+  tmp.crc = 0;
+  crc = crc_update (0, &tmp, sizeof (tmp));
+  crc = crc_update (crc, key, e->key_size);
+  return crc_update (crc, data, e->size);
+}
+
+static SANE_Bool
+entry_expired (Calib_Entry * e, time_t now)
+{
+  return e->expires != 0 && now >= e->expires;
+}
+
+static void
+entry_free (Calib_Entry * e)
+{
+  if (e->owned)
+    {
+      free (e->key);
+      free (e->data);
+    }
+}
+
+static int
+find_entry (SANEI_Calib * calib, const char *key)
+{
+  int i;
+
+  for (i = 0; i < calib->count; i++)
+    if (!strcmp (calib->entries[i].key, key))
+      return i;
+  return -1;
+}
+
+/* reserve room for one more entry */
+static SANE_Status
+grow_entries (SANEI_Calib * calib)
+{
+  Calib_Entry *entries;
+  int alloc;
+
+  if (calib->count < calib->alloc)
+    return SANE_STATUS_GOOD;
+
+  alloc = calib->alloc ? calib->alloc * 2 : 16;
+  entries = realloc (calib->entries, alloc * sizeof (Calib_Entry));
+  if (!entries)
+    return SANE_STATUS_NO_MEM;
+
+  calib->entries = entries;
+  calib->alloc = alloc;
+  return SANE_STATUS_GOOD;
+}
+
+/* get the whole file into memory, mapped if possible */
+static SANE_Status
+load_contents (SANEI_Calib * calib)
+{
+  struct stat st;
+  ssize_t len;
+  size_t done;
+  int fd;
+
+  fd = open (calib->path, O_RDONLY | O_BINARY);
+  if (fd < 0)
+    {
+      DBG (5, "load_contents: can't open %s: %s\n", calib->path,
+	   strerror (errno));
+      return SANE_STATUS_UNSUPPORTED;
+    }
+
+  if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof (Calib_File_Header))
+    {
+      DBG (1, "load_contents: %s is too short\n", calib->path);
+      close (fd);
+      return SANE_STATUS_INVAL;
+    }
+  calib->contents_size = st.st_size;
+
+#ifdef HAVE_MMAP
+  calib->contents = mmap (NULL, calib->contents_size, PROT_READ,
+			  MAP_PRIVATE, fd, 0);
+  if (calib->contents != MAP_FAILED)
+    {
+      calib->mapped = SANE_TRUE;
+      close (fd);
+      return SANE_STATUS_GOOD;
+    }
+  DBG (5, "load_contents: can't map %s, reading it\n", calib->path);
+#endif
+
+  calib->contents = malloc (calib->contents_size);
+  if (!calib->contents)
+    {
+      close (fd);
+      return SANE_STATUS_NO_MEM;
+    }
+  calib->mapped = SANE_FALSE;
+
+  for (done = 0; done < calib->contents_size; done += len)
+    {
+      len = read (fd, (char *) calib->contents + done,
+		  calib->contents_size - done);
+      if (len <= 0)
+	{
+	  DBG (1, "load_contents: error reading %s\n", calib->path);
+	  free (calib->contents);
+	  calib->contents = NULL;
+	  close (fd);
+	  return SANE_STATUS_IO_ERROR;
+	}
+    }
+
+  close (fd);
+  return SANE_STATUS_GOOD;
+}
+
+static void
+unload_contents (SANEI_Calib * calib)
+{
+  if (!calib->contents)
+    return;
+#ifdef HAVE_MMAP
+  if (calib->mapped)
+    munmap (calib->contents, calib->contents_size);
+  else
+#endif
+    free (calib->contents);
+  calib->contents = NULL;
+  calib->contents_size = 0;
+}
+
+/* check the file header and build the entry list pointing into the
+ * contents of the file */
+static SANE_Status
+parse_contents (SANEI_Calib * calib)
+{
+  Calib_File_Header header;
+  Calib_File_Entry e;
+  Calib_Entry *entry;
+  char *p, *end, *key, *data;
+  time_t now = time (NULL);
+  uint32_t crc, i;
+
+  memcpy (&header, calib->contents, sizeof (header));
+  crc = header.crc;
+  header.crc = 0;
+
+  if (memcmp (header.magic, CALIB_MAGIC, sizeof (header.magic))
+      || header.version != CALIB_VERSION
+      || header.byte_order != CALIB_BYTE_ORDER
+      || crc != crc_update (0, &header, sizeof (header)))
+    {
+      DBG (1, "parse_contents: %s is not a valid calibration store\n",
+	   calib->path);
+      return SANE_STATUS_INVAL;
+    }
+  if (memcmp (header.device, calib->device, CALIB_DEVICE_SIZE)
+      || header.format != (uint32_t) calib->format)
+    {
+      DBG (1, "parse_contents: %s was written for another device or "
+	   "version\n", calib->path);
+      return SANE_STATUS_INVAL;
+    }
+
+  p = (char *) calib->contents + sizeof (header);
+  end = (char *) calib->contents + calib->contents_size;
+  for (i = 0; i < header.count; i++)
+    {
+      if ((size_t) (end - p) < sizeof (e))
+	break;
+      memcpy (&e, p, sizeof (e));
+      key = p + sizeof (e);
+      /* the sizes are checked before they are padded, so the padding
+       * can't wrap around */
+      if (e.key_size == 0 || e.key_size > (size_t) (end - key)
+	  || CALIB_PAD (e.key_size) > (size_t) (end - key))
+	break;
+      data = key + CALIB_PAD (e.key_size);
+      if (e.size > (uint64_t) (end - data)
+	  || CALIB_PAD (e.size) > (size_t) (end - data))
+	break;
+      p = data + CALIB_PAD (e.size);
+
+      if (key[e.key_size - 1] != 0 || e.crc != entry_crc (&e, key, data))
+	{
+	  DBG (1, "parse_contents: skipping corrupted entry %d\n", i);
+	  calib->dirty = SANE_TRUE;
+	  continue;
+	}
+
+      if (grow_entries (calib) != SANE_STATUS_GOOD)
+	return SANE_STATUS_NO_MEM;
+      entry = &calib->entries[calib->count];
+      entry->key = key;
+      entry->data = data;
+      entry->size = e.size;
+      entry->created = e.created;
+      entry->expires = e.expires;
+      entry->owned = SANE_FALSE;
+
+      if (entry_expired (entry, now))
+	{
+	  DBG (5, "parse_contents: entry %s has expired\n", key);
+	  calib->dirty = SANE_TRUE;
+	  continue;
+	}
+      calib->count++;
+    }
+
+  if (i < header.count)
+    {
+      DBG (1, "parse_contents: %s is truncated\n", calib->path);
+      calib->dirty = SANE_TRUE;
+    }
+
+  DBG (5, "parse_contents: %d entries loaded from %s\n", calib->count,
+       calib->path);
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_calib_open (const char *path, const char *device, int format,
+		  SANEI_Calib ** calib)
+{
+  SANEI_Calib *c;
+  SANE_Status status;
+
+  DBG_INIT ();
+  DBG (4, "sanei_calib_open: %s for %s\n", path, device);
+
+  crc_init ();
+
+  *calib = NULL;
+  c = calloc (1, sizeof (SANEI_Calib));
+  if (!c)
+    return SANE_STATUS_NO_MEM;
+
+  c->path = strdup (path);
+  if (!c->path)
+    {
+      free (c);
+      return SANE_STATUS_NO_MEM;
+    }
+  strncpy (c->device, device, CALIB_DEVICE_SIZE - 1);
+  c->format = format;
+
+  status = load_contents (c);
+  if (status == SANE_STATUS_NO_MEM)
+    {
+      free (c->path);
+      free (c);
+      return status;
+    }
+  if (status == SANE_STATUS_GOOD)
+    {
+      status = parse_contents (c);
+      if (status == SANE_STATUS_NO_MEM)
+	{
+	  sanei_calib_clear (c);
+	  c->dirty = SANE_FALSE;
+	  sanei_calib_close (c);
+	  return status;
+	}
+      if (status != SANE_STATUS_GOOD)
+	{
+	  /* start over with an empty store */
+	  c->count = 0;
+	  c->dirty = SANE_FALSE;
+	  unload_contents (c);
+	}
+    }
+
+  *calib = c;
+  /* a missing file is just an empty store */
+  if (status == SANE_STATUS_GOOD || status == SANE_STATUS_UNSUPPORTED)
+    return SANE_STATUS_GOOD;
+  return SANE_STATUS_INVAL;
+}
+
+SANE_Status
+sanei_calib_get (SANEI_Calib * calib, const char *key, const void **data,
+		 size_t * size)
+{
+  int i;
+
+  i = find_entry (calib, key);
+  if (i < 0 || entry_expired (&calib->entries[i], time (NULL)))
+    {
+      DBG (5, "sanei_calib_get: no valid entry for %s\n", key);
+      return SANE_STATUS_UNSUPPORTED;
+    }
+
+  *data = calib->entries[i].data;
+  *size = calib->entries[i].size;
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_calib_next (SANEI_Calib * calib, int *index, const char **key,
+		  const void **data, size_t * size)
+{
+  time_t now = time (NULL);
+  Calib_Entry *e;
+
+  while (*index >= 0 && *index < calib->count)
+    {
+      e = &calib->entries[(*index)++];
+      if (entry_expired (e, now))
+	continue;
+      *key = e->key;
+      *data = e->data;
+      *size = e->size;
+      return SANE_STATUS_GOOD;
+    }
+  return SANE_STATUS_EOF;
+}
+
+SANE_Status
+sanei_calib_put (SANEI_Calib * calib, const char *key, const void *data,
+		 size_t size, int lifetime)
+{
+  Calib_Entry e;
+  int i;
+
+  DBG (5, "sanei_calib_put: %s, %lu bytes\n", key, (unsigned long) size);
+
+  e.key = strdup (key);
+  /* allocate at least one byte so that an empty entry has data too */
+  e.data = malloc (size ? size : 1);
+  if (!e.key || !e.data)
+    {
+      free (e.key);
+      free (e.data);
+      return SANE_STATUS_NO_MEM;
+    }
+  memcpy (e.data, data, size);
+  e.size = size;
+  e.created = time (NULL);
+  e.expires = lifetime > 0 ? e.created + lifetime : 0;
+  e.owned = SANE_TRUE;
+
+  i = find_entry (calib, key);
+  if (i >= 0)
+    entry_free (&calib->entries[i]);
+  else
+    {
+      if (grow_entries (calib) != SANE_STATUS_GOOD)
+	{
+	  entry_free (&e);
+	  return SANE_STATUS_NO_MEM;
+	}
+      i = calib->count++;
+    }
+
+  calib->entries[i] = e;
+  calib->dirty = SANE_TRUE;
+  return SANE_STATUS_GOOD;
+}
+
+void
+sanei_calib_remove (SANEI_Calib * calib, const char *key)
+{
+  int i;
+
+  i = find_entry (calib, key);
+  if (i < 0)
+    return;
+
+  entry_free (&calib->entries[i]);
+  calib->count--;
+  memmove (calib->entries + i, calib->entries + i + 1,
+	   (calib->count - i) * sizeof (Calib_Entry));
+  calib->dirty = SANE_TRUE;
+}
+
+void
+sanei_calib_clear (SANEI_Calib * calib)
+{
+  int i;
+
+  for (i = 0; i < calib->count; i++)
+    entry_free (&calib->entries[i]);
+  calib->count = 0;
+  calib->dirty = SANE_TRUE;
+}
+
+/* write data followed by the padding up to the next aligned position */
+static SANE_Bool
+write_padded (FILE * fp, const void *data, size_t size)
+{
+  static const char zero[CALIB_ALIGN];
+  size_t pad = CALIB_PAD (size) - size;
+
+  if (size && fwrite (data, size, 1, fp) != 1)
+    return SANE_FALSE;
+  if (pad && fwrite (zero, pad, 1, fp) != 1)
+    return SANE_FALSE;
+  return SANE_TRUE;
+}
+
+static SANE_Status
+write_contents (SANEI_Calib * calib, FILE * fp, time_t now)
+{
+  Calib_File_Header header;
+  Calib_File_Entry e;
+  Calib_Entry *entry;
+  int i;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, CALIB_MAGIC, sizeof (header.magic));
+  header.version = CALIB_VERSION;
+  header.byte_order = CALIB_BYTE_ORDER;
+  header.format = calib->format;
+  memcpy (header.device, calib->device, CALIB_DEVICE_SIZE);
+  for (i = 0; i < calib->count; i++)
+    if (!entry_expired (&calib->entries[i], now))
+      header.count++;
+  header.crc = crc_update (0, &header, sizeof (header));
+
+  if (fwrite (&header, sizeof (header), 1, fp) != 1)
+    return SANE_STATUS_IO_ERROR;
+
+  for (i = 0; i < calib->count; i++)
+    {
+      entry = &calib->entries[i];
+      if (entry_expired (entry, now))
+	continue;
+
+      memset (&e, 0, sizeof (e));
+      e.key_size = strlen (entry->key) + 1;
+      e.size = entry->size;
+      e.created = entry->created;
+      e.expires = entry->expires;
+      e.crc = entry_crc (&e, entry->key, entry->data);
+
+      if (fwrite (&e, sizeof (e), 1, fp) != 1
+	  || !write_padded (fp, entry->key, e.key_size)
+	  || !write_padded (fp, entry->data, e.size))
+	return SANE_STATUS_IO_ERROR;
+    }
+
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+sanei_calib_sync (SANEI_Calib * calib)
+{
+  SANE_Status status;
+  time_t now = time (NULL);
+  char *tmp;
+  FILE *fp = NULL;
+  int fd, i, valid = 0;
+
+  if (!calib->dirty)
+    return SANE_STATUS_GOOD;
+
+  for (i = 0; i < calib->count; i++)
+    if (!entry_expired (&calib->entries[i], now))
+      valid++;
+
+  if (!valid)
+    {
+      DBG (5, "sanei_calib_sync: store is empty, removing %s\n",
+	   calib->path);
+      if (unlink (calib->path) < 0 && errno != ENOENT)
+	return SANE_STATUS_IO_ERROR;
+      calib->dirty = SANE_FALSE;
+      return SANE_STATUS_GOOD;
+    }
+
+  /* the new contents go to a unique file next to the store, which then
+   * replaces it, so a crash leaves either the old or the new store */
+  tmp = malloc (strlen (calib->path) + 8);
+  if (!tmp)
+    return SANE_STATUS_NO_MEM;
+  sprintf (tmp, "%s.XXXXXX", calib->path);
+
+  fd = mkstemp (tmp);
+  if (fd < 0 || !(fp = fdopen (fd, "wb")))
+    {
+      DBG (1, "sanei_calib_sync: can't open %s for writing: %s\n", tmp,
+	   strerror (errno));
+      if (fd >= 0)
+	{
+	  close (fd);
+	  unlink (tmp);
+	}
+      free (tmp);
+      return SANE_STATUS_IO_ERROR;
+    }
+
+  status = write_contents (calib, fp, now);
+  if (status == SANE_STATUS_GOOD
+      && (fflush (fp) != 0 || fsync (fileno (fp)) < 0))
+    status = SANE_STATUS_IO_ERROR;
+  if (fclose (fp) != 0)
+    status = SANE_STATUS_IO_ERROR;
+
+  if (status == SANE_STATUS_GOOD && rename (tmp, calib->path) < 0)
+    {
+      /* some systems don't replace an existing file */
+      unlink (calib->path);
+      if (rename (tmp, calib->path) < 0)
+	status = SANE_STATUS_IO_ERROR;
+    }
+
+  if (status != SANE_STATUS_GOOD)
+    {
+      DBG (1, "sanei_calib_sync: failed to write %s\n", calib->path);
+      unlink (tmp);
+    }
+  else
+    {
+      DBG (5, "sanei_calib_sync: %d entries written to %s\n", valid,
+	   calib->path);
+      calib->dirty = SANE_FALSE;
+    }
+
+  free (tmp);
+  return status;
+}
+
+SANE_Status
+sanei_calib_close (SANEI_Calib * calib)
+{
+  SANE_Status status;
+  int i;
+
+  if (!calib)
+    return SANE_STATUS_GOOD;
+
+  status = sanei_calib_sync (calib);
+
+  for (i = 0; i < calib->count; i++)
+    entry_free (&calib->entries[i]);
+  free (calib->entries);
+  unload_contents (calib);
+  free (calib->path);
+  free (calib);
+
+  return status;
+}
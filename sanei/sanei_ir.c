@@ -27,11 +27,19 @@
  * licensed under the GNU General Public License version 2 or later.
 */
 
+#include "../include/sane/config.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
 #include <limits.h>
 #include <math.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 
 #define BACKEND_NAME sanei_ir	/* name of this module for debugging */
 
@@ -46,12 +54,124 @@ sanei_ir_create_norm_histo (const SANE_Parameters * params, const SANE_Uint *img
 double * sanei_ir_accumulate_norm_histo (double * histo_data);
 
 
+/* The image processing below is split into bands of rows which are
+ * processed in parallel if pthreads are available. Every band does
+ * exactly the arithmetic the serial code would do for its rows, so
+ * the results do not depend on the number of bands.
+ */
+#define IR_MAX_BANDS 8
+#define IR_MIN_BAND_ROWS 64
+
+typedef void (*IR_Band_Func) (void *arg, int band, int first, int last);
+
+typedef struct
+{
+  IR_Band_Func func;
+  void *arg;
+  int band;
+  int first;
+  int last;
+}
+IR_Band;
+
+static int ir_num_cpus = 1;
+
+
 /* Initialize sanei_ir
  */
 void
 sanei_ir_init (void)
 {
+#ifdef USE_PTHREAD
+  char *env;
+#endif
+
   DBG_INIT ();
+
+#ifdef USE_PTHREAD
+  env = getenv ("SANE_IR_THREADS");
+  if (env)
+    ir_num_cpus = atoi (env);
+#ifdef _SC_NPROCESSORS_ONLN
+  else
+    ir_num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+  if (ir_num_cpus < 1)
+    ir_num_cpus = 1;
+#endif
+  DBG (10, "sanei_ir_init: using up to %d threads\n",
+       ir_num_cpus < IR_MAX_BANDS ? ir_num_cpus : IR_MAX_BANDS);
+}
+
+
+/* Number of bands to split an image of rows lines into
+ */
+static int
+ir_num_bands (int rows)
+{
+  int n;
+
+  n = rows / IR_MIN_BAND_ROWS;
+  if (n > ir_num_cpus)
+    n = ir_num_cpus;
+  if (n > IR_MAX_BANDS)
+    n = IR_MAX_BANDS;
+  if (n < 1)
+    n = 1;
+  return n;
+}
+
+
+#ifdef USE_PTHREAD
+static void *
+ir_band_thread (void *arg)
+{
+  IR_Band *b = arg;
+
+  b->func (b->arg, b->band, b->first, b->last);
+  return NULL;
+}
+#endif
+
+
+/* Call func for nbands consecutive bands of rows, the last one in the
+ * calling thread. Returns when all bands are done.
+ */
+static void
+ir_run_bands (int rows, int nbands, IR_Band_Func func, void *arg)
+{
+  IR_Band bands[IR_MAX_BANDS];
+#ifdef USE_PTHREAD
+  pthread_t tid[IR_MAX_BANDS];
+  int started[IR_MAX_BANDS];
+#endif
+  int k;
+
+  for (k = 0; k < nbands; k++)
+    {
+      bands[k].func = func;
+      bands[k].arg = arg;
+      bands[k].band = k;
+      bands[k].first = (int) ((long) rows * k / nbands);
+      bands[k].last = (int) ((long) rows * (k + 1) / nbands);
+    }
+
+#ifdef USE_PTHREAD
+  for (k = 0; k < nbands - 1; k++)
+    started[k] = (pthread_create (&tid[k], NULL, ir_band_thread,
+                                  &bands[k]) == 0);
+  func (arg, nbands - 1, bands[nbands - 1].first, bands[nbands - 1].last);
+  for (k = 0; k < nbands - 1; k++)
+    {
+      if (started[k])
+        pthread_join (tid[k], NULL);
+      else                      /* fall back to doing it ourselves */
+        func (arg, k, bands[k].first, bands[k].last);
+    }
+#else
+  for (k = 0; k < nbands; k++)
+    func (arg, k, bands[k].first, bands[k].last);
+#endif
 }
 
 
@@ -512,6 +632,68 @@ sanei_ir_ln_table (int len, double **lut_ln)
 }
 
 
+/* Per band work of sanei_ir_spectral_clean
+ */
+typedef struct
+{
+  const SANE_Uint *red_data;
+  SANE_Uint *ir_data;
+  const double *llut;
+  double rfac;
+  int cols;
+  int imin[IR_MAX_BANDS];
+  int imax[IR_MAX_BANDS];
+  /* second pass */
+  int min_all;
+  double scale;
+}
+IR_Clean_Args;
+
+/* ired' = ired - a * ln (red), only keep the range */
+static void
+ir_clean_range (void *arg, int band, int first, int last)
+{
+  IR_Clean_Args *a = arg;
+  const SANE_Uint *rptr = a->red_data + first * a->cols;
+  const SANE_Uint *iptr = a->ir_data + first * a->cols;
+  const double *llut = a->llut;
+  double rfac = a->rfac;
+  int imin = INT_MAX, imax = INT_MIN;
+  int ival, i;
+
+  for (i = (last - first) * a->cols; i > 0; i--)
+    {
+      ival = *iptr++ - (int) (rfac * llut[*rptr++] + 0.5);
+      if (ival > imax)
+        imax = ival;
+      if (ival < imin)
+        imin = ival;
+    }
+  a->imin[band] = imin;
+  a->imax[band] = imax;
+}
+
+/* calculate ired' again and scale it back into the ired image */
+static void
+ir_clean_scale (void *arg, int band, int first, int last)
+{
+  IR_Clean_Args *a = arg;
+  const SANE_Uint *rptr = a->red_data + first * a->cols;
+  SANE_Uint *iptr = a->ir_data + first * a->cols;
+  const double *llut = a->llut;
+  double rfac = a->rfac, scale = a->scale;
+  int imin = a->min_all;
+  int ival, i;
+
+  (void) band;
+  for (i = (last - first) * a->cols; i > 0; i--)
+    {
+      ival = *iptr - (int) (rfac * llut[*rptr++] + 0.5);
+      *iptr++ = (double) (ival - imin) * scale;
+    }
+}
+
+
 /* Reduce red spectral overlap from an infrared image plane
  */
 SANE_Status
@@ -519,30 +701,22 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
 			const SANE_Uint *red_data,
 			SANE_Uint *ir_data)
 {
-  const SANE_Uint *rptr;
-  SANE_Uint *iptr;
+  IR_Clean_Args args;
   SANE_Int depth;
   double *llut;
   double rval, rsum, rrsum;
-  double risum, rfac, radd;
+  double risum, rfac;
   double *norm_histo;
   int64_t isum;
-  int *calc_buf, *calc_ptr;
   int ival, imin, imax;
   int itop, len, ssize;
   int thresh_low, thresh;
-  int irand, i;
+  int irand, i, nbands;
   SANE_Status status;
 
   DBG (10, "sanei_ir_spectral_clean\n");
 
   itop = params->pixels_per_line * params->lines;
-  calc_buf = malloc (itop * sizeof (int));		/* could save this */
-  if (!calc_buf)
-    {
-      DBG (5, "sanei_ir_spectral_clean: no buffer\n");
-      return SANE_STATUS_NO_MEM;
-    }
 
   depth = params->depth;
   len = 1 << depth;
@@ -551,10 +725,8 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
   else
     {
       status = sanei_ir_ln_table (len, &llut);
-      if (status != SANE_STATUS_GOOD) {
-        free (calc_buf);
+      if (status != SANE_STATUS_GOOD)
         return status;
-      }
     }
 
   /* determine not transparent areas to exclude them later
@@ -566,7 +738,8 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
   if (status != SANE_STATUS_GOOD)
     {
       DBG (5, "sanei_ir_spectral_clean: no buffer\n");
-      free (calc_buf);
+      if (!lut_ln)
+        free (llut);
       return SANE_STATUS_NO_MEM;
     }
 
@@ -612,118 +785,135 @@ sanei_ir_spectral_clean (const SANE_Parameters * params, double *lut_ln,
   rfac =
     ((double) ssize * risum -
     rsum * (double) isum) / ((double) ssize * rrsum - rsum * rsum);
-    radd = ((double) isum - rfac * rsum) / (double) ssize;      /* "b" unused */
 
   DBG (10, "sanei_ir_spectral_clean: n = %d, ired(red) = %f * ln(red) + %f\n",
-            ssize, rfac, radd);
+            ssize, rfac, ((double) isum - rfac * rsum) / (double) ssize);
+
+  /* now calculate ired' = ired - a  * ln (red), twice instead of
+   * buffering it, and scale the result back into the ired image */
+  args.red_data = red_data;
+  args.ir_data = ir_data;
+  args.llut = llut;
+  args.rfac = rfac;
+  args.cols = params->pixels_per_line;
+  nbands = ir_num_bands (params->lines);
+  ir_run_bands (params->lines, nbands, ir_clean_range, &args);
 
-  /* now calculate ired' = ired - a  * ln (red) */
   imin = INT_MAX;
   imax = INT_MIN;
-  rptr = red_data;
-  iptr = ir_data;
-  calc_ptr = calc_buf;
-    for (i = itop; i > 0; i--)
-      {
-	ival = *iptr++ - (int) (rfac * llut[*rptr++] + 0.5);
-	if (ival > imax)
-	  imax = ival;
-	if (ival < imin)
-	  imin = ival;
-	*calc_ptr++ = ival;
-      }
-
-  /* scale the result back into the ired image */
-  calc_ptr = calc_buf;
-  iptr = ir_data;
-  rfac = (double) (len - 1) / (double) (imax - imin);
-    for (i = itop; i > 0; i--)
-      *iptr++ = (double) (*calc_ptr++ - imin) * rfac;
+  for (i = 0; i < nbands; i++)
+    {
+      if (args.imax[i] > imax)
+        imax = args.imax[i];
+      if (args.imin[i] < imin)
+        imin = args.imin[i];
+    }
+  args.min_all = imin;
+  args.scale = (double) (len - 1) / (double) (imax - imin);
+  ir_run_bands (params->lines, nbands, ir_clean_scale, &args);
 
   if (!lut_ln)
     free (llut);
-  free (calc_buf);
   free (norm_histo);
   return SANE_STATUS_GOOD;
 }
 
 
-/* Hopefully fast mean filter
- * JV: what does this do? Remove local mean?
+/* The mean filter divides every pixel by the window size. Replace the
+ * division by a multiplication (Granlund and Montgomery, "Division by
+ * invariant integers using multiplication"), which is exact for all
+ * dividends 0 <= n < 2^31 and divisors 0 < d < 2^31.
  */
-SANE_Status
-sanei_ir_filter_mean (const SANE_Parameters * params,
-		      const SANE_Uint *in_img, SANE_Uint *out_img,
-		      int win_rows, int win_cols)
+typedef struct
 {
-  const SANE_Uint *src;
+  uint64_t mul;
+  int shift;
+}
+IR_Div;
+
+static void
+ir_div_init (IR_Div * div, unsigned int d)
+{
+  int l = 0;
+
+  while (((uint64_t) 1 << l) < d)
+    l++;
+  div->shift = 31 + l;
+  div->mul = ((uint64_t) 1 << div->shift) / d + 1;
+}
+
+#define IR_DIV(n, div) ((unsigned int) (((uint64_t) (n) * (div).mul) >> (div).shift))
+
+
+/* Mean filter rows first to last - 1 of an image
+ *
+ * The column sums are kept in sum[], which has to hold num_cols ints.
+ * They are set up for the first row of the band, so any band gives
+ * the same result as filtering the whole image at once.
+ */
+static void
+ir_mean_rows (const SANE_Uint *in_img, SANE_Uint *out_img,
+	      int num_cols, int num_rows, int win_rows, int win_cols,
+	      int *sum, int first, int last)
+{
+  const SANE_Uint *src, *sub;
   SANE_Uint *dest;
-  int num_cols, num_rows;
+  IR_Div div;
   int itop, iadd, isub;
-  int ndiv, the_sum;
+  int the_sum;
   int nrow, ncol;
   int hwr, hwc;
-  int *sum;
   int i, j;
 
-  DBG (10, "sanei_ir_filter_mean, window: %d x%d\n", win_rows, win_cols);
-
-  if (((win_rows & 1) == 0) || ((win_cols & 1) == 0))
-    {
-      DBG (5, "sanei_ir_filter_mean: window even sized\n");
-      return SANE_STATUS_INVAL;
-    }
-
-  num_cols = params->pixels_per_line;
-  num_rows = params->lines;
-
-  sum = malloc (num_cols * sizeof (int));
-  if (!sum)
-    {
-      DBG (5, "sanei_ir_filter_mean: no buffer for sums\n");
-      return SANE_STATUS_NO_MEM;
-    }
-  dest = out_img;
-
   hwr = win_rows / 2;		/* half window sizes */
   hwc = win_cols / 2;
 
-  /* pre-pre calculation */
+  /* pre-pre calculation, sums over the rows in the window of the
+   * row before the first one */
   for (j = 0; j < num_cols; j++)
+    sum[j] = 0;
+  i = first - hwr - 1;
+  if (i < 0)
+    i = 0;
+  nrow = 0;
+  for (; (i < first + hwr) && (i < num_rows); i++)
     {
-        sum[j] = 0;
-	src = in_img + j;
-	for (i = 0; i < hwr; i++)
-	  {
-	    sum[j] += *src;
-	    src += num_cols;
-	  }
+      src = in_img + i * num_cols;
+      for (j = 0; j < num_cols; j++)
+	sum[j] += src[j];
+      nrow++;
     }
 
   itop = num_rows * num_cols;
-  iadd = hwr * num_cols;
-  isub = (hwr - win_rows) * num_cols;
-  nrow = hwr;
+  iadd = (first + hwr) * num_cols;
+  isub = (first + hwr - win_rows) * num_cols;
+  dest = out_img + first * num_cols;
 
-      for (i = 0; i < num_rows; i++)
+      for (i = first; i < last; i++)
 	{
 	  /* update row sums if possible */
-	  if (isub >= 0)	/* subtract old row */
+	  if ((isub >= 0) && (iadd < itop))	/* replace old row by new */
+	    {
+	      sub = in_img + isub;
+	      src = in_img + iadd;
+	      for (j = 0; j < num_cols; j++)
+		sum[j] += src[j] - sub[j];
+	    }
+	  else if (isub >= 0)	/* subtract old row */
 	    {
 	      nrow--;
 	      src = in_img + isub;
 	      for (j = 0; j < num_cols; j++)
-		sum[j] -= *src++;
+		sum[j] -= src[j];
 	    }
-	  isub += num_cols;
-
-	  if (iadd < itop)	/* add new row */
+	  else if (iadd < itop)	/* add new row */
 	    {
 	      nrow++;
 	      src = in_img + iadd;
 	      for (j = 0; j < num_cols; j++)
-		sum[j] += *src++;
+		sum[j] += src[j];
 	    }
+	  isub += num_cols;
 	  iadd += num_cols;
 
 	  /* now we do the image columns using only the precalculated sums */
@@ -741,13 +931,12 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
 	      *dest++ = the_sum / (ncol * nrow);
 	    }
 
-	  ndiv = ncol * nrow;
+	  ir_div_init (&div, ncol * nrow);
 	  /* in the middle, real index hwc + 1 higher */
 	  for (j = 0; j < num_cols - win_cols; j++)
 	    {
-	      the_sum -= sum[j];
-	      the_sum += sum[j + win_cols];
-	      *dest++ = the_sum / ndiv;
+	      the_sum += sum[j + win_cols] - sum[j];
+	      *dest++ = IR_DIV (the_sum, div);
 	    }
 
 	  /* at the right margin, real index hwc + 1 higher */
@@ -758,11 +947,152 @@ sanei_ir_filter_mean (const SANE_Parameters * params,
 	      *dest++ = the_sum / (ncol * nrow);
 	    }
 	}
-  free (sum);
+}
+
+
+typedef struct
+{
+  const SANE_Uint *in_img;
+  SANE_Uint *out_img;
+  int num_cols, num_rows;
+  int win_rows, win_cols;
+  int *sums;			/* num_cols per band */
+}
+IR_Mean_Args;
+
+static void
+ir_mean_band (void *arg, int band, int first, int last)
+{
+  IR_Mean_Args *a = arg;
+
+  ir_mean_rows (a->in_img, a->out_img, a->num_cols, a->num_rows,
+		a->win_rows, a->win_cols, a->sums + band * a->num_cols,
+		first, last);
+}
+
+
+/* Mean filter with the column sums taken from sums[], which must hold
+ * ir_num_bands (lines) * pixels_per_line ints
+ */
+static void
+ir_filter_mean (const SANE_Parameters * params,
+		const SANE_Uint *in_img, SANE_Uint *out_img,
+		int win_rows, int win_cols, int *sums)
+{
+  IR_Mean_Args args;
+
+  args.in_img = in_img;
+  args.out_img = out_img;
+  args.num_cols = params->pixels_per_line;
+  args.num_rows = params->lines;
+  args.win_rows = win_rows;
+  args.win_cols = win_cols;
+  args.sums = sums;
+  ir_run_bands (params->lines, ir_num_bands (params->lines),
+		ir_mean_band, &args);
+}
+
+
+/* Hopefully fast mean filter
+ * JV: what does this do? Remove local mean?
+ */
+SANE_Status
+sanei_ir_filter_mean (const SANE_Parameters * params,
+		      const SANE_Uint *in_img, SANE_Uint *out_img,
+		      int win_rows, int win_cols)
+{
+  int *sums;
+
+  DBG (10, "sanei_ir_filter_mean, window: %d x%d\n", win_rows, win_cols);
+
+  if (((win_rows & 1) == 0) || ((win_cols & 1) == 0))
+    {
+      DBG (5, "sanei_ir_filter_mean: window even sized\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  sums = malloc ((size_t) ir_num_bands (params->lines)
+		 * params->pixels_per_line * sizeof (int));
+  if (!sums)
+    {
+      DBG (5, "sanei_ir_filter_mean: no buffer for sums\n");
+      return SANE_STATUS_NO_MEM;
+    }
+
+  ir_filter_mean (params, in_img, out_img, win_rows, win_cols, sums);
+
+  free (sums);
   return SANE_STATUS_GOOD;
 }
 
 
+/* Per band work of sanei_ir_filter_madmean
+ */
+typedef struct
+{
+  IR_Mean_Args mean;
+  const SANE_Uint *in_img;
+  SANE_Uint *delta_ij;
+  SANE_Uint *mad_ij;
+  SANE_Uint *out_ij;
+  const int *thresh;		/* threshold for mad values below b_val */
+  int a_val, b_val;
+}
+IR_Madmean_Args;
+
+/* differences to the local mean */
+static void
+ir_madmean_delta (void *arg, int band, int first, int last)
+{
+  IR_Madmean_Args *a = arg;
+  const SANE_Uint *src;
+  SANE_Uint *delta;
+  int ival, i;
+
+  ir_mean_band (&a->mean, band, first, last);
+
+  src = a->in_img + first * a->mean.num_cols;
+  delta = a->delta_ij + first * a->mean.num_cols;
+  for (i = (last - first) * a->mean.num_cols; i > 0; i--)
+    {
+      ival = *src++ - *delta;
+      *delta++ = abs (ival);
+    }
+}
+
+/* local mean differences and the noise map */
+static void
+ir_madmean_noise (void *arg, int band, int first, int last)
+{
+  IR_Madmean_Args *a = arg;
+  const SANE_Uint *mad_ptr, *delta_ptr;
+  SANE_Uint *dest8;
+  const int *thresh = a->thresh;
+  int b_val = a->b_val, a_val = a->a_val;
+  int ival, threshold, i;
+
+  ir_mean_band (&a->mean, band, first, last);
+
+  mad_ptr = a->mad_ij + first * a->mean.num_cols;
+  delta_ptr = a->delta_ij + first * a->mean.num_cols;
+  dest8 = a->out_ij + first * a->mean.num_cols;
+  for (i = (last - first) * a->mean.num_cols; i > 0; i--)
+    {
+      /* by looking up the threshold */
+      ival = *mad_ptr++;
+      if (ival >= b_val)	/* outlier */
+	threshold = a_val;
+      else
+	threshold = thresh[ival];
+      /* above threshold is noise, indicated by 0 */
+      if (*delta_ptr++ >= threshold)
+	*dest8++ = 0;
+      else
+	*dest8++ = 255;
+    }
+}
+
+
 /* Find noise by adaptive thresholding
  */
 SANE_Status
@@ -771,20 +1101,25 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
 			 SANE_Uint ** out_img, int win_size,
 			 int a_val, int b_val)
 {
-  SANE_Uint *delta_ij, *delta_ptr;
-  SANE_Uint *mad_ij;
-  const SANE_Uint *mad_ptr;
-  SANE_Uint *out_ij, *dest8;
+  IR_Madmean_Args args;
+  SANE_Uint *out_ij;
+  char *scratch;
+  int *thresh;
   double ab_term;
   int num_rows, num_cols;
-  int threshold, itop;
-  size_t size;
-  int ival, i;
+  int itop, nbands;
+  size_t size, tsize;
+  int i;
   int depth;
-  SANE_Status ret = SANE_STATUS_NO_MEM;
 
   DBG (10, "sanei_ir_filter_madmean\n");
 
+  if ((win_size & 1) == 0)
+    {
+      DBG (5, "sanei_ir_filter_madmean: window even sized\n");
+      return SANE_STATUS_INVAL;
+    }
+
   depth = params->depth;
   if (depth != 8)
     {
@@ -794,61 +1129,57 @@ sanei_ir_filter_madmean (const SANE_Parameters * params,
   num_cols = params->pixels_per_line;
   num_rows = params->lines;
   itop = num_rows * num_cols;
+  nbands = ir_num_bands (num_rows);
   size = itop * sizeof (SANE_Uint);
-  out_ij = malloc (size);
-  delta_ij = malloc (size);
-  mad_ij = malloc (size);
+  tsize = (b_val > 0 ? b_val : 0) * sizeof (int);
 
-  if (out_ij && delta_ij && mad_ij)
+  /* one scratch area for delta_ij, mad_ij, the column sums of all
+   * bands and the threshold table */
+  out_ij = malloc (size);
+  scratch = malloc (2 * size + (size_t) nbands * num_cols * sizeof (int)
+		    + tsize);
+  if (!out_ij || !scratch)
     {
-      /* get the differences to the local mean */
-      mad_ptr = in_img;
-      if (sanei_ir_filter_mean (params, mad_ptr, delta_ij, win_size, win_size)
-	  == SANE_STATUS_GOOD)
-	{
-	  delta_ptr = delta_ij;
-	    for (i = 0; i < itop; i++)
-	      {
-		ival = *mad_ptr++ - *delta_ptr;
-		*delta_ptr++ = abs (ival);
-	      }
-	  /* make the second filtering window a bit larger */
-	  win_size = MAD_WIN2_SIZE(win_size);
-	  /* and get the local mean differences */
-	  if (sanei_ir_filter_mean
-	      (params, delta_ij, mad_ij, win_size,
-	       win_size) == SANE_STATUS_GOOD)
-	    {
-	      mad_ptr = mad_ij;
-	      delta_ptr = delta_ij;
-	      dest8 = out_ij;
-	      /* construct the noise map */
-	      ab_term = (b_val - a_val) / (double) b_val;
-		for (i = 0; i < itop; i++)
-		  {
-		    /* by calculating the threshold */
-		    ival = *mad_ptr++;
-		    if (ival >= b_val)	/* outlier */
-		      threshold = a_val;
-		    else
-		      threshold = a_val + (double) ival *ab_term;
-		    /* above threshold is noise, indicated by 0 */
-		    if (*delta_ptr++ >= threshold)
-		      *dest8++ = 0;
-		    else
-		      *dest8++ = 255;
-		  }
-	      *out_img = out_ij;
-	      ret = SANE_STATUS_GOOD;
-	    }
-	}
+      DBG (5, "sanei_ir_filter_madmean: Cannot allocate buffers\n");
+      free (out_ij);
+      free (scratch);
+      return SANE_STATUS_NO_MEM;
     }
-  else
-    DBG (5, "sanei_ir_filter_madmean: Cannot allocate buffers\n");
-
-  free (mad_ij);
-  free (delta_ij);
-  return ret;
+  args.mean.sums = (int *) scratch;
+  thresh = args.mean.sums + nbands * num_cols;
+  args.delta_ij = (SANE_Uint *) (thresh + tsize / sizeof (int));
+  args.mad_ij = args.delta_ij + itop;
+
+  /* the threshold only depends on the mad value, and only mad values
+   * below b_val need it to be calculated */
+  ab_term = (b_val - a_val) / (double) b_val;
+  for (i = 0; i < b_val; i++)
+    thresh[i] = a_val + (double) i * ab_term;
+
+  args.in_img = in_img;
+  args.out_ij = out_ij;
+  args.thresh = thresh;
+  args.a_val = a_val;
+  args.b_val = b_val;
+  args.mean.num_cols = num_cols;
+  args.mean.num_rows = num_rows;
+
+  /* get the differences to the local mean */
+  args.mean.in_img = in_img;
+  args.mean.out_img = args.delta_ij;
+  args.mean.win_rows = args.mean.win_cols = win_size;
+  ir_run_bands (num_rows, nbands, ir_madmean_delta, &args);
+
+  /* make the second filtering window a bit larger
+   * and get the local mean differences to construct the noise map */
+  args.mean.in_img = args.delta_ij;
+  args.mean.out_img = args.mad_ij;
+  args.mean.win_rows = args.mean.win_cols = MAD_WIN2_SIZE(win_size);
+  ir_run_bands (num_rows, nbands, ir_madmean_noise, &args);
+
+  free (scratch);
+  *out_img = out_ij;
+  return SANE_STATUS_GOOD;
 }
 
 
@@ -984,6 +1315,188 @@ sanei_ir_manhattan_dist (const SANE_Parameters * params,
 }
 
 
+/* Per band work of sanei_ir_euclidean_dist
+ */
+#define IR_NO_SITE UINT_MAX
+
+typedef struct
+{
+  const SANE_Uint *mask_img;
+  unsigned int *dist_map;
+  unsigned int *idx_map;
+  unsigned int erode;
+  int rows, cols;
+  char *scratch;		/* row buffers for every band */
+  size_t band_size;
+}
+IR_Dist_Args;
+
+/* first pass, find the closest source pixel within each column of
+ * columns first to last - 1 and keep its row in idx_map */
+static void
+ir_dist_columns (void *arg, int band, int first, int last)
+{
+  IR_Dist_Args *a = arg;
+  const SANE_Uint *mask;
+  unsigned int *row, *prev;
+  int cols = a->cols;
+  int i, j;
+
+  (void) band;
+
+  /* from top to bottom */
+  for (i = 0; i < a->rows; i++)
+    {
+      mask = a->mask_img + i * cols;
+      row = a->idx_map + i * cols;
+      prev = row - cols;
+      for (j = first; j < last; j++)
+	{
+	  if (mask[j] == a->erode)
+	    row[j] = i;
+	  else if (i > 0)
+	    row[j] = prev[j];
+	  else
+	    row[j] = IR_NO_SITE;
+	}
+    }
+
+  /* and back, take the one below if it is closer */
+  for (i = a->rows - 2; i >= 0; i--)
+    {
+      row = a->idx_map + i * cols;
+      prev = row + cols;
+      for (j = first; j < last; j++)
+	{
+	  if (prev[j] == IR_NO_SITE)
+	    continue;
+	  if ((row[j] == IR_NO_SITE)
+	      || (prev[j] - i < i - row[j]))
+	    row[j] = prev[j];
+	}
+    }
+}
+
+/* second pass, the lower envelope of the parabolas (x - q)^2 + dy(q)^2
+ * along each row of rows first to last - 1 */
+static void
+ir_dist_rows (void *arg, int band, int first, int last)
+{
+  IR_Dist_Args *a = arg;
+  unsigned int *site_row, *idx, *dist;
+  double *f, *z;
+  int *v;
+  int cols = a->cols;
+  double s, dy;
+  int i, j, k, q;
+
+  /* scratch for one row */
+  site_row = (unsigned int *) (a->scratch + band * a->band_size);
+  f = (double *) (site_row + cols + 1);
+  z = f + cols;
+  v = (int *) (z + cols + 1);
+
+  for (i = first; i < last; i++)
+    {
+      idx = a->idx_map + i * cols;
+      dist = a->dist_map + i * cols;
+      memcpy (site_row, idx, cols * sizeof (unsigned int));
+
+      /* construct the envelope from the columns having a source */
+      k = -1;
+      for (q = 0; q < cols; q++)
+	{
+	  if (site_row[q] == IR_NO_SITE)
+	    continue;
+	  dy = (double) i - (double) site_row[q];
+	  f[q] = dy * dy;
+	  if (k < 0)
+	    {
+	      k = 0;
+	      v[0] = q;
+	      z[0] = -HUGE_VAL;
+	      z[1] = HUGE_VAL;
+	      continue;
+	    }
+	  /* drop the parabolas hidden by the new one, z[0] stops it */
+	  for (;;)
+	    {
+	      s = ((f[q] + (double) q * q) - (f[v[k]] + (double) v[k] * v[k]))
+		/ (2.0 * (q - v[k]));
+	      if (s > z[k])
+		break;
+	      k--;
+	    }
+	  k++;
+	  v[k] = q;
+	  z[k] = s;
+	  z[k + 1] = HUGE_VAL;
+	}
+
+      if (k < 0)		/* no source pixel at all */
+	{
+	  for (j = 0; j < cols; j++)
+	    {
+	      dist[j] = cols + a->rows;
+	      idx[j] = i * cols + j;
+	    }
+	  continue;
+	}
+
+      /* and read the distances off it */
+      k = 0;
+      for (j = 0; j < cols; j++)
+	{
+	  while (z[k + 1] < j)
+	    k++;
+	  q = v[k];
+	  s = (double) (j - q) * (j - q) + f[q];
+	  dist[j] = (unsigned int) (sqrt (s) + 0.5);
+	  idx[j] = site_row[q] * cols + q;
+	}
+    }
+}
+
+
+/* Calculate minimal Euclidean distances for an image mask
+ */
+void
+sanei_ir_euclidean_dist (const SANE_Parameters * params,
+			 const SANE_Uint * mask_img, unsigned int *dist_map,
+			 unsigned int *idx_map, unsigned int erode)
+{
+  IR_Dist_Args args;
+  int nbands;
+
+  DBG (10, "sanei_ir_euclidean_dist\n");
+
+  args.mask_img = mask_img;
+  args.dist_map = dist_map;
+  args.idx_map = idx_map;
+  args.erode = erode ? 255 : 0;
+  args.cols = params->pixels_per_line;
+  args.rows = params->lines;
+
+  nbands = ir_num_bands (args.rows);
+  args.band_size = (args.cols + 1) * sizeof (unsigned int)
+    + (2 * args.cols + 1) * sizeof (double) + args.cols * sizeof (int);
+  args.band_size = (args.band_size + sizeof (double) - 1)
+    / sizeof (double) * sizeof (double);
+  args.scratch = malloc (nbands * args.band_size);
+  if (!args.scratch)
+    {
+      DBG (5, "sanei_ir_euclidean_dist: no buffer, using Manhattan distances\n");
+      sanei_ir_manhattan_dist (params, mask_img, dist_map, idx_map, erode);
+      return;
+    }
+
+  ir_run_bands (args.cols, ir_num_bands (args.cols), ir_dist_columns, &args);
+  ir_run_bands (args.rows, nbands, ir_dist_rows, &args);
+
+  free (args.scratch);
+}
+
+
 /* dilate or erode a mask image */
 
 void
@@ -1013,7 +1526,7 @@ sanei_ir_dilate (const SANE_Parameters *params, SANE_Uint *mask_img,
 
   itop = params->pixels_per_line * params->lines;
   mask = mask_img;
-  sanei_ir_manhattan_dist (params, mask_img, dist_map, idx_map, erode);
+  sanei_ir_euclidean_dist (params, mask_img, dist_map, idx_map, erode);
 
   manhattan = dist_map;
   for (i = 0; i < itop; i++)
@@ -1123,6 +1636,8 @@ sanei_ir_dilate_mean (const SANE_Parameters * params,
 {
   SANE_Uint *color;
   SANE_Uint *plane;
+  char *scratch;
+  int *sums;
   unsigned int *dist_map, *manhattan;
   unsigned int *idx_map, *index;
   int dist;
@@ -1136,71 +1651,75 @@ sanei_ir_dilate_mean (const SANE_Parameters * params,
   cols = params->pixels_per_line;
   rows = params->lines;
   itop = rows * cols;
-  idx_map = malloc (itop * sizeof (unsigned int));
-  dist_map = malloc (itop * sizeof (unsigned int));
-  plane = malloc (itop * sizeof (SANE_Uint));
 
-  if (!idx_map || !dist_map || !plane)
+  if ((win_size & 1) == 0)
+    {
+      DBG (5, "sanei_ir_dilate_mean: window even sized\n");
+      return SANE_STATUS_INVAL;
+    }
+
+  /* one scratch area for all maps and the column sums of the filter */
+  scratch = malloc (2 * (size_t) itop * sizeof (unsigned int)
+		    + (size_t) ir_num_bands (rows) * cols * sizeof (int)
+		    + (size_t) itop * sizeof (SANE_Uint));
+  if (!scratch)
     DBG (5, "sanei_ir_dilate_mean: Cannot allocate buffers\n");
   else
     {
+      idx_map = (unsigned int *) scratch;
+      dist_map = idx_map + itop;
+      sums = (int *) (dist_map + itop);
+      plane = (SANE_Uint *) (sums + ir_num_bands (rows) * cols);
+
       /* expand dirty regions into their half dirty surround*/
       if (expand > 0)
 	sanei_ir_dilate (params, mask_img, dist_map, idx_map, expand);
       /* for dirty pixels determine the closest clean ones */
-      sanei_ir_manhattan_dist (params, mask_img, dist_map, idx_map, 1);
+      sanei_ir_euclidean_dist (params, mask_img, dist_map, idx_map, 1);
 
       /* use the distance map to find how to crop dark edges */
       if (crop)
         sanei_ir_find_crop (params, dist_map, inner, crop);
 
-      /* replace dirty pixels */
+      /* replace dirty pixels, all colors in one pass over the maps */
+      manhattan = dist_map;
+      index = idx_map;
+      for (i = 0; i < itop; i++)
+	{
+	  dist = *manhattan++;
+	  if ((dist != 0) && (dist <= dist_max))
+	    for (k = 0; k < 3; k++)
+	      in_img[k][i] = in_img[k][index[i]];
+	}
+
       for (k = 0; k < 3; k++)
 	{
-	  manhattan = dist_map;
-	  index = idx_map;
 	  color = in_img[k];
-	  /* first replacement */
-	    for (i = 0; i < itop; i++)
-	      {
-		dist = *manhattan++;
-		if ((dist != 0) && (dist <= dist_max))
-		  color[i] = color[index[i]];
-	      }
           /* adapt pixels to their new surround and
            * smooth the whole image or the replaced pixels only */
-	  ret =
-	    sanei_ir_filter_mean (params, color, plane, win_size, win_size);
-	  if (ret != SANE_STATUS_GOOD)
-	    break;
+	  ir_filter_mean (params, color, plane, win_size, win_size, sums);
+	  if (smooth)
+	    {
+	      /* a second mean results in triangular blur */
+	      DBG (10, "sanei_ir_dilate_mean(): smoothing whole image\n");
+	      ir_filter_mean (params, plane, color, win_size, win_size, sums);
+	    }
 	  else
-	    if (smooth)
-              {
-                /* a second mean results in triangular blur */
-                DBG (10, "sanei_ir_dilate_mean(): smoothing whole image\n");
-                ret =
-                  sanei_ir_filter_mean (params, plane, color, win_size,
-                                        win_size);
-                if (ret != SANE_STATUS_GOOD)
-                  break;
-              }
-            else
-              {
-                /* replace with smoothened pixels only */
-                DBG (10, "sanei_ir_dilate_mean(): smoothing replaced pixels only\n");
-                manhattan = dist_map;
-                  for (i = 0; i < itop; i++)
-                    {
-                      dist = *manhattan++;
-                      if ((dist != 0) && (dist <= dist_max))
-                        color[i] = plane[i];
-                    }
-              }
-      }
+	    {
+	      /* replace with smoothened pixels only */
+	      DBG (10, "sanei_ir_dilate_mean(): smoothing replaced pixels only\n");
+	      manhattan = dist_map;
+	      for (i = 0; i < itop; i++)
+		{
+		  dist = *manhattan++;
+		  if ((dist != 0) && (dist <= dist_max))
+		    color[i] = plane[i];
+		}
+	    }
+	}
+      ret = SANE_STATUS_GOOD;
     }
-  free (plane);
-  free (dist_map);
-  free (idx_map);
+  free (scratch);
 
   return ret;
 }
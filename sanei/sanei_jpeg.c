@@ -9,6 +9,12 @@
 
 #include "../include/sane/sanei_jpeg.h"
 
+#include <setjmp.h>
+#include <unistd.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
 typedef struct
   {
     struct djpeg_dest_struct pub;	/* public fields */
@@ -232,4 +238,528 @@ sanei_jpeg_jinit_write_ppm (j_decompress_ptr cinfo)
   return (djpeg_dest_ptr) dest;
 }
 
+
+/*
+ * Decoding of a whole image held in memory, straight into the caller's
+ * buffer.
+ *
+ * Scanners that send JPEG often put restart markers in the data. The
+ * entropy coder starts afresh after each one, so if a marker falls at
+ * the start of a row of MCUs, the image can be cut there. Each band is
+ * given the headers of the image, with its own height, and decoded by a
+ * thread of its own. When the chroma is upsampled vertically, the rows
+ * at the edge of a band depend on the rows next to it, so the bands are
+ * decoded with a little overlap, which is thrown away. The result is the
+ * same as decoding the image in one go, which is what is done when the
+ * image has no suitable markers, or without threads.
+ */
+
+#define MAX_THREADS 8		/* bands decoded at once */
+#define MIN_BAND_LINES 128	/* not worth a thread below this */
+
+struct mem_error
+  {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+  };
+
+struct mem_decoder
+  {
+    struct jpeg_decompress_struct cinfo;
+    struct mem_error err;
+    struct jpeg_source_mgr src;
+  };
+
+/* where the parts of the image are, and how they can be cut */
+struct layout
+  {
+    size_t sof;			/* offset of the image height in SOF */
+    size_t scan;		/* start of the entropy coded data */
+    size_t end;			/* offset of EOI */
+    unsigned int height;	/* lines in the image */
+    unsigned int mcu_h;		/* lines in an MCU */
+    unsigned int mcu_rows;	/* rows of MCUs in the image */
+    unsigned int mcus_per_row;
+    unsigned int restart;	/* MCUs between restart markers */
+    int upsample_v;		/* chroma is upsampled vertically */
+    size_t *rst;		/* offsets of the restart markers */
+    unsigned int nrst;
+  };
+
+struct band
+  {
+    JOCTET *data;		/* a small image of its own */
+    size_t len;
+    JDIMENSION skip;		/* overlap lines at the top */
+    JDIMENSION lines;		/* lines that are kept */
+    SANE_Byte *out;
+    SANE_Int bytes_per_line;
+    SANE_Status status;
+#ifdef USE_PTHREAD
+    pthread_t thread;
+    int started;
+#endif
+  };
+
+METHODDEF (void)
+sanei_jpeg_mem_error_exit (j_common_ptr cinfo)
+{
+  longjmp (((struct mem_error *) cinfo->err)->jmp, 1);
+}
+
+METHODDEF (void)
+sanei_jpeg_mem_output_message (j_common_ptr cinfo)
+{
+  cinfo = cinfo;
+
+  /* warnings about damaged data are not printed */
+}
+
+METHODDEF (void)
+sanei_jpeg_mem_init_source (j_decompress_ptr cinfo)
+{
+  cinfo = cinfo;
+
+  /* all data is in the buffer already */
+}
+
+METHODDEF (boolean)
+sanei_jpeg_mem_fill_input (j_decompress_ptr cinfo)
+{
+  static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+
+  /* the image is cut short, end it */
+  WARNMS (cinfo, JWRN_JPEG_EOF);
+  cinfo->src->next_input_byte = eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+METHODDEF (void)
+sanei_jpeg_mem_skip_input (j_decompress_ptr cinfo, long num_bytes)
+{
+  if (num_bytes <= 0)
+    return;
+  if ((size_t) num_bytes > cinfo->src->bytes_in_buffer)
+    num_bytes = (long) cinfo->src->bytes_in_buffer;
+  cinfo->src->next_input_byte += num_bytes;
+  cinfo->src->bytes_in_buffer -= num_bytes;
+}
+
+METHODDEF (void)
+sanei_jpeg_mem_term_source (j_decompress_ptr cinfo)
+{
+  cinfo = cinfo;
+}
+
+/* The caller must have set d->err.jmp, and d must be zeroed so that
+ * jpeg_destroy_decompress works whatever happens here. */
+LOCAL (void)
+mem_decoder_init (struct mem_decoder *d, const JOCTET * data, size_t len)
+{
+  d->cinfo.err = jpeg_std_error (&d->err.pub);
+  d->err.pub.error_exit = sanei_jpeg_mem_error_exit;
+  d->err.pub.output_message = sanei_jpeg_mem_output_message;
+  jpeg_create_decompress (&d->cinfo);
+
+  d->src.init_source = sanei_jpeg_mem_init_source;
+  d->src.fill_input_buffer = sanei_jpeg_mem_fill_input;
+  d->src.skip_input_data = sanei_jpeg_mem_skip_input;
+  d->src.resync_to_restart = jpeg_resync_to_restart;
+  d->src.term_source = sanei_jpeg_mem_term_source;
+  d->src.next_input_byte = data;
+  d->src.bytes_in_buffer = len;
+  d->cinfo.src = &d->src;
+}
+
+/* Decodes lines skip to skip + lines - 1 of an image into out, or all
+ * lines from skip on if lines is 0. */
+LOCAL (SANE_Status)
+decode_lines (const JOCTET * data, size_t len, JDIMENSION skip,
+	      JDIMENSION lines, SANE_Byte * out, SANE_Int bytes_per_line)
+{
+  struct mem_decoder d;
+  JSAMPROW volatile scratch = NULL;
+  JSAMPROW rows[8];
+  JDIMENSION row_size, n, i;
+  volatile JDIMENSION end = skip + lines;
+  volatile SANE_Status status = SANE_STATUS_GOOD;
+
+  memset (&d, 0, sizeof (d));
+  if (setjmp (d.err.jmp))
+    {
+      status = SANE_STATUS_IO_ERROR;
+      goto cleanup;
+    }
+  mem_decoder_init (&d, data, len);
+
+  jpeg_read_header (&d.cinfo, TRUE);
+  jpeg_start_decompress (&d.cinfo);
+
+  row_size = d.cinfo.output_width * d.cinfo.output_components;
+  if (!lines)
+    end = d.cinfo.output_height;
+  if ((d.cinfo.output_components != 1 && d.cinfo.output_components != 3)
+      || row_size > (JDIMENSION) bytes_per_line
+      || skip > end || end > d.cinfo.output_height)
+    {
+      status = SANE_STATUS_INVAL;
+      goto cleanup;
+    }
+
+  if (skip)
+    {
+      scratch = malloc (row_size);
+      if (!scratch)
+	{
+	  status = SANE_STATUS_NO_MEM;
+	  goto cleanup;
+	}
+    }
+  while (d.cinfo.output_scanline < skip)
+    jpeg_read_scanlines (&d.cinfo, (JSAMPARRAY) &scratch, 1);
+
+  while (d.cinfo.output_scanline < end)
+    {
+      n = end - d.cinfo.output_scanline;
+      if (n > (JDIMENSION) d.cinfo.rec_outbuf_height)
+	n = d.cinfo.rec_outbuf_height;
+      if (n > sizeof (rows) / sizeof (rows[0]))
+	n = sizeof (rows) / sizeof (rows[0]);
+      for (i = 0; i < n; i++)
+	rows[i] = (JSAMPROW) (out + (size_t) (d.cinfo.output_scanline
+					      - skip + i) * bytes_per_line);
+      jpeg_read_scanlines (&d.cinfo, rows, n);
+    }
+
+  /* a band may stop before the end of its image */
+  if (d.cinfo.output_scanline == d.cinfo.output_height)
+    jpeg_finish_decompress (&d.cinfo);
+
+cleanup:
+  jpeg_destroy_decompress (&d.cinfo);
+  free (scratch);
+  return status;
+}
+
+/* Returns 1 if the image is a single interleaved baseline scan with
+ * restart markers, and fills l. l->rst must be freed then. */
+LOCAL (int)
+find_layout (const JOCTET * data, size_t len, struct layout *l)
+{
+  size_t pos = 2, seglen;
+  unsigned int width = 0, comps = 0, h, v, max_h = 1, max_v = 1, min_v = 4;
+  unsigned int i, expected;
+  int marker;
+
+  memset (l, 0, sizeof (*l));
+  if (len < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return 0;
+
+  /* the markers up to the start of scan */
+  for (;;)
+    {
+      while (pos + 1 < len && data[pos] == 0xFF && data[pos + 1] == 0xFF)
+	pos++;
+      if (pos + 4 > len || data[pos] != 0xFF)
+	return 0;
+      marker = data[pos + 1];
+      seglen = (data[pos + 2] << 8) | data[pos + 3];
+      if (seglen < 2 || pos + 2 + seglen > len)
+	return 0;
+
+      /* baseline and extended sequential huffman SOF */
+      if (marker == 0xC0 || marker == 0xC1)
+	{
+	  if (seglen < 8)
+	    return 0;
+	  l->sof = pos + 5;
+	  l->height = (data[pos + 5] << 8) | data[pos + 6];
+	  width = (data[pos + 7] << 8) | data[pos + 8];
+	  comps = data[pos + 9];
+	  if (!comps || seglen < 8 + 3 * comps)
+	    return 0;
+	  for (i = 0; i < comps; i++)
+	    {
+	      h = data[pos + 11 + 3 * i] >> 4;
+	      v = data[pos + 11 + 3 * i] & 15;
+	      if (h > max_h)
+		max_h = h;
+	      if (v > max_v)
+		max_v = v;
+	      if (v < min_v)
+		min_v = v;
+	    }
+	}
+      /* any other SOF: progressive, lossless, arithmetic */
+      else if (marker >= 0xC2 && marker <= 0xCF
+	       && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+	return 0;
+      /* DRI */
+      else if (marker == 0xDD)
+	{
+	  if (seglen < 4)
+	    return 0;
+	  l->restart = (data[pos + 4] << 8) | data[pos + 5];
+	}
+      /* SOS, all components in one scan */
+      else if (marker == 0xDA)
+	{
+	  if (!l->sof || data[pos + 4] != comps)
+	    return 0;
+	  l->scan = pos + 2 + seglen;
+	  break;
+	}
+      pos += 2 + seglen;
+    }
+
+  if (!l->restart || !l->height || !width)
+    return 0;
+
+  if (comps == 1)
+    max_h = max_v = 1;
+  l->mcu_h = DCTSIZE * max_v;
+  l->mcus_per_row = (width + DCTSIZE * max_h - 1) / (DCTSIZE * max_h);
+  l->mcu_rows = (l->height + l->mcu_h - 1) / l->mcu_h;
+  l->upsample_v = comps > 1 && min_v < max_v;
+
+  expected = (l->mcus_per_row * l->mcu_rows + l->restart - 1)
+    / l->restart - 1;
+  if (!expected)
+    return 0;
+  l->rst = malloc (expected * sizeof (size_t));
+  if (!l->rst)
+    return 0;
+
+  /* the restart markers, up to EOI */
+  for (pos = l->scan; pos + 1 < len; pos++)
+    {
+      if (data[pos] != 0xFF)
+	continue;
+      marker = data[pos + 1];
+      if (marker == 0 || marker == 0xFF)
+	continue;
+      if (marker < JPEG_RST0 || marker > JPEG_RST0 + 7
+	  || l->nrst == expected)
+	break;
+      l->rst[l->nrst++] = pos++;
+    }
+
+  if (pos + 1 >= len || data[pos + 1] != JPEG_EOI || l->nrst != expected)
+    {
+      free (l->rst);
+      l->rst = NULL;
+      return 0;
+    }
+  l->end = pos;
+  return 1;
+}
+
+/* Makes a small image of the MCU rows first to last - 1, first must be
+ * the start of a restart interval. */
+LOCAL (JOCTET *)
+make_band (const JOCTET * data, const struct layout *l, unsigned int first,
+	   unsigned int last, size_t * len)
+{
+  unsigned int s0 = first * l->mcus_per_row / l->restart;
+  unsigned int s1 = l->nrst + 1;
+  unsigned int height = last * l->mcu_h, i;
+  size_t from, to;
+  JOCTET *band;
+
+  if (last < l->mcu_rows)
+    s1 = last * l->mcus_per_row / l->restart;
+  if (height > l->height)
+    height = l->height;
+  height -= first * l->mcu_h;
+
+  from = s0 ? l->rst[s0 - 1] + 2 : l->scan;
+  to = s1 <= l->nrst ? l->rst[s1 - 1] : l->end;
+
+  *len = l->scan + (to - from) + 2;
+  band = malloc (*len);
+  if (!band)
+    return NULL;
+
+  memcpy (band, data, l->scan);
+  band[l->sof] = (JOCTET) (height >> 8);
+  band[l->sof + 1] = (JOCTET) (height & 0xFF);
+  memcpy (band + l->scan, data + from, to - from);
+
+  /* the restart markers count from 0 again */
+  for (i = s0; i + 1 < s1; i++)
+    band[l->scan + l->rst[i] - from + 1] = JPEG_RST0 + (i - s0) % 8;
+
+  band[*len - 2] = 0xFF;
+  band[*len - 1] = JPEG_EOI;
+  return band;
+}
+
+#ifdef USE_PTHREAD
+static void *
+band_thread (void *arg)
+{
+  struct band *b = arg;
+
+  b->status = decode_lines (b->data, b->len, b->skip, b->lines, b->out,
+			    b->bytes_per_line);
+  return NULL;
+}
+#endif
+
+/* Tells the size and format of an image held in memory. Only 8 bit gray
+ * and RGB output is supported. */
+GLOBAL (SANE_Status)
+sanei_jpeg_get_params (const JOCTET * data, size_t len,
+		       SANE_Parameters * params)
+{
+  struct mem_decoder d;
+  volatile SANE_Status status = SANE_STATUS_GOOD;
+
+  memset (&d, 0, sizeof (d));
+  if (setjmp (d.err.jmp))
+    {
+      status = SANE_STATUS_IO_ERROR;
+      goto cleanup;
+    }
+  mem_decoder_init (&d, data, len);
+
+  jpeg_read_header (&d.cinfo, TRUE);
+  jpeg_calc_output_dimensions (&d.cinfo);
+
+  if (d.cinfo.output_components == 3)
+    params->format = SANE_FRAME_RGB;
+  else if (d.cinfo.output_components == 1)
+    params->format = SANE_FRAME_GRAY;
+  else
+    {
+      status = SANE_STATUS_UNSUPPORTED;
+      goto cleanup;
+    }
+  params->last_frame = SANE_TRUE;
+  params->depth = 8;
+  params->pixels_per_line = d.cinfo.output_width;
+  params->lines = d.cinfo.output_height;
+  params->bytes_per_line = d.cinfo.output_width
+    * d.cinfo.output_components;
+
+cleanup:
+  jpeg_destroy_decompress (&d.cinfo);
+  return status;
+}
+
+/* Decodes an image held in memory into out, with rows bytes_per_line
+ * apart. Up to threads bands are decoded at once, 0 means one per
+ * processor. */
+GLOBAL (SANE_Status)
+sanei_jpeg_decode (const JOCTET * data, size_t len, SANE_Byte * out,
+		   SANE_Int bytes_per_line, int threads)
+{
+  SANE_Status status = SANE_STATUS_GOOD;
+  struct band bands[MAX_THREADS];
+  struct layout l;
+  unsigned int step, cuts, first, last, from, to, n, i, a, b;
+
+#ifdef USE_PTHREAD
+  if (threads <= 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    }
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+#else
+  threads = 1;
+#endif
+
+  if (threads < 2 || !find_layout (data, len, &l))
+    return decode_lines (data, len, 0, 0, out, bytes_per_line);
+
+  /* MCU rows at the start of a restart interval are step apart */
+  a = l.restart;
+  b = l.mcus_per_row;
+  while (b)
+    {
+      i = a % b;
+      a = b;
+      b = i;
+    }
+  step = l.restart / a;
+  cuts = (l.mcu_rows + step - 1) / step;
+
+  n = (unsigned int) threads;
+  if (n > cuts)
+    n = cuts;
+  if (n > l.height / MIN_BAND_LINES)
+    n = l.height / MIN_BAND_LINES;
+  if (n < 2)
+    {
+      free (l.rst);
+      return decode_lines (data, len, 0, 0, out, bytes_per_line);
+    }
+
+  memset (bands, 0, sizeof (bands));
+  for (i = 0; i < n; i++)
+    {
+      struct band *bd = bands + i;
+
+      first = i * cuts / n * step;
+      last = (i + 1) * cuts / n * step;
+      if (last > l.mcu_rows)
+	last = l.mcu_rows;
+
+      /* decode a restart interval more on each side, for upsampling */
+      from = first;
+      to = last;
+      if (l.upsample_v && from)
+	from -= step;
+      if (l.upsample_v && to < l.mcu_rows)
+	to = to + step < l.mcu_rows ? to + step : l.mcu_rows;
+
+      bd->data = make_band (data, &l, from, to, &bd->len);
+      if (!bd->data)
+	{
+	  status = SANE_STATUS_NO_MEM;
+	  goto cleanup;
+	}
+      bd->skip = (first - from) * l.mcu_h;
+      bd->lines = (last < l.mcu_rows ? last * l.mcu_h : l.height)
+	- first * l.mcu_h;
+      bd->out = out + (size_t) first * l.mcu_h * bytes_per_line;
+      bd->bytes_per_line = bytes_per_line;
+    }
+
+  /* this thread decodes the first band */
+#ifdef USE_PTHREAD
+  for (i = 1; i < n; i++)
+    bands[i].started = !pthread_create (&bands[i].thread, NULL,
+					band_thread, bands + i);
+#endif
+  for (i = 0; i < n; i++)
+    {
+#ifdef USE_PTHREAD
+      if (bands[i].started)
+	continue;
+#endif
+      bands[i].status = decode_lines (bands[i].data, bands[i].len,
+				      bands[i].skip, bands[i].lines,
+				      bands[i].out, bytes_per_line);
+    }
+#ifdef USE_PTHREAD
+  for (i = 1; i < n; i++)
+    if (bands[i].started)
+      pthread_join (bands[i].thread, NULL);
+#endif
+
+  for (i = 0; i < n && !status; i++)
+    status = bands[i].status;
+
+cleanup:
+  for (i = 0; i < n; i++)
+    free (bands[i].data);
+  free (l.rst);
+  return status;
+}
+
 #endif
@@ -50,11 +50,18 @@
 #include <errno.h>
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #define BACKEND_NAME sanei_magic      /* name of this module for debugging */
 
 #include "../include/sane/sane.h"
 #include "../include/sane/sanei_debug.h"
 #include "../include/sane/sanei_magic.h"
+#include "../include/sane/sanei_perf.h"
 
 /* prototypes for utility functions defined at bottom of file */
 int * sanei_magic_getTransY (
@@ -66,6 +73,10 @@ int * sanei_magic_getTransX (
 static SANE_Status getTopEdge (int width, int height, int resolution,
   int * buff, double * finSlope, int * finXInter, int * finYInter);
 
+static SANE_Status findSkew(SANE_Parameters * params, SANE_Byte * buffer,
+  int dpiX, int dpiY, int * centerX, int * centerY, double * finSlope,
+  SANE_Bool useBottom);
+
 static SANE_Status getLeftEdge (int width, int height, int * top, int * bot,
  double slope, int * finXInter, int * finYInter);
 
@@ -74,10 +85,17 @@ static SANE_Status getLine (int height, int width, int * buff,
   int offsets, int minOffset, int maxOffset,
   double * finSlope, int * finOffset, int * finDensity);
 
+static int getBits (SANE_Byte * row, int x, int n);
+
+static int sumBytes (SANE_Byte * ptr, int n);
+
+static int countBits (SANE_Byte * ptr, int n);
+
 void
 sanei_magic_init( void )
 {
   DBG_INIT();
+  sanei_perf_init();
 }
 
 /* find small spots and replace them with image background color */
@@ -87,6 +105,7 @@ sanei_magic_despeck (SANE_Parameters * params, SANE_Byte * buffer,
 {
 
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Perf_Time perf_start;
 
   int pw = params->pixels_per_line;
   int bw = params->bytes_per_line;
@@ -95,53 +114,81 @@ sanei_magic_despeck (SANE_Parameters * params, SANE_Byte * buffer,
 
   int i,j,k,l,n;
 
+  /* darkest pixel in each column of the current window row, kept up to
+   * date as the window moves right, instead of rescanning diam*diam */
+  int * colmin = NULL;
+
   DBG (10, "sanei_magic_despeck: start\n");
+  SANEI_PERF_START (perf_start);
 
   if(params->format == SANE_FRAME_RGB){
 
+    colmin = calloc(pw+diam, sizeof(int));
+    if(!colmin){
+      DBG (5, "sanei_magic_despeck: no colmin\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+
     for(i=bw; i<bt-bw-(bw*diam); i+=bw){
+
+      /* preload all but the last column of the first window */
+      for(l=1; l<diam && 1<pw-1-diam; l++){
+        colmin[l] = 255*3;
+        for(k=0; k<diam; k++){
+          SANE_Byte * p = buffer + i + k*bw + l*3;
+          if(p[0]+p[1]+p[2] < colmin[l])
+            colmin[l] = p[0]+p[1]+p[2];
+        }
+      }
+
       for(j=1; j<pw-1-diam; j++){
 
         int thresh = 255*3;
         int outer[] = {0,0,0};
         int hits = 0;
+        int c = j+diam-1;
 
-        /* loop over rows and columns in window */
-        /* find darkest pixel */
+        /* load the column entering the window */
+        colmin[c] = 255*3;
         for(k=0; k<diam; k++){
-          for(l=0; l<diam; l++){
-            int tmp = 0;
-
-            for(n=0; n<3; n++){
-              tmp += buffer[i + j*3 + k*bw + l*3 + n];
-            }
+          SANE_Byte * p = buffer + i + k*bw + c*3;
+          if(p[0]+p[1]+p[2] < colmin[c])
+            colmin[c] = p[0]+p[1]+p[2];
+        }
 
-            if(tmp < thresh)
-              thresh = tmp;
-          }
+        /* find darkest pixel in window */
+        for(l=0; l<diam; l++){
+          if(colmin[j+l] < thresh)
+            thresh = colmin[j+l];
         }
 
         /* convert darkest pixel into a brighter threshold */
         thresh = (thresh + 255*3 + 255*3)/3;
 
-        /*loop over rows and columns around window */
-        for(k=-1; k<diam+1; k++){
-          for(l=-1; l<diam+1; l++){
+        /* rows above and below window */
+        for(l=-1; l<diam+1 && !hits; l++){
+          SANE_Byte * a = buffer + i + j*3 - bw + l*3;
+          SANE_Byte * b = buffer + i + j*3 + diam*bw + l*3;
 
-            int tmp[3];
+          if(a[0]+a[1]+a[2] < thresh || b[0]+b[1]+b[2] < thresh)
+            hits++;
 
-            /* dont count pixels in the window */
-            if(k != -1 && k != diam && l != -1 && l != diam)
-              continue;
+          for(n=0; n<3; n++){
+            outer[n] += a[n] + b[n];
+          }
+        }
 
-            for(n=0; n<3; n++){
-              tmp[n] = buffer[i + j*3 + k*bw + l*3 + n];
-              outer[n] += tmp[n];
-            }
-            if(tmp[0]+tmp[1]+tmp[2] < thresh){
-              hits++;
-              break;
-            }
+        /* columns left and right of window */
+        for(k=0; k<diam && !hits; k++){
+          SANE_Byte * a = buffer + i + j*3 + k*bw - 3;
+          SANE_Byte * b = buffer + i + j*3 + k*bw + diam*3;
+
+          if(a[0]+a[1]+a[2] < thresh || b[0]+b[1]+b[2] < thresh)
+            hits++;
+
+          for(n=0; n<3; n++){
+            outer[n] += a[n] + b[n];
           }
         }
 
@@ -160,48 +207,78 @@ sanei_magic_despeck (SANE_Parameters * params, SANE_Byte * buffer,
               }
             }
           }
+
+          for(l=0; l<diam; l++){
+            colmin[j+l] = outer[0] + outer[1] + outer[2];
+          }
         }
       }
     }
   }
 
   else if(params->format == SANE_FRAME_GRAY && params->depth == 8){
+
+    colmin = calloc(pw+diam, sizeof(int));
+    if(!colmin){
+      DBG (5, "sanei_magic_despeck: no colmin\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+
     for(i=bw; i<bt-bw-(bw*diam); i+=bw){
+
+      /* preload all but the last column of the first window */
+      for(l=1; l<diam && 1<pw-1-diam; l++){
+        colmin[l] = 255;
+        for(k=0; k<diam; k++){
+          if(buffer[i + k*bw + l] < colmin[l])
+            colmin[l] = buffer[i + k*bw + l];
+        }
+      }
+
       for(j=1; j<pw-1-diam; j++){
 
         int thresh = 255;
         int outer = 0;
         int hits = 0;
+        int c = j+diam-1;
 
+        /* load the column entering the window */
+        colmin[c] = 255;
         for(k=0; k<diam; k++){
-          for(l=0; l<diam; l++){
-            if(buffer[i + j + k*bw + l] < thresh)
-              thresh = buffer[i + j + k*bw + l];
-          }
+          if(buffer[i + k*bw + c] < colmin[c])
+            colmin[c] = buffer[i + k*bw + c];
+        }
+
+        /* find darkest pixel in window */
+        for(l=0; l<diam; l++){
+          if(colmin[j+l] < thresh)
+            thresh = colmin[j+l];
         }
 
         /* convert darkest pixel into a brighter threshold */
         thresh = (thresh + 255 + 255)/3;
 
-        /*loop over rows and columns around window */
-        for(k=-1; k<diam+1; k++){
-          for(l=-1; l<diam+1; l++){
+        /* rows above and below window */
+        for(l=-1; l<diam+1 && !hits; l++){
+          int a = buffer[i + j - bw + l];
+          int b = buffer[i + j + diam*bw + l];
 
-            int tmp = 0;
+          if(a < thresh || b < thresh)
+            hits++;
 
-            /* dont count pixels in the window */
-            if(k != -1 && k != diam && l != -1 && l != diam)
-              continue;
+          outer += a + b;
+        }
 
-            tmp = buffer[i + j + k*bw + l];
+        /* columns left and right of window */
+        for(k=0; k<diam && !hits; k++){
+          int a = buffer[i + j + k*bw - 1];
+          int b = buffer[i + j + k*bw + diam];
 
-            if(tmp < thresh){
-              hits++;
-              break;
-            }
+          if(a < thresh || b < thresh)
+            hits++;
 
-            outer += tmp;
-          }
+          outer += a + b;
         }
 
         /*no hits, overwrite with avg surrounding color*/
@@ -209,14 +286,84 @@ sanei_magic_despeck (SANE_Parameters * params, SANE_Byte * buffer,
           /* replacement color */
           outer /= (4*diam + 4);
 
+          for(k=0; k<diam; k++){
+            memset(buffer + i + j + k*bw, outer, diam);
+          }
+
+          for(l=0; l<diam; l++){
+            colmin[j+l] = outer;
+          }
+        }
+      }
+    }
+  }
+
+  /* window and border are read as bit fields, and runs of white
+   * background are skipped using the OR of the rows in the window */
+  else if(params->format == SANE_FRAME_GRAY && params->depth == 1
+    && diam <= 24){
+
+    /* may go stale as specks are removed, so only used to skip */
+    SANE_Byte * orrow = malloc(bw);
+    if(!orrow){
+      DBG (5, "sanei_magic_despeck: no orrow\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
+
+    for(i=bw; i<bt-bw-(bw*diam); i+=bw){
+
+      memcpy(orrow, buffer + i, bw);
+      for(k=1; k<diam; k++){
+        for(l=0; l<bw; l++){
+          orrow[l] |= buffer[i + k*bw + l];
+        }
+      }
+
+      for(j=1; j<pw-1-diam; j++){
+
+        int curr = 0;
+        int hits = 0;
+
+        /* nothing set in window, jump to the next set bit */
+        if(!getBits(orrow, j, diam)){
+          int p = j+diam;
+          while(p < pw && !(orrow[p/8] >> (7-p%8) & 1)){
+            p += (p%8 || orrow[p/8]) ? 1 : 8;
+          }
+          /* next window that contains bit p starts at p-diam+1 */
+          j = p-diam;
+          continue;
+        }
+
+        for(k=0; k<diam && !curr; k++){
+          curr = getBits(buffer + i + k*bw, j, diam);
+        }
+
+        if(!curr)
+          continue;
+
+        /* rows above and below window, columns left and right */
+        hits = getBits(buffer + i - bw, j-1, diam+2)
+          || getBits(buffer + i + diam*bw, j-1, diam+2);
+
+        for(k=0; k<diam && !hits; k++){
+          hits = getBits(buffer + i + k*bw, j-1, 1)
+            || getBits(buffer + i + k*bw, j+diam, 1);
+        }
+
+        /*no hits, overwrite with white*/
+        if(!hits){
           for(k=0; k<diam; k++){
             for(l=0; l<diam; l++){
-              buffer[i + j + k*bw + l] = outer;
+              buffer[i + k*bw + (j+l)/8] &= ~(1 << (7-(j+l)%8));
             }
           }
         }
       }
     }
+
+    free(orrow);
   }
 
   else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
@@ -267,6 +414,13 @@ sanei_magic_despeck (SANE_Parameters * params, SANE_Byte * buffer,
     ret = SANE_STATUS_INVAL;
   }
 
+  cleanup:
+
+  if(colmin)
+    free(colmin);
+
+  SANEI_PERF_TIME ("magic_despeck", 0, perf_start);
+
   DBG (10, "sanei_magic_despeck: finish\n");
   return ret;
 }
@@ -278,6 +432,7 @@ sanei_magic_findEdges(SANE_Parameters * params, SANE_Byte * buffer,
 {
 
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Perf_Time perf_start;
 
   int width = params->pixels_per_line;
   int height = params->lines;
@@ -291,6 +446,7 @@ sanei_magic_findEdges(SANE_Parameters * params, SANE_Byte * buffer,
   int i;
 
   DBG (10, "sanei_magic_findEdges: start\n");
+  SANEI_PERF_START (perf_start);
 
   /* get buffers to find sides and bottom */
   topBuf = sanei_magic_getTransY(params,dpiY,buffer,1);
@@ -428,6 +584,8 @@ sanei_magic_findEdges(SANE_Parameters * params, SANE_Byte * buffer,
   if(rightBuf)
     free(rightBuf);
 
+  SANEI_PERF_TIME ("magic_findEdges", 0, perf_start);
+
   DBG (10, "sanei_magic_findEdges: finish\n");
   return ret;
 }
@@ -439,6 +597,7 @@ sanei_magic_crop(SANE_Parameters * params, SANE_Byte * buffer,
 {
 
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Perf_Time perf_start;
 
   int bwidth = params->bytes_per_line;
 
@@ -448,6 +607,7 @@ sanei_magic_crop(SANE_Parameters * params, SANE_Byte * buffer,
   int pos = 0, i;
 
   DBG (10, "sanei_magic_crop: start\n");
+  SANEI_PERF_START (perf_start);
 
   /*convert left and right to bytes, figure new byte and pixel width */
   if(params->format == SANE_FRAME_RGB){
@@ -496,6 +656,8 @@ sanei_magic_crop(SANE_Parameters * params, SANE_Byte * buffer,
   if(line)
     free(line);
 
+  SANEI_PERF_TIME ("magic_crop", 0, perf_start);
+
   DBG (10, "sanei_magic_crop: finish\n");
   return ret;
 }
@@ -504,8 +666,28 @@ sanei_magic_crop(SANE_Parameters * params, SANE_Byte * buffer,
 SANE_Status
 sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
   int dpiX, int dpiY, int * centerX, int * centerY, double * finSlope)
+{
+  return findSkew(params, buffer, dpiX, dpiY, centerX, centerY, finSlope,
+    SANE_TRUE);
+}
+
+/* same, for the start of an image. the last line of the buffer is where
+ * reading stopped, not the bottom of the media, so the left edge is only
+ * searched from the top */
+SANE_Status
+sanei_magic_findSkewTop(SANE_Parameters * params, SANE_Byte * buffer,
+  int dpiX, int dpiY, int * centerX, int * centerY, double * finSlope)
+{
+  return findSkew(params, buffer, dpiX, dpiY, centerX, centerY, finSlope,
+    SANE_FALSE);
+}
+
+static SANE_Status
+findSkew(SANE_Parameters * params, SANE_Byte * buffer, int dpiX, int dpiY,
+  int * centerX, int * centerY, double * finSlope, SANE_Bool useBottom)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Perf_Time perf_start;
 
   int pwidth = params->pixels_per_line;
   int height = params->lines;
@@ -528,6 +710,7 @@ sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
   int * topBuf = NULL, * botBuf = NULL;
 
   DBG (10, "sanei_magic_findSkew: start\n");
+  SANEI_PERF_START (perf_start);
 
   dpiX=dpiX;
 
@@ -539,11 +722,13 @@ sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
     goto cleanup;
   }
 
-  botBuf = sanei_magic_getTransY(params,dpiY,buffer,0);
-  if(!botBuf){
-    DBG (5, "sanei_magic_findSkew: cant gTY\n");
-    ret = SANE_STATUS_NO_MEM;
-    goto cleanup;
+  if(useBottom){
+    botBuf = sanei_magic_getTransY(params,dpiY,buffer,0);
+    if(!botBuf){
+      DBG (5, "sanei_magic_findSkew: cant gTY\n");
+      ret = SANE_STATUS_NO_MEM;
+      goto cleanup;
+    }
   }
 
   /* find best top line */
@@ -595,6 +780,8 @@ sanei_magic_findSkew(SANE_Parameters * params, SANE_Byte * buffer,
   if(botBuf)
     free(botBuf);
 
+  SANEI_PERF_TIME ("magic_findSkew", 0, perf_start);
+
   DBG (10, "sanei_magic_findSkew: finish\n");
   return ret;
 }
@@ -607,110 +794,390 @@ SANE_Status
 sanei_magic_rotate (SANE_Parameters * params, SANE_Byte * buffer,
   int centerX, int centerY, double slope, int bg_color)
 {
+  return sanei_magic_rotate2(params, buffer, centerX, centerY, slope,
+    bg_color, SANE_FALSE);
+}
+
+/* Rotation maps each output pixel back to the source, like the plain
+ * per pixel version did, but steps the source coordinates along the
+ * row in 32.32 fixed point instead of two double multiplies per pixel.
+ *
+ * The image is rotated in place, in bands of output rows. An output
+ * row only reads source rows within 'reach' of itself, so the original
+ * content of the rows already overwritten is kept in a ring of scratch
+ * rows, instead of a copy of the whole page. Each band is processed in
+ * tiles of ROTATE_TILE bytes per row, which keeps both the output and
+ * the source rows it reads in cache. */
+#define ROTATE_FIX 32
+#define ROTATE_BAND 32
+#define ROTATE_TILE 4096
+
+/* fixed point to int, rounding toward zero like a cast of a double */
+#define ROTATE_TRUNC(v) ((v) >= 0 ? (int)((v) >> ROTATE_FIX) \
+  : -(int)((-(v)) >> ROTATE_FIX))
+
+static long long
+toFixed (double val)
+{
+  return (long long)floor(val * 4294967296.0 + 0.5);
+}
+
+/* state of a rotation, kept between calls to sanei_magic_rotateLines */
+struct sanei_magic_rotator
+{
+  SANE_Parameters params;
+  SANE_Byte * buffer;
+  int centerX;
+  int centerY;
+  double slopeSin;
+  double slopeCos;
+  long long stepSin;
+  long long stepCos;
+  int bg_color;
+  SANE_Bool smooth;
+  int depth;
+  int tile;
+
+  /* scratch rows, and the current location of each source row */
+  SANE_Byte * ring;
+  SANE_Byte ** rows;
+  int reach;
+  int ringRows;
+
+  /* output lines finished */
+  int done;
+};
+
+SANE_Status
+sanei_magic_rotate2 (SANE_Parameters * params, SANE_Byte * buffer,
+  int centerX, int centerY, double slope, int bg_color, SANE_Bool smooth)
+{
+  SANE_Status ret;
+  SANEI_Magic_Rotator * rot = NULL;
+
+  ret = sanei_magic_rotateStart(params, buffer, centerX, centerY, slope,
+    bg_color, smooth, &rot);
 
+  if(ret == SANE_STATUS_GOOD){
+    sanei_magic_rotateLines(rot, params->lines);
+    sanei_magic_rotateFinish(rot);
+  }
+
+  return ret;
+}
+
+SANE_Status
+sanei_magic_rotateStart (SANE_Parameters * params, SANE_Byte * buffer,
+  int centerX, int centerY, double slope, int bg_color, SANE_Bool smooth,
+  SANEI_Magic_Rotator ** rotator)
+{
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Magic_Rotator * rot = NULL;
 
   double slopeRad = -atan(slope);
-  double slopeSin = sin(slopeRad);
-  double slopeCos = cos(slopeRad);
 
   int pwidth = params->pixels_per_line;
-  int bwidth = params->bytes_per_line;
   int height = params->lines;
-  int depth = 1;
+  int i;
 
-  unsigned char * outbuf;
-  int i, j, k;
+  DBG(10,"sanei_magic_rotateStart: start: %d %d %d\n",centerX,centerY,smooth);
 
-  DBG(10,"sanei_magic_rotate: start: %d %d\n",centerX,centerY);
+  *rotator = NULL;
 
-  outbuf = malloc(bwidth*height);
-  if(!outbuf){
-    DBG(15,"sanei_magic_rotate: no outbuf\n");
-    ret = SANE_STATUS_NO_MEM;
-    goto cleanup;
+  rot = calloc(1, sizeof(SANEI_Magic_Rotator));
+  if(!rot){
+    DBG(15,"sanei_magic_rotateStart: no rot\n");
+    return SANE_STATUS_NO_MEM;
   }
 
+  rot->params = *params;
+  rot->buffer = buffer;
+  rot->centerX = centerX;
+  rot->centerY = centerY;
+  rot->slopeSin = sin(slopeRad);
+  rot->slopeCos = cos(slopeRad);
+  rot->stepSin = toFixed(rot->slopeSin);
+  rot->stepCos = toFixed(rot->slopeCos);
+  rot->bg_color = bg_color;
+  rot->smooth = smooth;
+  rot->depth = 1;
+
   if(params->format == SANE_FRAME_RGB ||
     (params->format == SANE_FRAME_GRAY && params->depth == 8)
   ){
-
     if(params->format == SANE_FRAME_RGB)
-      depth = 3;
+      rot->depth = 3;
+    rot->tile = ROTATE_TILE/rot->depth;
+  }
+  else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
+    if(bg_color)
+      rot->bg_color = 0xff;
+    rot->tile = ROTATE_TILE*8;
+  }
+  else{
+    DBG (5, "sanei_magic_rotateStart: unsupported format/depth\n");
+    ret = SANE_STATUS_INVAL;
+    goto cleanup;
+  }
 
-    memset(outbuf,bg_color,bwidth*height);
+  /* furthest any output row reads from its own row, plus
+   * room for rounding and the second row of bilinear sampling */
+  {
+    double dy = abs(centerY) > abs(height-centerY)
+      ? abs(centerY) : abs(height-centerY);
+    double dx = abs(centerX) > abs(pwidth-centerX)
+      ? abs(centerX) : abs(pwidth-centerX);
+    double far = dy*(1-rot->slopeCos) + dx*fabs(rot->slopeSin) + 3;
 
-    for (i=0; i<height; i++) {
-      int shiftY = centerY - i;
+    rot->reach = far < height ? (int)ceil(far) : height;
+  }
 
-      for (j=0; j<pwidth; j++) {
-        int shiftX = centerX - j;
-        int sourceX, sourceY;
+  rot->ringRows = rot->reach + ROTATE_BAND;
+  if(rot->ringRows > height)
+    rot->ringRows = height;
 
-        sourceX = centerX - (int)(shiftX * slopeCos + shiftY * slopeSin);
-        if (sourceX < 0 || sourceX >= pwidth)
-          continue;
+  rot->ring = malloc((size_t)rot->ringRows*params->bytes_per_line);
+  rot->rows = malloc(height*sizeof(SANE_Byte *));
+  if(!rot->ring || !rot->rows){
+    DBG(15,"sanei_magic_rotateStart: no ring\n");
+    ret = SANE_STATUS_NO_MEM;
+    goto cleanup;
+  }
 
-        sourceY = centerY + (int)(-shiftY * slopeCos + shiftX * slopeSin);
-        if (sourceY < 0 || sourceY >= height)
-          continue;
+  for(i=0; i<height; i++){
+    rot->rows[i] = buffer + (size_t)i*params->bytes_per_line;
+  }
 
-        for (k=0; k<depth; k++) {
-          outbuf[i*bwidth+j*depth+k]
-            = buffer[sourceY*bwidth+sourceX*depth+k];
+  DBG(15,"sanei_magic_rotateStart: reach %d, ring %d rows\n",
+    rot->reach,rot->ringRows);
+
+  *rotator = rot;
+  rot = NULL;
+
+  cleanup:
+
+  if(rot)
+    sanei_magic_rotateFinish(rot);
+
+  DBG(10,"sanei_magic_rotateStart: finish\n");
+
+  return ret;
+}
+
+/* rotate one row of a tile of output pixels */
+static void
+rotateRow (SANEI_Magic_Rotator * rot, int i, int t, int tEnd)
+{
+  int pwidth = rot->params.pixels_per_line;
+  int height = rot->params.lines;
+  int centerX = rot->centerX;
+  int centerY = rot->centerY;
+  int depth = rot->depth;
+  int bg_color = rot->bg_color;
+  long long stepSin = rot->stepSin;
+  long long stepCos = rot->stepCos;
+  SANE_Byte ** rows = rot->rows;
+
+  SANE_Byte * out = rot->buffer + (size_t)i*rot->params.bytes_per_line;
+
+  /* source coordinates of the first pixel of this tile row,
+   * relative to the center, stepped by -cos and -sin per pixel */
+  long long u = toFixed((centerX-t)*rot->slopeCos
+    + (centerY-i)*rot->slopeSin);
+  long long w = toFixed(-(centerY-i)*rot->slopeCos
+    + (centerX-t)*rot->slopeSin);
+
+  int j, k;
+
+  if(rot->params.depth == 1){
+
+    for(j=t; j<tEnd; j+=8){
+
+      int byte = 0;
+      int sx = centerX - ROTATE_TRUNC(u);
+      int sy = centerY + ROTATE_TRUNC(w);
+      long long u7 = u - 7*stepCos;
+      long long w7 = w - 7*stepSin;
+
+      /* all 8 pixels come from 8 adjacent source pixels */
+      if(j+8 <= pwidth
+        && sy == centerY + ROTATE_TRUNC(w7)
+        && sx + 7 == centerX - ROTATE_TRUNC(u7)
+        && sx >= 0 && sx + 7 < pwidth
+        && sy >= 0 && sy < height
+      ){
+        out[j/8] = getBits(rows[sy], sx, 8);
+        u = u7 - stepCos;
+        w = w7 - stepSin;
+        continue;
+      }
+
+      for(k=0; k<8; k++, u-=stepCos, w-=stepSin){
+
+        int bit = bg_color & 1;
+
+        sx = centerX - ROTATE_TRUNC(u);
+        sy = centerY + ROTATE_TRUNC(w);
+
+        if(j+k < pwidth && sx >= 0 && sx < pwidth
+          && sy >= 0 && sy < height){
+          bit = rows[sy][sx/8] >> (7-(sx%8)) & 1;
         }
+
+        byte |= bit << (7-k);
       }
+
+      out[j/8] = byte;
     }
   }
 
-  else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
+  else if(!rot->smooth){
 
-    if(bg_color)
-      bg_color = 0xff;
+    out += t*depth;
 
-    memset(outbuf,bg_color,bwidth*height);
+    for(j=t; j<tEnd; j++, u-=stepCos, w-=stepSin, out+=depth){
 
-    for (i=0; i<height; i++) {
-      int shiftY = centerY - i;
+      int sx = centerX - ROTATE_TRUNC(u);
+      int sy = centerY + ROTATE_TRUNC(w);
+      SANE_Byte * src;
 
-      for (j=0; j<pwidth; j++) {
-        int shiftX = centerX - j;
-        int sourceX, sourceY;
+      /* next 8 pixels come from 8 adjacent source pixels */
+      if(j+8 <= tEnd && sx >= 0 && sx + 7 < pwidth
+        && sy >= 0 && sy < height
+        && sy == centerY + ROTATE_TRUNC(w - 7*stepSin)
+        && sx + 7 == centerX - ROTATE_TRUNC(u - 7*stepCos)
+      ){
+        memcpy(out, rows[sy] + sx*depth, 8*depth);
+        j += 7;
+        u -= 7*stepCos;
+        w -= 7*stepSin;
+        out += 7*depth;
+        continue;
+      }
 
-        sourceX = centerX - (int)(shiftX * slopeCos + shiftY * slopeSin);
-        if (sourceX < 0 || sourceX >= pwidth)
-          continue;
+      if(sx < 0 || sx >= pwidth || sy < 0 || sy >= height){
+        for(k=0; k<depth; k++){
+          out[k] = bg_color;
+        }
+        continue;
+      }
 
-        sourceY = centerY + (int)(-shiftY * slopeCos + shiftX * slopeSin);
-        if (sourceY < 0 || sourceY >= height)
-          continue;
+      src = rows[sy] + sx*depth;
+      for(k=0; k<depth; k++){
+        out[k] = src[k];
+      }
+    }
+  }
+
+  /* bilinear, with 8 bit weights */
+  else{
+
+    long long x = ((long long)centerX << ROTATE_FIX) - u;
+    long long y = ((long long)centerY << ROTATE_FIX) + w;
+
+    out += t*depth;
+
+    for(j=t; j<tEnd; j++, x+=stepCos, y-=stepSin, out+=depth){
 
-        /* wipe out old bit */
-        outbuf[i*bwidth + j/8] &= ~(1 << (7-(j%8)));
+      int sx, sy, fx, fy, dx, dy;
+      SANE_Byte * src0, * src1;
 
-        /* fill in new bit */
-        outbuf[i*bwidth + j/8] |=
-          ((buffer[sourceY*bwidth + sourceX/8]
-          >> (7-(sourceX%8))) & 1) << (7-(j%8));
+      if(x < 0 || y < 0){
+        for(k=0; k<depth; k++){
+          out[k] = bg_color;
+        }
+        continue;
+      }
+
+      sx = (int)(x >> ROTATE_FIX);
+      sy = (int)(y >> ROTATE_FIX);
+
+      if(sx >= pwidth || sy >= height){
+        for(k=0; k<depth; k++){
+          out[k] = bg_color;
+        }
+        continue;
+      }
+
+      fx = (int)(x >> (ROTATE_FIX-8)) & 0xff;
+      fy = (int)(y >> (ROTATE_FIX-8)) & 0xff;
+      dx = sx+1 < pwidth ? depth : 0;
+      dy = sy+1 < height ? 1 : 0;
+
+      src0 = rows[sy] + sx*depth;
+      src1 = rows[sy+dy] + sx*depth;
+
+      for(k=0; k<depth; k++){
+        int top = src0[k]*(256-fx) + src0[k+dx]*fx;
+        int bot = src1[k]*(256-fx) + src1[k+dx]*fx;
+        out[k] = (top*(256-fy) + bot*fy + 32768) >> 16;
       }
     }
   }
-  else{
-    DBG (5, "sanei_magic_rotate: unsupported format/depth\n");
-    ret = SANE_STATUS_INVAL;
-    goto cleanup;
+}
+
+int
+sanei_magic_rotateLines (SANEI_Magic_Rotator * rot, int lines)
+{
+  SANEI_Perf_Time perf_start;
+
+  int pwidth = rot->params.pixels_per_line;
+  int bwidth = rot->params.bytes_per_line;
+  int height = rot->params.lines;
+
+  int i, t;
+
+  DBG(10,"sanei_magic_rotateLines: start: %d %d\n",lines,rot->done);
+  SANEI_PERF_START (perf_start);
+
+  while(rot->done < height){
+
+    int band = rot->done;
+    int bandEnd = band+ROTATE_BAND < height ? band+ROTATE_BAND : height;
+
+    /* the last row of the band reads up to reach rows below itself */
+    if(lines < height && bandEnd-1 + rot->reach >= lines)
+      break;
+
+    /* save the rows of this band before they are overwritten. The
+     * slot reused held a row more than reach above this band */
+    for(i=band; i<bandEnd; i++){
+      SANE_Byte * slot = rot->ring + (size_t)(i % rot->ringRows)*bwidth;
+      memcpy(slot, rot->buffer + (size_t)i*bwidth, bwidth);
+      rot->rows[i] = slot;
+    }
+
+    for(t=0; t<pwidth; t+=rot->tile){
+
+      int tEnd = t+rot->tile < pwidth ? t+rot->tile : pwidth;
+
+      for(i=band; i<bandEnd; i++){
+        rotateRow(rot, i, t, tEnd);
+      }
+    }
+
+    rot->done = bandEnd;
   }
 
-  memcpy(buffer,outbuf,bwidth*height);
+  SANEI_PERF_TIME ("magic_rotate", 0, perf_start);
 
-  cleanup:
+  DBG(10,"sanei_magic_rotateLines: finish: %d\n",rot->done);
 
-  if(outbuf)
-    free(outbuf);
+  return rot->done;
+}
 
-  DBG(10,"sanei_magic_rotate: finish\n");
+void
+sanei_magic_rotateFinish (SANEI_Magic_Rotator * rot)
+{
+  if(!rot)
+    return;
 
-  return ret;
+  if(rot->ring)
+    free(rot->ring);
+  if(rot->rows)
+    free(rot->rows);
+
+  free(rot);
 }
 
 SANE_Status
@@ -718,10 +1185,12 @@ sanei_magic_isBlank (SANE_Parameters * params, SANE_Byte * buffer,
   double thresh)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Perf_Time perf_start;
   double imagesum = 0;
   int i, j;
 
   DBG(10,"sanei_magic_isBlank: start: %f\n",thresh);
+  SANEI_PERF_START (perf_start);
 
   /*convert thresh from percent (0-100) to 0-1 range*/
   thresh /= 100;
@@ -735,10 +1204,9 @@ sanei_magic_isBlank (SANE_Parameters * params, SANE_Byte * buffer,
       int rowsum = 0;
       SANE_Byte * ptr = buffer + params->bytes_per_line*i;
 
-      /* loop over all columns, sum the 'darkness' of the pixels */
-      for(j=0; j<params->bytes_per_line; j++){
-        rowsum += 255 - ptr[j];
-      }
+      /* sum the 'darkness' of the pixels */
+      rowsum = params->bytes_per_line * 255
+        - sumBytes(ptr, params->bytes_per_line);
 
       imagesum += (double)rowsum/params->bytes_per_line/255;
     }
@@ -751,8 +1219,9 @@ sanei_magic_isBlank (SANE_Parameters * params, SANE_Byte * buffer,
       int rowsum = 0;
       SANE_Byte * ptr = buffer + params->bytes_per_line*i;
 
-      /* loop over all columns, sum the pixels */
-      for(j=0; j<params->pixels_per_line; j++){
+      /* sum the pixels, whole bytes first */
+      rowsum = countBits(ptr, params->pixels_per_line/8);
+      for(j=params->pixels_per_line/8*8; j<params->pixels_per_line; j++){
         rowsum += ptr[j/8] >> (7-(j%8)) & 1;
       }
 
@@ -776,6 +1245,8 @@ sanei_magic_isBlank (SANE_Parameters * params, SANE_Byte * buffer,
 
   cleanup:
 
+  SANEI_PERF_TIME ("magic_isBlank", 0, perf_start);
+
   DBG(10,"sanei_magic_isBlank: finish\n");
 
   return ret;
@@ -789,7 +1260,8 @@ SANE_Status
 sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
   int dpiX, int dpiY, double thresh)
 {
-  int xb,yb,x,y;
+  SANEI_Perf_Time perf_start;
+  int xb,yb,y;
 
   /* .25 inch, rounded down to 8 pixel */
   int xquarter = dpiX/4/8*8;
@@ -804,6 +1276,7 @@ sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
   thresh /= 100;
 
   DBG (10, "sanei_magic_isBlank2: start %d %d %f %d\n",xhalf,yhalf,thresh,blockpix);
+  SANEI_PERF_START (perf_start);
 
   if(params->depth == 8 &&
     (params->format == SANE_FRAME_RGB || params->format == SANE_FRAME_GRAY)
@@ -825,11 +1298,7 @@ sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
           SANE_Byte * ptr = buffer + offset;
 
           /*count darkness of pix in this row*/
-          int rowsum = 0;
-
-          for(x=0; x<xhalf*Bpp; x++){
-            rowsum += 255 - ptr[x];
-          }
+          int rowsum = xhalf*Bpp*255 - sumBytes(ptr, xhalf*Bpp);
 
           blocksum += (double)rowsum/(xhalf*Bpp)/255;
         }
@@ -837,6 +1306,7 @@ sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
         /* block was darker than thresh, keep image */
         if(blocksum/yhalf > thresh){
           DBG (15, "sanei_magic_isBlank2: not blank %f %d %d\n", blocksum/yhalf, yb, xb);
+          SANEI_PERF_TIME ("magic_isBlank2", 0, perf_start);
           return SANE_STATUS_GOOD;
         }
         DBG (20, "sanei_magic_isBlank2: block blank %f %d %d\n", blocksum/yhalf, yb, xb);
@@ -858,12 +1328,8 @@ sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
             + (xquarter + xb*xhalf) / 8;
           SANE_Byte * ptr = buffer + offset;
 
-          /*count darkness of pix in this row*/
-          int rowsum = 0;
-
-          for(x=0; x<xhalf; x++){
-            rowsum += ptr[x/8] >> (7-(x%8)) & 1;
-          }
+          /*count darkness of pix in this row, xhalf is a multiple of 8*/
+          int rowsum = countBits(ptr, xhalf/8);
 
           blocksum += (double)rowsum/xhalf;
         }
@@ -871,6 +1337,7 @@ sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
         /* block was darker than thresh, keep image */
         if(blocksum/yhalf > thresh){
           DBG (15, "sanei_magic_isBlank2: not blank %f %d %d\n", blocksum/yhalf, yb, xb);
+          SANEI_PERF_TIME ("magic_isBlank2", 0, perf_start);
           return SANE_STATUS_GOOD;
         }
         DBG (20, "sanei_magic_isBlank2: block blank %f %d %d\n", blocksum/yhalf, yb, xb);
@@ -882,6 +1349,8 @@ sanei_magic_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
     return SANE_STATUS_INVAL;
   }
 
+  SANEI_PERF_TIME ("magic_isBlank2", 0, perf_start);
+
   DBG (10, "sanei_magic_isBlank2: returning blank\n");
   return SANE_STATUS_NO_DOCS;
 }
@@ -891,12 +1360,14 @@ sanei_magic_findTurn(SANE_Parameters * params, SANE_Byte * buffer,
   int dpiX, int dpiY, int * angle)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Perf_Time perf_start;
   int i, j, k;
   int depth = 1;
   int htrans=0, vtrans=0;
   int htot=0, vtot=0;
 
   DBG(10,"sanei_magic_findTurn: start\n");
+  SANEI_PERF_START (perf_start);
 
   if(params->format == SANE_FRAME_RGB ||
     (params->format == SANE_FRAME_GRAY && params->depth == 8)
@@ -1050,6 +1521,8 @@ sanei_magic_findTurn(SANE_Parameters * params, SANE_Byte * buffer,
 
   cleanup:
 
+  SANEI_PERF_TIME ("magic_findTurn", 0, perf_start);
+
   DBG(10,"sanei_magic_findTurn: finish\n");
 
   return ret;
@@ -1061,6 +1534,7 @@ sanei_magic_turn(SANE_Parameters * params, SANE_Byte * buffer,
   int angle)
 {
   SANE_Status ret = SANE_STATUS_GOOD;
+  SANEI_Perf_Time perf_start;
   int opwidth, ipwidth = params->pixels_per_line;
   int obwidth, ibwidth = params->bytes_per_line;
   int oheight, iheight = params->lines;
@@ -1070,6 +1544,7 @@ sanei_magic_turn(SANE_Parameters * params, SANE_Byte * buffer,
   int i, j, k;
 
   DBG(10,"sanei_magic_turn: start %d\n",angle);
+  SANEI_PERF_START (perf_start);
 
   if(params->format == SANE_FRAME_RGB)
     depth = 3;
@@ -1255,6 +1730,8 @@ sanei_magic_turn(SANE_Parameters * params, SANE_Byte * buffer,
   if(outbuf)
     free(outbuf);
 
+  SANEI_PERF_TIME ("magic_turn", 0, perf_start);
+
   DBG(10,"sanei_magic_turn: finish\n");
 
   return ret;
@@ -1637,7 +2114,7 @@ getLeftEdge (int width, int height, int * top, int * bot,
   botYInter = 0;
   leftCount = 0;
 
-  for(i=0;i<width;i++){
+  for(i=0;bot && i<width;i++){
 
     if(bot[i] > -1){
 
@@ -1719,50 +2196,126 @@ sanei_magic_getTransY (
     (params->format == SANE_FRAME_GRAY && params->depth == 8)
   ){
 
+    /* running sums of the near and far windows of each column, and
+     * the list of columns still searching for their first transition */
+    int * near = NULL;
+    int * far = NULL;
+    int * active = NULL;
+    int remaining = width;
+    int a;
+
     if(params->format == SANE_FRAME_RGB)
       depth = 3;
 
-    /* loop over all columns, find first transition */
+    near = calloc(width,sizeof(int));
+    far = calloc(width,sizeof(int));
+    active = calloc(width,sizeof(int));
+    if(!near || !far || !active){
+      DBG (5, "sanei_magic_getTransY: no near/far\n");
+      free(near);
+      free(far);
+      free(active);
+      free(buff);
+      return NULL;
+    }
+
+    /* load the near and far windows with repeated copy of first pixel */
     for(i=0; i<width; i++){
+      active[i] = i;
+      for(k=0; k<depth; k++){
+        near[i] += buffer[(firstLine*width+i) * depth + k];
+      }
+      near[i] *= winLen;
+      far[i] = near[i];
+    }
 
-      int near = 0;
-      int far = 0;
+    /* move windows one line at a time over all columns, instead of
+     * walking each column down the page, to stay in cache. Columns
+     * drop out of the active list once their first transition is found */
+    for(j=firstLine+direction; j!=lastLine && remaining; j+=direction){
 
-      /* load the near and far windows with repeated copy of first pixel */
-      for(k=0; k<depth; k++){
-        near += buffer[(firstLine*width+i) * depth + k];
+      int farLine = j-winLen*2*direction;
+      int nearLine = j-winLen*direction;
+      SANE_Byte * farPtr, * nearPtr, * linePtr;
+
+      if(farLine < 0 || farLine >= height){
+        farLine = firstLine;
+      }
+      if(nearLine < 0 || nearLine >= height){
+        nearLine = firstLine;
       }
-      near *= winLen;
-      far = near;
 
-      /* move windows, check delta */
-      for(j=firstLine+direction; j!=lastLine; j+=direction){
+      farPtr = buffer + farLine*width*depth;
+      nearPtr = buffer + nearLine*width*depth;
+      linePtr = buffer + j*width*depth;
 
-        int farLine = j-winLen*2*direction;
-        int nearLine = j-winLen*direction;
+      for(a=0; a<remaining; ){
 
-        if(farLine < 0 || farLine >= height){
-          farLine = firstLine;
-        }
-        if(nearLine < 0 || nearLine >= height){
-          nearLine = firstLine;
-        }
+        i = active[a];
 
         for(k=0; k<depth; k++){
-          far -= buffer[(farLine*width+i)*depth+k];
-          far += buffer[(nearLine*width+i)*depth+k];
+          far[i] -= farPtr[i*depth+k];
+          far[i] += nearPtr[i*depth+k];
 
-          near -= buffer[(nearLine*width+i)*depth+k];
-          near += buffer[(j*width+i)*depth+k];
+          near[i] -= nearPtr[i*depth+k];
+          near[i] += linePtr[i*depth+k];
         }
 
         /* significant transition */
-        if(abs(near - far) > 50*winLen*depth - near*40/255){
+        if(abs(near[i] - far[i]) > 50*winLen*depth - near[i]*40/255){
           buff[i] = j;
-          break;
+          active[a] = active[--remaining];
+        }
+        else{
+          a++;
+        }
+      }
+    }
+
+    free(near);
+    free(far);
+    free(active);
+  }
+
+  else if(params->format == SANE_FRAME_GRAY && params->depth == 1
+    && width % 8 == 0){
+
+    /* compare each line to the first one, a byte at a time,
+     * and only look at the bits of columns still searching */
+    int bwidth = width/8;
+    int remaining = width;
+    SANE_Byte * firstPtr = buffer + firstLine*bwidth;
+    SANE_Byte * mask = malloc(bwidth);
+
+    if(!mask){
+      DBG (5, "sanei_magic_getTransY: no mask\n");
+      free(buff);
+      return NULL;
+    }
+    memset(mask,0xff,bwidth);
+
+    for(j=firstLine+direction; j!=lastLine && remaining; j+=direction){
+
+      SANE_Byte * linePtr = buffer + j*bwidth;
+
+      for(i=0; i<bwidth; i++){
+
+        int diff = (linePtr[i] ^ firstPtr[i]) & mask[i];
+
+        if(!diff)
+          continue;
+
+        for(k=0; k<8; k++){
+          if(diff & (0x80 >> k)){
+            buff[i*8+k] = j;
+            remaining--;
+          }
         }
+        mask[i] &= ~diff;
       }
     }
+
+    free(mask);
   }
 
   else if(params->format == SANE_FRAME_GRAY && params->depth == 1){
@@ -1903,12 +2456,26 @@ sanei_magic_getTransX (
 
     for(i=0; i<height; i++){
 
+      SANE_Byte * row = buffer + i*bwidth;
+
       /* load the near window with first pixel */
-      near = buffer[i*bwidth + firstCol/8] >> (7-(firstCol%8)) & 1;
+      near = row[firstCol/8] >> (7-(firstCol%8)) & 1;
 
       /* move */
       for(j=firstCol+direction; j!=lastCol; j+=direction){
-        if((buffer[i*bwidth + j/8] >> (7-(j%8)) & 1) != near){
+
+        /* skip whole bytes of the same color as the first pixel */
+        while(j%8 == (direction > 0 ? 0 : 7)
+          && j-(j%8)+7 < width
+          && row[j/8] == (near ? 0xff : 0)){
+          j += 8*direction;
+          if(j < 0 || j >= width)
+            break;
+        }
+        if(j == lastCol || j < 0 || j >= width)
+          break;
+
+        if((row[j/8] >> (7-(j%8)) & 1) != near){
           buff[i] = j;
           break;
         }
@@ -1938,3 +2505,71 @@ sanei_magic_getTransX (
 
   return buff;
 }
+
+/* Return n (<= 32) bits of a 1 bit per pixel row, starting at pixel x.
+ * The first pixel ends up in the highest of the n returned bits. */
+static int
+getBits (SANE_Byte * row, int x, int n)
+{
+  SANE_Byte * ptr = row + x/8;
+  int shift = x%8;
+  int bytes = (shift + n + 7)/8;
+  unsigned long long val = 0;
+  int i;
+
+  for(i=0; i<bytes; i++){
+    val = val << 8 | ptr[i];
+  }
+
+  return (val >> (bytes*8 - shift - n)) & ((1ULL << n) - 1);
+}
+
+/* Return the sum of n bytes. Uses SSE2 or NEON if the compiler targets
+ * them, the loop at the end is the reference and handles the rest. */
+static int
+sumBytes (SANE_Byte * ptr, int n)
+{
+  int sum = 0;
+  int i = 0;
+
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+
+  for(; i+16<=n; i+=16){
+    __m128i v = _mm_loadu_si128((const __m128i *)(ptr+i));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+  }
+  sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  uint32x4_t acc = vdupq_n_u32(0);
+
+  for(; i+16<=n; i+=16){
+    acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(ptr+i)));
+  }
+  sum = vaddvq_u32(acc);
+#endif
+
+  for(; i<n; i++){
+    sum += ptr[i];
+  }
+
+  return sum;
+}
+
+/* Return the number of set bits in n bytes */
+static int
+countBits (SANE_Byte * ptr, int n)
+{
+  int sum = 0;
+  int i;
+
+  for(i=0; i<n; i++){
+    unsigned int b = ptr[i];
+    b = b - ((b >> 1) & 0x55);
+    b = (b & 0x33) + ((b >> 2) & 0x33);
+    sum += (b + (b >> 4)) & 0x0f;
+  }
+
+  return sum;
+}
@@ -0,0 +1,288 @@
+/* sane - Scanner Access Now Easy.
+
+   This file is part of the SANE package.
+
+   SANE is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   SANE is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with sane; see the file COPYING.  If not, write to the Free
+   Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   As a special exception, the authors of SANE give permission for
+   additional uses of the libraries contained in this release of SANE.
+
+   The exception is that, if you link a SANE library with other files
+   to produce an executable, this does not by itself cause the
+   resulting executable to be covered by the GNU General Public
+   License.  Your use of that executable is in no way restricted on
+   account of linking the SANE library code into it.
+
+   This exception does not, however, invalidate any other reasons why
+   the executable file might be covered by the GNU General Public
+   License.
+
+   If you submit changes to SANE to the maintainers to be included in
+   a subsequent release, you agree by submitting the changes that
+   those changes may be distributed with this exception intact.
+
+   If you write modifications of your own for SANE, it is your choice
+   whether to permit this exception to apply to your modifications.
+   If you do not wish that, delete this exception notice.
+
+   Per-scan performance counters, see sanei_perf.h
+*/
+
+#include "../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#define BACKEND_NAME sanei_perf      /* name of this module for debugging */
+
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_debug.h"
+#include "../include/sane/sanei_perf.h"
+
+/* counters are looked up by linear search, there are only a few
+ * per backend. Once the table is full, further counters are dropped */
+#define MAX_COUNTERS 64
+
+typedef struct
+{
+  const char *name;
+  int index;
+  unsigned long count;
+  unsigned long long bytes;
+  unsigned long long usec;
+  unsigned long long max;
+}
+Perf_Counter;
+
+int sanei_perf_enabled = 0;
+
+static int initialized = 0;
+static const char *output = NULL;
+static Perf_Counter counters[MAX_COUNTERS];
+static int num_counters = 0;
+static SANEI_Perf_Time scan_start = 0;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK()   pthread_mutex_lock (&perf_lock)
+# define UNLOCK() pthread_mutex_unlock (&perf_lock)
+#else
+# define LOCK()
+# define UNLOCK()
+#endif
+
+void
+sanei_perf_init (void)
+{
+  if (initialized)
+    return;
+  initialized = 1;
+
+  DBG_INIT ();
+
+  output = getenv ("SANE_PERF");
+  if (output && *output)
+    {
+      sanei_perf_enabled = 1;
+      scan_start = sanei_perf_now ();
+      DBG (5, "sanei_perf_init: writing counters to %s\n", output);
+    }
+}
+
+SANEI_Perf_Time
+sanei_perf_now (void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return (SANEI_Perf_Time) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+#ifdef HAVE_SYS_TIME_H
+  {
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (SANEI_Perf_Time) tv.tv_sec * 1000000 + tv.tv_usec;
+  }
+#else
+  return (SANEI_Perf_Time) time (NULL) * 1000000;
+#endif
+}
+
+/* must be called with the lock held */
+static Perf_Counter *
+get_counter (const char *name, int index)
+{
+  int i;
+
+  for (i = 0; i < num_counters; i++)
+    {
+      if (counters[i].index == index
+	  && (counters[i].name == name || !strcmp (counters[i].name, name)))
+	return &counters[i];
+    }
+
+  if (num_counters >= MAX_COUNTERS)
+    return NULL;
+
+  memset (&counters[num_counters], 0, sizeof (Perf_Counter));
+  counters[num_counters].name = name;
+  counters[num_counters].index = index;
+
+  return &counters[num_counters++];
+}
+
+void
+sanei_perf_io (const char *name, int index, size_t bytes,
+	       SANEI_Perf_Time start)
+{
+  SANEI_Perf_Time now;
+  Perf_Counter *c;
+
+  if (!sanei_perf_enabled)
+    return;
+
+  now = sanei_perf_now ();
+
+  LOCK ();
+  c = get_counter (name, index);
+  if (c)
+    {
+      c->count++;
+      c->bytes += bytes;
+      if (start && now > start)
+	c->usec += now - start;
+      if (bytes > c->max)
+	c->max = bytes;
+    }
+  UNLOCK ();
+}
+
+void
+sanei_perf_time (const char *name, int index, SANEI_Perf_Time start)
+{
+  SANEI_Perf_Time now;
+  Perf_Counter *c;
+
+  if (!sanei_perf_enabled)
+    return;
+
+  now = sanei_perf_now ();
+
+  LOCK ();
+  c = get_counter (name, index);
+  if (c)
+    {
+      c->count++;
+      if (start && now > start)
+	{
+	  c->usec += now - start;
+	  if (now - start > c->max)
+	    c->max = now - start;
+	}
+    }
+  UNLOCK ();
+}
+
+void
+sanei_perf_hwm (const char *name, int index, size_t value)
+{
+  Perf_Counter *c;
+
+  if (!sanei_perf_enabled)
+    return;
+
+  LOCK ();
+  c = get_counter (name, index);
+  if (c)
+    {
+      c->count++;
+      if (value > c->max)
+	c->max = value;
+    }
+  UNLOCK ();
+}
+
+void
+sanei_perf_reset (void)
+{
+  LOCK ();
+  num_counters = 0;
+  scan_start = sanei_perf_enabled ? sanei_perf_now () : 0;
+  UNLOCK ();
+}
+
+void
+sanei_perf_dump (const char *backend)
+{
+  FILE *fp;
+  int i;
+
+  if (!sanei_perf_enabled)
+    return;
+
+  LOCK ();
+
+  if (!num_counters)
+    {
+      UNLOCK ();
+      return;
+    }
+
+  if (!strcmp (output, "-") || !strcmp (output, "stderr"))
+    fp = stderr;
+  else
+    fp = fopen (output, "a");
+
+  if (!fp)
+    {
+      DBG (1, "sanei_perf_dump: unable to open %s\n", output);
+    }
+  else
+    {
+      fprintf (fp, "{\"backend\":\"%s\",\"usec\":%llu,\"counters\":[",
+	       backend ? backend : "", sanei_perf_now () - scan_start);
+
+      for (i = 0; i < num_counters; i++)
+	{
+	  fprintf (fp, "%s{\"name\":\"%s\",\"index\":%d,\"count\":%lu,"
+		   "\"bytes\":%llu,\"usec\":%llu,\"max\":%llu}",
+		   i ? "," : "", counters[i].name, counters[i].index,
+		   counters[i].count, counters[i].bytes, counters[i].usec,
+		   counters[i].max);
+	}
+
+      fprintf (fp, "]}\n");
+
+      if (fp == stderr)
+	fflush (fp);
+      else
+	fclose (fp);
+    }
+
+  num_counters = 0;
+  scan_start = sanei_perf_now ();
+
+  UNLOCK ();
+}
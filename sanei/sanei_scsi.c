@@ -235,6 +235,7 @@
 #include "../include/sane/sanei.h"
 #include "../include/sane/sanei_config.h"
 #include "../include/sane/sanei_scsi.h"
+#include "../include/sane/sanei_perf.h"
 
 #define BACKEND_NAME	sanei_scsi
 #include "../include/sane/sanei_debug.h"
@@ -898,6 +899,7 @@ sanei_scsi_open (const char *dev, int *fdp,
     }
 
   DBG_INIT ();
+  sanei_perf_init ();
 
 #if USE == LINUX_INTERFACE
   if (first_time)
@@ -2478,14 +2480,20 @@ issue (struct req *req)
 		     void *dst, size_t * dst_size)
   {
     SANE_Status status;
+    SANEI_Perf_Time perf_start;
     void *id;
 
+    SANEI_PERF_START (perf_start);
     status =
       sanei_scsi_req_enter2 (fd, cmd, cmd_size, src, src_size, dst, dst_size,
 			     &id);
     if (status != SANE_STATUS_GOOD)
       return status;
-    return sanei_scsi_req_wait (id);
+    status = sanei_scsi_req_wait (id);
+    if (status == SANE_STATUS_GOOD)
+      SANEI_PERF_IO ("scsi_cmd", fd,
+		     src_size + (dst_size ? *dst_size : 0), perf_start);
+    return status;
   }
 
 /* The following code (up to and including sanei_scsi_find_devices() )
@@ -116,6 +116,7 @@ GetNextDescriptor( struct usb_descriptor_header *currHead, UCHAR *lastBytePtr)
 #include "../include/sane/sane.h"
 #include "../include/sane/sanei_debug.h"
 #include "../include/sane/sanei_usb.h"
+#include "../include/sane/sanei_perf.h"
 #include "../include/sane/sanei_config.h"
 
 typedef enum
@@ -469,6 +470,8 @@ sanei_usb_init (void)
   debug_level = 0;
 #endif
 
+  sanei_perf_init ();
+
   /* if no device yet, clean up memory */
   if(device_number==0)
     memset (devices, 0, sizeof (devices));
@@ -2289,6 +2292,7 @@ SANE_Status
 sanei_usb_read_bulk (SANE_Int dn, SANE_Byte * buffer, size_t * size)
 {
   ssize_t read_size = 0;
+  SANEI_Perf_Time perf_start;
 
   if (!size)
     {
@@ -2303,6 +2307,7 @@ sanei_usb_read_bulk (SANE_Int dn, SANE_Byte * buffer, size_t * size)
     }
   DBG (5, "sanei_usb_read_bulk: trying to read %lu bytes\n",
        (unsigned long) *size);
+  SANEI_PERF_START (perf_start);
 
   if (devices[dn].method == sanei_usb_method_scanner_driver)
     {
@@ -2428,6 +2433,7 @@ sanei_usb_read_bulk (SANE_Int dn, SANE_Byte * buffer, size_t * size)
       *size = 0;
       return SANE_STATUS_EOF;
     }
+  SANEI_PERF_IO ("usb_bulk_in", dn, read_size, perf_start);
   if (debug_level > 10)
     print_buffer (buffer, read_size);
   DBG (5, "sanei_usb_read_bulk: wanted %lu bytes, got %ld bytes\n",
@@ -2441,6 +2447,7 @@ SANE_Status
 sanei_usb_write_bulk (SANE_Int dn, const SANE_Byte * buffer, size_t * size)
 {
   ssize_t write_size = 0;
+  SANEI_Perf_Time perf_start;
 
   if (!size)
     {
@@ -2455,6 +2462,7 @@ sanei_usb_write_bulk (SANE_Int dn, const SANE_Byte * buffer, size_t * size)
     }
   DBG (5, "sanei_usb_write_bulk: trying to write %lu bytes\n",
        (unsigned long) *size);
+  SANEI_PERF_START (perf_start);
   if (debug_level > 10)
     print_buffer (buffer, *size);
 
@@ -2576,6 +2584,7 @@ sanei_usb_write_bulk (SANE_Int dn, const SANE_Byte * buffer, size_t * size)
 #endif
       return SANE_STATUS_IO_ERROR;
     }
+  SANEI_PERF_IO ("usb_bulk_out", dn, write_size, perf_start);
   DBG (5, "sanei_usb_write_bulk: wanted %lu bytes, wrote %ld bytes\n",
        (unsigned long) *size, (unsigned long) write_size);
   *size = write_size;
@@ -2722,6 +2731,7 @@ SANE_Status
 sanei_usb_read_int (SANE_Int dn, SANE_Byte * buffer, size_t * size)
 {
   ssize_t read_size = 0;
+  SANEI_Perf_Time perf_start;
 #if defined(HAVE_LIBUSB_LEGACY) || defined(HAVE_LIBUSB)
   SANE_Bool stalled = SANE_FALSE;
 #endif
@@ -2740,6 +2750,7 @@ sanei_usb_read_int (SANE_Int dn, SANE_Byte * buffer, size_t * size)
 
   DBG (5, "sanei_usb_read_int: trying to read %lu bytes\n",
        (unsigned long) *size);
+  SANEI_PERF_START (perf_start);
   if (devices[dn].method == sanei_usb_method_scanner_driver)
     {
       DBG (1, "sanei_usb_read_int: access method %d not implemented\n",
@@ -2856,6 +2867,7 @@ sanei_usb_read_int (SANE_Int dn, SANE_Byte * buffer, size_t * size)
       *size = 0;
       return SANE_STATUS_EOF;
     }
+  SANEI_PERF_IO ("usb_int_in", dn, read_size, perf_start);
   DBG (5, "sanei_usb_read_int: wanted %lu bytes, got %ld bytes\n",
        (unsigned long) *size, (unsigned long) read_size);
   *size = read_size;
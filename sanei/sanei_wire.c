@@ -48,6 +48,7 @@
 
 #include "../include/sane/sane.h"
 #include "../include/sane/sanei_wire.h"
+#include "../include/sane/sanei_perf.h"
 
 #define BACKEND_NAME	sanei_wire
 #include "../include/sane/sanei_backend.h"
@@ -58,6 +59,7 @@ sanei_w_space (Wire * w, size_t howmuch)
   size_t nbytes, left_over;
   int fd = w->io.fd;
   ssize_t nread, nwritten;
+  SANEI_Perf_Time perf_start;
 
   DBG (3, "sanei_w_space: %lu bytes for wire %d\n", (u_long) howmuch, fd);
 
@@ -83,6 +85,7 @@ sanei_w_space (Wire * w, size_t howmuch)
 	  w->buffer.curr = w->buffer.start;
 	  DBG (4, "sanei_w_space: ENCODE: sending %lu bytes\n",
 	       (u_long) nbytes);
+	  SANEI_PERF_START (perf_start);
 	  while (nbytes > 0)
 	    {
 	      nwritten = (*w->io.write) (fd, w->buffer.curr, nbytes);
@@ -95,6 +98,8 @@ sanei_w_space (Wire * w, size_t howmuch)
 	      w->buffer.curr += nwritten;
 	      nbytes -= nwritten;
 	    }
+	  SANEI_PERF_IO ("wire_write", fd,
+			 w->buffer.curr - w->buffer.start, perf_start);
 	  w->buffer.curr = w->buffer.start;
 	  w->buffer.end = w->buffer.start + w->buffer.size;
 	  DBG (4, "sanei_w_space: ENCODE: free buffer is now %lu\n",
@@ -120,6 +125,8 @@ sanei_w_space (Wire * w, size_t howmuch)
 	  w->buffer.end = w->buffer.start + left_over;
 
 	  DBG (4, "sanei_w_space: DECODE: receiving data\n");
+	  SANEI_PERF_START (perf_start);
+	  nbytes = left_over;
 	  do
 	    {
 	      nread = (*w->io.read) (fd, w->buffer.end,
@@ -137,6 +144,7 @@ sanei_w_space (Wire * w, size_t howmuch)
 	      w->buffer.end += nread;
 	    }
 	  while (left_over < howmuch);
+	  SANEI_PERF_IO ("wire_read", fd, left_over - nbytes, perf_start);
 	  DBG (4, "sanei_w_space: DECODE: %lu bytes read\n",
 	       (u_long) (w->buffer.end - w->buffer.start));
 	  break;
@@ -656,6 +664,7 @@ void
 sanei_w_init (Wire * w, void (*codec_init_func) (Wire *))
 {
   DBG_INIT ();
+  sanei_perf_init ();
 
   DBG (3, "sanei_w_init: initializing\n");
   w->status = 0;
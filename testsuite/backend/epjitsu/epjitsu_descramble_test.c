@@ -0,0 +1,381 @@
+#include "../../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+/* the descramble functions are static functions of the epjitsu backend,
+ * so the backend is included, its scanner commands are never called */
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/epjitsu.c"
+#include "../../../backend/sane_strstatus.c"
+
+/* the descramble functions as they were before the column maps */
+
+static SANE_Status
+ref_descramble_raw_gray (struct scanner *s, struct transfer *tp)
+{
+    SANE_Status ret = SANE_STATUS_GOOD;
+    int height = tp->total_bytes / tp->line_stride;
+    int row, col_out;
+
+    DBG(15, "descramble_raw_gray: start\n");
+
+    if (s->model == MODEL_FI60F || s->model == MODEL_FI65F) {
+      for (row = 0; row < height; row++){
+
+        unsigned char *p_in = tp->raw_data + row * tp->line_stride;
+        unsigned char *p_out = tp->image->buffer + row * tp->image->width_pix;
+
+        for (col_out = 0; col_out < tp->image->width_pix; col_out++){
+          int col_in = col_out * tp->x_res/tp->image->x_res;
+          int offset = col_in%tp->plane_width;
+          int step   = col_in/tp->plane_width;
+
+          *p_out = *(p_in + offset*3 + step);
+          p_out++;
+        }
+      }
+    }
+
+    else{
+        DBG(5, "internal error: descramble_raw_gray not supported\n");
+        ret = SANE_STATUS_INVAL;
+    }
+
+    DBG(15, "descramble_raw_gray: finish %d\n", ret);
+    return ret;
+}
+
+static SANE_Status
+ref_descramble_raw (struct scanner *s, struct transfer *tp)
+{
+    SANE_Status ret = SANE_STATUS_GOOD;
+    unsigned char *p_out = tp->image->buffer;
+    int height = tp->total_bytes / tp->line_stride;
+    int i, j, k;
+
+    /* raw gray data handled in another function */
+    if(tp->mode == MODE_GRAYSCALE){
+      return ref_descramble_raw_gray(s, tp);
+    }
+
+    DBG(15, "descramble_raw: start\n");
+
+    if (s->model == MODEL_S300 || s->model == MODEL_S1300i) {
+      for (i = 0; i < 2; i++){                   /* page, front/back */
+        for (j = 0; j < height; j++){             /* row (y)*/
+          int curr_col = 0;
+          int r=0, g=0, b=0, ppc=0;
+
+          for (k = 0; k <= tp->plane_width; k++){  /* column (x) */
+            int this_col = k*tp->image->x_res/tp->x_res;
+
+            /* going to change output pixel, dump rgb and reset */
+            if(ppc && curr_col != this_col){
+              *p_out = r/ppc;
+              p_out++;
+
+              *p_out = g/ppc;
+              p_out++;
+
+              *p_out = b/ppc;
+              p_out++;
+
+              r = g = b = ppc = 0;
+
+              curr_col = this_col;
+            }
+
+            if(k == tp->plane_width || this_col >= tp->image->width_pix){
+              break;
+            }
+
+            /*red is first*/
+            r += tp->raw_data[j*tp->line_stride + k*3 + i];
+
+            /*green is second*/
+            g += tp->raw_data[j*tp->line_stride + tp->plane_stride + k*3 + i];
+
+            /*blue is third*/
+            b += tp->raw_data[j*tp->line_stride + 2*tp->plane_stride + k*3 + i];
+
+            ppc++;
+          }
+        }
+      }
+    }
+    else if (s->model == MODEL_S1100){
+      for (j = 0; j < height; j++){             /* row (y)*/
+        int curr_col = 0;
+        int r=0, g=0, b=0, ppc=0;
+
+        for (k = 0; k <= tp->plane_width; k++){  /* column (x) */
+          int this_col = k*tp->image->x_res/tp->x_res;
+
+          /* going to change output pixel, dump rgb and reset */
+          if(ppc && curr_col != this_col){
+            *p_out = r/ppc;
+            p_out++;
+
+            *p_out = g/ppc;
+            p_out++;
+
+            *p_out = b/ppc;
+            p_out++;
+
+            r = g = b = ppc = 0;
+
+            curr_col = this_col;
+          }
+
+          if(k == tp->plane_width || this_col >= tp->image->width_pix){
+            break;
+          }
+
+          /*red is second*/
+          r += tp->raw_data[j*tp->line_stride + tp->plane_stride + k];
+
+          /*green is third*/
+          g += tp->raw_data[j*tp->line_stride + 2*tp->plane_stride + k];
+
+          /*blue is first*/
+          b += tp->raw_data[j*tp->line_stride + k];
+
+          ppc++;
+        }
+      }
+    }
+    else { /* MODEL_FI60F or MODEL_FI65F */
+
+      for (j = 0; j < height; j++){             /* row (y)*/
+        int curr_col = 0;
+
+        for (i = 0; i < 3; i++){                /* read head */
+          int r=0, g=0, b=0, ppc=0;
+
+          for (k = 0; k <= tp->plane_width; k++){  /* column (x) within the read head */
+            int this_col = (k+i*tp->plane_width)*tp->image->x_res/tp->x_res;
+
+            /* going to change output pixel, dump rgb and reset */
+            if(ppc && curr_col != this_col){
+              *p_out = r/ppc;
+              p_out++;
+
+              *p_out = g/ppc;
+              p_out++;
+
+              *p_out = b/ppc;
+              p_out++;
+
+              r = g = b = ppc = 0;
+
+              curr_col = this_col;
+            }
+
+            if(k == tp->plane_width || this_col >= tp->image->width_pix){
+              break;
+            }
+
+            /*red is first*/
+            r += tp->raw_data[j*tp->line_stride + k*3 + i];
+
+            /*green is second*/
+            g += tp->raw_data[j*tp->line_stride + tp->plane_stride + k*3 + i];
+
+            /*blue is third*/
+            b += tp->raw_data[j*tp->line_stride + 2*tp->plane_stride + k*3 + i];
+
+            ppc++;
+          }
+        }
+      }
+    }
+
+    DBG(15, "descramble_raw: finish %d\n", ret);
+
+    return ret;
+}
+
+/* simple reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static double
+now (void)
+{
+  return (double) clock () / CLOCKS_PER_SEC;
+}
+
+#define ROWS 32
+
+static struct scanner scanner;
+static struct transfer block;
+static struct image image;
+
+/* a block of random raw data, as the scanner sends it for the model,
+ * plane_width is in pixels of one read head */
+static void
+setup (int model, int mode, int plane_width, int x_res, int out_res,
+       int width_pix)
+{
+  int heads = (model == MODEL_FI60F) ? 3 : 1;
+  int sides = (model == MODEL_S300) ? 2 : 1;
+  int i;
+
+  scanner.model = model;
+
+  block.mode = mode;
+  block.x_res = x_res;
+  block.plane_width = plane_width;
+  if (model == MODEL_S1100)
+    block.plane_stride = plane_width + rnd () % 8;
+  else
+    block.plane_stride = (plane_width + rnd () % 8) * 3;
+  if (mode == MODE_GRAYSCALE)
+    block.line_stride = plane_width * 3 + rnd () % 8;
+  else
+    block.line_stride = block.plane_stride * 3 + rnd () % 8;
+  block.total_bytes = block.line_stride * ROWS;
+  block.raw_data = realloc (block.raw_data, block.total_bytes);
+  for (i = 0; i < block.total_bytes; i++)
+    block.raw_data[i] = rnd ();
+
+  image.x_res = out_res;
+  image.width_pix = width_pix;
+  image.buffer = realloc (image.buffer,
+			  (heads * plane_width + 1) * 3 * sides * ROWS);
+  block.image = &image;
+}
+
+/* compares the output of both functions on the current block */
+static void
+compare (void)
+{
+  size_t size = (block.plane_width * 3 + 1) * 3 * 2 * ROWS;
+  unsigned char *expected = malloc (size);
+
+  assert (expected);
+  image.buffer = realloc (image.buffer, size);
+  memset (image.buffer, 0x5a, size);
+  assert (ref_descramble_raw (&scanner, &block) == SANE_STATUS_GOOD);
+  memcpy (expected, image.buffer, size);
+
+  memset (image.buffer, 0x5a, size);
+  assert (descramble_raw (&scanner, &block) == SANE_STATUS_GOOD);
+  assert (memcmp (expected, image.buffer, size) == 0);
+  free (expected);
+}
+
+static void
+check_models (void)
+{
+  static const int models[] = { MODEL_S300, MODEL_S1100, MODEL_FI60F };
+  static const int x_res[] = { 150, 225, 300, 400, 600 };
+  static const int out_res[] = { 50, 75, 100, 150, 200, 225, 300, 400, 600 };
+  unsigned m, r, o, w, cases = 0;
+
+  for (m = 0; m < sizeof (models) / sizeof (models[0]); m++)
+    for (r = 0; r < sizeof (x_res) / sizeof (x_res[0]); r++)
+      for (o = 0; o < sizeof (out_res) / sizeof (out_res[0]); o++)
+	{
+	  int heads = (models[m] == MODEL_FI60F) ? 3 : 1;
+	  int plane_width = x_res[r] * 4 + rnd () % 64;
+	  int full = heads * plane_width * out_res[o] / x_res[r];
+
+	  if (out_res[o] > x_res[r])
+	    continue;
+
+	  /* the full width, a cropped width and one past the data */
+	  for (w = 0; w < 3; w++)
+	    {
+	      int width_pix = w == 0 ? full : w == 1 ? full * 2 / 3 : full + 3;
+
+	      setup (models[m], MODE_COLOR, plane_width, x_res[r], out_res[o],
+		     width_pix);
+	      compare ();
+	      cases++;
+
+	      if (models[m] == MODEL_FI60F && width_pix <= full)
+		{
+		  setup (models[m], MODE_GRAYSCALE, plane_width, x_res[r],
+			 out_res[o], width_pix);
+		  compare ();
+		  cases++;
+		}
+	    }
+	}
+
+  printf ("%u blocks descrambled like before\n", cases);
+}
+
+/* the averaging weights must give exact quotients for all pixel sums */
+static void
+check_weights (void)
+{
+  unsigned int n, sum, weight;
+
+  for (n = 1; n <= 256; n++)
+    {
+      weight = ((1 << 24) + n - 1) / n;
+      for (sum = 0; sum <= 255 * n; sum++)
+	assert ((sum * weight) >> 24 == sum / n);
+    }
+}
+
+/* the descramble speed over synthetic raw blocks, in raw data per second,
+ * the output is only a hint as the test machine may be busy */
+static void
+bench (const char *what, int model, int x_res, int out_res)
+{
+  int heads = (model == MODEL_FI60F) ? 3 : 1;
+  int plane_width = x_res * 9;
+  double start, ref_time, time;
+  int i;
+
+  setup (model, MODE_COLOR, plane_width, x_res, out_res,
+	 heads * plane_width * out_res / x_res);
+
+  start = now ();
+  for (i = 0; i < 200; i++)
+    ref_descramble_raw (&scanner, &block);
+  ref_time = now () - start;
+
+  start = now ();
+  for (i = 0; i < 200; i++)
+    descramble_raw (&scanner, &block);
+  time = now () - start;
+
+  printf ("%s: %.1f MB/s reference, %.1f MB/s\n", what,
+	  200.0 * block.total_bytes / (1 << 20) / ref_time,
+	  200.0 * block.total_bytes / (1 << 20) / time);
+}
+
+int
+main (int argc, char **argv)
+{
+  check_weights ();
+  check_models ();
+
+  /* the speed comparison only runs for 'make bench' */
+  if (argc > 1 && strcmp (argv[1], "--bench") == 0)
+    {
+      bench ("S300 color 600 -> 300 dpi", MODEL_S300, 600, 300);
+      bench ("S300 color 300 dpi", MODEL_S300, 300, 300);
+      bench ("fi-60F color 600 -> 150 dpi", MODEL_FI60F, 600, 150);
+    }
+
+  free (block.raw_data);
+  free (image.buffer);
+  return 0;
+}
@@ -0,0 +1,412 @@
+#include "../../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* the backend is included, the scanner commands are replaced by stubs
+ * which send a jpeg page in blocks like the scanner */
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/epsonds.c"
+#include "../../../backend/epsonds-ops.c"
+#include "../../../backend/epsonds-jpeg.c"
+#include "../../../backend/epsonds-usb.c"
+#include "../../../backend/sane_strstatus.c"
+
+#ifdef HAVE_LIBJPEG
+
+#define BSZ (65536 * 4)
+
+static unsigned char *page;	/* the compressed page */
+static unsigned long page_len;
+static unsigned long page_sent;	/* bytes sent so far */
+static unsigned long block;	/* bytes sent per IMG command */
+static int page_end;		/* sent the page end */
+static int cancel_at;		/* cancel at this byte, if not 0 */
+
+SANE_Status
+esci2_info (epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+esci2_fin (epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+esci2_can (epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+esci2_capa (epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+esci2_resa (epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+esci2_para (epsonds_scanner __sane_unused__ * s,
+	    char __sane_unused__ * parameters)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+esci2_mech (epsonds_scanner __sane_unused__ * s,
+	    char __sane_unused__ * parameters)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+esci2_trdt (epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+/* a block of the page, then the page end */
+SANE_Status
+esci2_img (struct epsonds_scanner *s, SANE_Int * length)
+{
+  unsigned long n = page_len - page_sent;
+
+  *length = 0;
+  s->backside = 0;
+
+  if (cancel_at && page_sent >= (unsigned long) cancel_at)
+    return SANE_STATUS_CANCELLED;
+
+  if (n == 0)
+    {
+      assert (!page_end);
+      page_end = 1;
+      s->eof = 1;
+      return SANE_STATUS_EOF;
+    }
+
+  if (n > block)
+    n = block;
+  memcpy (s->buf, page + page_sent, n);
+  page_sent += n;
+  *length = n;
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+eds_lock (epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+size_t
+eds_recv (epsonds_scanner __sane_unused__ * s, void __sane_unused__ * buf,
+	  size_t __sane_unused__ length, SANE_Status * status)
+{
+  *status = SANE_STATUS_IO_ERROR;
+  return 0;
+}
+
+SANE_Status
+epsonds_net_lock (struct epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+epsonds_net_unlock (struct epsonds_scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+/* a page with some text, so that the blocks differ */
+static unsigned char *
+make_image (int width, int height, int comps)
+{
+  unsigned char *img = malloc ((size_t) width * height * comps);
+  int x, y, c, v;
+
+  assert (img);
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      for (c = 0; c < comps; c++)
+	{
+	  v = 235 - (x + y * (c + 1)) % 40;
+	  if ((y / 13) % 4 == 1 && (x / 9) % 5)
+	    v = 30 + c * 20;
+	  img[((size_t) y * width + x) * comps + c] = v;
+	}
+  return img;
+}
+
+/* with a big comment, which the decoder skips in pieces */
+static unsigned char *
+compress (unsigned char *img, int width, int height, int comps,
+	  int progressive, unsigned long *len)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned char *out = NULL;
+  JOCTET comment[20000];
+  JSAMPROW row;
+
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_compress (&cinfo);
+  jpeg_mem_dest (&cinfo, &out, len);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = comps;
+  cinfo.in_color_space = comps == 3 ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, 90, TRUE);
+  if (progressive)
+    jpeg_simple_progression (&cinfo);
+  jpeg_start_compress (&cinfo, TRUE);
+  memset (comment, 'x', sizeof (comment));
+  jpeg_write_marker (&cinfo, JPEG_APP0 + 5, comment, sizeof (comment));
+  while (cinfo.next_scanline < cinfo.image_height)
+    {
+      row = img + (size_t) cinfo.next_scanline * width * comps;
+      jpeg_write_scanlines (&cinfo, &row, 1);
+    }
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+  return out;
+}
+
+/* plain libjpeg decode, of the whole page or the part given */
+static unsigned char *
+reference (unsigned char *data, unsigned long len, unsigned long *size)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned char *img;
+  size_t stride;
+  JSAMPROW row;
+
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_decompress (&cinfo);
+  jpeg_mem_src (&cinfo, data, len);
+  jpeg_read_header (&cinfo, TRUE);
+  jpeg_start_decompress (&cinfo);
+  stride = cinfo.output_width * cinfo.output_components;
+  *size = stride * cinfo.output_height;
+  img = malloc (*size);
+  assert (img);
+  while (cinfo.output_scanline < cinfo.output_height)
+    {
+      row = img + cinfo.output_scanline * stride;
+      jpeg_read_scanlines (&cinfo, &row, 1);
+    }
+  jpeg_abort_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+  return img;
+}
+
+static epsonds_scanner *
+new_scanner (void)
+{
+  epsonds_scanner *s = calloc (1, sizeof (*s));
+
+  assert (s);
+  s->fd = -1;
+  s->mode_jpeg = 1;
+  /* one pass adf, sane_start only picks the ring and the decoder */
+  s->scanning = 1;
+  assert (eds_ring_init (&s->front, BSZ * 2) == SANE_STATUS_GOOD);
+  s->buf = malloc (BSZ);
+  assert (s->buf);
+  return s;
+}
+
+static void
+free_scanner (epsonds_scanner * s)
+{
+  free (s->buf);
+  close_scanner (s);
+}
+
+static void
+send_page (unsigned char *data, unsigned long len, unsigned long size)
+{
+  page = data;
+  page_len = len;
+  page_sent = 0;
+  page_end = 0;
+  block = size;
+}
+
+/* reads the page, returns the status after the last byte */
+static SANE_Status
+read_page (epsonds_scanner * s, unsigned char *out, unsigned long size,
+	   SANE_Int max_len, unsigned long *got, unsigned long *first)
+{
+  SANE_Status st;
+  SANE_Int len;
+
+  *got = 0;
+  *first = 0;
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  while ((st = sane_read (s, out + *got, max_len, &len)) == SANE_STATUS_GOOD)
+    {
+      assert (len > 0 && len <= max_len);
+      if (*got == 0)
+	*first = page_sent;
+      *got += len;
+      assert (*got <= size);
+    }
+  return st;
+}
+
+/* the page comes out as libjpeg decodes it in one go, and the first
+ * lines before the scanner sent the whole page */
+static void
+test_page (int comps, int progressive)
+{
+  int width = 1275, height = 1650;
+  unsigned long len, size, got, first, first_4k = 0;
+  unsigned long blocks[] = { 7, 777, 4096, 65536, BSZ };
+  SANE_Int max_len[] = { 1, 1000, 32768, 1 << 22 };
+  unsigned char *img, *data, *ref, *out;
+  epsonds_scanner *s;
+  unsigned i, j;
+
+  img = make_image (width, height, comps);
+  data = compress (img, width, height, comps, progressive, &len);
+  ref = reference (data, len, &size);
+  out = malloc (size);
+  assert (out);
+
+  s = new_scanner ();
+  for (i = 0; i < sizeof (blocks) / sizeof (blocks[0]); i++)
+    for (j = 0; j < sizeof (max_len) / sizeof (max_len[0]); j++)
+      {
+	/* tiny blocks and reads only the usual way */
+	if ((blocks[i] == 7 && max_len[j] != 32768)
+	    || (max_len[j] == 1 && blocks[i] != 4096))
+	  continue;
+
+	send_page (data, len, blocks[i]);
+	memset (out, 0xA5, size);
+	assert (read_page (s, out, size, max_len[j], &got, &first)
+		== SANE_STATUS_EOF);
+	assert (got == size);
+	assert (!memcmp (out, ref, size));
+	assert (page_end);
+
+	if (!progressive && blocks[i] < len / 8)
+	  assert (first < len / 4);
+	if (blocks[i] == 4096)
+	  first_4k = first;
+      }
+  free_scanner (s);
+
+  printf ("%s%s page, %lu bytes: same as libjpeg, first line after %lu\n",
+	  comps == 3 ? "color" : "gray", progressive ? " progressive" : "",
+	  len, first_4k);
+
+  free (out);
+  free (ref);
+  free (data);
+  free (img);
+}
+
+/* a page cut short still gives all lines, broken data an error, and
+ * pages left half read do not stop the next one */
+static void
+test_damaged (void)
+{
+  int width = 850, height = 1100;
+  unsigned long len, size, got, first, cut;
+  unsigned char *img, *data, *ref, *out;
+  epsonds_scanner *s;
+  SANE_Int l;
+  int i;
+
+  img = make_image (width, height, 3);
+  data = compress (img, width, height, 3, 0, &len);
+  ref = reference (data, len, &size);
+  out = malloc (size);
+  assert (out);
+  s = new_scanner ();
+
+  /* cut short */
+  for (cut = len / 4; cut < len; cut += len / 4)
+    {
+      send_page (data, cut, 4096);
+      assert (read_page (s, out, size, 32768, &got, &first)
+	      == SANE_STATUS_EOF);
+      assert (got == size);
+      assert (!memcmp (out, ref, width * 3 * 100));
+    }
+
+  /* no jpeg */
+  send_page (img, 100000, 4096);
+  assert (read_page (s, out, size, 32768, &got, &first)
+	  == SANE_STATUS_IO_ERROR);
+  assert (got == 0);
+
+  /* left half read, or cancelled */
+  for (i = 0; i < 2; i++)
+    {
+      send_page (data, len, 4096);
+      cancel_at = i ? len / 2 : 0;
+      assert (sane_start (s) == SANE_STATUS_GOOD);
+      while (sane_read (s, out, 32768, &l) == SANE_STATUS_GOOD
+	     && page_sent < len / 2);
+      cancel_at = 0;
+    }
+  send_page (data, len, 65536);
+  assert (read_page (s, out, size, 32768, &got, &first) == SANE_STATUS_EOF);
+  assert (got == size && !memcmp (out, ref, size));
+
+  /* the frontend reads on after the end */
+  assert (sane_read (s, out, 32768, &l) == SANE_STATUS_EOF);
+
+  /* and closes during a page */
+  send_page (data, len, 4096);
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  assert (sane_read (s, out, 32768, &l) == SANE_STATUS_GOOD);
+  free_scanner (s);
+
+  printf ("damaged and unfinished pages handled\n");
+  free (out);
+  free (ref);
+  free (data);
+  free (img);
+}
+
+int
+main (void)
+{
+  DBG_INIT ();
+
+  test_page (1, 0);
+  test_page (3, 0);
+  test_page (3, 1);
+  test_damaged ();
+  return 0;
+}
+
+#else
+
+int
+main (void)
+{
+  /* skipped */
+  return 77;
+}
+
+#endif
@@ -0,0 +1,222 @@
+#include "../../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* the backend is included, the jpeg pages are made with libjpeg and put
+ * in the image buffers as if read from the scanner */
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/fujitsu.c"
+#include "../../../backend/sane_strstatus.c"
+
+#ifdef HAVE_LIBJPEG
+
+/* letter at 200 dpi, on a dark background */
+#define WIDTH 1700
+#define LINES 2200
+#define DPI 200
+#define PAGE_L 101
+#define PAGE_T 133
+#define PAGE_R 1601
+#define PAGE_B 2050
+
+static unsigned char *
+make_page (int comps, int text)
+{
+  unsigned char *img = malloc (WIDTH * LINES * comps);
+  int x, y, c;
+
+  assert (img);
+  for (y = 0; y < LINES; y++)
+    for (x = 0; x < WIDTH; x++)
+      {
+	int v = 245;
+
+	if (x < PAGE_L || x >= PAGE_R || y < PAGE_T || y >= PAGE_B)
+	  v = 20;
+	else if (text && x > 300 && x < 1200 && y > 400 && y < 1500
+		 && (y / 20) % 2)
+	  v = 30;
+	for (c = 0; c < comps; c++)
+	  img[(y * WIDTH + x) * comps + c] = v + c * 3;
+      }
+  return img;
+}
+
+static unsigned char *
+compress (unsigned char *img, int comps, int restart, unsigned long *len)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned char *out = NULL;
+
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_compress (&cinfo);
+  jpeg_mem_dest (&cinfo, &out, len);
+  cinfo.image_width = WIDTH;
+  cinfo.image_height = LINES;
+  cinfo.input_components = comps;
+  cinfo.in_color_space = comps == 3 ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, 85, TRUE);
+  cinfo.restart_interval = restart;
+  jpeg_start_compress (&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height)
+    {
+      JSAMPROW row = img + cinfo.next_scanline * WIDTH * comps;
+      jpeg_write_scanlines (&cinfo, &row, 1);
+    }
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+  return out;
+}
+
+static unsigned char *
+decompress (unsigned char *data, unsigned long len, int *width, int *lines)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned char *img;
+  int stride;
+
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_decompress (&cinfo);
+  jpeg_mem_src (&cinfo, data, len);
+  jpeg_read_header (&cinfo, TRUE);
+  jpeg_start_decompress (&cinfo);
+  *width = cinfo.output_width;
+  *lines = cinfo.output_height;
+  stride = cinfo.output_width * cinfo.output_components;
+  img = malloc (stride * cinfo.output_height);
+  assert (img);
+  while (cinfo.output_scanline < cinfo.output_height)
+    {
+      JSAMPROW row = img + cinfo.output_scanline * stride;
+      jpeg_read_scanlines (&cinfo, &row, 1);
+    }
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+  return img;
+}
+
+/* a page as the scanner sends it, in the front buffer */
+static void
+load_page (struct fujitsu *s, SANE_Parameters * p, int comps, int text,
+	   int restart, unsigned char **orig, unsigned long *orig_len)
+{
+  unsigned char *img = make_page (comps, text);
+
+  memset (s, 0, sizeof (*s));
+  s->resolution_x = s->resolution_y = DPI;
+  s->swcrop = 1;
+  s->swskip = 10;
+  s->s_params.format = SANE_FRAME_JPEG;
+
+  *orig = compress (img, comps, restart, orig_len);
+  free (img);
+  s->buffers[0] = malloc (*orig_len);
+  assert (s->buffers[0]);
+  memcpy (s->buffers[0], *orig, *orig_len);
+  s->buff_rx[0] = s->buff_tot[0] = *orig_len;
+
+  memset (p, 0, sizeof (*p));
+  p->format = SANE_FRAME_JPEG;
+  p->depth = 8;
+  p->pixels_per_line = WIDTH;
+  p->lines = LINES;
+  p->bytes_per_line = WIDTH * comps;
+}
+
+/* the cropped jpeg decodes to the same pixels as the original */
+static void
+test_crop (int comps, int restart)
+{
+  struct fujitsu s;
+  SANE_Parameters p;
+  unsigned char *orig, *full, *crop;
+  unsigned long orig_len;
+  int fw, fl, cw, cl, left, top, x, y;
+
+  load_page (&s, &p, comps, 1, restart, &orig, &orig_len);
+  assert (buffer_crop_JPEG (&s, 0, &p) == SANE_STATUS_GOOD);
+  assert ((unsigned long) s.jpeg_len[0] < orig_len);
+
+  crop = decompress (s.buffers[0], s.jpeg_len[0], &cw, &cl);
+  full = decompress (orig, orig_len, &fw, &fl);
+  assert (cw == p.pixels_per_line && cl == p.lines);
+  assert (p.bytes_per_line == cw * comps);
+
+  /* the top left corner moves to a whole MCU, inside the border */
+  left = PAGE_L / 16 * 16;
+  top = PAGE_T / 16 * 16;
+  assert (cw < PAGE_R - left && cw > PAGE_R - left - 32);
+  assert (cl < PAGE_B - top && cl > PAGE_B - top - 32);
+  for (y = 0; y < cl; y++)
+    for (x = 0; x < cw * comps; x++)
+      assert (crop[y * cw * comps + x]
+	      == full[(y + top) * fw * comps + left * comps + x]);
+
+  free (crop);
+  free (full);
+  free (orig);
+  free (s.buffers[0]);
+  printf ("%s, restart %d: cropped to %dx%d, %lu -> %d bytes\n",
+	  comps == 3 ? "color" : "gray", restart, cw, cl, orig_len,
+	  s.jpeg_len[0]);
+}
+
+/* blank pages are found once the dark border is cropped away */
+static void
+test_blank (int comps, int text)
+{
+  struct fujitsu s;
+  SANE_Parameters p;
+  unsigned char *orig;
+  unsigned long orig_len;
+  int cropped = 0, blank;
+
+  load_page (&s, &p, comps, text, 0, &orig, &orig_len);
+  assert (!buffer_isblank_JPEG (&s, 0, &p));
+
+  blank = buffer_process (&s, 0, &p, 1, &cropped);
+  assert (cropped);
+  assert (blank == !text);
+
+  /* a broken image is never blank */
+  s.buff_rx[0] = 100;
+  assert (!buffer_isblank_JPEG (&s, 0, &p));
+
+  free (orig);
+  free (s.buffers[0]);
+  printf ("%s %s page: blank %d\n", comps == 3 ? "color" : "gray",
+	  text ? "text" : "empty", blank);
+}
+
+int
+main (void)
+{
+  test_crop (1, 0);
+  test_crop (3, 0);
+  test_crop (1, 7);
+  test_crop (3, 4);
+  test_blank (1, 0);
+  test_blank (1, 1);
+  test_blank (3, 0);
+  test_blank (3, 1);
+  return 0;
+}
+
+#else
+
+int
+main (void)
+{
+  /* skipped */
+  return 77;
+}
+
+#endif
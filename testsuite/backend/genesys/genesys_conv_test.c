@@ -0,0 +1,485 @@
+#include "../../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+/* the conversion filters are static functions of the genesys backend,
+ * not all of them are tested here */
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/genesys.h"
+#include "../../../include/sane/sanei_magic.h"
+#include "../../../backend/genesys_conv.c"
+
+/* simple reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+/* set by --bench, the timings are only printed by 'make bench' */
+static int bench;
+
+static double
+now (void)
+{
+  return (double) clock () / CLOCKS_PER_SEC;
+}
+
+/**
+ * create synthetic sensor lines: a ramp in every component with some
+ * noise, so neighbouring pixels and channels differ
+ */
+static uint8_t *
+make_lines (size_t size)
+{
+  uint8_t *buf = malloc (size);
+  size_t i;
+
+  assert (buf != NULL);
+  seed = size;
+  for (i = 0; i < size; i++)
+    buf[i] = (i / 7 + rnd ()) & 0xff;
+  return buf;
+}
+
+static unsigned int
+get_component (uint8_t * p, unsigned int i, int bytes)
+{
+  if (bytes == 1)
+    return p[i];
+  return ((uint16_t *) p)[i];
+}
+
+static void
+put_component (uint8_t * p, unsigned int i, int bytes, unsigned int v)
+{
+  if (bytes == 1)
+    p[i] = v;
+  else
+    ((uint16_t *) p)[i] = v;
+}
+
+/* the reference implementations below are the plain per byte and per
+ * pixel loops the genesys conversion filters started with */
+
+static void
+ref_reorder_cis (uint8_t * src_data, uint8_t * dst_data, unsigned int lines,
+		 unsigned int pixels, int bytes, int bgr)
+{
+  unsigned int x, y, c, b;
+  uint8_t *src[3];
+  uint8_t *dst = dst_data;
+  unsigned int rest = pixels * 2 * bytes;
+
+  for (c = 0; c < 3; c++)
+    src[c] = src_data + pixels * bytes * (bgr ? 2 - c : c);
+
+  for (y = 0; y < lines; y++)
+    {
+      for (x = 0; x < pixels; x++)
+	for (c = 0; c < 3; c++)
+	  {
+#ifdef WORDS_BIGENDIAN
+	    for (b = bytes; b > 0; b--)
+	      *dst++ = src[c][b - 1];
+	    src[c] += bytes;
+#else
+	    for (b = 0; b < (unsigned int) bytes; b++)
+	      *dst++ = *src[c]++;
+#endif
+	  }
+      for (c = 0; c < 3; c++)
+	src[c] += rest;
+    }
+}
+
+static void
+ref_reorder_bgr (uint8_t * src, uint8_t * dst, unsigned int lines,
+		 unsigned int pixels, int bytes)
+{
+  unsigned int c, k, b;
+
+  for (c = 0; c < lines * pixels; c++)
+    {
+      for (k = 0; k < 3; k++)
+	for (b = 0; b < (unsigned int) bytes; b++)
+#ifdef WORDS_BIGENDIAN
+	  *dst++ = src[(2 - k) * bytes + bytes - 1 - b];
+#else
+	  *dst++ = src[(2 - k) * bytes + b];
+#endif
+      src += 3 * bytes;
+    }
+}
+
+static void
+ref_reverse_ccd (uint8_t * src, uint8_t * dst, unsigned int lines,
+		 unsigned int pitch, unsigned int *ccd_shift,
+		 unsigned int component_count, int bytes)
+{
+  unsigned int x, y, c;
+  unsigned int s = 0, d = 0;
+
+  for (y = 0; y < lines; y++)
+    for (x = 0; x < pitch; x += component_count)
+      for (c = 0; c < component_count && c + x < pitch; c++)
+	{
+	  put_component (dst, d++, bytes,
+			 get_component (src, s + ccd_shift[c] * pitch, bytes));
+	  s++;
+	}
+}
+
+static void
+ref_shrink_lines (uint8_t * src_data, uint8_t * dst_data, unsigned int lines,
+		  unsigned int src_pixels, unsigned int dst_pixels,
+		  unsigned int channels, int bytes)
+{
+  unsigned int dst_x, src_x, y, c, cnt;
+  unsigned int avg[3];
+  unsigned int count;
+  unsigned int s = 0, d = 0;
+
+  if (src_pixels > dst_pixels)
+    {
+      for (c = 0; c < channels; c++)
+	avg[c] = 0;
+      for (y = 0; y < lines; y++)
+	{
+	  cnt = src_pixels / 2;
+	  src_x = 0;
+	  for (dst_x = 0; dst_x < dst_pixels; dst_x++)
+	    {
+	      count = 0;
+	      while (cnt < src_pixels && src_x < src_pixels)
+		{
+		  cnt += dst_pixels;
+		  for (c = 0; c < channels; c++)
+		    avg[c] += get_component (src_data, s++, bytes);
+		  src_x++;
+		  count++;
+		}
+	      cnt -= src_pixels;
+	      for (c = 0; c < channels; c++)
+		{
+		  put_component (dst_data, d++, bytes, avg[c] / count);
+		  avg[c] = 0;
+		}
+	    }
+	}
+    }
+  else
+    {
+      for (y = 0; y < lines; y++)
+	{
+	  cnt = dst_pixels / 2;
+	  dst_x = 0;
+	  for (src_x = 0; src_x < src_pixels; src_x++)
+	    {
+	      for (c = 0; c < channels; c++)
+		avg[c] = get_component (src_data, s++, bytes);
+	      while ((cnt < dst_pixels || src_x + 1 == src_pixels) &&
+		     dst_x < dst_pixels)
+		{
+		  cnt += src_pixels;
+		  for (c = 0; c < channels; c++)
+		    put_component (dst_data, d++, bytes, avg[c]);
+		  dst_x++;
+		}
+	      cnt -= dst_pixels;
+	    }
+	}
+    }
+}
+
+static void
+ref_double_bits (uint8_t * src, uint8_t * dst, unsigned int bytes)
+{
+  unsigned int c, val;
+
+  for (c = 0; c < bytes; c++)
+    {
+      val = 0;
+      val |= (*src & 0x80) >> 0;
+      val |= (*src & 0x80) >> 1;
+      val |= (*src & 0x40) >> 1;
+      val |= (*src & 0x40) >> 2;
+      val |= (*src & 0x20) >> 2;
+      val |= (*src & 0x20) >> 3;
+      val |= (*src & 0x10) >> 3;
+      val |= (*src & 0x10) >> 4;
+      *dst++ = val;
+
+      val = 0;
+      val |= (*src & 0x08) << 4;
+      val |= (*src & 0x08) << 3;
+      val |= (*src & 0x04) << 3;
+      val |= (*src & 0x04) << 2;
+      val |= (*src & 0x02) << 2;
+      val |= (*src & 0x02) << 1;
+      val |= (*src & 0x01) << 1;
+      val |= (*src & 0x01) << 0;
+      *dst++ = val;
+      src++;
+    }
+}
+
+static void
+report (const char *what, int depth, double ref_time, double time)
+{
+  if (bench)
+    printf ("  %s %d bit: %.3fs reference, %.3fs\n", what, depth, ref_time,
+	    time);
+}
+
+/**
+ * reorder the color components of lines as they come from cis and
+ * ccd sensors
+ */
+static void
+compare_reorder (unsigned int pixels, unsigned int lines)
+{
+  uint8_t *src, *ref, *dst;
+  size_t size;
+  double start, ref_time, time;
+  int bytes, bgr;
+
+  for (bytes = 1; bytes <= 2; bytes++)
+    {
+      size = (size_t) pixels * lines * 3 * bytes;
+      src = make_lines (size);
+      ref = malloc (size);
+      dst = malloc (size);
+      assert (ref != NULL && dst != NULL);
+
+      for (bgr = 0; bgr < 2; bgr++)
+	{
+	  start = now ();
+	  ref_reorder_cis (src, ref, lines, pixels, bytes, bgr);
+	  ref_time = now () - start;
+	  start = now ();
+	  if (bytes == 1)
+	    {
+	      if (bgr)
+		genesys_reorder_components_cis_bgr_8 (src, dst, lines, pixels);
+	      else
+		genesys_reorder_components_cis_8 (src, dst, lines, pixels);
+	    }
+	  else
+	    {
+	      if (bgr)
+		genesys_reorder_components_cis_bgr_16 (src, dst, lines,
+						       pixels);
+	      else
+		genesys_reorder_components_cis_16 (src, dst, lines, pixels);
+	    }
+	  time = now () - start;
+	  assert (memcmp (ref, dst, size) == 0);
+	  report (bgr ? "cis bgr" : "cis rgb", bytes * 8, ref_time, time);
+	}
+
+      start = now ();
+      ref_reorder_bgr (src, ref, lines, pixels, bytes);
+      ref_time = now () - start;
+      start = now ();
+      if (bytes == 1)
+	genesys_reorder_components_bgr_8 (src, dst, lines, pixels);
+      else
+	genesys_reorder_components_bgr_16 (src, dst, lines, pixels);
+      time = now () - start;
+      assert (memcmp (ref, dst, size) == 0);
+      report ("bgr", bytes * 8, ref_time, time);
+
+      /* in place */
+      memcpy (dst, src, size);
+      if (bytes == 1)
+	genesys_reorder_components_bgr_8 (dst, dst, lines, pixels);
+      else
+	genesys_reorder_components_bgr_16 (dst, dst, lines, pixels);
+      assert (memcmp (ref, dst, size) == 0);
+
+      free (src);
+      free (ref);
+      free (dst);
+    }
+}
+
+/**
+ * undo the line distance of staggered ccd sensors
+ */
+static void
+compare_reverse_ccd (unsigned int pixels, unsigned int lines,
+		     unsigned int channels, unsigned int shift_count)
+{
+  unsigned int ccd_shift[12];
+  uint8_t *src, *ref, *dst;
+  size_t size, line;
+  double start, ref_time, time;
+  unsigned int i;
+  int bytes;
+
+  for (i = 0; i < shift_count; i++)
+    ccd_shift[i] = (i % 2) * 4 + i / 2;
+
+  for (bytes = 1; bytes <= 2; bytes++)
+    {
+      line = (size_t) pixels * channels * bytes;
+      size = line * lines;
+      src = make_lines (size + line * 8);
+      ref = malloc (size);
+      dst = malloc (size);
+      assert (ref != NULL && dst != NULL);
+
+      start = now ();
+      ref_reverse_ccd (src, ref, lines, pixels * channels, ccd_shift,
+		       shift_count, bytes);
+      ref_time = now () - start;
+      start = now ();
+      if (bytes == 1)
+	genesys_reverse_ccd_8 (src, dst, lines, pixels * channels, ccd_shift,
+			       shift_count);
+      else
+	genesys_reverse_ccd_16 (src, dst, lines, pixels * channels,
+				ccd_shift, shift_count);
+      time = now () - start;
+      assert (memcmp (ref, dst, size) == 0);
+      report ("reverse ccd", bytes * 8, ref_time, time);
+
+      free (src);
+      free (ref);
+      free (dst);
+    }
+}
+
+/**
+ * shrink or grow lines from the sensor resolution to the requested one
+ */
+static void
+compare_shrink (unsigned int src_pixels, unsigned int dst_pixels,
+		unsigned int lines, unsigned int channels)
+{
+  uint8_t *src, *ref, *dst;
+  size_t dst_size;
+  double start, ref_time, time;
+  int bytes;
+
+  if (bench)
+    printf (" %u -> %u pixels, %u channels:\n", src_pixels, dst_pixels,
+	    channels);
+
+  for (bytes = 1; bytes <= 2; bytes++)
+    {
+      src = make_lines ((size_t) src_pixels * lines * channels * bytes);
+      dst_size = (size_t) dst_pixels * lines * channels * bytes;
+      ref = malloc (dst_size);
+      dst = malloc (dst_size);
+      assert (ref != NULL && dst != NULL);
+
+      start = now ();
+      ref_shrink_lines (src, ref, lines, src_pixels, dst_pixels, channels,
+			bytes);
+      ref_time = now () - start;
+      start = now ();
+      if (bytes == 1)
+	assert (genesys_shrink_lines_8 (src, dst, lines, src_pixels,
+					dst_pixels, channels)
+		== SANE_STATUS_GOOD);
+      else
+	assert (genesys_shrink_lines_16 (src, dst, lines, src_pixels,
+					 dst_pixels, channels)
+		== SANE_STATUS_GOOD);
+      time = now () - start;
+      assert (memcmp (ref, dst, dst_size) == 0);
+      report ("shrink", bytes * 8, ref_time, time);
+
+      free (src);
+      free (ref);
+      free (dst);
+    }
+}
+
+/**
+ * double the width of lineart lines
+ */
+static void
+compare_grow_lineart (unsigned int pixels, unsigned int lines)
+{
+  uint8_t *src, *ref, *dst;
+  size_t size = (size_t) pixels / 8 * lines;
+  double start, ref_time, time;
+
+  src = make_lines (size);
+  ref = malloc (size * 2);
+  dst = malloc (size * 2);
+  assert (ref != NULL && dst != NULL);
+
+  start = now ();
+  ref_double_bits (src, ref, size);
+  ref_time = now () - start;
+  start = now ();
+  assert (genesys_shrink_lines_1 (src, dst, lines, pixels, pixels * 2, 1)
+	  == SANE_STATUS_GOOD);
+  time = now () - start;
+  assert (memcmp (ref, dst, size * 2) == 0);
+  report ("grow lineart", 1, ref_time, time);
+
+  free (src);
+  free (ref);
+  free (dst);
+}
+
+/**
+ * run the conversion filters on synthetic sensor lines, every filter
+ * must give the same result as the plain reference implementation
+ */
+static void
+genesys_conv_suite (void)
+{
+  /* A4 width at 2400 dpi */
+  if (bench)
+    printf ("reorder, 20400 pixels:\n");
+  compare_reorder (20400, 100);
+  compare_reorder (17, 3);
+
+  if (bench)
+    printf ("reverse ccd, 20400 pixels:\n");
+  compare_reverse_ccd (20400, 100, 3, 3);
+  compare_reverse_ccd (20400, 100, 1, 4);
+  compare_reverse_ccd (101, 5, 3, 4);
+
+  if (bench)
+    printf ("shrink:\n");
+  compare_shrink (20400, 5100, 100, 3);
+  compare_shrink (20400, 6800, 100, 1);
+  compare_shrink (10200, 7000, 100, 3);
+  compare_shrink (5100, 10200, 50, 3);
+  compare_shrink (4000, 7001, 50, 1);
+  compare_shrink (1000, 999, 10, 3);
+
+  compare_grow_lineart (10200, 200);
+}
+
+/**
+ * main function to run the test suites
+ */
+int
+main (int argc, char **argv)
+{
+  bench = argc > 1 && strcmp (argv[1], "--bench") == 0;
+
+  /* run suites */
+  genesys_conv_suite ();
+
+  return 0;
+}
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
@@ -0,0 +1,497 @@
+#include "../../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+/* the image processing functions are static functions of the plustek
+ * backend, the device access they need is replaced by stubs */
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../include/sane/sane.h"
+#include "../../../include/sane/sanei.h"
+#include "../../../include/sane/sanei_backend.h"
+#include "../../../include/sane/sanei_thread.h"
+#include "../../../backend/plustek-usb.h"
+#include "../../../backend/plustek.h"
+
+#define _DBG_ERROR      1
+#define _DBG_INFO       5
+#define _DBG_READ      30
+
+/* from plustek-usbdevs.c */
+#define _ONE_CH_COLOR 0x04
+
+static SANE_Bool
+usb_IsCISDevice (Plustek_Device * dev)
+{
+  return (dev->usbDev.HwSetting.bReg_0x26 & _ONE_CH_COLOR);
+}
+
+/* set to run the checks as if on a big endian host */
+static SANE_Bool big_endian;
+
+static SANE_Bool
+usb_HostSwap (void)
+{
+  u_short pattern = 0xfeed;
+
+  if (big_endian)
+    return SANE_FALSE;
+  return ((u_char *) & pattern)[0] != 0xfe;
+}
+
+static SANE_Bool
+usb_IsEscPressed (void)
+{
+  return SANE_FALSE;
+}
+
+static SANE_Bool
+usb_ScanReadImage (Plustek_Device * dev, void *buf, u_long len)
+{
+  (void) dev;
+  (void) buf;
+  (void) len;
+  return SANE_FALSE;
+}
+
+static SANE_Status
+sanei_lm983x_write (SANE_Int fd, SANE_Byte reg, SANE_Byte * buf,
+		    SANE_Word len, SANE_Bool increment)
+{
+  (void) fd;
+  (void) reg;
+  (void) buf;
+  (void) len;
+  (void) increment;
+  return SANE_STATUS_GOOD;
+}
+
+static void
+dumpPic (char *name, SANE_Byte * buffer, u_long len, int is_gray)
+{
+  (void) name;
+  (void) buffer;
+  (void) len;
+  (void) is_gray;
+}
+
+#include "../../../backend/plustek-usbimg.c"
+
+/* simple reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static double
+now (void)
+{
+  return (double) clock () / CLOCKS_PER_SEC;
+}
+
+#define PIXELS  5100
+#define PHY_DPI 600
+
+enum
+{
+  FMT_COLOR8, FMT_COLOR16, FMT_COLOR_PSEUDO16, FMT_COLOR_GRAY8,
+  FMT_COLOR_GRAY16, FMT_COLOR_BW, FMT_GRAY8, FMT_GRAY16, FMT_GRAY_PSEUDO16,
+  FMT_NUM_FORMATS
+};
+
+static Plustek_Device dev;
+static u_char src[PHY_DPI * 17 * 3 * 2 + 64];
+static u_char out[PIXELS * 3 * 2];
+static u_char expected[PIXELS * 3 * 2];
+static u_long map[PIXELS];
+
+/**
+ * the pixel mapping of the DDA scaler formerly used in every scale
+ * function
+ */
+static void
+ref_map (u_long pixels, int user_dpi)
+{
+  int izoom, ddax;
+  u_long i, k;
+
+  if (user_dpi == PHY_DPI)
+    {
+      for (i = 0; i < pixels; i++)
+	map[i] = i;
+      return;
+    }
+
+  izoom = (int) (1.0 / ((double) user_dpi / (double) PHY_DPI) * 1000);
+  for (i = 0, k = 0, ddax = 0; i < pixels; k++)
+    {
+      ddax -= 1000;
+      while (ddax < 0 && i < pixels)
+	{
+	  map[i++] = k;
+	  ddax += izoom;
+	}
+    }
+}
+
+/**
+ * set up the scan parameters and the source lines for a format
+ */
+static void
+setup (int format, int cis, int adf, int user_dpi, u_long pixels)
+{
+  ScanDef *scan = &dev.scanning;
+  u_long i, bps, line;
+
+  scan->sParam.Size.dwPixels = pixels;
+  scan->sParam.Size.dwPhyPixels = pixels * PHY_DPI / user_dpi + 2;
+  scan->sParam.UserDpi.x = user_dpi;
+  scan->sParam.PhyDpi.x = PHY_DPI;
+  scan->sParam.bSource = adf ? SOURCE_ADF : SOURCE_Reflection;
+  scan->dwFlag = 0;
+  scan->fGrayFromColor = 0;
+  dev.usbDev.HwSetting.bReg_0x26 = cis ? _ONE_CH_COLOR : 0;
+  dev.usbDev.HwSetting.chip = _LM9832;
+
+  switch (format)
+    {
+    case FMT_GRAY8:
+    case FMT_GRAY16:
+    case FMT_GRAY_PSEUDO16:
+      scan->sParam.bDataType = SCANDATATYPE_Gray;
+      break;
+    default:
+      scan->sParam.bDataType = SCANDATATYPE_Color;
+      break;
+    }
+  scan->sParam.bBitDepth = 8;
+  if (format == FMT_COLOR16 || format == FMT_COLOR_GRAY16
+      || format == FMT_GRAY16)
+    {
+      scan->sParam.bBitDepth = 16;
+      scan->dwFlag |= SCANFLAG_RightAlign;
+    }
+  if (format == FMT_COLOR_PSEUDO16 || format == FMT_GRAY_PSEUDO16)
+    scan->dwFlag |= SCANFLAG_Pseudo48;
+  if (format == FMT_COLOR_GRAY8 || format == FMT_COLOR_GRAY16)
+    scan->fGrayFromColor = 3;
+  if (format == FMT_COLOR_BW)
+    scan->fGrayFromColor = 10;
+
+  for (i = 0; i < sizeof (src); i++)
+    src[i] = (format == FMT_COLOR_BW && rnd () % 3 == 0) ? 0 : rnd ();
+
+  bps = scan->sParam.bBitDepth > 8 ? 2 : 1;
+  line = scan->sParam.Size.dwPhyPixels * bps;
+  if (cis || scan->sParam.bDataType == SCANDATATYPE_Gray)
+    {
+      scan->Red.pb = src;
+      scan->Green.pb = src + line;
+      scan->Blue.pb = src + line * 2;
+    }
+  else
+    {
+      scan->Red.pb = src;
+      scan->Green.pb = src + bps;
+      scan->Blue.pb = src + bps * 2;
+    }
+  scan->UserBuf.pb = out;
+
+  memset (out, 0x5a, sizeof (out));
+  memset (expected, 0x5a, sizeof (expected));
+}
+
+static u_short
+ref_word (const u_char * p)
+{
+  return p[0] * 256 + p[1];
+}
+
+/**
+ * compute the expected user line, pixel by pixel
+ */
+static void
+expect (int format, int cis, int adf, u_long pixels)
+{
+  ScanDef *scan = &dev.scanning;
+  u_short *exp16 = (u_short *) expected;
+  const u_char *ch[3];
+  u_long p, k, c, b, stride, prev;
+  u_char d;
+  int ls = 2;
+
+  ch[0] = scan->Red.pb;
+  ch[1] = scan->Green.pb;
+  ch[2] = scan->Blue.pb;
+  if (scan->sParam.bDataType == SCANDATATYPE_Gray || cis)
+    stride = 1;
+  else
+    stride = 3;
+  if (scan->sParam.bBitDepth > 8)
+    stride *= 2;
+
+  if (format == FMT_COLOR_BW)
+    {
+      for (b = 0; b < pixels / 8; b++)
+	{
+	  d = 0;
+	  for (p = b * 8; p < b * 8 + 8; p++)
+	    d = (d << 1) | (ch[1][map[p] * stride] != 0);
+	  expected[adf ? pixels - 1 - b : b] = d;
+	}
+      return;
+    }
+
+  for (p = 0; p < pixels; p++)
+    {
+      k = map[adf ? pixels - 1 - p : p];
+      prev = k ? k - 1 : 0;
+      switch (format)
+	{
+	case FMT_COLOR8:
+	  for (c = 0; c < 3; c++)
+	    expected[p * 3 + c] = ch[c][k * stride];
+	  break;
+	case FMT_COLOR16:
+	  for (c = 0; c < 3; c++)
+	    exp16[p * 3 + c] = ref_word (ch[c] + k * stride) >> ls;
+	  break;
+	case FMT_COLOR_PSEUDO16:
+	  for (c = 0; c < 3; c++)
+	    exp16[p * 3 + c] = (ch[c][prev * stride] + ch[c][k * stride]) << 7;
+	  break;
+	case FMT_COLOR_GRAY8:
+	  expected[p] = ch[2][k * stride];
+	  break;
+	case FMT_COLOR_GRAY16:
+	  exp16[p] = ref_word (ch[2] + k * stride) >> ls;
+	  break;
+	case FMT_GRAY8:
+	  expected[p] = ch[1][k];
+	  break;
+	case FMT_GRAY16:
+	  exp16[p] = ref_word (ch[1] + k * 2) >> ls;
+	  break;
+	case FMT_GRAY_PSEUDO16:
+	  exp16[p] = (u_short) ((ch[1][prev] + ch[1][k]) << 7);
+	  break;
+	}
+    }
+}
+
+/**
+ * every format, for CCD and CIS devices, normal and mirrored (ADF), copied
+ * and scaled
+ */
+static void
+check_formats (void)
+{
+  static const int dpis[] = { 600, 400, 300, 200, 150, 75 };
+  int format, cis, adf;
+  u_long d, pixels;
+
+  for (format = 0; format < FMT_NUM_FORMATS; format++)
+    for (cis = 0; cis < 2; cis++)
+      for (adf = 0; adf < 2; adf++)
+	for (d = 0; d < sizeof (dpis) / sizeof (dpis[0]); d++)
+	  {
+	    /* odd sizes too, for the incomplete last byte of lineart */
+	    pixels = (PIXELS - 16) * dpis[d] / PHY_DPI + d;
+
+	    setup (format, cis, adf, dpis[d], pixels);
+	    ref_map (pixels, dpis[d]);
+	    expect (format, cis, adf, pixels);
+
+	    assert (usb_GetImageProc (&dev));
+	    assert ((dpis[d] == PHY_DPI) == (dev.scanning.pScaleIdx == NULL));
+	    dev.scanning.pfnProcess (&dev);
+	    assert (memcmp (out, expected, sizeof (out)) == 0);
+	  }
+
+  free (dev.scanning.pScaleIdx);
+  dev.scanning.pScaleIdx = NULL;
+}
+
+/**
+ * negatives and slides above 800 dpi are averaged with the neighbouring
+ * pixel, the scaled 16 bit gray line must be picked from the averaged line
+ * like the copied one
+ */
+static void
+check_average (void)
+{
+  static u_char line[sizeof (src)];
+  static u_short copy[PIXELS];
+  ScanDef *scan = &dev.scanning;
+  u_long p, pixels = PIXELS / 2;
+  int cis;
+
+  for (cis = 0; cis < 2; cis++)
+    {
+      setup (FMT_COLOR_GRAY16, cis, 0, PHY_DPI, pixels);
+      scan->sParam.bSource = SOURCE_Negative;
+      scan->sParam.PhyDpi.x = scan->sParam.UserDpi.x = 1200;
+      memcpy (line, src, sizeof (src));
+
+      assert (usb_GetImageProc (&dev));
+      dev.scanning.pfnProcess (&dev);
+      memcpy (copy, out, pixels * 2);
+
+      memcpy (src, line, sizeof (src));
+      scan->sParam.UserDpi.x = 600;
+      scan->sParam.Size.dwPixels = pixels / 2;
+      assert (usb_GetImageProc (&dev));
+      dev.scanning.pfnProcess (&dev);
+      for (p = 0; p < pixels / 2; p++)
+	assert (((u_short *) out)[p] == copy[scan->pScaleIdx[p]]);
+
+      free (scan->pScaleIdx);
+      scan->pScaleIdx = NULL;
+    }
+}
+
+/**
+ * the per pixel 16 bit color scaling formerly used
+ */
+static void
+ref_ColorScale16 (Plustek_Device * pdev)
+{
+  u_char ls;
+  int izoom, ddax, next;
+  u_long dw, pixels, bitsput;
+  SANE_Bool swap = usb_HostSwap ();
+  ScanDef *scan = &pdev->scanning;
+
+  dw = scan->sParam.Size.dwPixels;
+  next = 1;
+  pixels = 0;
+  izoom = usb_GetScaler (scan);
+  ls = (scan->dwFlag & SCANFLAG_RightAlign) ? Shift : 0;
+
+  for (bitsput = 0, ddax = 0; dw; bitsput++)
+    {
+      ddax -= _SCALER;
+      while ((ddax < 0) && (dw > 0))
+	{
+	  if (swap)
+	    {
+	      scan->UserBuf.pw_rgb[pixels].Red =
+		_HILO2WORD (scan->Red.pcw[bitsput].HiLo[0]) >> ls;
+	      scan->UserBuf.pw_rgb[pixels].Green =
+		_HILO2WORD (scan->Green.pcw[bitsput].HiLo[0]) >> ls;
+	      scan->UserBuf.pw_rgb[pixels].Blue =
+		_HILO2WORD (scan->Blue.pcw[bitsput].HiLo[0]) >> ls;
+	    }
+	  else
+	    {
+	      scan->UserBuf.pw_rgb[pixels].Red = scan->Red.pw[bitsput] >> ls;
+	      scan->UserBuf.pw_rgb[pixels].Green =
+		scan->Green.pw[bitsput] >> ls;
+	      scan->UserBuf.pw_rgb[pixels].Blue = scan->Blue.pw[bitsput] >> ls;
+	    }
+	  pixels += next;
+	  ddax += izoom;
+	  dw--;
+	}
+    }
+}
+
+/**
+ * the per pixel 16 bit gray copy formerly used
+ */
+static void
+ref_GrayDuplicate16 (Plustek_Device * pdev)
+{
+  u_char ls;
+  u_short *dest;
+  u_long pixels;
+  HiLoDef *pwm;
+  ScanDef *scan = &pdev->scanning;
+  SANE_Bool swap = usb_HostSwap ();
+
+  dest = scan->UserBuf.pw;
+  ls = (scan->dwFlag & SCANFLAG_RightAlign) ? Shift : 0;
+
+  pwm = scan->Green.philo;
+  for (pixels = scan->sParam.Size.dwPixels; pixels--; pwm++, dest++)
+    {
+      if (swap)
+	*dest = (_PHILO2WORD (pwm)) >> ls;
+      else
+	*dest = (_PLOHI2WORD (pwm)) >> ls;
+    }
+}
+
+static void
+bench (const char *what, int format, int user_dpi,
+       void (*ref) (Plustek_Device *))
+{
+  double start, ref_time, time;
+  u_long pixels = PIXELS * user_dpi / PHY_DPI;
+  int i;
+
+  setup (format, 0, 0, user_dpi, pixels);
+  ref_map (pixels, user_dpi);
+  expect (format, 0, 0, pixels);
+  assert (usb_GetImageProc (&dev));
+
+  start = now ();
+  for (i = 0; i < 2000; i++)
+    ref (&dev);
+  ref_time = now () - start;
+  assert (memcmp (out, expected, sizeof (out)) == 0);
+
+  start = now ();
+  for (i = 0; i < 2000; i++)
+    dev.scanning.pfnProcess (&dev);
+  time = now () - start;
+  assert (memcmp (out, expected, sizeof (out)) == 0);
+
+  printf ("%s: %.3fs reference, %.3fs\n", what, ref_time, time);
+
+  free (dev.scanning.pScaleIdx);
+  dev.scanning.pScaleIdx = NULL;
+}
+
+/**
+ * main function to run the test suites
+ */
+int
+main (int argc, char **argv)
+{
+  check_formats ();
+  check_average ();
+
+  /* no format may depend on the byte order of the host */
+  big_endian = SANE_TRUE;
+  check_formats ();
+  check_average ();
+  big_endian = SANE_FALSE;
+
+  /* a speed comparison over synthetic lines for 'make bench', the output
+   * is only a hint as the test machine may be busy */
+  if (argc > 1 && strcmp (argv[1], "--bench") == 0)
+    {
+      bench ("color 16 bit 600 -> 400 dpi", FMT_COLOR16, 400,
+	     ref_ColorScale16);
+      bench ("gray 16 bit 600 dpi", FMT_GRAY16, PHY_DPI, ref_GrayDuplicate16);
+    }
+
+  return 0;
+}
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
@@ -0,0 +1,286 @@
+#include "../../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the backend is included, the usb transfers go to a fake scanner which
+ * feeds a fixed number of sheets and keeps a count of the commands */
+#define sanei_usb_write_bulk fake_usb_write_bulk
+#define sanei_usb_read_bulk fake_usb_read_bulk
+#define BACKEND_NAME canon_dr
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/canon_dr.c"
+#include "../../../backend/sane_strstatus.c"
+
+#include "read_ahead_test.h"
+
+#define SHEETS 5
+#define WIDTH 850
+#define LINES 1100
+#define SIDE_BYTES (WIDTH * LINES)
+
+static unsigned sheets_loaded;	/* sheets put in the feeder */
+static unsigned sheets_fed;	/* sheets taken from the feeder */
+static unsigned sent;		/* bytes of the sheet sent */
+static unsigned reads;		/* read image data commands */
+static unsigned feeds;		/* object position load commands */
+static int interlaced;		/* both sides come as one stream */
+
+static unsigned char cmd[USB_COMMAND_LEN];
+static int data_phase;		/* the command reads data before the status */
+static unsigned char status;
+static unsigned short_by;	/* bytes asked for but not sent */
+static int empty;		/* the feeder was empty */
+
+/* a command, or the data sent with one */
+SANE_Status
+fake_usb_write_bulk (SANE_Int __sane_unused__ dn, const SANE_Byte * buffer,
+		     size_t * size)
+{
+  if (*size != USB_HEADER_LEN + USB_COMMAND_LEN || buffer[6] != 0x90)
+    return SANE_STATUS_GOOD;
+
+  TRACE_LOCK ();
+  memcpy (cmd, buffer + USB_HEADER_LEN, sizeof (cmd));
+  status = 0;
+  data_phase = cmd[0] == READ_code || cmd[0] == REQUEST_SENSE_code;
+  if (cmd[0] == OBJECT_POSITION_code && (cmd[1] & 7) == OP_Feed)
+    {
+      feeds++;
+      if (sheets_fed < sheets_loaded)
+	{
+	  sheets_fed++;
+	  sent = 0;
+	}
+      else
+	{
+	  status = 2;
+	  empty = 1;
+	}
+    }
+  TRACE_UNLOCK ();
+  return SANE_STATUS_GOOD;
+}
+
+/* the data asked for by read and request sense, then the status */
+SANE_Status
+fake_usb_read_bulk (SANE_Int __sane_unused__ dn, SANE_Byte * buffer,
+		    size_t * size)
+{
+  unsigned n, i, side_end;
+
+  TRACE_LOCK ();
+  if (data_phase && cmd[0] == READ_code && cmd[2] == SR_datatype_image)
+    {
+      reads++;
+      /* a short block ends each side */
+      side_end = sent < SIDE_BYTES && !interlaced ? SIDE_BYTES
+	: 2 * SIDE_BYTES;
+      n = *size;
+      if (n > side_end - sent)
+	{
+	  n = side_end - sent;
+	  short_by = *size - n;
+	  status = 2;
+	}
+      for (i = 0; i < n; i++)
+	buffer[i] = pattern (sheets_fed, sent + i);
+      sent += n;
+      *size = n;
+    }
+  else if (data_phase && cmd[0] == REQUEST_SENSE_code)
+    {
+      memset (buffer, 0, *size);
+      buffer[0] = 0x70;
+      if (empty)
+	{
+	  buffer[2] = 3;
+	  buffer[12] = 0x3a;
+	}
+      else if (short_by)
+	{
+	  buffer[2] = 0x20;
+	  putnbyte (buffer + 3, short_by, 4);
+	}
+      empty = 0;
+      short_by = 0;
+    }
+  else if (data_phase)
+    memset (buffer, 0, *size);
+  else
+    {
+      memset (buffer, 0, *size);
+      buffer[USB_STATUS_LEN - 1] = status;
+      *size = USB_STATUS_LEN;
+      status = 0;
+    }
+  data_phase = 0;
+  TRACE_UNLOCK ();
+  return SANE_STATUS_GOOD;
+}
+
+static struct scanner *
+open_scanner (int source, int interlace)
+{
+  struct scanner *s = calloc (1, sizeof (*s));
+
+  assert (s);
+  s->connection = CONNECTION_USB;
+  s->fd = 0;
+  s->buffer_size = 65536;
+  s->can_grayscale = 1;
+  s->step_x_res = 1;
+  s->ppl_mod = 1;
+
+  s->u.source = source;
+  s->duplex_interlace = interlace;
+  s->u.mode = MODE_GRAYSCALE;
+  s->u.dpi_x = s->u.dpi_y = 100;
+  s->u.br_x = s->u.page_x = WIDTH * 12;
+  s->u.br_y = s->u.page_y = LINES * 12;
+
+  TRACE_LOCK ();
+  interlaced = source == SOURCE_ADF_DUPLEX
+    && interlace != DUPLEX_INTERLACE_NONE;
+  sheets_loaded = SHEETS;
+  sheets_fed = 0;
+  reads = 0;
+  feeds = 0;
+  TRACE_UNLOCK ();
+  return s;
+}
+
+static void
+close_scanner (struct scanner *s)
+{
+  sane_cancel (s);
+  assert (!s->ahead);
+  free (s->buffers[SIDE_FRONT]);
+  free (s->buffers[SIDE_BACK]);
+  free_line_plan (s);
+  free (s);
+}
+
+static void
+test_same_data (int source, int interlace, const char *name)
+{
+  struct scanner *s;
+  unsigned long sync_sum, ahead_sum;
+  unsigned sync_images, ahead_images;
+  unsigned sync_reads, sync_feeds;
+  unsigned sides = source == SOURCE_ADF_DUPLEX ? 2 : 1;
+
+  s = open_scanner (source, interlace);
+  sync_sum = scan_all (s, &sync_images);
+  sync_reads = reads;
+  sync_feeds = feeds;
+  close_scanner (s);
+  assert (sync_images == SHEETS * sides);
+
+  s = open_scanner (source, interlace);
+  s->read_ahead = 3;
+  ahead_sum = scan_all (s, &ahead_images);
+  assert (sync_sum == ahead_sum);
+  assert (sync_images == ahead_images);
+  /* the same commands are sent, only from the thread, except that
+   * sane_start tries to feed from the empty feeder again */
+  assert (sync_reads == reads);
+  assert (sync_feeds + 1 == feeds);
+  close_scanner (s);
+
+  printf ("%s: %u images, read ahead gives the same data\n", name,
+	  ahead_images);
+}
+
+#ifdef USE_PTHREAD
+/* the first sheet of a batch is read directly, the thread starts with
+ * the second one */
+static void
+test_limit (int megabytes)
+{
+  struct scanner *s;
+  struct read_ahead *a;
+  int sheets;
+
+  s = open_scanner (SOURCE_ADF_FRONT, DUPLEX_INTERLACE_NONE);
+  s->read_ahead = megabytes;
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  assert (!s->ahead);
+  read_image (s);
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  a = s->ahead;
+  assert (a);
+
+  sheets = megabytes * 1024 * 1024 / SIDE_BYTES;
+  if (!sheets)
+    sheets = 1;
+  assert (a->sheets == sheets);
+
+  /* the frontend is slow, the thread fills all slots and waits. the
+   * sheet being read keeps its slot, unless it was read to the end
+   * before sane_start got it */
+  AHEAD_WAIT (a, AHEAD_FULL (a));
+  assert ((int) sheets_fed == 1 + sheets + !a->taken);
+
+  /* its slot is free once it is read */
+  read_image (s);
+  assert (!a->taken);
+  AHEAD_WAIT (a, AHEAD_FULL (a));
+  assert ((int) sheets_fed == 2 + sheets);
+
+  /* cancel with sheets still queued */
+  close_scanner (s);
+  assert ((int) sheets_fed == 2 + sheets);
+
+  printf ("%d MB: %d sheets of %d bytes read ahead\n", megabytes, sheets,
+	  SIDE_BYTES);
+}
+
+/* the thread finds the feeder empty, more paper is loaded before the
+ * frontend gets there, and the scan goes on */
+static void
+test_late_paper (void)
+{
+  struct scanner *s;
+  unsigned images;
+
+  s = open_scanner (SOURCE_ADF_FRONT, DUPLEX_INTERLACE_NONE);
+  s->read_ahead = 3;
+  TRACE_LOCK ();
+  sheets_loaded = 2;
+  TRACE_UNLOCK ();
+
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  read_image (s);
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  AHEAD_WAIT (s->ahead, s->ahead->done);
+  read_image (s);
+
+  TRACE_LOCK ();
+  sheets_loaded = SHEETS;
+  TRACE_UNLOCK ();
+  scan_all (s, &images);
+  assert (images == SHEETS - 2);
+  assert (sheets_fed == SHEETS);
+  close_scanner (s);
+
+  printf ("paper loaded after the thread stopped is scanned\n");
+}
+#endif
+
+int
+main (void)
+{
+  test_same_data (SOURCE_ADF_FRONT, DUPLEX_INTERLACE_NONE, "simplex");
+  test_same_data (SOURCE_ADF_DUPLEX, DUPLEX_INTERLACE_FBfb, "duplex");
+  test_same_data (SOURCE_ADF_DUPLEX, DUPLEX_INTERLACE_NONE,
+		  "duplex, one side after the other");
+#ifdef USE_PTHREAD
+  test_limit (1);
+  test_limit (3);
+  test_late_paper ();
+#endif
+  return 0;
+}
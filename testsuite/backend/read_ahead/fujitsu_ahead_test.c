@@ -0,0 +1,293 @@
+#include "../../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the backend is included, the usb transfers go to a fake scanner which
+ * feeds a fixed number of sheets and keeps a count of the commands */
+#define sanei_usb_write_bulk fake_usb_write_bulk
+#define sanei_usb_read_bulk fake_usb_read_bulk
+#define BACKEND_NAME fujitsu
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/fujitsu.c"
+#include "../../../backend/sane_strstatus.c"
+
+#include "read_ahead_test.h"
+
+#define SHEETS 7
+#define WIDTH 850
+#define LINES 1100
+#define SIDE_BYTES (WIDTH * LINES)
+
+static unsigned sheets_loaded;	/* sheets put in the feeder */
+static unsigned sheets_fed;	/* sheets taken from the feeder */
+static unsigned sent[2];	/* bytes of each side of the sheet sent */
+static unsigned reads;		/* read image data commands */
+static unsigned feeds;		/* object position commands */
+
+static unsigned char cmd[USB_COMMAND_LEN - USB_COMMAND_OFFSET];
+static unsigned char status;
+static int check_condition;	/* the feeder was empty */
+
+/* a command, or the data sent with one */
+SANE_Status
+fake_usb_write_bulk (SANE_Int __sane_unused__ dn, const SANE_Byte * buffer,
+		     size_t * size)
+{
+  if (*size != USB_COMMAND_LEN || buffer[0] != USB_COMMAND_CODE)
+    return SANE_STATUS_GOOD;
+
+  TRACE_LOCK ();
+  memcpy (cmd, buffer + USB_COMMAND_OFFSET, sizeof (cmd));
+  status = 0;
+  if (cmd[0] == OBJECT_POSITION_code && (cmd[1] & 7) == OP_Feed)
+    {
+      feeds++;
+      if (sheets_fed < sheets_loaded)
+	{
+	  sheets_fed++;
+	  sent[0] = sent[1] = 0;
+	}
+      else
+	{
+	  status = 2;
+	  check_condition = 1;
+	}
+    }
+  TRACE_UNLOCK ();
+  return SANE_STATUS_GOOD;
+}
+
+/* the data asked for by read and request sense, then the status */
+SANE_Status
+fake_usb_read_bulk (SANE_Int __sane_unused__ dn, SANE_Byte * buffer,
+		    size_t * size)
+{
+  unsigned n, i;
+  int side;
+
+  TRACE_LOCK ();
+  if (cmd[0] == READ_code && cmd[2] == R_datatype_imagedata)
+    {
+      side = cmd[5] == WD_wid_back;
+      reads++;
+      n = *size;
+      if (n > SIDE_BYTES - sent[side])
+	n = SIDE_BYTES - sent[side];
+      for (i = 0; i < n; i++)
+	buffer[i] = pattern (sheets_fed * 2 + side, sent[side] + i);
+      sent[side] += n;
+      *size = n;
+      cmd[0] = 0;
+    }
+  else if (cmd[0] == READ_code && cmd[2] == R_datatype_pixelsize)
+    {
+      memset (buffer, 0, *size);
+      putnbyte (buffer, WIDTH, 4);
+      putnbyte (buffer + 4, LINES, 4);
+      cmd[0] = 0;
+    }
+  else if (cmd[0] == REQUEST_SENSE_code)
+    {
+      memset (buffer, 0, *size);
+      if (check_condition)
+	{
+	  buffer[0] = 0x70;
+	  buffer[2] = 3;
+	  buffer[12] = 0x80;
+	  buffer[13] = 0x03;
+	}
+      check_condition = 0;
+      cmd[0] = 0;
+    }
+  else
+    {
+      memset (buffer, 0, *size);
+      buffer[0] = USB_STATUS_CODE;
+      buffer[USB_STATUS_OFFSET] = status;
+      *size = USB_STATUS_LEN;
+    }
+  TRACE_UNLOCK ();
+  return SANE_STATUS_GOOD;
+}
+
+static struct fujitsu *
+open_scanner (int source, int interlace)
+{
+  struct fujitsu *s = calloc (1, sizeof (*s));
+  int i;
+
+  assert (s);
+  s->connection = CONNECTION_USB;
+  s->fd = 0;
+  s->buffer_size = 65536;
+  s->has_pixelsize = 1;
+  s->has_vuid_mono = 1;
+  s->no_wait_after_op = 1;
+  s->brightness_steps = s->contrast_steps = 1;
+  for (i = MODE_LINEART; i <= MODE_COLOR; i++)
+    s->ppl_mod_by_mode[i] = i < MODE_GRAYSCALE ? 8 : 1;
+
+  s->source = source;
+  s->duplex_interlace = interlace;
+  s->s_mode = s->u_mode = MODE_GRAYSCALE;
+  s->basic_x_res = s->basic_y_res = 600;
+  s->resolution_x = s->resolution_y = 100;
+  s->br_x = s->page_width = WIDTH * 12;
+  s->br_y = s->page_height = LINES * 12;
+
+  TRACE_LOCK ();
+  sheets_loaded = SHEETS;
+  sheets_fed = 0;
+  reads = 0;
+  feeds = 0;
+  TRACE_UNLOCK ();
+  return s;
+}
+
+static void
+close_scanner (struct fujitsu *s)
+{
+  sane_cancel (s);
+  assert (!s->ahead);
+  free (s->buffers[SIDE_FRONT]);
+  free (s->buffers[SIDE_BACK]);
+  free (s);
+}
+
+static void
+test_same_data (int source, int interlace, const char *name)
+{
+  struct fujitsu *s;
+  unsigned long sync_sum, ahead_sum;
+  unsigned sync_images, ahead_images;
+  unsigned sync_reads, sync_feeds;
+  unsigned sides = source == SOURCE_ADF_DUPLEX ? 2 : 1;
+
+  s = open_scanner (source, interlace);
+  sync_sum = scan_all (s, &sync_images);
+  sync_reads = reads;
+  sync_feeds = feeds;
+  close_scanner (s);
+  assert (sync_images == SHEETS * sides);
+
+  s = open_scanner (source, interlace);
+  s->read_ahead = 3;
+  ahead_sum = scan_all (s, &ahead_images);
+  assert (sync_sum == ahead_sum);
+  assert (sync_images == ahead_images);
+  /* the same commands are sent, only from the thread, except that
+   * sane_start tries to feed from the empty feeder again */
+  assert (sync_reads == reads);
+  assert (sync_feeds + 1 == feeds);
+  close_scanner (s);
+
+  printf ("%s: %u images, read ahead gives the same data\n", name,
+	  ahead_images);
+}
+
+#ifdef USE_PTHREAD
+/* the thread starts with the first sheet, sane_start returns as soon
+ * as it is loaded */
+static void
+test_limit (int megabytes)
+{
+  struct fujitsu *s;
+  struct read_ahead *a;
+  int sheets;
+
+  s = open_scanner (SOURCE_ADF_FRONT, DUPLEX_INTERLACE_ALT);
+  s->read_ahead = megabytes;
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  a = s->ahead;
+  assert (a);
+
+  sheets = megabytes * 1024 * 1024 / SIDE_BYTES;
+  if (!sheets)
+    sheets = 1;
+  assert (a->sheets == sheets);
+
+  /* the frontend is slow, the thread fills all slots and waits. the
+   * sheet being read keeps its slot, unless it was read to the end
+   * before sane_start got it */
+  AHEAD_WAIT (a, AHEAD_FULL (a));
+  assert ((int) sheets_fed == sheets + !a->taken);
+
+  /* its slot is free once it is read */
+  read_image (s);
+  assert (!a->taken);
+  AHEAD_WAIT (a, AHEAD_FULL (a));
+  assert ((int) sheets_fed == 1 + sheets);
+
+  /* cancel with sheets still queued */
+  close_scanner (s);
+  assert ((int) sheets_fed == 1 + sheets);
+
+  printf ("%d MB: %d sheets of %d bytes read ahead\n", megabytes, sheets,
+	  SIDE_BYTES);
+}
+
+/* the thread finds the feeder empty, more paper is loaded before the
+ * frontend gets there, and the scan goes on */
+static void
+test_late_paper (void)
+{
+  struct fujitsu *s;
+  unsigned images;
+
+  /* two slots, the thread need not wait for the first sheet to be read
+   * before it tries to feed the next one */
+  s = open_scanner (SOURCE_ADF_DUPLEX, DUPLEX_INTERLACE_NONE);
+  s->read_ahead = 4;
+  TRACE_LOCK ();
+  sheets_loaded = 1;
+  TRACE_UNLOCK ();
+
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  AHEAD_WAIT (s->ahead, s->ahead->done);
+  read_image (s);
+
+  TRACE_LOCK ();
+  sheets_loaded = SHEETS;
+  TRACE_UNLOCK ();
+  scan_all (s, &images);
+  /* the back of the first sheet, and both sides of the others */
+  assert (images == SHEETS * 2 - 1);
+  assert (sheets_fed == SHEETS);
+  close_scanner (s);
+
+  printf ("paper loaded after the thread stopped is scanned\n");
+}
+
+static void
+test_busy (void)
+{
+  struct fujitsu *s;
+
+  s = open_scanner (SOURCE_ADF_FRONT, DUPLEX_INTERLACE_ALT);
+  s->read_ahead = 1;
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  assert (set_sleep_mode (s) == SANE_STATUS_DEVICE_BUSY);
+  sane_cancel (s);
+  assert (set_sleep_mode (s) == SANE_STATUS_GOOD);
+  close_scanner (s);
+}
+#endif
+
+int
+main (void)
+{
+  test_same_data (SOURCE_ADF_FRONT, DUPLEX_INTERLACE_ALT, "simplex");
+  test_same_data (SOURCE_ADF_DUPLEX, DUPLEX_INTERLACE_ALT, "duplex");
+  test_same_data (SOURCE_ADF_DUPLEX, DUPLEX_INTERLACE_NONE,
+		  "duplex, one side after the other");
+#ifdef USE_PTHREAD
+  test_limit (1);
+  test_limit (3);
+  test_late_paper ();
+  test_busy ();
+#endif
+  return 0;
+}
@@ -0,0 +1,279 @@
+#include "../../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the backend and its options are included, the scanner commands are
+ * replaced by stubs which feed a fixed number of sheets and keep a
+ * count of what the backend asked for */
+#define BACKEND_NAME kvs20xx
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/kvs20xx.c"
+#include "../../../backend/kvs20xx_opt.c"
+
+#include "read_ahead_test.h"
+
+#define SHEETS 7
+
+static unsigned sheets_loaded;	/* sheets put in the feeder */
+static unsigned sheets_fed;	/* sheets completely read */
+static unsigned sheet_bytes;	/* bytes of the current sheet read */
+static unsigned reads;		/* read image data commands */
+static unsigned checks;		/* document exist commands */
+
+SANE_Status
+kvs20xx_scan (struct scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs20xx_test_unit_ready (struct scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs20xx_set_timeout (struct scanner __sane_unused__ * s,
+		     int __sane_unused__ timeout)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs20xx_set_window (struct scanner __sane_unused__ * s,
+		    int __sane_unused__ wnd_id)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs20xx_reset_window (struct scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs20xx_read_picture_element (struct scanner __sane_unused__ * s,
+			      unsigned __sane_unused__ side,
+			      SANE_Parameters * p)
+{
+  /* A4 at 100 dpi */
+  p->pixels_per_line = 827;
+  p->lines = 1169;
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+get_adjust_data (struct scanner __sane_unused__ * s, unsigned *dummy_length)
+{
+  *dummy_length = 0;
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs20xx_sense_handler (int __sane_unused__ fd,
+		       u_char __sane_unused__ * sense_buffer,
+		       void __sane_unused__ * arg)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs20xx_document_exist (struct scanner __sane_unused__ * s)
+{
+  SANE_Status st;
+
+  TRACE_LOCK ();
+  checks++;
+  st = sheets_fed < sheets_loaded ? SANE_STATUS_GOOD : SANE_STATUS_NO_DOCS;
+  TRACE_UNLOCK ();
+  return st;
+}
+
+/* delivers the sheet in chunks like the scanner, EOF with the last one */
+SANE_Status
+kvs20xx_read_image_data (struct scanner *s, unsigned page,
+			 unsigned __sane_unused__ side, void *buf,
+			 unsigned max_size, unsigned *size)
+{
+  unsigned total = s->side_size * (s->val[DUPLEX].w ? 2 : 1);
+  unsigned i, n = max_size < 0x10000 ? max_size : 0x10000;
+  SANE_Status st = SANE_STATUS_GOOD;
+
+  TRACE_LOCK ();
+  reads++;
+  assert (page == sheets_fed);
+  if (n >= total - sheet_bytes)
+    {
+      n = total - sheet_bytes;
+      st = SANE_STATUS_EOF;
+    }
+  for (i = 0; i < n; i++)
+    ((u8 *) buf)[i] = pattern (page, sheet_bytes + i);
+  sheet_bytes += n;
+  if (st == SANE_STATUS_EOF)
+    {
+      sheet_bytes = 0;
+      sheets_fed++;
+    }
+  TRACE_UNLOCK ();
+  *size = n;
+  return st;
+}
+
+static struct scanner *
+open_scanner (int duplex)
+{
+  struct scanner *s = calloc (1, sizeof (*s));
+
+  assert (s);
+  s->id = KV_S2046C;
+  kvs20xx_init_options (s);
+  strcpy (s->val[MODE].s, SANE_VALUE_SCAN_MODE_GRAY);
+  strcpy (s->val[FEEDER_MODE].s, "continuous");
+  s->val[DUPLEX].w = duplex;
+
+  TRACE_LOCK ();
+  sheets_loaded = SHEETS;
+  sheets_fed = 0;
+  sheet_bytes = 0;
+  reads = 0;
+  checks = 0;
+  TRACE_UNLOCK ();
+  return s;
+}
+
+static void
+close_scanner (struct scanner *s)
+{
+  sane_cancel (s);
+  assert (!s->ahead);
+  free (s->data);
+  free (s);
+}
+
+static void
+test_same_data (int duplex)
+{
+  struct scanner *s;
+  unsigned long sync_sum, ahead_sum;
+  unsigned sync_images, ahead_images;
+  unsigned sync_reads, sync_checks;
+
+  s = open_scanner (duplex);
+  sync_sum = scan_all (s, &sync_images);
+  sync_reads = reads;
+  sync_checks = checks;
+  close_scanner (s);
+  assert (sync_images == SHEETS * (duplex ? 2 : 1));
+
+  s = open_scanner (duplex);
+  s->read_ahead = 3;
+  ahead_sum = scan_all (s, &ahead_images);
+  assert (sync_sum == ahead_sum);
+  assert (sync_images == ahead_images);
+  /* the same commands are sent, only from the thread, except that
+   * sane_start checks the empty feeder again */
+  assert (sync_reads == reads);
+  assert (sync_checks + 1 == checks);
+  close_scanner (s);
+
+  printf ("%s: %u images, read ahead gives the same data\n",
+	  duplex ? "duplex" : "simplex", ahead_images);
+}
+
+#ifdef USE_PTHREAD
+static void
+test_limit (int megabytes)
+{
+  struct scanner *s;
+  unsigned long size;
+  unsigned pages;
+
+  s = open_scanner (0);
+  s->read_ahead = megabytes;
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  assert (s->ahead);
+
+  size = s->side_size;
+  pages = megabytes * 1024UL * 1024 / size;
+  if (!pages)
+    pages = 1;
+  assert (s->ahead->pages == pages);
+
+  /* the frontend is slow, the thread fills all buffers and waits */
+  AHEAD_WAIT (s->ahead, s->ahead->count == pages);
+  assert (sheets_fed == 1 + pages);
+
+  /* cancel with pages still queued */
+  close_scanner (s);
+  assert (sheets_fed == 1 + pages);
+
+  printf ("%d MB: %u pages of %lu bytes read ahead\n", megabytes, pages,
+	  size);
+}
+
+/* the thread finds the feeder empty, more paper is loaded before the
+ * frontend gets there, and the scan goes on */
+static void
+test_late_paper (void)
+{
+  struct scanner *s;
+  unsigned images;
+
+  s = open_scanner (0);
+  s->read_ahead = 3;
+  TRACE_LOCK ();
+  sheets_loaded = 2;
+  TRACE_UNLOCK ();
+
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  AHEAD_WAIT (s->ahead, s->ahead->done);
+
+  TRACE_LOCK ();
+  sheets_loaded = SHEETS;
+  TRACE_UNLOCK ();
+  scan_all (s, &images);
+  assert (images == SHEETS - 1);
+  assert (sheets_fed == SHEETS);
+  close_scanner (s);
+
+  printf ("paper loaded after the thread stopped is scanned\n");
+}
+
+static void
+test_busy (void)
+{
+  struct scanner *s;
+  SANE_Int timeout = 10;
+
+  s = open_scanner (0);
+  s->read_ahead = 1;
+  assert (sane_control_option (s, MANUALFEED, SANE_ACTION_SET_VALUE,
+			       "wait_doc", NULL) == SANE_STATUS_GOOD);
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  assert (sane_control_option (s, FEED_TIMEOUT, SANE_ACTION_SET_VALUE,
+			       &timeout, NULL) == SANE_STATUS_DEVICE_BUSY);
+  sane_cancel (s);
+  assert (sane_control_option (s, FEED_TIMEOUT, SANE_ACTION_SET_VALUE,
+			       &timeout, NULL) == SANE_STATUS_GOOD);
+  close_scanner (s);
+}
+#endif
+
+int
+main (void)
+{
+  test_same_data (0);
+  test_same_data (1);
+#ifdef USE_PTHREAD
+  test_limit (1);
+  test_limit (3);
+  test_late_paper ();
+  test_busy ();
+#endif
+  return 0;
+}
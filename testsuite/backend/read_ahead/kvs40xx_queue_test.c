@@ -0,0 +1,354 @@
+#include "../../../include/sane/config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the backend and its options are included, the scanner commands are
+ * replaced by stubs which feed a fixed number of sheets */
+#define BACKEND_NAME kvs40xx
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "../../../backend/kvs40xx.c"
+#include "../../../backend/kvs40xx_opt.c"
+
+#include "read_ahead_test.h"
+
+#define SHEETS 7
+#define WIDTH 827
+#define LINES 1169
+#define PIECE 0x8000
+
+static unsigned sheets_fed;	/* sheets completely read */
+static unsigned scan_base;	/* sheets read before the scan command */
+static unsigned side_bytes[2];	/* bytes of the sides of the current sheet */
+static int side_eof[2];
+static int crop;		/* the sheets get shorter */
+
+static unsigned
+sheet_lines (unsigned sheet)
+{
+  return crop ? LINES - 50 * sheet : LINES;
+}
+
+/* the pages are counted from each scan command */
+SANE_Status
+kvs40xx_scan (struct scanner __sane_unused__ * s)
+{
+  TRACE_LOCK ();
+  scan_base = sheets_fed;
+  TRACE_UNLOCK ();
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs40xx_test_unit_ready (struct scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs40xx_set_timeout (struct scanner __sane_unused__ * s,
+		     int __sane_unused__ timeout)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs40xx_set_window (struct scanner __sane_unused__ * s,
+		    int __sane_unused__ wnd_id)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs40xx_reset_window (struct scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+hopper_down (struct scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+stop_adf (struct scanner __sane_unused__ * s)
+{
+  return SANE_STATUS_GOOD;
+}
+
+/* the model name, as the real command leaves it */
+SANE_Status
+inquiry (struct scanner __sane_unused__ * s, char *id)
+{
+  strcpy (id, "KV-S4085CW");
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs40xx_sense_handler (int __sane_unused__ fd,
+		       u_char __sane_unused__ * sense_buffer,
+		       void __sane_unused__ * arg)
+{
+  return SANE_STATUS_GOOD;
+}
+
+/* the size of the last sheet read, or of the first before scanning */
+SANE_Status
+kvs40xx_read_picture_element (struct scanner __sane_unused__ * s,
+			      unsigned __sane_unused__ side,
+			      SANE_Parameters * p)
+{
+  TRACE_LOCK ();
+  p->pixels_per_line = WIDTH;
+  p->lines = sheet_lines (sheets_fed ? sheets_fed - 1 : 0);
+  TRACE_UNLOCK ();
+  return SANE_STATUS_GOOD;
+}
+
+SANE_Status
+kvs40xx_document_exist (struct scanner __sane_unused__ * s)
+{
+  SANE_Status st;
+
+  TRACE_LOCK ();
+  st = sheets_fed < SHEETS ? SANE_STATUS_GOOD : SANE_STATUS_NO_DOCS;
+  TRACE_UNLOCK ();
+  return st;
+}
+
+SANE_Status
+get_buffer_status (struct scanner __sane_unused__ * s,
+		   unsigned *data_avalible)
+{
+  SANE_Status st;
+
+  TRACE_LOCK ();
+  *data_avalible = sheets_fed < SHEETS;
+  st = sheets_fed < SHEETS ? SANE_STATUS_GOOD : SANE_STATUS_NO_DOCS;
+  TRACE_UNLOCK ();
+  return st;
+}
+
+/* delivers a side in pieces like the scanner, in duplex it asks for the
+ * other side after each piece, EOF comes with the last piece of a side */
+SANE_Status
+kvs40xx_read_image_data (struct scanner *s, unsigned page, unsigned side,
+			 void *buf, unsigned max_size, unsigned *size)
+{
+  int duplex = s->val[DUPLEX].w, i = side == SIDE_FRONT ? 0 : 1;
+  unsigned sheet, total, k, n = max_size < PIECE ? max_size : PIECE;
+  SANE_Status st = SANE_STATUS_GOOD;
+
+  TRACE_LOCK ();
+  sheet = scan_base + page;
+  assert (sheet == sheets_fed);
+  total = WIDTH * sheet_lines (sheet);
+  assert (!side_eof[i]);
+  if (n >= total - side_bytes[i])
+    n = total - side_bytes[i];
+  for (k = 0; k < n; k++)
+    ((u8 *) buf)[k] = pattern (sheet * 2 + i, side_bytes[i] + k);
+  side_bytes[i] += n;
+  if (side_bytes[i] == total)
+    {
+      st = SANE_STATUS_EOF;
+      side_eof[i] = 1;
+    }
+  else if (duplex && !side_eof[!i])
+    st = INCORRECT_LENGTH;
+
+  if (side_eof[0] && (!duplex || side_eof[1]))
+    {
+      side_bytes[0] = side_bytes[1] = 0;
+      side_eof[0] = side_eof[1] = 0;
+      sheets_fed++;
+    }
+  TRACE_UNLOCK ();
+  *size = n;
+  return st;
+}
+
+static unsigned
+fed (void)
+{
+  unsigned n;
+
+  TRACE_LOCK ();
+  n = sheets_fed;
+  TRACE_UNLOCK ();
+  return n;
+}
+
+static struct scanner *
+open_scanner (int duplex, const char *feeder)
+{
+  struct scanner *s = calloc (1, sizeof (*s));
+
+  assert (s);
+  pthread_mutex_init (&s->mu, NULL);
+  pthread_cond_init (&s->data_cond, NULL);
+  pthread_cond_init (&s->room_cond, NULL);
+  s->id = KV_S4085CW;
+  kvs40xx_init_options (s);
+  strcpy (s->val[MODE].s, SANE_VALUE_SCAN_MODE_GRAY);
+  strcpy (s->val[FEEDER_MODE].s, feeder);
+  s->val[DUPLEX].w = duplex;
+  s->val[CROP].b = crop;
+
+  TRACE_LOCK ();
+  sheets_fed = 0;
+  side_bytes[0] = side_bytes[1] = 0;
+  side_eof[0] = side_eof[1] = 0;
+  scan_base = 0;
+  TRACE_UNLOCK ();
+  return s;
+}
+
+static void
+close_scanner (struct scanner *s)
+{
+  sane_cancel (s);
+  assert (!s->thread);
+  assert (!s->buf[0].head && !s->buf[1].head);
+  pthread_cond_destroy (&s->room_cond);
+  pthread_cond_destroy (&s->data_cond);
+  pthread_mutex_destroy (&s->mu);
+  free (s);
+}
+
+/* scans all sheets and checks every byte delivered */
+static unsigned
+scan_checked (struct scanner *s, SANE_Int max_len)
+{
+  int duplex = s->val[DUPLEX].w;
+  unsigned char *buf = malloc (max_len);
+  unsigned images = 0, got;
+  SANE_Parameters p;
+  SANE_Int i, len;
+  SANE_Status st;
+
+  assert (buf);
+  while ((st = sane_start (s)) == SANE_STATUS_GOOD)
+    {
+      unsigned sheet = images / (duplex ? 2 : 1);
+      unsigned side = duplex ? images % 2 : 0;
+
+      assert (sane_get_parameters (s, &p) == SANE_STATUS_GOOD);
+      assert (p.bytes_per_line == WIDTH);
+      assert ((unsigned) p.lines == sheet_lines (sheet));
+
+      got = 0;
+      while ((st = sane_read (s, buf, max_len, &len)) == SANE_STATUS_GOOD)
+	{
+	  assert (len > 0 && len <= max_len);
+	  for (i = 0; i < len; i++)
+	    assert (buf[i] == pattern (sheet * 2 + side, got + i));
+	  got += len;
+	}
+      assert (st == SANE_STATUS_EOF);
+      assert (got == WIDTH * sheet_lines (sheet));
+      images++;
+    }
+  assert (st == SANE_STATUS_NO_DOCS);
+  free (buf);
+  return images;
+}
+
+static void
+test_scan (int duplex, const char *feeder, int depth)
+{
+  struct scanner *s;
+  unsigned images;
+  SANE_Int max_len[] = { 1000, 4093, 0x10000, 1 << 22 };
+  unsigned i;
+
+  for (i = 0; i < sizeof (max_len) / sizeof (max_len[0]); i++)
+    {
+      s = open_scanner (duplex, feeder);
+      s->read_ahead = depth;
+      images = scan_checked (s, max_len[i]);
+      assert (images == SHEETS * (duplex ? 2 : 1));
+      close_scanner (s);
+    }
+
+  printf ("%s %s, %d page(s) ahead: %u images\n",
+	  duplex ? "duplex" : "simplex", feeder, depth, images);
+}
+
+/* the reader runs ahead as far as allowed and waits for the frontend */
+static void
+test_backpressure (int duplex, int depth)
+{
+  struct scanner *s;
+  unsigned char buf[0x4000];
+  SANE_Int len;
+
+  s = open_scanner (duplex, "continuous");
+  s->read_ahead = depth;
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+
+  /* with nothing taken the reader cannot pass wait_room after this */
+  AHEAD_WAIT_ON (&s->mu, &s->data_cond, load_int (&s->done) == depth);
+  assert (!load_int (&s->taken));
+  assert (fed () == (unsigned) depth);
+
+  /* finishing the first page lets the reader fetch one more */
+  while (sane_read (s, buf, sizeof (buf), &len) == SANE_STATUS_GOOD);
+  if (duplex)
+    {
+      assert (sane_start (s) == SANE_STATUS_GOOD);
+      while (sane_read (s, buf, sizeof (buf), &len) == SANE_STATUS_GOOD);
+    }
+  AHEAD_WAIT_ON (&s->mu, &s->data_cond, load_int (&s->done) == depth + 1);
+  assert (fed () == (unsigned) depth + 1);
+
+  /* cancel with pages still queued */
+  close_scanner (s);
+  assert (fed () == (unsigned) depth + 1);
+
+  printf ("%s: the reader waits %d page(s) ahead of the frontend\n",
+	  duplex ? "duplex" : "simplex", depth);
+}
+
+static void
+test_busy (void)
+{
+  struct scanner *s;
+  SANE_Int timeout = 10;
+
+  s = open_scanner (0, "continuous");
+  s->read_ahead = 1;
+  assert (sane_control_option (s, MANUALFEED, SANE_ACTION_SET_VALUE,
+			       "wait_doc", NULL) == SANE_STATUS_GOOD);
+  assert (sane_start (s) == SANE_STATUS_GOOD);
+  assert (sane_control_option (s, FEED_TIMEOUT, SANE_ACTION_SET_VALUE,
+			       &timeout, NULL) == SANE_STATUS_DEVICE_BUSY);
+  sane_cancel (s);
+  assert (sane_control_option (s, FEED_TIMEOUT, SANE_ACTION_SET_VALUE,
+			       &timeout, NULL) == SANE_STATUS_GOOD);
+  close_scanner (s);
+}
+
+int
+main (void)
+{
+  int duplex;
+
+  for (duplex = 0; duplex < 2; duplex++)
+    {
+      test_scan (duplex, "single", 1);
+      test_scan (duplex, "continuous", 1);
+      test_scan (duplex, "continuous", 4);
+      crop = 1;
+      test_scan (duplex, "single", 1);
+      test_scan (duplex, "continuous", 3);
+      crop = 0;
+      test_backpressure (duplex, 1);
+      test_backpressure (duplex, 3);
+    }
+  test_busy ();
+  return 0;
+}
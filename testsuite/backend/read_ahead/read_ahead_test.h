@@ -0,0 +1,91 @@
+/* shared by the read-ahead tests. each test includes its backend, puts a
+ * fake scanner in place of the transport and checks that the sheets read
+ * by the thread give the same data as the ones read directly. include
+ * this after the backend, it uses its sane_start and sane_read */
+
+#ifndef READ_AHEAD_TEST_H
+#define READ_AHEAD_TEST_H
+
+#include <stdio.h>
+#include <assert.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#include <time.h>
+#endif
+
+/* the fake scanner is called by the thread and by the test */
+#ifdef USE_PTHREAD
+static pthread_mutex_t trace_mu = PTHREAD_MUTEX_INITIALIZER;
+#define TRACE_LOCK() pthread_mutex_lock (&trace_mu)
+#define TRACE_UNLOCK() pthread_mutex_unlock (&trace_mu)
+
+/* waits until expr holds, the read-ahead thread signals cond on every
+ * change of it under mu. gives up after ten seconds */
+#define AHEAD_WAIT_ON(mu, cond, expr)					\
+  do									\
+    {									\
+      struct timespec until_;						\
+      int wait_ = 0;							\
+      clock_gettime (CLOCK_REALTIME, &until_);				\
+      until_.tv_sec += 10;						\
+      pthread_mutex_lock (mu);						\
+      while (!(expr) && !wait_)						\
+	wait_ = pthread_cond_timedwait (cond, mu, &until_);		\
+      assert (expr);							\
+      pthread_mutex_unlock (mu);					\
+    }									\
+  while (0)
+
+/* for the backends which keep the state of the thread in a struct */
+#define AHEAD_WAIT(a, expr) AHEAD_WAIT_ON (&(a)->mu, &(a)->cond, expr)
+
+/* for the backends which keep each sheet in a slot: the slots are all
+ * used, the last one read to the end, the thread cannot feed another
+ * sheet before sane_read finishes the oldest one */
+#define AHEAD_FULL(a)							\
+  ((a)->count == (a)->sheets						\
+   && (a)->sheet[((a)->head + (a)->sheets - 1) % (a)->sheets].done)
+#else
+#define TRACE_LOCK()
+#define TRACE_UNLOCK()
+#endif
+
+/* the image data of each sheet differs, and a shifted block shows */
+static unsigned char
+pattern (unsigned sheet, unsigned offset)
+{
+  return (unsigned char) (sheet * 31 + offset * 7 + (offset >> 9));
+}
+
+/* scans all sheets, returns a checksum of the data delivered */
+static unsigned long
+scan_all (SANE_Handle h, unsigned *images)
+{
+  unsigned long sum = 0;
+  unsigned char buf[30000];
+  SANE_Int i, len;
+  SANE_Status st;
+
+  *images = 0;
+  while ((st = sane_start (h)) == SANE_STATUS_GOOD)
+    {
+      while (sane_read (h, buf, sizeof (buf), &len) == SANE_STATUS_GOOD)
+	for (i = 0; i < len; i++)
+	  sum = sum * 33 + buf[i];
+      (*images)++;
+    }
+  assert (st == SANE_STATUS_NO_DOCS);
+  return sum;
+}
+
+/* reads the current image to the end */
+static void
+read_image (SANE_Handle h)
+{
+  unsigned char buf[30000];
+  SANE_Int len;
+
+  while (sane_read (h, buf, sizeof (buf), &len) == SANE_STATUS_GOOD);
+}
+
+#endif /* READ_AHEAD_TEST_H */
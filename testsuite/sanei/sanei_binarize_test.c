@@ -0,0 +1,296 @@
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+/* sane includes for the sanei functions called */
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_binarize.h"
+
+/* simple reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+/* set by --bench, the speed comparison only runs for 'make bench' */
+static int bench;
+
+static double
+now (void)
+{
+  return (double) clock () / CLOCKS_PER_SEC;
+}
+
+/* threshold table as built by the backends for a medium curve */
+static unsigned char lut[256];
+
+static void
+fill_lut (void)
+{
+  int i;
+
+  for (i = 0; i < 256; i++)
+    lut[i] = 50 + (i * 155) / 255;
+}
+
+/**
+ * gray line of text like data: a slowly changing background with dark
+ * strokes, and some noise
+ */
+static void
+make_line (unsigned char *line, int width, int y)
+{
+  int x, v;
+
+  for (x = 0; x < width; x++)
+    {
+      v = 140 + (x + y) % 90;
+      if ((x / 7 + y / 5) % 6 == 0)
+	v -= 110;
+      v += rnd () % 20 - 10;
+      line[x] = v < 0 ? 0 : (v > 255 ? 255 : v);
+    }
+}
+
+/**
+ * the normalize and sliding window code formerly found in the backends
+ */
+static void
+ref_binarize_line (unsigned char *src, unsigned char *dst, int width,
+		   int dpi, int threshold, const unsigned char *curve,
+		   int normalize)
+{
+  int j, x, windowX, sum = 0;
+  int thresh, offset, addCol, dropCol;
+  unsigned char mask;
+  int min = 255, max = 0;
+
+  if (normalize)
+    {
+      for (x = 0; x < width; x++)
+	{
+	  if (src[x] > max)
+	    max = src[x];
+	  if (src[x] < min)
+	    min = src[x];
+	}
+      if (min > 80)
+	min = 0;
+      if (max < 80)
+	max = 255;
+      for (x = 0; x < width; x++)
+	src[x] = ((src[x] - min) * 255) / (max - min);
+    }
+
+  windowX = (6 * dpi) / 150;
+  if (!(windowX % 2))
+    windowX++;
+
+  for (j = 0; j < windowX; j++)
+    sum += src[j];
+
+  for (j = 0; j < width; j++)
+    {
+      offset = j % 8;
+      mask = 0x80 >> offset;
+      thresh = threshold;
+      if (curve)
+	{
+	  addCol = j + windowX / 2;
+	  dropCol = addCol - windowX;
+	  if (dropCol >= 0 && addCol < width)
+	    {
+	      sum -= src[dropCol];
+	      sum += src[addCol];
+	    }
+	  thresh = curve[sum / windowX];
+	}
+      if (src[j] > thresh)
+	*dst &= ~mask;
+      else
+	*dst |= mask;
+      if (offset == 7)
+	dst++;
+    }
+}
+
+/**
+ * convert lines with both implementations and compare the results,
+ * also converting in place
+ */
+static void
+compare (int width, int dpi, int use_curve, int normalize)
+{
+  SANEI_Binarize bin;
+  unsigned char *line, *src, *ref, *dst;
+  int y, bytes = (width + 7) / 8;
+
+  line = malloc (width);
+  src = malloc (width);
+  ref = malloc (bytes);
+  dst = malloc (bytes);
+  assert (line && src && ref && dst);
+
+  assert (sanei_binarize_init (&bin, dpi, 128, use_curve ? lut : NULL,
+			       normalize ? SANEI_BINARIZE_NORMALIZE : 0)
+	  == SANE_STATUS_GOOD);
+  for (y = 0; y < 20; y++)
+    {
+      make_line (line, width, y);
+
+      memset (ref, 0x55, bytes);
+      memset (dst, 0x55, bytes);
+      memcpy (src, line, width);
+      ref_binarize_line (src, ref, width, dpi, 128,
+			 use_curve ? lut : NULL, normalize);
+      memcpy (src, line, width);
+      assert (sanei_binarize_line (&bin, src, dst, width) ==
+	      SANE_STATUS_GOOD);
+      assert (memcmp (ref, dst, bytes) == 0);
+
+      /* in place, the unused bits of the last byte are pixel data */
+      memcpy (src, line, width);
+      assert (sanei_binarize_line (&bin, src, src, width) ==
+	      SANE_STATUS_GOOD);
+      assert (memcmp (ref, src, width / 8) == 0);
+      if (width % 8)
+	assert (((ref[bytes - 1] ^ src[bytes - 1])
+		 & (0xff00 >> (width % 8))) == 0);
+    }
+  sanei_binarize_free (&bin);
+
+  free (line);
+  free (src);
+  free (ref);
+  free (dst);
+}
+
+/**
+ * uniform gray areas give a share of black pixels matching their level
+ */
+static void
+dither (int level)
+{
+  SANEI_Binarize bin;
+  unsigned char src[1000], dst[125];
+  int x, y, black = 0, count = 0;
+
+  assert (sanei_binarize_init (&bin, 300, 127, NULL, SANEI_BINARIZE_DITHER)
+	  == SANE_STATUS_GOOD);
+  for (y = 0; y < 100; y++)
+    {
+      memset (src, level, sizeof (src));
+      assert (sanei_binarize_line (&bin, src, dst, sizeof (src)) ==
+	      SANE_STATUS_GOOD);
+      /* skip the first lines, the error has to build up */
+      if (y < 10)
+	continue;
+      for (x = 0; x < (int) sizeof (src); x++)
+	{
+	  black += (dst[x / 8] >> (7 - x % 8)) & 1;
+	  count++;
+	}
+    }
+  sanei_binarize_free (&bin);
+
+  x = (black * 255 + count / 2) / count;
+  assert (abs (x - (255 - level)) <= 3);
+}
+
+/**
+ * 600 dpi A4 lines, the time of the new code is reported against the
+ * former one
+ */
+static void
+speed (void)
+{
+  SANEI_Binarize bin;
+  unsigned char *lines, *src, *dst;
+  int width = 5100, count = 400, y;
+  double start, ref_time, time;
+
+  lines = malloc (width * count);
+  src = malloc (width);
+  dst = malloc (width / 8);
+  assert (lines && src && dst);
+  for (y = 0; y < count; y++)
+    make_line (lines + y * width, width, y);
+
+  start = now ();
+  for (y = 0; y < count; y++)
+    {
+      memcpy (src, lines + y * width, width);
+      ref_binarize_line (src, dst, width, 600, 128, lut, 1);
+    }
+  ref_time = now () - start;
+
+  sanei_binarize_init (&bin, 600, 128, lut, SANEI_BINARIZE_NORMALIZE);
+  start = now ();
+  for (y = 0; y < count; y++)
+    {
+      memcpy (src, lines + y * width, width);
+      sanei_binarize_line (&bin, src, dst, width);
+    }
+  time = now () - start;
+  sanei_binarize_free (&bin);
+
+  printf ("binarize 600 dpi: reference %.3fs, sanei_binarize %.3fs\n",
+	  ref_time, time);
+
+  free (lines);
+  free (src);
+  free (dst);
+}
+
+static void
+sanei_binarize_suite (void)
+{
+  fill_lut ();
+
+  compare (5100, 600, 1, 1);
+  compare (5100, 600, 0, 1);
+  compare (2550, 300, 1, 0);
+  compare (2551, 300, 0, 0);
+  compare (1203, 150, 1, 1);
+  compare (77, 300, 1, 1);
+  compare (21, 75, 1, 0);
+
+  dither (64);
+  dither (128);
+  dither (200);
+
+  /* an invalid resolution is refused */
+  {
+    SANEI_Binarize bin;
+
+    assert (sanei_binarize_init (&bin, 0, 128, lut, 0) == SANE_STATUS_INVAL);
+    sanei_binarize_free (&bin);
+  }
+
+  if (bench)
+    speed ();
+}
+
+/**
+ * main function to run the test suites
+ */
+int
+main (int argc, char **argv)
+{
+  bench = argc > 1 && strcmp (argv[1], "--bench") == 0;
+
+  /* run suites */
+  sanei_binarize_suite ();
+
+  return 0;
+}
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
@@ -0,0 +1,327 @@
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/* sane includes for the sanei functions called */
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_calib.h"
+
+static char path[1024];
+
+static unsigned char black[1000];
+static unsigned char white[4096];
+
+/* the clock seen by sanei_calib, moved forward instead of waiting for
+ * entries to expire */
+static time_t clock_offset;
+
+time_t
+time (time_t * t)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  tv.tv_sec += clock_offset;
+  if (t)
+    *t = tv.tv_sec;
+  return tv.tv_sec;
+}
+
+static void
+fill_data (void)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof (black); i++)
+    black[i] = i * 7;
+  for (i = 0; i < sizeof (white); i++)
+    white[i] = 255 - i * 3;
+}
+
+static void
+check_entry (SANEI_Calib * calib, const char *key, void *expected,
+	     size_t size)
+{
+  const void *data;
+  size_t len;
+
+  assert (sanei_calib_get (calib, key, &data, &len) == SANE_STATUS_GOOD);
+  assert (len == size);
+  assert (memcmp (data, expected, size) == 0);
+  /* data is aligned for any type */
+  assert (((unsigned long) data & 7) == 0);
+}
+
+static void
+check_missing (SANEI_Calib * calib, const char *key)
+{
+  const void *data;
+  size_t len;
+
+  assert (sanei_calib_get (calib, key, &data, &len) ==
+	  SANE_STATUS_UNSUPPORTED);
+}
+
+/**
+ * write a store with two entries and read it back
+ */
+static void
+write_and_read (void)
+{
+  SANEI_Calib *calib;
+  const char *key;
+  const void *data;
+  size_t len;
+  int index, count;
+
+  unlink (path);
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_missing (calib, "color-300");
+  assert (sanei_calib_put (calib, "color-300", black, sizeof (black), 0)
+	  == SANE_STATUS_GOOD);
+  assert (sanei_calib_put (calib, "gray-600", white, 5, 3600)
+	  == SANE_STATUS_GOOD);
+  /* replacing an entry */
+  assert (sanei_calib_put (calib, "gray-600", white, sizeof (white), 3600)
+	  == SANE_STATUS_GOOD);
+  check_entry (calib, "gray-600", white, sizeof (white));
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+  assert (access (path, F_OK) == 0);
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_entry (calib, "color-300", black, sizeof (black));
+  check_entry (calib, "gray-600", white, sizeof (white));
+  check_missing (calib, "gray-300");
+
+  count = 0;
+  index = 0;
+  while (sanei_calib_next (calib, &index, &key, &data, &len) ==
+	 SANE_STATUS_GOOD)
+    {
+      assert (!strcmp (key, "color-300") || !strcmp (key, "gray-600"));
+      count++;
+    }
+  assert (count == 2);
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+}
+
+/**
+ * a store for another device or layout version must not be used
+ */
+static void
+wrong_device (void)
+{
+  SANEI_Calib *calib;
+
+  assert (sanei_calib_open (path, "serial 2", 1, &calib) == SANE_STATUS_INVAL);
+  check_missing (calib, "color-300");
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+
+  assert (sanei_calib_open (path, "serial 1", 2, &calib) == SANE_STATUS_INVAL);
+  check_missing (calib, "color-300");
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+
+  /* nothing was changed so the file is still there */
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_entry (calib, "color-300", black, sizeof (black));
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+}
+
+/**
+ * damage the data of the second entry, the first one must still be
+ * usable
+ */
+static void
+corrupted_entry (void)
+{
+  SANEI_Calib *calib;
+  FILE *fp;
+  long size;
+  int c;
+
+  fp = fopen (path, "r+b");
+  assert (fp != NULL);
+  fseek (fp, 0, SEEK_END);
+  size = ftell (fp);
+  fseek (fp, size - 10, SEEK_SET);
+  c = fgetc (fp);
+  fseek (fp, size - 10, SEEK_SET);
+  fputc (c ^ 0x10, fp);
+  fclose (fp);
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_entry (calib, "color-300", black, sizeof (black));
+  check_missing (calib, "gray-600");
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+
+  /* the damaged entry is gone from the rewritten file */
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_entry (calib, "color-300", black, sizeof (black));
+  check_missing (calib, "gray-600");
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+}
+
+/**
+ * a truncated file keeps the complete entries
+ */
+static void
+truncated_file (void)
+{
+  SANEI_Calib *calib;
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  assert (sanei_calib_put (calib, "gray-600", white, sizeof (white), 0)
+	  == SANE_STATUS_GOOD);
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+
+  assert (truncate (path, 200 + sizeof (black)) == 0);
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_entry (calib, "color-300", black, sizeof (black));
+  check_missing (calib, "gray-600");
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+}
+
+/**
+ * expired entries are not returned and are dropped from the file
+ */
+static void
+expired_entry (void)
+{
+  SANEI_Calib *calib;
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  assert (sanei_calib_put (calib, "lineart-300", white, 100, 1)
+	  == SANE_STATUS_GOOD);
+  check_entry (calib, "lineart-300", white, 100);
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+
+  clock_offset += 2;
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_missing (calib, "lineart-300");
+  check_entry (calib, "color-300", black, sizeof (black));
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+}
+
+/**
+ * removing all the entries removes the file
+ */
+static void
+remove_entries (void)
+{
+  SANEI_Calib *calib;
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  assert (sanei_calib_put (calib, "gray-600", white, sizeof (white), 0)
+	  == SANE_STATUS_GOOD);
+  sanei_calib_remove (calib, "color-300");
+  check_missing (calib, "color-300");
+  check_entry (calib, "gray-600", white, sizeof (white));
+  assert (sanei_calib_sync (calib) == SANE_STATUS_GOOD);
+  sanei_calib_clear (calib);
+  check_missing (calib, "gray-600");
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+  assert (access (path, F_OK) != 0);
+}
+
+/**
+ * a file which isn't a store gives an empty store and is replaced
+ */
+static void
+garbage_file (void)
+{
+  SANEI_Calib *calib;
+  FILE *fp;
+  int i;
+
+  fp = fopen (path, "wb");
+  assert (fp != NULL);
+  for (i = 0; i < 1000; i++)
+    fputc (i, fp);
+  fclose (fp);
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_INVAL);
+  check_missing (calib, "color-300");
+  assert (sanei_calib_put (calib, "color-300", black, sizeof (black), 0)
+	  == SANE_STATUS_GOOD);
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_entry (calib, "color-300", black, sizeof (black));
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+  unlink (path);
+}
+
+/**
+ * entry sizes which go past the end of the file, even once padded,
+ * must not be used
+ */
+static void
+huge_size (long offset, uint64_t size, size_t bytes)
+{
+  SANEI_Calib *calib;
+  uint32_t size32 = size;
+  FILE *fp;
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  assert (sanei_calib_put (calib, "color-300", black, sizeof (black), 0)
+	  == SANE_STATUS_GOOD);
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+
+  fp = fopen (path, "r+b");
+  assert (fp != NULL);
+  fseek (fp, offset, SEEK_SET);
+  assert (fwrite (bytes == 4 ? (void *) &size32 : (void *) &size, bytes, 1,
+		  fp) == 1);
+  fclose (fp);
+
+  assert (sanei_calib_open (path, "serial 1", 1, &calib) == SANE_STATUS_GOOD);
+  check_missing (calib, "color-300");
+  assert (sanei_calib_close (calib) == SANE_STATUS_GOOD);
+  unlink (path);
+}
+
+static void
+sanei_calib_suite (void)
+{
+  fill_data ();
+  snprintf (path, sizeof (path), "sanei_calib_test_%d.cal", (int) getpid ());
+
+  write_and_read ();
+  wrong_device ();
+  corrupted_entry ();
+  truncated_file ();
+  expired_entry ();
+  remove_entries ();
+  garbage_file ();
+
+  /* the first entry follows the 96 byte file header, its key size is
+   * at the start and its data size at byte 8 */
+  huge_size (96, 0xfffffff9, 4);
+  huge_size (96, 0xffffffff, 4);
+  huge_size (104, 0xfffffffffffffff9ULL, 8);
+  huge_size (104, 0xffffffffULL, 8);
+}
+
+/**
+ * main function to run the test suites
+ */
+int
+main (void)
+{
+  /* run suites */
+  sanei_calib_suite ();
+
+  return 0;
+}
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
@@ -0,0 +1,783 @@
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+
+/* sane includes for the sanei functions called */
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei.h"
+#include "../include/sane/sanei_ir.h"
+
+/* simple reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+/* set by --bench, the timings are only printed by 'make bench' */
+static int bench;
+
+static double
+now (void)
+{
+  return (double) clock () / CLOCKS_PER_SEC;
+}
+
+static void
+report (const char *format, ...)
+{
+  va_list ap;
+
+  if (!bench)
+    return;
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+}
+
+/**
+ * create a synthetic 16 bit film frame: smooth red, green and blue
+ * gradients with some grain, an infrared plane which picks up a bit
+ * of the red plane and dark specks of dust in all planes
+ */
+static void
+make_frame (SANE_Parameters * params, SANE_Uint ** planes, int cols,
+	    int rows)
+{
+  int x, y, i, k, n;
+
+  params->format = SANE_FRAME_GRAY;
+  params->depth = 16;
+  params->pixels_per_line = cols;
+  params->lines = rows;
+  params->bytes_per_line = cols * 2;
+  params->last_frame = SANE_TRUE;
+
+  seed = cols * 31 + rows;
+
+  for (k = 0; k < 4; k++)
+    {
+      planes[k] = malloc (cols * rows * sizeof (SANE_Uint));
+      assert (planes[k] != NULL);
+    }
+
+  for (y = 0; y < rows; y++)
+    for (x = 0; x < cols; x++)
+      {
+	i = y * cols + x;
+	planes[0][i] = 8000 + 40000 * x / cols + rnd () % 2000;
+	planes[1][i] = 12000 + 30000 * y / rows + rnd () % 2000;
+	planes[2][i] = 20000 + 20000 * (x + y) / (cols + rows)
+	  + rnd () % 2000;
+	planes[3][i] = 40000 + planes[0][i] / 8 + rnd () % 1000;
+      }
+
+  /* dust, a few pixels up to about 20 pixels wide */
+  n = cols * rows / 4000 + 1;
+  while (n--)
+    {
+      int cx = rnd () % cols, cy = rnd () % rows, r = rnd () % 10 + 1;
+
+      for (y = cy - r; y <= cy + r; y++)
+	for (x = cx - r; x <= cx + r; x++)
+	  {
+	    if (x < 0 || y < 0 || x >= cols || y >= rows
+		|| (x - cx) * (x - cx) + (y - cy) * (y - cy) > r * r)
+	      continue;
+	    i = y * cols + x;
+	    for (k = 0; k < 4; k++)
+	      planes[k][i] /= 4;
+	  }
+    }
+}
+
+/* the reference implementations below are the plain single threaded
+ * versions sanei_ir started with */
+
+/* Reduce red spectral overlap from an infrared image plane
+ */
+static SANE_Status
+ref_spectral_clean (const SANE_Parameters * params, double *lut_ln,
+			const SANE_Uint *red_data,
+			SANE_Uint *ir_data)
+{
+  const SANE_Uint *rptr;
+  SANE_Uint *iptr;
+  SANE_Int depth;
+  double *llut;
+  double rval, rsum, rrsum;
+  double risum, rfac;
+  double *norm_histo;
+  int64_t isum;
+  int *calc_buf, *calc_ptr;
+  int ival, imin, imax;
+  int itop, len, ssize;
+  int thresh_low, thresh;
+  int irand, i;
+  SANE_Status status;
+
+  itop = params->pixels_per_line * params->lines;
+  calc_buf = malloc (itop * sizeof (int));		/* could save this */
+  if (!calc_buf)
+    {
+      return SANE_STATUS_NO_MEM;
+    }
+
+  depth = params->depth;
+  len = 1 << depth;
+  if (lut_ln)
+    llut = lut_ln;
+  else
+    {
+      status = sanei_ir_ln_table (len, &llut);
+      if (status != SANE_STATUS_GOOD) {
+        free (calc_buf);
+        return status;
+      }
+    }
+
+  /* determine not transparent areas to exclude them later
+   * TODO: this has not been tested for negatives
+   */
+  thresh_low = INT_MAX;
+  status =
+      sanei_ir_create_norm_histogram (params, ir_data, &norm_histo);
+  if (status != SANE_STATUS_GOOD)
+    {
+      free (calc_buf);
+      return SANE_STATUS_NO_MEM;
+    }
+
+  /* TODO: remember only needed if cropping is not ok */
+  status = sanei_ir_threshold_maxentropy (params, norm_histo, &thresh);
+  if (status == SANE_STATUS_GOOD)
+    thresh_low = thresh;
+  status = sanei_ir_threshold_otsu (params, norm_histo, &thresh);
+  if ((status == SANE_STATUS_GOOD) && (thresh < thresh_low))
+    thresh_low = thresh;
+  status = sanei_ir_threshold_yen (params, norm_histo, &thresh);
+  if ((status == SANE_STATUS_GOOD) && (thresh < thresh_low))
+    thresh_low = thresh;
+  if (thresh_low == INT_MAX)
+    thresh_low = 0;
+  else
+    thresh_low /= 2;
+
+  /* calculate linear regression ired (red) from randomly chosen points */
+  ssize = itop / 2;
+  if (SAMPLE_SIZE < ssize)
+    ssize = SAMPLE_SIZE;
+  isum = 0;
+  rsum = rrsum = risum = 0.0;
+  i = ssize;
+  while (i > 0)
+    {
+      irand = rand () % itop;
+      rval = llut[red_data[irand]];
+      ival = ir_data[irand];
+      if (ival > thresh_low)
+        {
+          isum += ival;
+          rsum += rval;
+          rrsum += rval * rval;
+          risum += rval * (double) ival;
+          i--;
+        }
+    }
+
+  /* "a" in ired = b + a * ln (red) */
+  rfac =
+    ((double) ssize * risum -
+    rsum * (double) isum) / ((double) ssize * rrsum - rsum * rsum);
+
+  /* now calculate ired' = ired - a  * ln (red) */
+  imin = INT_MAX;
+  imax = INT_MIN;
+  rptr = red_data;
+  iptr = ir_data;
+  calc_ptr = calc_buf;
+    for (i = itop; i > 0; i--)
+      {
+	ival = *iptr++ - (int) (rfac * llut[*rptr++] + 0.5);
+	if (ival > imax)
+	  imax = ival;
+	if (ival < imin)
+	  imin = ival;
+	*calc_ptr++ = ival;
+      }
+
+  /* scale the result back into the ired image */
+  calc_ptr = calc_buf;
+  iptr = ir_data;
+  rfac = (double) (len - 1) / (double) (imax - imin);
+    for (i = itop; i > 0; i--)
+      *iptr++ = (double) (*calc_ptr++ - imin) * rfac;
+
+  if (!lut_ln)
+    free (llut);
+  free (calc_buf);
+  free (norm_histo);
+  return SANE_STATUS_GOOD;
+}
+
+
+/* Mean filter */
+static SANE_Status
+ref_filter_mean (const SANE_Parameters * params,
+		      const SANE_Uint *in_img, SANE_Uint *out_img,
+		      int win_rows, int win_cols)
+{
+  const SANE_Uint *src;
+  SANE_Uint *dest;
+  int num_cols, num_rows;
+  int itop, iadd, isub;
+  int ndiv, the_sum;
+  int nrow, ncol;
+  int hwr, hwc;
+  int *sum;
+  int i, j;
+
+  if (((win_rows & 1) == 0) || ((win_cols & 1) == 0))
+    {
+      return SANE_STATUS_INVAL;
+    }
+
+  num_cols = params->pixels_per_line;
+  num_rows = params->lines;
+
+  sum = malloc (num_cols * sizeof (int));
+  if (!sum)
+    {
+      return SANE_STATUS_NO_MEM;
+    }
+  dest = out_img;
+
+  hwr = win_rows / 2;		/* half window sizes */
+  hwc = win_cols / 2;
+
+  /* pre-pre calculation */
+  for (j = 0; j < num_cols; j++)
+    {
+        sum[j] = 0;
+	src = in_img + j;
+	for (i = 0; i < hwr; i++)
+	  {
+	    sum[j] += *src;
+	    src += num_cols;
+	  }
+    }
+
+  itop = num_rows * num_cols;
+  iadd = hwr * num_cols;
+  isub = (hwr - win_rows) * num_cols;
+  nrow = hwr;
+
+      for (i = 0; i < num_rows; i++)
+	{
+	  /* update row sums if possible */
+	  if (isub >= 0)	/* subtract old row */
+	    {
+	      nrow--;
+	      src = in_img + isub;
+	      for (j = 0; j < num_cols; j++)
+		sum[j] -= *src++;
+	    }
+	  isub += num_cols;
+
+	  if (iadd < itop)	/* add new row */
+	    {
+	      nrow++;
+	      src = in_img + iadd;
+	      for (j = 0; j < num_cols; j++)
+		sum[j] += *src++;
+	    }
+	  iadd += num_cols;
+
+	  /* now we do the image columns using only the precalculated sums */
+
+	  the_sum = 0;		/* precalculation */
+	  for (j = 0; j < hwc; j++)
+	    the_sum += sum[j];
+	  ncol = hwc;
+
+	  /* at the left margin, real index hwc lower */
+	  for (j = hwc; j < win_cols; j++)
+	    {
+	      ncol++;
+	      the_sum += sum[j];
+	      *dest++ = the_sum / (ncol * nrow);
+	    }
+
+	  ndiv = ncol * nrow;
+	  /* in the middle, real index hwc + 1 higher */
+	  for (j = 0; j < num_cols - win_cols; j++)
+	    {
+	      the_sum -= sum[j];
+	      the_sum += sum[j + win_cols];
+	      *dest++ = the_sum / ndiv;
+	    }
+
+	  /* at the right margin, real index hwc + 1 higher */
+	  for (j = num_cols - win_cols; j < num_cols - hwc - 1; j++)
+	    {
+	      ncol--;
+	      the_sum -= sum[j];	/* j - hwc - 1 */
+	      *dest++ = the_sum / (ncol * nrow);
+	    }
+	}
+  free (sum);
+  return SANE_STATUS_GOOD;
+}
+
+
+/* Find noise by adaptive thresholding
+ */
+static SANE_Status
+ref_filter_madmean (const SANE_Parameters * params,
+			 const SANE_Uint *in_img,
+			 SANE_Uint ** out_img, int win_size,
+			 int a_val, int b_val)
+{
+  SANE_Uint *delta_ij, *delta_ptr;
+  SANE_Uint *mad_ij;
+  const SANE_Uint *mad_ptr;
+  SANE_Uint *out_ij, *dest8;
+  double ab_term;
+  int num_rows, num_cols;
+  int threshold, itop;
+  size_t size;
+  int ival, i;
+  int depth;
+  SANE_Status ret = SANE_STATUS_NO_MEM;
+
+  depth = params->depth;
+  if (depth != 8)
+    {
+      a_val = a_val << (depth - 8);
+      b_val = b_val << (depth - 8);
+    }
+  num_cols = params->pixels_per_line;
+  num_rows = params->lines;
+  itop = num_rows * num_cols;
+  size = itop * sizeof (SANE_Uint);
+  out_ij = malloc (size);
+  delta_ij = malloc (size);
+  mad_ij = malloc (size);
+
+  if (out_ij && delta_ij && mad_ij)
+    {
+      /* get the differences to the local mean */
+      mad_ptr = in_img;
+      if (ref_filter_mean (params, mad_ptr, delta_ij, win_size, win_size)
+	  == SANE_STATUS_GOOD)
+	{
+	  delta_ptr = delta_ij;
+	    for (i = 0; i < itop; i++)
+	      {
+		ival = *mad_ptr++ - *delta_ptr;
+		*delta_ptr++ = abs (ival);
+	      }
+	  /* make the second filtering window a bit larger */
+	  win_size = MAD_WIN2_SIZE(win_size);
+	  /* and get the local mean differences */
+	  if (ref_filter_mean
+	      (params, delta_ij, mad_ij, win_size,
+	       win_size) == SANE_STATUS_GOOD)
+	    {
+	      mad_ptr = mad_ij;
+	      delta_ptr = delta_ij;
+	      dest8 = out_ij;
+	      /* construct the noise map */
+	      ab_term = (b_val - a_val) / (double) b_val;
+		for (i = 0; i < itop; i++)
+		  {
+		    /* by calculating the threshold */
+		    ival = *mad_ptr++;
+		    if (ival >= b_val)	/* outlier */
+		      threshold = a_val;
+		    else
+		      threshold = a_val + (double) ival *ab_term;
+		    /* above threshold is noise, indicated by 0 */
+		    if (*delta_ptr++ >= threshold)
+		      *dest8++ = 0;
+		    else
+		      *dest8++ = 255;
+		  }
+	      *out_img = out_ij;
+	      ret = SANE_STATUS_GOOD;
+	    }
+	}
+    }
+
+  free (mad_ij);
+  free (delta_ij);
+  return ret;
+}
+
+
+/* Dilate clean image parts into dirty ones and smooth
+ */
+static SANE_Status
+ref_dilate_mean (const SANE_Parameters * params,
+                      SANE_Uint **in_img,
+                      SANE_Uint * mask_img,
+                      int dist_max, int expand, int win_size,
+                      SANE_Bool smooth, int inner,
+                      int *crop)
+{
+  SANE_Uint *color;
+  SANE_Uint *plane;
+  unsigned int *dist_map, *manhattan;
+  unsigned int *idx_map, *index;
+  int dist;
+  int rows, cols;
+  int k, i, itop;
+  SANE_Status ret = SANE_STATUS_NO_MEM;
+
+  cols = params->pixels_per_line;
+  rows = params->lines;
+  itop = rows * cols;
+  idx_map = malloc (itop * sizeof (unsigned int));
+  dist_map = malloc (itop * sizeof (unsigned int));
+  plane = malloc (itop * sizeof (SANE_Uint));
+
+  if (idx_map && dist_map && plane)
+    {
+      /* expand dirty regions into their half dirty surround*/
+      if (expand > 0)
+	sanei_ir_dilate (params, mask_img, dist_map, idx_map, expand);
+      /* for dirty pixels determine the closest clean ones */
+      sanei_ir_euclidean_dist (params, mask_img, dist_map, idx_map, 1);
+
+      /* use the distance map to find how to crop dark edges */
+      if (crop)
+        sanei_ir_find_crop (params, dist_map, inner, crop);
+
+      /* replace dirty pixels */
+      for (k = 0; k < 3; k++)
+	{
+	  manhattan = dist_map;
+	  index = idx_map;
+	  color = in_img[k];
+	  /* first replacement */
+	    for (i = 0; i < itop; i++)
+	      {
+		dist = *manhattan++;
+		if ((dist != 0) && (dist <= dist_max))
+		  color[i] = color[index[i]];
+	      }
+          /* adapt pixels to their new surround and
+           * smooth the whole image or the replaced pixels only */
+	  ret =
+	    ref_filter_mean (params, color, plane, win_size, win_size);
+	  if (ret != SANE_STATUS_GOOD)
+	    break;
+	  else
+	    if (smooth)
+              {
+                /* a second mean results in triangular blur */
+                ret =
+                  ref_filter_mean (params, plane, color, win_size,
+                                        win_size);
+                if (ret != SANE_STATUS_GOOD)
+                  break;
+              }
+            else
+              {
+                /* replace with smoothened pixels only */
+                manhattan = dist_map;
+                  for (i = 0; i < itop; i++)
+                    {
+                      dist = *manhattan++;
+                      if ((dist != 0) && (dist <= dist_max))
+                        color[i] = plane[i];
+                    }
+              }
+      }
+    }
+  free (plane);
+  free (dist_map);
+  free (idx_map);
+
+  return ret;
+}
+
+
+static SANE_Uint *
+copy_plane (const SANE_Uint * src, int itop)
+{
+  SANE_Uint *dst = malloc (itop * sizeof (SANE_Uint));
+
+  assert (dst != NULL);
+  memcpy (dst, src, itop * sizeof (SANE_Uint));
+  return dst;
+}
+
+/**
+ * run the ir cleaning steps on a synthetic frame, every optimized
+ * function must return the same result as the reference implementation
+ */
+static void
+compare_frame (int cols, int rows, int win_size)
+{
+  SANE_Parameters params;
+  SANE_Uint *planes[4], *ref_planes[4];
+  SANE_Uint *ref_out, *out;
+  double *lut;
+  double start, ref_time, time;
+  int itop, k, smooth;
+
+  make_frame (&params, planes, cols, rows);
+  itop = cols * rows;
+  report ("%dx%d, window %d:\n", cols, rows, win_size);
+
+  assert (sanei_ir_ln_table (1 << params.depth, &lut) == SANE_STATUS_GOOD);
+
+  /* mean filter */
+  ref_out = malloc (itop * sizeof (SANE_Uint));
+  out = malloc (itop * sizeof (SANE_Uint));
+  assert (ref_out != NULL && out != NULL);
+  start = now ();
+  assert (ref_filter_mean (&params, planes[3], ref_out, win_size, win_size)
+	  == SANE_STATUS_GOOD);
+  ref_time = now () - start;
+  start = now ();
+  assert (sanei_ir_filter_mean (&params, planes[3], out, win_size, win_size)
+	  == SANE_STATUS_GOOD);
+  time = now () - start;
+  assert (memcmp (ref_out, out, itop * sizeof (SANE_Uint)) == 0);
+  report ("  filter_mean: %.3fs reference, %.3fs\n", ref_time, time);
+  free (ref_out);
+  free (out);
+
+  /* spectral cleaning, same random samples for both */
+  for (k = 0; k < 4; k++)
+    ref_planes[k] = copy_plane (planes[k], itop);
+  srand (1);
+  start = now ();
+  assert (ref_spectral_clean (&params, lut, ref_planes[0], ref_planes[3])
+	  == SANE_STATUS_GOOD);
+  ref_time = now () - start;
+  srand (1);
+  start = now ();
+  assert (sanei_ir_spectral_clean (&params, lut, planes[0], planes[3])
+	  == SANE_STATUS_GOOD);
+  time = now () - start;
+  assert (memcmp (ref_planes[3], planes[3], itop * sizeof (SANE_Uint)) == 0);
+  report ("  spectral_clean: %.3fs reference, %.3fs\n", ref_time, time);
+
+  /* noise map */
+  start = now ();
+  assert (ref_filter_madmean (&params, planes[3], &ref_out, win_size,
+			      20, 100) == SANE_STATUS_GOOD);
+  ref_time = now () - start;
+  start = now ();
+  assert (sanei_ir_filter_madmean (&params, planes[3], &out, win_size,
+				   20, 100) == SANE_STATUS_GOOD);
+  time = now () - start;
+  assert (memcmp (ref_out, out, itop * sizeof (SANE_Uint)) == 0);
+  report ("  filter_madmean: %.3fs reference, %.3fs\n", ref_time, time);
+  free (ref_out);
+
+  /* dirt replacement, the distance maps come from sanei_ir for both */
+  for (smooth = 0; smooth < 2; smooth++)
+    {
+      SANE_Uint *ref_mask = copy_plane (out, itop);
+      SANE_Uint *mask = copy_plane (out, itop);
+
+      for (k = 0; k < 3; k++)
+	memcpy (ref_planes[k], planes[k], itop * sizeof (SANE_Uint));
+
+      srand (2);
+      start = now ();
+      assert (ref_dilate_mean (&params, ref_planes, ref_mask, 500, 2,
+			       win_size, smooth, 0, NULL)
+	      == SANE_STATUS_GOOD);
+      ref_time = now () - start;
+      srand (2);
+      start = now ();
+      assert (sanei_ir_dilate_mean (&params, planes, mask, 500, 2,
+				    win_size, smooth, 0, NULL)
+	      == SANE_STATUS_GOOD);
+      time = now () - start;
+      for (k = 0; k < 3; k++)
+	assert (memcmp (ref_planes[k], planes[k], itop * sizeof (SANE_Uint))
+		== 0);
+      assert (memcmp (ref_mask, mask, itop * sizeof (SANE_Uint)) == 0);
+      report ("  dilate_mean(%d): %.3fs reference, %.3fs\n", smooth,
+	      ref_time, time);
+      free (ref_mask);
+      free (mask);
+    }
+
+  free (out);
+  free (lut);
+  for (k = 0; k < 4; k++)
+    {
+      free (planes[k]);
+      free (ref_planes[k]);
+    }
+}
+
+/**
+ * compare the distance transform with a brute force search for the
+ * closest pixel of value erode on a random mask with about one in
+ * density pixels set
+ */
+static void
+compare_dist (int cols, int rows, int density, unsigned int erode)
+{
+  SANE_Parameters params;
+  SANE_Uint *mask;
+  unsigned int *dist_map, *idx_map;
+  int itop, i, j, x, y, best, d2;
+
+  params.format = SANE_FRAME_GRAY;
+  params.depth = 16;
+  params.pixels_per_line = cols;
+  params.lines = rows;
+  params.bytes_per_line = cols * 2;
+  params.last_frame = SANE_TRUE;
+
+  itop = cols * rows;
+  mask = malloc (itop * sizeof (SANE_Uint));
+  dist_map = malloc (itop * sizeof (unsigned int));
+  idx_map = malloc (itop * sizeof (unsigned int));
+  assert (mask != NULL && dist_map != NULL && idx_map != NULL);
+
+  seed = cols * 7 + rows + density;
+  for (i = 0; i < itop; i++)
+    mask[i] = (density && rnd () % density == 0) ? erode : 255 - erode;
+
+  sanei_ir_euclidean_dist (&params, mask, dist_map, idx_map, erode);
+
+  for (i = 0; i < itop; i++)
+    {
+      best = -1;
+      for (j = 0; j < itop; j++)
+	{
+	  if (mask[j] != erode)
+	    continue;
+	  x = j % cols - i % cols;
+	  y = j / cols - i / cols;
+	  d2 = x * x + y * y;
+	  if (best < 0 || d2 < best)
+	    best = d2;
+	}
+      if (best < 0)		/* nothing to find */
+	{
+	  assert (dist_map[i] == (unsigned int) (cols + rows));
+	  assert (idx_map[i] == (unsigned int) i);
+	  continue;
+	}
+      assert (dist_map[i] == (unsigned int) (sqrt (best) + 0.5));
+      /* the index must point to one of the closest pixels */
+      assert (idx_map[i] < (unsigned int) itop);
+      assert (mask[idx_map[i]] == erode);
+      x = idx_map[i] % cols - i % cols;
+      y = idx_map[i] / cols - i / cols;
+      assert (x * x + y * y == best);
+    }
+
+  free (mask);
+  free (dist_map);
+  free (idx_map);
+}
+
+/**
+ * time the noise map for growing window sizes, the time per pixel
+ * should not depend on the window size
+ */
+static void
+bench_madmean (int cols, int rows)
+{
+  static const int win_sizes[] = { 5, 9, 17, 33, 65, 0 };
+  SANE_Parameters params;
+  SANE_Uint *planes[4];
+  SANE_Uint *ref_out, *out;
+  double start, ref_time, time;
+  int itop, i, k;
+
+  make_frame (&params, planes, cols, rows);
+  itop = cols * rows;
+  printf ("filter_madmean %dx%d:\n", cols, rows);
+
+  for (i = 0; win_sizes[i]; i++)
+    {
+      start = now ();
+      assert (ref_filter_madmean (&params, planes[3], &ref_out,
+				  win_sizes[i], 20, 100) == SANE_STATUS_GOOD);
+      ref_time = now () - start;
+      start = now ();
+      assert (sanei_ir_filter_madmean (&params, planes[3], &out,
+				       win_sizes[i], 20, 100)
+	      == SANE_STATUS_GOOD);
+      time = now () - start;
+      assert (memcmp (ref_out, out, itop * sizeof (SANE_Uint)) == 0);
+      printf ("  window %2d: %.3fs reference, %.3fs, %.1f ns/pixel\n",
+	      win_sizes[i], ref_time, time, time * 1e9 / itop);
+      free (ref_out);
+      free (out);
+    }
+
+  for (k = 0; k < 4; k++)
+    free (planes[k]);
+}
+
+/**
+ * run the test suite for sanei_ir with a single and with several
+ * threads, the results must not depend on it
+ */
+static void
+sanei_ir_suite (void)
+{
+  const char *threads[] = { "1", "3", NULL };
+  int i;
+
+  for (i = 0; threads[i]; i++)
+    {
+      setenv ("SANE_IR_THREADS", threads[i], 1);
+      sanei_ir_init ();
+      report ("SANE_IR_THREADS=%s\n", threads[i]);
+
+      compare_dist (61, 130, 50, 255);
+      compare_dist (130, 61, 400, 0);
+      compare_dist (40, 140, 3, 255);
+      compare_dist (1, 150, 10, 255);
+      compare_dist (33, 131, 0, 0);
+
+      compare_frame (37, 29, 9);
+      compare_frame (640, 427, 9);
+      compare_frame (641, 200, 31);
+      compare_frame (2400, 1600, 11);
+    }
+
+  if (bench)
+    bench_madmean (3600, 2400);
+}
+
+/**
+ * main function to run the test suites
+ */
+int
+main (int argc, char **argv)
+{
+  bench = argc > 1 && strcmp (argv[1], "--bench") == 0;
+
+  /* run suites */
+  sanei_ir_suite ();
+
+  return 0;
+}
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
@@ -0,0 +1,286 @@
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#ifdef HAVE_LIBJPEG
+
+/* sane includes for the sanei functions called */
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei_jpeg.h"
+
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+
+/* simple reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+/* set by --bench, the speed test only runs for 'make bench' */
+static int bench;
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* a page with gradients, text like stripes and some noise, so that
+ * every block has coefficients */
+static unsigned char *
+make_image (int width, int height, int comps)
+{
+  unsigned char *img = malloc ((size_t) width * height * comps);
+  int x, y, c, v;
+
+  assert (img);
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      for (c = 0; c < comps; c++)
+	{
+	  v = (x * (c + 1) + y * (3 - c)) % 200 + (rnd () % 32);
+	  if ((y / 11) % 3 == 0 && (x / 7) % 4)
+	    v /= 4;
+	  img[((size_t) y * width + x) * comps + c] = v;
+	}
+  return img;
+}
+
+/* restart is in MCUs, h and v are the luma sampling factors */
+static unsigned char *
+compress (unsigned char *img, int width, int height, int comps, int h,
+	  int v, int restart, unsigned long *len)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned char *out = NULL;
+  JSAMPROW row;
+
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_compress (&cinfo);
+  jpeg_mem_dest (&cinfo, &out, len);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = comps;
+  cinfo.in_color_space = comps == 3 ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, 80, TRUE);
+  cinfo.comp_info[0].h_samp_factor = h;
+  cinfo.comp_info[0].v_samp_factor = v;
+  cinfo.restart_interval = restart;
+  jpeg_start_compress (&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height)
+    {
+      row = img + (size_t) cinfo.next_scanline * width * comps;
+      jpeg_write_scanlines (&cinfo, &row, 1);
+    }
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+  return out;
+}
+
+/* plain libjpeg decode */
+static unsigned char *
+reference (unsigned char *data, unsigned long len, int *row_size,
+	   int *lines)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned char *img;
+  JSAMPROW row;
+
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_decompress (&cinfo);
+  jpeg_mem_src (&cinfo, data, len);
+  jpeg_read_header (&cinfo, TRUE);
+  jpeg_start_decompress (&cinfo);
+  *row_size = cinfo.output_width * cinfo.output_components;
+  *lines = cinfo.output_height;
+  img = malloc ((size_t) *row_size * *lines);
+  assert (img);
+  while (cinfo.output_scanline < cinfo.output_height)
+    {
+      row = img + (size_t) cinfo.output_scanline * *row_size;
+      jpeg_read_scanlines (&cinfo, &row, 1);
+    }
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+  return img;
+}
+
+/* the image decoded in bands is the same as in one go, also in rows
+ * with padding, which is left alone */
+static void
+test_same (const char *name, int width, int height, int comps, int h, int v,
+	   int restart)
+{
+  unsigned char *img, *data, *ref, *out;
+  unsigned long len;
+  SANE_Parameters params;
+  int row_size, lines, bpl, threads, y;
+
+  img = make_image (width, height, comps);
+  data = compress (img, width, height, comps, h, v, restart, &len);
+  ref = reference (data, len, &row_size, &lines);
+
+  assert (sanei_jpeg_get_params (data, len, &params) == SANE_STATUS_GOOD);
+  assert (params.format == (comps == 3 ? SANE_FRAME_RGB : SANE_FRAME_GRAY));
+  assert (params.depth == 8);
+  assert (params.pixels_per_line == width);
+  assert (params.lines == height);
+  assert (params.bytes_per_line == row_size);
+
+  bpl = row_size + 5;
+  out = malloc ((size_t) bpl * lines);
+  assert (out);
+  for (threads = 1; threads <= 8; threads *= 2)
+    {
+      memset (out, 0xA5, (size_t) bpl * lines);
+      assert (sanei_jpeg_decode (data, len, out, bpl, threads)
+	      == SANE_STATUS_GOOD);
+      for (y = 0; y < lines; y++)
+	{
+	  assert (!memcmp (out + (size_t) y * bpl, ref + (size_t) y * row_size,
+			   row_size));
+	  assert (out[(size_t) y * bpl + row_size] == 0xA5);
+	}
+    }
+
+  printf ("%s %dx%d, restart %d: same with 1 to 8 threads\n", name, width,
+	  height, restart);
+
+  free (out);
+  free (ref);
+  free (data);
+  free (img);
+}
+
+/* damaged data gives an image or an error, never a crash */
+static void
+test_damaged (void)
+{
+  unsigned char *img, *data, *out;
+  unsigned long len, cut;
+  int i;
+
+  img = make_image (800, 1000, 3);
+  data = compress (img, 800, 1000, 3, 2, 2, 50, &len);
+  out = malloc (800 * 3 * 1000);
+  assert (out);
+
+  /* cut short */
+  for (cut = len / 3; cut < len; cut += len / 3)
+    sanei_jpeg_decode (data, cut, out, 800 * 3, 4);
+
+  /* bit errors */
+  for (i = 0; i < 20; i++)
+    data[700 + rnd () % (len - 800)] ^= 1 << (rnd () % 8);
+  sanei_jpeg_decode (data, len, out, 800 * 3, 4);
+
+  /* no image */
+  assert (sanei_jpeg_decode (img, 1000, out, 800 * 3, 4)
+	  == SANE_STATUS_IO_ERROR);
+  assert (sanei_jpeg_decode (data, len, out, 100, 4) == SANE_STATUS_INVAL);
+
+  printf ("damaged images handled\n");
+  free (out);
+  free (data);
+  free (img);
+}
+
+/* A4 color at 300 dpi, a restart marker per MCU row */
+static void
+test_speed (void)
+{
+  int width = 2480, height = 3508, mcus = (width + 15) / 16;
+  unsigned char *img, *data, *out;
+  unsigned long len;
+  double t0, t1, t2;
+
+  img = make_image (width, height, 3);
+  data = compress (img, width, height, 3, 2, 2, mcus, &len);
+  out = malloc ((size_t) width * 3 * height);
+  assert (out);
+
+  t0 = now ();
+  assert (sanei_jpeg_decode (data, len, out, width * 3, 1)
+	  == SANE_STATUS_GOOD);
+  t1 = now ();
+  assert (sanei_jpeg_decode (data, len, out, width * 3, 0)
+	  == SANE_STATUS_GOOD);
+  t2 = now ();
+
+  printf ("A4 color 300 dpi: %.1f ms in one go, %.1f ms in bands\n",
+	  (t1 - t0) * 1000, (t2 - t1) * 1000);
+  free (out);
+  free (data);
+  free (img);
+}
+
+static void
+sanei_jpeg_suite (void)
+{
+  /* a restart interval per MCU row */
+  test_same ("gray", 1001, 1203, 1, 1, 1, 126);
+  test_same ("color 4:2:0", 1537, 1299, 3, 2, 2, 97);
+  test_same ("color 4:2:2", 1537, 1299, 3, 2, 1, 97);
+  test_same ("color 4:4:4", 1537, 1299, 3, 1, 1, 193);
+  /* two rows, and part of a row */
+  test_same ("color 4:2:0", 1537, 1299, 3, 2, 2, 194);
+  test_same ("color 4:2:0", 1600, 1299, 3, 2, 2, 25);
+  test_same ("gray", 1001, 1203, 1, 1, 1, 7);
+  /* no restart markers */
+  test_same ("color 4:2:0", 1537, 1299, 3, 2, 2, 0);
+  /* too small to cut */
+  test_same ("color 4:2:0", 300, 200, 3, 2, 2, 19);
+
+  test_damaged ();
+  if (bench)
+    test_speed ();
+}
+
+int
+main (int argc, char **argv)
+{
+  bench = argc > 1 && strcmp (argv[1], "--bench") == 0;
+
+  /* run suites */
+  sanei_jpeg_suite ();
+
+  return 0;
+}
+
+#else
+
+int
+main (void)
+{
+  /* skipped, no jpeg_mem_src() to compare with */
+  return 77;
+}
+
+#endif
+
+#else
+
+int
+main (void)
+{
+  /* skipped */
+  return 77;
+}
+
+#endif
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */
@@ -0,0 +1,746 @@
+#include "../../include/sane/config.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <math.h>
+
+/* sane includes for the sanei functions called */
+#include "../include/sane/sane.h"
+#include "../include/sane/sanei.h"
+#include "../include/sane/sanei_magic.h"
+
+/* not in the public header, but exported by sanei_magic */
+extern int *sanei_magic_getTransY (SANE_Parameters * params, int dpi,
+				   SANE_Byte * buffer, int top);
+extern int *sanei_magic_getTransX (SANE_Parameters * params, int dpi,
+				   SANE_Byte * buffer, int left);
+
+/* A4 size in 1/10 mm */
+#define A4_WIDTH  2100
+#define A4_HEIGHT 2970
+
+/* simple reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+/* set by --bench, the timings are only printed by 'make bench' */
+static int bench;
+
+static double
+now (void)
+{
+  return (double) clock () / CLOCKS_PER_SEC;
+}
+
+static void
+report (const char *format, ...)
+{
+  va_list ap;
+
+  if (!bench)
+    return;
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+}
+
+/**
+ * create a synthetic page: white background, a slightly darker and
+ * skewed sheet of paper, some lines of 'text' and a few specks
+ */
+static SANE_Byte *
+make_page (SANE_Parameters * params, SANE_Frame format, int depth, int dpi)
+{
+  SANE_Byte *buffer;
+  int width = A4_WIDTH * dpi / 254;
+  int height = A4_HEIGHT * dpi / 254;
+  int x, y, i;
+
+  params->format = format;
+  params->depth = depth;
+  params->pixels_per_line = width / 8 * 8;
+  params->lines = height;
+  if (depth == 1)
+    params->bytes_per_line = params->pixels_per_line / 8;
+  else if (format == SANE_FRAME_RGB)
+    params->bytes_per_line = params->pixels_per_line * 3;
+  else
+    params->bytes_per_line = params->pixels_per_line;
+  params->last_frame = SANE_TRUE;
+
+  buffer = malloc (params->bytes_per_line * params->lines);
+  assert (buffer != NULL);
+
+  seed = dpi + depth * 7 + format * 13;
+
+  for (y = 0; y < params->lines; y++)
+    {
+      /* sheet edges, skewed by about one degree */
+      int left = dpi / 4 + y / 60;
+      int right = params->pixels_per_line - dpi / 4 + y / 60;
+      int top = dpi / 5 + (params->pixels_per_line - left) / 60;
+
+      for (x = 0; x < params->pixels_per_line; x++)
+	{
+	  int val = 255;
+
+	  if (x > left && x < right && y > top && y < params->lines - dpi / 5)
+	    {
+	      val = 235 + rnd () % 8;
+
+	      /* lines of text */
+	      if ((y / (dpi / 6)) % 2 && (y % (dpi / 6)) < dpi / 10
+		  && (x / (dpi / 12)) % 3 && x > dpi && x < right - dpi)
+		val = rnd () % 60;
+	    }
+
+	  if (depth == 1)
+	    {
+	      if (x % 8 == 0)
+		buffer[y * params->bytes_per_line + x / 8] = 0;
+	      if (val < 128)
+		buffer[y * params->bytes_per_line + x / 8] |= 0x80 >> (x % 8);
+	    }
+	  else if (format == SANE_FRAME_RGB)
+	    {
+	      buffer[y * params->bytes_per_line + x * 3] = val;
+	      buffer[y * params->bytes_per_line + x * 3 + 1] = val;
+	      buffer[y * params->bytes_per_line + x * 3 + 2] = val;
+	    }
+	  else
+	    buffer[y * params->bytes_per_line + x] = val;
+	}
+    }
+
+  /* specks of one and two pixels */
+  for (i = 0; i < 2000; i++)
+    {
+      int size = 1 + rnd () % 2;
+      int sx = 2 + rnd () % (params->pixels_per_line - 8);
+      int sy = 2 + rnd () % (params->lines - 8);
+
+      for (y = sy; y < sy + size; y++)
+	for (x = sx; x < sx + size; x++)
+	  {
+	    if (depth == 1)
+	      buffer[y * params->bytes_per_line + x / 8] |= 0x80 >> (x % 8);
+	    else if (format == SANE_FRAME_RGB)
+	      memset (buffer + y * params->bytes_per_line + x * 3, 0, 3);
+	    else
+	      buffer[y * params->bytes_per_line + x] = 0;
+	  }
+    }
+
+  return buffer;
+}
+
+/**
+ * reference implementation of sanei_magic_despeck, a plain
+ * per pixel loop over the window and its border
+ */
+static void
+ref_despeck (SANE_Parameters * params, SANE_Byte * buffer, int diam)
+{
+  int pw = params->pixels_per_line;
+  int bw = params->bytes_per_line;
+  int bt = bw * params->lines;
+  int i, j, k, l, n;
+
+  for (i = bw; i < bt - bw - (bw * diam); i += bw)
+    {
+      for (j = 1; j < pw - 1 - diam; j++)
+	{
+	  if (params->depth == 1)
+	    {
+	      int curr = 0;
+	      int hits = 0;
+
+	      for (k = 0; k < diam; k++)
+		for (l = 0; l < diam; l++)
+		  curr += buffer[i + k * bw + (j + l) / 8] >> (7 - (j + l) % 8) & 1;
+
+	      if (!curr)
+		continue;
+
+	      for (k = -1; k < diam + 1; k++)
+		for (l = -1; l < diam + 1; l++)
+		  {
+		    if (k != -1 && k != diam && l != -1 && l != diam)
+		      continue;
+		    hits += buffer[i + k * bw + (j + l) / 8] >> (7 - (j + l) % 8) & 1;
+		  }
+
+	      if (!hits)
+		for (k = 0; k < diam; k++)
+		  for (l = 0; l < diam; l++)
+		    buffer[i + k * bw + (j + l) / 8] &= ~(1 << (7 - (j + l) % 8));
+	    }
+	  else
+	    {
+	      int depth = params->format == SANE_FRAME_RGB ? 3 : 1;
+	      int thresh = 255 * depth;
+	      int outer[] = { 0, 0, 0 };
+	      int hits = 0;
+
+	      for (k = 0; k < diam; k++)
+		for (l = 0; l < diam; l++)
+		  {
+		    int tmp = 0;
+		    for (n = 0; n < depth; n++)
+		      tmp += buffer[i + j * depth + k * bw + l * depth + n];
+		    if (tmp < thresh)
+		      thresh = tmp;
+		  }
+
+	      thresh = (thresh + 255 * depth + 255 * depth) / 3;
+
+	      for (k = -1; k < diam + 1; k++)
+		for (l = -1; l < diam + 1; l++)
+		  {
+		    int tmp = 0;
+		    if (k != -1 && k != diam && l != -1 && l != diam)
+		      continue;
+		    for (n = 0; n < depth; n++)
+		      {
+			outer[n] += buffer[i + j * depth + k * bw + l * depth + n];
+			tmp += buffer[i + j * depth + k * bw + l * depth + n];
+		      }
+		    if (tmp < thresh)
+		      hits++;
+		  }
+
+	      if (!hits)
+		for (k = 0; k < diam; k++)
+		  for (l = 0; l < diam; l++)
+		    for (n = 0; n < depth; n++)
+		      buffer[i + j * depth + k * bw + l * depth + n]
+			= outer[n] / (4 * diam + 4);
+	    }
+	}
+    }
+}
+
+/**
+ * reference implementation of sanei_magic_getTransY, walking
+ * each column separately
+ */
+static int *
+ref_getTransY (SANE_Parameters * params, int dpi, SANE_Byte * buffer,
+	       int top)
+{
+  int width = params->pixels_per_line;
+  int height = params->lines;
+  int depth = params->format == SANE_FRAME_RGB ? 3 : 1;
+  int firstLine = top ? 0 : height - 1;
+  int lastLine = top ? height : -1;
+  int direction = top ? 1 : -1;
+  int winLen = 9;
+  int *buff;
+  int i, j, k;
+
+  buff = calloc (width, sizeof (int));
+  assert (buff != NULL);
+
+  for (i = 0; i < width; i++)
+    {
+      buff[i] = lastLine;
+
+      if (params->depth == 1)
+	{
+	  int near = buffer[(firstLine * width + i) / 8] >> (7 - (i % 8)) & 1;
+
+	  for (j = firstLine + direction; j != lastLine; j += direction)
+	    if ((buffer[(j * width + i) / 8] >> (7 - (i % 8)) & 1) != near)
+	      {
+		buff[i] = j;
+		break;
+	      }
+	}
+      else
+	{
+	  int near = 0, far;
+
+	  for (k = 0; k < depth; k++)
+	    near += buffer[(firstLine * width + i) * depth + k];
+	  near *= winLen;
+	  far = near;
+
+	  for (j = firstLine + direction; j != lastLine; j += direction)
+	    {
+	      int farLine = j - winLen * 2 * direction;
+	      int nearLine = j - winLen * direction;
+
+	      if (farLine < 0 || farLine >= height)
+		farLine = firstLine;
+	      if (nearLine < 0 || nearLine >= height)
+		nearLine = firstLine;
+
+	      for (k = 0; k < depth; k++)
+		{
+		  far -= buffer[(farLine * width + i) * depth + k];
+		  far += buffer[(nearLine * width + i) * depth + k];
+		  near -= buffer[(nearLine * width + i) * depth + k];
+		  near += buffer[(j * width + i) * depth + k];
+		}
+
+	      if (abs (near - far) > 50 * winLen * depth - near * 40 / 255)
+		{
+		  buff[i] = j;
+		  break;
+		}
+	    }
+	}
+    }
+
+  for (i = 0; i < width - 7; i++)
+    {
+      int sum = 0;
+      for (j = 1; j <= 7; j++)
+	if (abs (buff[i + j] - buff[i]) < dpi / 2)
+	  sum++;
+      if (sum < 2)
+	buff[i] = lastLine;
+    }
+
+  return buff;
+}
+
+/**
+ * reference for the 1 bit per pixel search of sanei_magic_getTransX
+ */
+static int *
+ref_getTransX (SANE_Parameters * params, int dpi, SANE_Byte * buffer,
+	       int left)
+{
+  int width = params->pixels_per_line;
+  int height = params->lines;
+  int firstCol = left ? 0 : width - 1;
+  int lastCol = left ? width : -1;
+  int direction = left ? 1 : -1;
+  int *buff;
+  int i, j;
+
+  buff = calloc (height, sizeof (int));
+  assert (buff != NULL);
+
+  for (i = 0; i < height; i++)
+    {
+      SANE_Byte *row = buffer + i * params->bytes_per_line;
+      int near = row[firstCol / 8] >> (7 - (firstCol % 8)) & 1;
+
+      buff[i] = lastCol;
+      for (j = firstCol + direction; j != lastCol; j += direction)
+	if ((row[j / 8] >> (7 - (j % 8)) & 1) != near)
+	  {
+	    buff[i] = j;
+	    break;
+	  }
+    }
+
+  for (i = 0; i < height - 7; i++)
+    {
+      int sum = 0;
+      for (j = 1; j <= 7; j++)
+	if (abs (buff[i + j] - buff[i]) < dpi / 2)
+	  sum++;
+      if (sum < 2)
+	buff[i] = lastCol;
+    }
+
+  return buff;
+}
+
+/**
+ * reference implementation of sanei_magic_isBlank2
+ */
+static SANE_Status
+ref_isBlank2 (SANE_Parameters * params, SANE_Byte * buffer,
+	      int dpiX, int dpiY, double thresh)
+{
+  int xquarter = dpiX / 4 / 8 * 8;
+  int yquarter = dpiY / 4 / 8 * 8;
+  int xhalf = xquarter * 2;
+  int yhalf = yquarter * 2;
+  int xblocks = (params->pixels_per_line - xhalf) / xhalf;
+  int yblocks = (params->lines - yhalf) / yhalf;
+  int Bpp = params->format == SANE_FRAME_RGB ? 3 : 1;
+  int xb, yb, x, y;
+
+  thresh /= 100;
+
+  for (yb = 0; yb < yblocks; yb++)
+    for (xb = 0; xb < xblocks; xb++)
+      {
+	double blocksum = 0;
+
+	for (y = 0; y < yhalf; y++)
+	  {
+	    int rowsum = 0;
+	    SANE_Byte *ptr = buffer
+	      + (yquarter + yb * yhalf + y) * params->bytes_per_line;
+
+	    if (params->depth == 1)
+	      {
+		ptr += (xquarter + xb * xhalf) / 8;
+		for (x = 0; x < xhalf; x++)
+		  rowsum += ptr[x / 8] >> (7 - (x % 8)) & 1;
+		blocksum += (double) rowsum / xhalf;
+	      }
+	    else
+	      {
+		ptr += (xquarter + xb * xhalf) * Bpp;
+		for (x = 0; x < xhalf * Bpp; x++)
+		  rowsum += 255 - ptr[x];
+		blocksum += (double) rowsum / (xhalf * Bpp) / 255;
+	      }
+	  }
+
+	if (blocksum / yhalf > thresh)
+	  return SANE_STATUS_GOOD;
+      }
+
+  return SANE_STATUS_NO_DOCS;
+}
+
+/**
+ * reference implementation of sanei_magic_rotate, nearest neighbor
+ * with two double multiplies per pixel, into a copy of the page
+ */
+static void
+ref_rotate (SANE_Parameters * params, SANE_Byte * buffer,
+	    int centerX, int centerY, double slope, int bg_color)
+{
+  double slopeRad = -atan (slope);
+  double slopeSin = sin (slopeRad);
+  double slopeCos = cos (slopeRad);
+  int pwidth = params->pixels_per_line;
+  int bwidth = params->bytes_per_line;
+  int height = params->lines;
+  int depth = params->format == SANE_FRAME_RGB ? 3 : 1;
+  SANE_Byte *outbuf;
+  int i, j, k;
+
+  outbuf = malloc (bwidth * height);
+  assert (outbuf != NULL);
+
+  if (params->depth == 1 && bg_color)
+    bg_color = 0xff;
+  memset (outbuf, bg_color, bwidth * height);
+
+  for (i = 0; i < height; i++)
+    {
+      int shiftY = centerY - i;
+
+      for (j = 0; j < pwidth; j++)
+	{
+	  int shiftX = centerX - j;
+	  int sourceX, sourceY;
+
+	  sourceX = centerX - (int) (shiftX * slopeCos + shiftY * slopeSin);
+	  if (sourceX < 0 || sourceX >= pwidth)
+	    continue;
+
+	  sourceY = centerY + (int) (-shiftY * slopeCos + shiftX * slopeSin);
+	  if (sourceY < 0 || sourceY >= height)
+	    continue;
+
+	  if (params->depth == 1)
+	    {
+	      outbuf[i * bwidth + j / 8] &= ~(1 << (7 - (j % 8)));
+	      outbuf[i * bwidth + j / 8] |=
+		((buffer[sourceY * bwidth + sourceX / 8]
+		  >> (7 - (sourceX % 8))) & 1) << (7 - (j % 8));
+	    }
+	  else
+	    for (k = 0; k < depth; k++)
+	      outbuf[i * bwidth + j * depth + k]
+		= buffer[sourceY * bwidth + sourceX * depth + k];
+	}
+    }
+
+  memcpy (buffer, outbuf, bwidth * height);
+  free (outbuf);
+}
+
+static void
+compare_page (SANE_Frame format, int depth, int dpi)
+{
+  SANE_Parameters params;
+  SANE_Byte *page, *copy;
+  size_t size;
+  int *ref, *res;
+  int i, top;
+  double start, ref_time, time;
+  SANE_Status ref_status, status;
+
+  page = make_page (&params, format, depth, dpi);
+  size = params.bytes_per_line * params.lines;
+  copy = malloc (size);
+  assert (copy != NULL);
+  memcpy (copy, page, size);
+
+  report ("%s %d bit, %d dpi, %dx%d:\n",
+	  format == SANE_FRAME_RGB ? "color" : "gray", depth, dpi,
+	  params.pixels_per_line, params.lines);
+
+  /* edges */
+  for (top = 0; top < 2; top++)
+    {
+      start = now ();
+      ref = ref_getTransY (&params, dpi, page, top);
+      ref_time = now () - start;
+      start = now ();
+      res = sanei_magic_getTransY (&params, dpi, page, top);
+      time = now () - start;
+      assert (res != NULL);
+      for (i = 0; i < params.pixels_per_line; i++)
+	assert (ref[i] == res[i]);
+      report ("  getTransY(%d): %.3fs reference, %.3fs\n", top, ref_time,
+	      time);
+      free (ref);
+      free (res);
+
+      if (depth != 1)
+	continue;
+
+      start = now ();
+      ref = ref_getTransX (&params, dpi, page, top);
+      ref_time = now () - start;
+      start = now ();
+      res = sanei_magic_getTransX (&params, dpi, page, top);
+      time = now () - start;
+      assert (res != NULL);
+      for (i = 0; i < params.lines; i++)
+	assert (ref[i] == res[i]);
+      report ("  getTransX(%d): %.3fs reference, %.3fs\n", top, ref_time,
+	      time);
+      free (ref);
+      free (res);
+    }
+
+  /* blank detection, the page is not blank at 1%, but at 50% */
+  start = now ();
+  ref_status = ref_isBlank2 (&params, page, dpi, dpi, 1);
+  ref_time = now () - start;
+  start = now ();
+  status = sanei_magic_isBlank2 (&params, page, dpi, dpi, 1);
+  time = now () - start;
+  assert (ref_status == SANE_STATUS_GOOD);
+  assert (status == ref_status);
+  report ("  isBlank2: %.3fs reference, %.3fs\n", ref_time, time);
+
+  start = now ();
+  ref_status = ref_isBlank2 (&params, page, dpi, dpi, 50);
+  ref_time = now () - start;
+  start = now ();
+  status = sanei_magic_isBlank2 (&params, page, dpi, dpi, 50);
+  time = now () - start;
+  assert (ref_status == SANE_STATUS_NO_DOCS);
+  assert (status == ref_status);
+  report ("  isBlank2 (blank): %.3fs reference, %.3fs\n", ref_time, time);
+
+  /* despeckle, must modify both buffers the same way */
+  start = now ();
+  ref_despeck (&params, copy, 2);
+  ref_time = now () - start;
+  start = now ();
+  status = sanei_magic_despeck (&params, page, 2);
+  time = now () - start;
+  assert (status == SANE_STATUS_GOOD);
+  assert (memcmp (copy, page, size) == 0);
+  report ("  despeck: %.3fs reference, %.3fs\n", ref_time, time);
+
+  /* rotation, fixed point stepping may round the source coordinate
+   * of a few pixels differently than the double math did */
+  for (i = 0; i < 2; i++)
+    {
+      double slope = i ? -0.03 : 0.05;
+      size_t diff = 0, j;
+
+      memcpy (copy, page, size);
+      start = now ();
+      ref_rotate (&params, copy, params.pixels_per_line / 2,
+		  params.lines / 2, slope, 0xff);
+      ref_time = now () - start;
+      start = now ();
+      status = sanei_magic_rotate (&params, page, params.pixels_per_line / 2,
+				   params.lines / 2, slope, 0xff);
+      time = now () - start;
+      assert (status == SANE_STATUS_GOOD);
+      for (j = 0; j < size; j++)
+	if (copy[j] != page[j])
+	  diff++;
+      assert (diff < size / 1000);
+      report ("  rotate(%.2f): %.3fs reference, %.3fs, %lu bytes differ\n",
+	      slope, ref_time, time, (unsigned long) diff);
+    }
+
+  /* rotating while the page arrives gives the same result, lines
+   * which have not arrived yet are filled with garbage */
+  {
+    SANEI_Magic_Rotator *rot;
+    SANE_Byte *stream;
+    int lines, done = 0, last;
+
+    stream = malloc (size);
+    assert (stream != NULL);
+    memset (stream, 0x55, size);
+    memcpy (copy, page, size);
+
+    status = sanei_magic_rotateStart (&params, stream,
+				      params.pixels_per_line / 3,
+				      params.lines / 4, 0.04, 0, SANE_FALSE,
+				      &rot);
+    assert (status == SANE_STATUS_GOOD);
+
+    for (lines = 0; lines < params.lines; lines += 97)
+      {
+	last = lines + 97 < params.lines ? lines + 97 : params.lines;
+	memcpy (stream + lines * params.bytes_per_line,
+		page + lines * params.bytes_per_line,
+		(last - lines) * params.bytes_per_line);
+	last = sanei_magic_rotateLines (rot, last);
+	assert (last >= done);
+	done = last;
+      }
+    assert (done == params.lines);
+    sanei_magic_rotateFinish (rot);
+
+    status = sanei_magic_rotate (&params, copy, params.pixels_per_line / 3,
+				 params.lines / 4, 0.04, 0);
+    assert (status == SANE_STATUS_GOOD);
+    assert (memcmp (copy, stream, size) == 0);
+
+    memcpy (page, stream, size);
+    free (stream);
+  }
+
+  /* no rotation is an exact copy, with and without interpolation */
+  memcpy (copy, page, size);
+  status = sanei_magic_rotate (&params, page, 100, 100, 0, 0);
+  assert (status == SANE_STATUS_GOOD);
+  assert (memcmp (copy, page, size) == 0);
+  status = sanei_magic_rotate2 (&params, page, 100, 100, 0, 0, SANE_TRUE);
+  assert (status == SANE_STATUS_GOOD);
+  assert (memcmp (copy, page, size) == 0);
+
+  if (bench && depth == 8)
+    {
+      start = now ();
+      status = sanei_magic_rotate2 (&params, page, params.pixels_per_line / 2,
+				    params.lines / 2, 0.05, 0xff, SANE_TRUE);
+      time = now () - start;
+      assert (status == SANE_STATUS_GOOD);
+      report ("  rotate2(0.05, smooth): %.3fs\n", time);
+    }
+
+  free (copy);
+  free (page);
+}
+
+/**
+ * the skew found from the first inch of a page, as when deskewing while
+ * the page is read, matches the one found from the whole page. the
+ * corners of the sheet must be inside the image, else the left edge may
+ * only be seen further down the page
+ */
+static void
+skew_top (int dpi, double angle)
+{
+  SANE_Parameters params, part;
+  SANE_Byte *page;
+  int width = 9 * dpi, height = 12 * dpi;
+  int x, y, part_x, part_y;
+  double slope, part_slope, u, v;
+  SANE_Status status;
+
+  params.format = SANE_FRAME_GRAY;
+  params.depth = 8;
+  params.pixels_per_line = width;
+  params.bytes_per_line = width;
+  params.lines = height;
+  params.last_frame = SANE_TRUE;
+
+  /* a letter sized sheet on black, rotated around the middle */
+  page = malloc (width * height);
+  assert (page != NULL);
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+	u = (x - width / 2) * cos (angle) + (y - height / 2) * sin (angle);
+	v = (y - height / 2) * cos (angle) - (x - width / 2) * sin (angle);
+	page[y * width + x] = 0x10;
+	if (fabs (u) < 4.25 * dpi && fabs (v) < 5.5 * dpi)
+	  {
+	    page[y * width + x] = 0xe0;
+	    /* lines of text */
+	    if (fabs (u) < 3.5 * dpi && fabs (v) < 5.2 * dpi
+		&& (int) (v + 6 * dpi) % (dpi / 6) < dpi / 12)
+	      page[y * width + x] = 0x20;
+	  }
+      }
+
+  status = sanei_magic_findSkew (&params, page, dpi, dpi, &x, &y, &slope);
+  assert (status == SANE_STATUS_GOOD);
+
+  part = params;
+  part.lines = dpi;
+  status = sanei_magic_findSkewTop (&part, page, dpi, dpi, &part_x, &part_y,
+				    &part_slope);
+  assert (status == SANE_STATUS_GOOD);
+  /* the same rotation, around a center which moves the page by less
+   * than half a millimeter */
+  assert (fabs (slope - part_slope) < 0.0005);
+  assert (fabs (atan (slope)) * hypot (x - part_x, y - part_y) < dpi / 50.0);
+
+  free (page);
+}
+
+/**
+ * run the test suite for sanei_magic, every optimized function must
+ * return the same result as the plain reference implementation
+ */
+static void
+sanei_magic_suite (void)
+{
+  sanei_magic_init ();
+
+  compare_page (SANE_FRAME_GRAY, 1, 300);
+  compare_page (SANE_FRAME_GRAY, 8, 300);
+  compare_page (SANE_FRAME_RGB, 8, 300);
+  compare_page (SANE_FRAME_GRAY, 1, 600);
+  compare_page (SANE_FRAME_GRAY, 8, 600);
+
+  skew_top (300, 0.02);
+  skew_top (300, -0.03);
+  skew_top (600, 0.01);
+  skew_top (200, -0.05);
+  skew_top (300, 0.08);
+  skew_top (300, 0.15);
+}
+
+/**
+ * main function to run the test suites
+ */
+int
+main (int argc, char **argv)
+{
+  bench = argc > 1 && strcmp (argv[1], "--bench") == 0;
+
+  /* run suites */
+  sanei_magic_suite ();
+
+  return 0;
+}
+
+/* vim: set sw=2 cino=>2se-1sn-1s{s^-1st0(0u0 smarttab expandtab: */